@@ -0,0 +1,94 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "admission_control.h"
+
+AdmissionControl::AdmissionControl() {
+    _limits[ACCESS_READ] = {MCP_READ_RATE_PER_SEC, MCP_READ_BURST};
+    _limits[ACCESS_WRITE] = {MCP_WRITE_RATE_PER_SEC, MCP_WRITE_BURST};
+}
+
+void AdmissionControl::configure(Access access, float ratePerSec, float burst) {
+    _limits[access] = {ratePerSec, burst};
+}
+
+bool AdmissionControl::precheck(uint32_t ip, uint32_t now, uint32_t* retryAfterMs) {
+    Client& client = lookup(ip, now);
+    
+    uint32_t shortest = UINT32_MAX;
+    for (int i = 0; i < ACCESS_COUNT; i++) {
+        refill(client.buckets[i], _limits[i], now);
+        if (client.buckets[i].tokens >= 1.0f) {
+            return true;
+        }
+        uint32_t wait = retryAfter(client.buckets[i], _limits[i]);
+        if (wait < shortest) {
+            shortest = wait;
+        }
+    }
+    
+    *retryAfterMs = shortest;
+    return false;
+}
+
+bool AdmissionControl::consume(uint32_t ip, Access access, uint32_t now, uint32_t* retryAfterMs) {
+    Client& client = lookup(ip, now);
+    Bucket& bucket = client.buckets[access];
+    
+    refill(bucket, _limits[access], now);
+    if (bucket.tokens < 1.0f) {
+        *retryAfterMs = retryAfter(bucket, _limits[access]);
+        _stats.rejectedRate++;
+        return false;
+    }
+    
+    bucket.tokens -= 1.0f;
+    _stats.admitted++;
+    return true;
+}
+
+AdmissionControl::Client& AdmissionControl::lookup(uint32_t ip, uint32_t now) {
+    Client* oldest = &_clients[0];
+    for (auto& client : _clients) {
+        if (client.ip == ip && client.lastSeen != 0) {
+            client.lastSeen = now | 1;
+            return client;
+        }
+        // Free entries (lastSeen 0) first, then the least recently seen;
+        // compared by difference so millis() wrapping doesn't upset the order
+        if (oldest->lastSeen != 0 &&
+            (client.lastSeen == 0 || (int32_t)(client.lastSeen - oldest->lastSeen) < 0)) {
+            oldest = &client;
+        }
+    }
+    
+    // New client (or evicted one) starts with full buckets
+    if (oldest->lastSeen == 0) {
+        _stats.clients++;
+    }
+    oldest->ip = ip;
+    oldest->lastSeen = now | 1;  // Zero marks a free entry
+    for (int i = 0; i < ACCESS_COUNT; i++) {
+        oldest->buckets[i] = {_limits[i].burst, now};
+    }
+    return *oldest;
+}
+
+void AdmissionControl::refill(Bucket& bucket, const Limit& limit, uint32_t now) {
+    uint32_t elapsed = now - bucket.updated;
+    bucket.updated = now;
+    bucket.tokens += elapsed * limit.ratePerSec / 1000.0f;
+    if (bucket.tokens > limit.burst) {
+        bucket.tokens = limit.burst;
+    }
+}
+
+uint32_t AdmissionControl::retryAfter(const Bucket& bucket, const Limit& limit) {
+    if (limit.ratePerSec <= 0) {
+        return 60000;
+    }
+    float missing = 1.0f - bucket.tokens;
+    return (uint32_t)(missing * 1000.0f / limit.ratePerSec) + 1;
+}
@@ -0,0 +1,92 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+
+// Default per-client limits, override with -D build flags
+#ifndef MCP_READ_RATE_PER_SEC
+#define MCP_READ_RATE_PER_SEC 10
+#endif
+#ifndef MCP_READ_BURST
+#define MCP_READ_BURST 20
+#endif
+#ifndef MCP_WRITE_RATE_PER_SEC
+#define MCP_WRITE_RATE_PER_SEC 5
+#endif
+#ifndef MCP_WRITE_BURST
+#define MCP_WRITE_BURST 10
+#endif
+
+/*
+ * Per-client token buckets for the /mcp endpoint.
+ *
+ * Each client IP gets one bucket for read capabilities and one for write
+ * capabilities. Clients live in a small fixed table; the least recently seen
+ * client is evicted when a new one arrives. Not thread safe: only used from
+ * the AsyncTCP task.
+ */
+class AdmissionControl {
+public:
+    enum Access {
+        ACCESS_READ = 0,
+        ACCESS_WRITE,
+        ACCESS_COUNT
+    };
+
+    struct Stats {
+        uint32_t admitted;
+        uint32_t rejectedRate;
+        uint32_t rejectedBusy;
+        uint32_t clients;
+    };
+
+    static constexpr int MAX_CLIENTS = 16;
+
+    AdmissionControl();
+
+    // Change the refill rate and burst size for one access class
+    void configure(Access access, float ratePerSec, float burst);
+
+    // Cheap pre-check before the body is parsed: false when the client has
+    // no token left in any bucket. retryAfterMs is set on rejection. Does
+    // not consume tokens or update the stats.
+    bool precheck(uint32_t ip, uint32_t now, uint32_t* retryAfterMs);
+
+    // Take one token for the given access class
+    bool consume(uint32_t ip, Access access, uint32_t now, uint32_t* retryAfterMs);
+
+    // Count requests turned away after a failed precheck, or because the
+    // server was at its concurrency cap
+    void noteRateLimited() { _stats.rejectedRate++; }
+    void noteBusy() { _stats.rejectedBusy++; }
+
+    const Stats& stats() const { return _stats; }
+
+private:
+    struct Bucket {
+        float tokens;
+        uint32_t updated;
+    };
+
+    struct Client {
+        uint32_t ip;
+        uint32_t lastSeen;
+        Bucket buckets[ACCESS_COUNT];
+    };
+
+    struct Limit {
+        float ratePerSec;
+        float burst;
+    };
+
+    Limit _limits[ACCESS_COUNT];
+    Client _clients[MAX_CLIENTS] = {};
+    Stats _stats                 = {};
+
+    Client& lookup(uint32_t ip, uint32_t now);
+    void refill(Bucket& bucket, const Limit& limit, uint32_t now);
+    uint32_t retryAfter(const Bucket& bucket, const Limit& limit);
+};
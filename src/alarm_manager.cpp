@@ -0,0 +1,268 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "alarm_manager.h"
+#include "esp_timer.h"
+#include <Preferences.h>
+#include <string.h>
+
+AlarmManager::AlarmManager() {}
+
+void AlarmManager::begin() {
+    Preferences prefs;
+    if (prefs.begin("alarms", true)) {
+        if (prefs.getBytesLength("table") == sizeof(_configs)) {
+            prefs.getBytes("table", _configs, sizeof(_configs));
+        }
+        prefs.end();
+    }
+}
+
+void AlarmManager::onScan(void* context, const IOSnapshot& previous, const IOSnapshot& current) {
+    static_cast<AlarmManager*>(context)->evaluate(current);
+}
+
+void AlarmManager::evaluate(const IOSnapshot& snapshot) {
+    uint32_t now = snapshot.timestamp;
+
+    portENTER_CRITICAL(&_lock);
+    for (int id = 0; id < MAX_ALARMS; id++) {
+        const Config& config = _configs[id];
+        if (!config.enabled) {
+            continue;
+        }
+        Runtime& runtime = _runtime[id];
+        float value = valueOf(config, snapshot);
+        runtime.value = value;
+
+        // Once past the limit, the value has to come back past the
+        // hysteresis band to count as returned
+        float threshold = runtime.beyond ? (config.type == TYPE_HIGH ? config.limit - config.hysteresis
+                                                                     : config.limit + config.hysteresis)
+                                         : config.limit;
+        bool raw = config.type == TYPE_HIGH ? value > threshold : value < threshold;
+        if (raw != runtime.beyond) {
+            runtime.beyond = raw;
+            if (_event_log) {
+                _event_log->record(EventLog::TYPE_LIMIT, id, raw, value, esp_timer_get_time());
+            }
+        }
+
+        if (raw == runtime.condition) {
+            runtime.pending = false;
+            continue;
+        }
+        if (!runtime.pending) {
+            runtime.pending = true;
+            runtime.pendingSinceMs = now;
+        }
+        if (now - runtime.pendingSinceMs < (raw ? config.delayOnMs : config.delayOffMs)) {
+            continue;
+        }
+
+        runtime.pending = false;
+        runtime.condition = raw;
+        if (raw) {
+            runtime.acknowledged = false;
+            update(id, STATE_ACTIVE, now);
+        } else if (config.latching && !runtime.acknowledged) {
+            update(id, STATE_LATCHED, now);
+        } else {
+            update(id, STATE_NORMAL, now);
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+void AlarmManager::update(int id, State next, uint32_t now) {
+    Runtime& runtime = _runtime[id];
+    if (runtime.state == next) {
+        return;
+    }
+    runtime.state = next;
+    runtime.changedMs = now;
+
+    _sequence++;
+    _events[(_sequence - 1) % MAX_EVENTS] = {_sequence, now, (uint8_t)id, next, runtime.value};
+    if (_event_log) {
+        _event_log->record(EventLog::TYPE_ALARM, id, next, runtime.value, esp_timer_get_time());
+    }
+}
+
+bool AlarmManager::configure(int id, const Config& config) {
+    if (id < 0 || id >= MAX_ALARMS) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&_lock);
+    _configs[id] = config;
+    _configs[id].name[NAME_LENGTH - 1] = '\0';
+    if (!config.defined) {
+        _configs[id].enabled = false;
+    }
+
+    // Start over from normal; an alarm that was up reports clearing
+    float value = _runtime[id].value;
+    update(id, STATE_NORMAL, millis());
+    _runtime[id] = {};
+    _runtime[id].value = value;
+    portEXIT_CRITICAL(&_lock);
+
+    save();
+    return true;
+}
+
+int AlarmManager::acknowledge(int id) {
+    int changed = 0;
+    uint32_t now = millis();
+
+    portENTER_CRITICAL(&_lock);
+    for (int i = 0; i < MAX_ALARMS; i++) {
+        if (id != -1 && id != i) {
+            continue;
+        }
+        Runtime& runtime = _runtime[i];
+        if (runtime.state == STATE_ACTIVE) {
+            runtime.acknowledged = true;
+            update(i, STATE_ACKNOWLEDGED, now);
+            changed++;
+        } else if (runtime.state == STATE_LATCHED) {
+            runtime.acknowledged = true;
+            update(i, STATE_NORMAL, now);
+            changed++;
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    return changed;
+}
+
+bool AlarmManager::status(int id, Status& out) {
+    if (id < 0 || id >= MAX_ALARMS) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&_lock);
+    out.config = _configs[id];
+    out.state = _runtime[id].state;
+    out.value = _runtime[id].value;
+    out.changedMs = _runtime[id].changedMs;
+    portEXIT_CRITICAL(&_lock);
+
+    return out.config.defined;
+}
+
+int AlarmManager::events(uint32_t since, Event* out, int maxEvents) {
+    int count = 0;
+
+    portENTER_CRITICAL(&_lock);
+    uint32_t oldest = _sequence > MAX_EVENTS ? _sequence - MAX_EVENTS + 1 : 1;
+    for (uint32_t sequence = since + 1 > oldest ? since + 1 : oldest; sequence <= _sequence && count < maxEvents;
+         sequence++) {
+        out[count++] = _events[(sequence - 1) % MAX_EVENTS];
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    return count;
+}
+
+uint32_t AlarmManager::lastSequence() {
+    portENTER_CRITICAL(&_lock);
+    uint32_t sequence = _sequence;
+    portEXIT_CRITICAL(&_lock);
+    return sequence;
+}
+
+void AlarmManager::counts(int& active, int& unacknowledged) {
+    active = 0;
+    unacknowledged = 0;
+
+    portENTER_CRITICAL(&_lock);
+    for (int id = 0; id < MAX_ALARMS; id++) {
+        State state = _runtime[id].state;
+        if (state != STATE_NORMAL) {
+            active++;
+        }
+        if (state == STATE_ACTIVE || state == STATE_LATCHED) {
+            unacknowledged++;
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+void AlarmManager::save() {
+    // Only the worker saves; a static copy keeps the table off its stack
+    // and the flash write out of the lock
+    static Config copy[MAX_ALARMS];
+    portENTER_CRITICAL(&_lock);
+    memcpy(copy, _configs, sizeof(copy));
+    portEXIT_CRITICAL(&_lock);
+
+    Preferences prefs;
+    if (prefs.begin("alarms", false)) {
+        prefs.putBytes("table", copy, sizeof(copy));
+        prefs.end();
+    }
+}
+
+float AlarmManager::valueOf(const Config& config, const IOSnapshot& snapshot) {
+    switch (config.source) {
+        case SOURCE_TEMPERATURE: return snapshot.temperature;
+        case SOURCE_VOLTAGE:     return snapshot.voltage;
+        case SOURCE_CURRENT:     return snapshot.current;
+        case SOURCE_POWER:       return snapshot.voltage * snapshot.current;
+        case SOURCE_INPUT:       return (snapshot.inputs >> config.channel) & 1;
+        case SOURCE_RELAY:       return (snapshot.relays >> config.channel) & 1;
+        default:                 return 0;
+    }
+}
+
+const char* AlarmManager::sourceName(Source source) {
+    switch (source) {
+        case SOURCE_TEMPERATURE: return "temperature";
+        case SOURCE_VOLTAGE:     return "voltage";
+        case SOURCE_CURRENT:     return "current";
+        case SOURCE_POWER:       return "power";
+        case SOURCE_INPUT:       return "input";
+        case SOURCE_RELAY:       return "relay";
+        default:                 return "unknown";
+    }
+}
+
+const char* AlarmManager::typeName(Type type) {
+    return type == TYPE_LOW ? "low" : "high";
+}
+
+const char* AlarmManager::stateName(State state) {
+    switch (state) {
+        case STATE_NORMAL:       return "normal";
+        case STATE_ACTIVE:       return "active";
+        case STATE_ACKNOWLEDGED: return "acknowledged";
+        case STATE_LATCHED:      return "latched";
+        default:                 return "unknown";
+    }
+}
+
+bool AlarmManager::parseSource(const char* name, Source& source) {
+    for (int s = 0; s < SOURCE_COUNT; s++) {
+        if (strcmp(name, sourceName(static_cast<Source>(s))) == 0) {
+            source = static_cast<Source>(s);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool AlarmManager::parseType(const char* name, Type& type) {
+    if (strcmp(name, "high") == 0) {
+        type = TYPE_HIGH;
+        return true;
+    }
+    if (strcmp(name, "low") == 0) {
+        type = TYPE_LOW;
+        return true;
+    }
+    return false;
+}
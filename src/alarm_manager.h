@@ -0,0 +1,144 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include "io_scanner.h"
+#include "event_log.h"
+
+/*
+ * Table-driven alarms evaluated on every I/O scan.
+ *
+ * Each alarm watches one value of the snapshot against a high or low limit.
+ * Hysteresis keeps it from chattering: a high alarm sets above the limit and
+ * clears only below limit - hysteresis. The condition must hold for delayOn
+ * before the alarm activates and be gone for delayOff before it clears.
+ *
+ * An active alarm is unacknowledged until ackAlarm. A latching alarm whose
+ * condition has cleared stays latched until it is acknowledged as well.
+ * Every state change is queued as an event with a sequence number for SSE
+ * and getAlarms. With an EventLog attached, the state changes and the
+ * moments the value crossed the limit (before any delay) are recorded there
+ * too.
+ *
+ * The table is fixed-size and lives in NVS; evaluation is a few compares
+ * per alarm with no heap use. evaluate() runs on the scan task, the rest on
+ * the worker; a spinlock guards the table.
+ */
+class AlarmManager {
+public:
+    static constexpr int MAX_ALARMS = 32;
+    static constexpr int MAX_EVENTS = 32;
+    static constexpr int NAME_LENGTH = 16;
+
+    enum Source : uint8_t {
+        SOURCE_TEMPERATURE = 0,
+        SOURCE_VOLTAGE,
+        SOURCE_CURRENT,
+        SOURCE_POWER,
+        SOURCE_INPUT,           // 0/1 of input channel
+        SOURCE_RELAY,           // 0/1 of relay channel
+        SOURCE_COUNT
+    };
+
+    enum Type : uint8_t {
+        TYPE_HIGH = 0,
+        TYPE_LOW
+    };
+
+    enum State : uint8_t {
+        STATE_NORMAL = 0,
+        STATE_ACTIVE,           // Condition present, not acknowledged
+        STATE_ACKNOWLEDGED,     // Condition present, acknowledged
+        STATE_LATCHED           // Condition gone, latching alarm not acknowledged
+    };
+
+    struct Config {
+        char name[NAME_LENGTH];
+        bool defined;
+        bool enabled;
+        bool latching;
+        Source source;
+        uint8_t channel;
+        Type type;
+        float limit;
+        float hysteresis;
+        uint32_t delayOnMs;
+        uint32_t delayOffMs;
+    };
+
+    struct Status {
+        Config config;
+        State state;
+        float value;            // At the last evaluation
+        uint32_t changedMs;     // millis() of the last state change
+    };
+
+    struct Event {
+        uint32_t sequence;
+        uint32_t timestamp;
+        uint8_t id;
+        State state;
+        float value;
+    };
+
+    AlarmManager();
+
+    // Restores the table from NVS
+    void begin();
+
+    // Also record transitions and limit crossings in the sequence-of-events log
+    void setEventLog(EventLog* log) {
+        _event_log = log;
+    }
+
+    // Scan listener; evaluates every alarm against the new snapshot
+    static void onScan(void* context, const IOSnapshot& previous, const IOSnapshot& current);
+    void evaluate(const IOSnapshot& snapshot);
+
+    // Replaces (or with defined = false removes) one alarm and stores the table
+    bool configure(int id, const Config& config);
+
+    // Acknowledge one alarm, or all with id -1; returns how many changed state
+    int acknowledge(int id);
+
+    bool status(int id, Status& out);
+
+    // Events after sequence since, oldest first; returns the count
+    int events(uint32_t since, Event* out, int maxEvents);
+    uint32_t lastSequence();
+
+    // Counts of alarms not in STATE_NORMAL, and of those not acknowledged
+    void counts(int& active, int& unacknowledged);
+
+    static const char* sourceName(Source source);
+    static const char* typeName(Type type);
+    static const char* stateName(State state);
+    static bool parseSource(const char* name, Source& source);
+    static bool parseType(const char* name, Type& type);
+
+private:
+    struct Runtime {
+        State state;
+        bool beyond;            // Past the limit, with hysteresis
+        bool condition;         // After the delays as well
+        bool pending;           // The raw condition differs and its delay is running
+        bool acknowledged;
+        uint32_t pendingSinceMs;
+        uint32_t changedMs;
+        float value;
+    };
+
+    Config _configs[MAX_ALARMS]   = {};
+    Runtime _runtime[MAX_ALARMS]  = {};
+    Event _events[MAX_EVENTS]     = {};
+    uint32_t _sequence            = 0;
+    EventLog* _event_log          = nullptr;
+    portMUX_TYPE _lock            = portMUX_INITIALIZER_UNLOCKED;
+
+    void update(int id, State next, uint32_t now);
+    void save();
+    static float valueOf(const Config& config, const IOSnapshot& snapshot);
+};
@@ -0,0 +1,134 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "alloc_tracker.h"
+
+#ifdef MCP_ALLOC_TRACKING
+#include <atomic>
+
+namespace {
+
+// Global counters, updated from every task
+std::atomic<uint32_t> g_allocs{0};
+std::atomic<uint32_t> g_frees{0};
+std::atomic<uint32_t> g_failures{0};
+std::atomic<uint64_t> g_bytes{0};
+
+// One active scope per kind. The hook only compares task handles, so it
+// stays cheap enough to run on every allocation.
+volatile TaskHandle_t g_scope_task[AllocTracker::SCOPE_COUNT] = {};
+volatile uint32_t g_scope_count[AllocTracker::SCOPE_COUNT]    = {};
+AllocTracker::ScopeStats g_scope_stats[AllocTracker::SCOPE_COUNT] = {};
+
+const char* const g_scope_names[AllocTracker::SCOPE_COUNT] = {"loop", "request", "execute"};
+
+inline void note_alloc(size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    g_bytes.fetch_add(size, std::memory_order_relaxed);
+
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < AllocTracker::SCOPE_COUNT; i++) {
+        if (g_scope_task[i] == self) {
+            g_scope_count[i] = g_scope_count[i] + 1;
+        }
+    }
+}
+
+}  // namespace
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+void* __wrap_malloc(size_t size)
+{
+    void* ptr = __real_malloc(size);
+    if (ptr) {
+        note_alloc(size);
+    } else {
+        g_failures.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ptr;
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    void* ptr = __real_calloc(count, size);
+    if (ptr) {
+        note_alloc(count * size);
+    } else {
+        g_failures.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ptr;
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    void* result = __real_realloc(ptr, size);
+    if (result) {
+        // A moved or grown block costs the same as a fresh allocation
+        note_alloc(size);
+        if (ptr) {
+            g_frees.fetch_add(1, std::memory_order_relaxed);
+        }
+    } else if (size) {
+        g_failures.fetch_add(1, std::memory_order_relaxed);
+    }
+    return result;
+}
+
+void __wrap_free(void* ptr)
+{
+    if (ptr) {
+        g_frees.fetch_add(1, std::memory_order_relaxed);
+    }
+    __real_free(ptr);
+}
+}
+
+namespace AllocTracker {
+
+Totals totals()
+{
+    return {g_allocs.load(), g_frees.load(), g_failures.load(), g_bytes.load()};
+}
+
+ScopeStats scopeStats(ScopeKind kind)
+{
+    return g_scope_stats[kind];
+}
+
+const char* scopeName(ScopeKind kind)
+{
+    return g_scope_names[kind];
+}
+
+void beginScope(ScopeKind kind)
+{
+    g_scope_count[kind] = 0;
+    g_scope_task[kind]  = xTaskGetCurrentTaskHandle();
+}
+
+void endScope(ScopeKind kind)
+{
+    g_scope_task[kind] = nullptr;
+
+    uint32_t count     = g_scope_count[kind];
+    ScopeStats& stats  = g_scope_stats[kind];
+    stats.last         = count;
+    stats.samples++;
+    if (count > stats.peak) {
+        stats.peak = count;
+    }
+    if (count) {
+        stats.dirty++;
+    }
+}
+
+}  // namespace AllocTracker
+#endif
@@ -0,0 +1,77 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+
+/*
+ * Heap allocation counters.
+ *
+ * Counting is only compiled in when the firmware is built with
+ * MCP_ALLOC_TRACKING (see the alloc-tracking env in platformio.ini), which
+ * wraps malloc/calloc/realloc/free at link time. In the normal build every
+ * call here is a no-op and Scope is an empty object.
+ *
+ * Allocations that go straight to heap_caps_* (WiFi driver, lwIP pools) are
+ * not seen by the wrappers; use the heap statistics for those.
+ */
+namespace AllocTracker {
+
+enum ScopeKind {
+    SCOPE_LOOP = 0,     // One iteration of loop()
+    SCOPE_REQUEST,      // Intake of one /mcp request on the AsyncTCP task
+    SCOPE_EXECUTE,      // Execution of one request on the scheduler worker
+    SCOPE_COUNT
+};
+
+struct Totals {
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failures;
+    uint64_t bytes;
+};
+
+struct ScopeStats {
+    uint32_t last;      // Allocations in the most recent scope
+    uint32_t peak;      // Highest count seen in a single scope
+    uint32_t samples;   // Scopes measured
+    uint32_t dirty;     // Scopes that allocated at least once
+};
+
+#ifdef MCP_ALLOC_TRACKING
+constexpr bool enabled = true;
+
+Totals totals();
+ScopeStats scopeStats(ScopeKind kind);
+const char* scopeName(ScopeKind kind);
+
+void beginScope(ScopeKind kind);
+void endScope(ScopeKind kind);
+
+// Counts allocations made by the calling task until destroyed
+class Scope {
+public:
+    explicit Scope(ScopeKind kind) : _kind(kind) { beginScope(kind); }
+    ~Scope() { endScope(_kind); }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    ScopeKind _kind;
+};
+#else
+constexpr bool enabled = false;
+
+inline Totals totals() { return {}; }
+inline ScopeStats scopeStats(ScopeKind) { return {}; }
+inline const char* scopeName(ScopeKind) { return ""; }
+
+class Scope {
+public:
+    explicit Scope(ScopeKind) {}
+};
+#endif
+
+}  // namespace AllocTracker
@@ -0,0 +1,165 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "anomaly_detector.h"
+#include "esp_timer.h"
+#include <math.h>
+#include <string.h>
+
+AnomalyDetector::AnomalyDetector() {}
+
+void AnomalyDetector::onScan(void* context, const IOSnapshot& previous, const IOSnapshot& current) {
+    static_cast<AnomalyDetector*>(context)->record(current);
+}
+
+void AnomalyDetector::record(const IOSnapshot& snapshot) {
+    uint32_t now = snapshot.timestamp;
+
+    portENTER_CRITICAL(&_lock);
+    if (snapshot.relays != _relays) {
+        _relays = snapshot.relays;
+        _relay_change_ms = now;
+    }
+    if (snapshot.sensorTimestamp != _last_sensor_ms) {
+        _last_sensor_ms = snapshot.sensorTimestamp;
+        bool settling = now - _relay_change_ms < SETTLE_MS;
+        evaluate(SERIES_TEMPERATURE, snapshot.temperature, now, settling);
+        evaluate(SERIES_VOLTAGE, snapshot.voltage, now, settling);
+        evaluate(SERIES_CURRENT, snapshot.current, now, settling);
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+void AnomalyDetector::evaluate(Series series, float value, uint32_t now, bool settling) {
+    // The load is still switching; its readings fit no profile yet
+    if (settling) {
+        return;
+    }
+
+    State& state = _profiles[series][_relays % PROFILE_COUNT];
+    uint8_t bit = 1 << series;
+
+    if (state.count >= WARMUP_SAMPLES) {
+        float sigma = sqrtf(state.ewmaVar);
+        if (sigma < minSigma(series)) {
+            sigma = minSigma(series);
+        }
+        float deviation = fabsf(value - state.ewmaMean) / sigma;
+
+        // Out of range: never learned from, so a fault cannot become the baseline
+        if (deviation > MCP_ANOMALY_SIGMA) {
+            _normal[series] = 0;
+            if (!(_active & bit) && ++_deviating[series] >= MCP_ANOMALY_CONFIRM) {
+                _active |= bit;
+                raise(series, true, value, state.ewmaMean, deviation, now);
+            }
+            return;
+        }
+
+        _deviating[series] = 0;
+        if (_active & bit) {
+            if (++_normal[series] < CLEAR_SAMPLES) {
+                return;
+            }
+            _active &= ~bit;
+            _normal[series] = 0;
+            raise(series, false, value, state.ewmaMean, deviation, now);
+        }
+    }
+
+    // Welford over every normal reading
+    state.count++;
+    double delta = value - state.mean;
+    state.mean += delta / state.count;
+    state.m2 += delta * (value - state.mean);
+
+    // The baseline starts from the warm-up statistics, then follows the EWMA
+    if (state.count <= WARMUP_SAMPLES) {
+        state.ewmaMean = state.mean;
+        state.ewmaVar = state.m2 / state.count;
+    } else {
+        float difference = value - state.ewmaMean;
+        state.ewmaMean += EWMA_ALPHA * difference;
+        state.ewmaVar = (1 - EWMA_ALPHA) * (state.ewmaVar + EWMA_ALPHA * difference * difference);
+    }
+}
+
+void AnomalyDetector::raise(Series series, bool active, float value, float expected, float deviation, uint32_t now) {
+    _sequence++;
+    _events[(_sequence - 1) % MAX_EVENTS] = {_sequence, now, series, _relays, active, value, expected, deviation};
+    if (_event_log) {
+        _event_log->record(EventLog::TYPE_ANOMALY, series, active, value, esp_timer_get_time());
+    }
+}
+
+int AnomalyDetector::events(uint32_t since, Event* out, int maxEvents) {
+    int count = 0;
+
+    portENTER_CRITICAL(&_lock);
+    uint32_t oldest = _sequence > MAX_EVENTS ? _sequence - MAX_EVENTS + 1 : 1;
+    for (uint32_t sequence = since + 1 > oldest ? since + 1 : oldest; sequence <= _sequence && count < maxEvents;
+         sequence++) {
+        out[count++] = _events[(sequence - 1) % MAX_EVENTS];
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    return count;
+}
+
+uint32_t AnomalyDetector::lastSequence() {
+    portENTER_CRITICAL(&_lock);
+    uint32_t sequence = _sequence;
+    portEXIT_CRITICAL(&_lock);
+    return sequence;
+}
+
+uint8_t AnomalyDetector::activeMask() {
+    portENTER_CRITICAL(&_lock);
+    uint8_t active = _active;
+    portEXIT_CRITICAL(&_lock);
+    return active;
+}
+
+AnomalyDetector::Profile AnomalyDetector::profile(Series series, uint8_t relays) {
+    portENTER_CRITICAL(&_lock);
+    State state = _profiles[series][relays % PROFILE_COUNT];
+    portEXIT_CRITICAL(&_lock);
+
+    Profile profile = {};
+    profile.count = state.count;
+    profile.mean = (float)state.mean;
+    profile.stddev = state.count ? (float)sqrt(state.m2 / state.count) : 0.0f;
+    profile.baseline = state.ewmaMean;
+    profile.baselineSigma = sqrtf(state.ewmaVar);
+    return profile;
+}
+
+void AnomalyDetector::reset() {
+    portENTER_CRITICAL(&_lock);
+    memset(_profiles, 0, sizeof(_profiles));
+    memset(_deviating, 0, sizeof(_deviating));
+    memset(_normal, 0, sizeof(_normal));
+    _active = 0;
+    portEXIT_CRITICAL(&_lock);
+}
+
+float AnomalyDetector::minSigma(Series series) {
+    // Floors for readings that barely move, so quantization steps do not alarm
+    switch (series) {
+        case SERIES_TEMPERATURE: return 0.5f;
+        case SERIES_VOLTAGE:     return 0.1f;
+        case SERIES_CURRENT:     return 0.02f;
+        default:                 return 1.0f;
+    }
+}
+
+const char* AnomalyDetector::seriesName(Series series) {
+    switch (series) {
+        case SERIES_TEMPERATURE: return "temperature";
+        case SERIES_VOLTAGE:     return "voltage";
+        case SERIES_CURRENT:     return "current";
+        default:                 return "unknown";
+    }
+}
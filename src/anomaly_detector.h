@@ -0,0 +1,125 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include "io_scanner.h"
+#include "event_log.h"
+
+// Deviation from the baseline, in standard deviations, that raises an anomaly
+#ifndef MCP_ANOMALY_SIGMA
+#define MCP_ANOMALY_SIGMA 6.0f
+#endif
+
+// Consecutive deviating readings needed to raise one
+#ifndef MCP_ANOMALY_CONFIRM
+#define MCP_ANOMALY_CONFIRM 1
+#endif
+
+/*
+ * Streaming anomaly detection on the analog sensors.
+ *
+ * Each series keeps one profile per relay combination, since the load
+ * current (and with it the voltage and temperature) depends on which relays
+ * are closed. A profile holds Welford running statistics of every normal
+ * reading and an EWMA baseline of mean and variance, both O(1) per sample.
+ *
+ * Every sensor reading of the I/O scan is compared with the EWMA baseline of
+ * the current relay state. A reading more than MCP_ANOMALY_SIGMA deviations
+ * away raises an anomaly, for example a relay that closed but draws no
+ * current, or an overcurrent spike; CLEAR_SAMPLES readings back within range
+ * clear it. Readings are not learned from while their series is anomalous,
+ * nor during the settling time after a relay change, nor compared until a
+ * profile has seen WARMUP_SAMPLES.
+ *
+ * Raise and clear events go into a small ring with sequence numbers for SSE
+ * and getAnomalies. record() runs on the scan task; a spinlock guards the
+ * profiles and events for readers on other tasks.
+ */
+class AnomalyDetector {
+public:
+    enum Series : uint8_t {
+        SERIES_TEMPERATURE = 0,
+        SERIES_VOLTAGE,
+        SERIES_CURRENT,
+        SERIES_COUNT
+    };
+
+    static constexpr int PROFILE_COUNT        = 16;     // One per relay combination
+    static constexpr int MAX_EVENTS           = 16;
+    static constexpr uint32_t WARMUP_SAMPLES  = 50;
+    static constexpr uint32_t CLEAR_SAMPLES   = 10;
+    static constexpr uint32_t SETTLE_MS       = 500;
+    static constexpr float EWMA_ALPHA         = 1.0f / 64;
+
+    struct Profile {
+        uint32_t count;         // Normal readings learned
+        float mean;             // Welford, over all of them
+        float stddev;
+        float baseline;         // EWMA
+        float baselineSigma;
+    };
+
+    struct Event {
+        uint32_t sequence;
+        uint32_t timestamp;     // millis() of the reading
+        Series series;
+        uint8_t relays;         // Relay state the reading was compared under
+        bool active;            // Raised or cleared
+        float value;
+        float expected;         // Baseline at the time
+        float deviation;        // In standard deviations
+    };
+
+    AnomalyDetector();
+
+    // Also record raise and clear events in the sequence-of-events log
+    void setEventLog(EventLog* log) {
+        _event_log = log;
+    }
+
+    // Scan listener; evaluates once per new sensor reading
+    static void onScan(void* context, const IOSnapshot& previous, const IOSnapshot& current);
+    void record(const IOSnapshot& snapshot);
+
+    // Events after sequence since, oldest first; returns the count
+    int events(uint32_t since, Event* out, int maxEvents);
+    uint32_t lastSequence();
+
+    // Bit s set while series s is anomalous
+    uint8_t activeMask();
+
+    Profile profile(Series series, uint8_t relays);
+
+    // Forget everything learned, e.g. after the load was changed on purpose
+    void reset();
+
+    static const char* seriesName(Series series);
+
+private:
+    struct State {
+        uint32_t count;
+        double mean;
+        double m2;
+        float ewmaMean;
+        float ewmaVar;
+    };
+
+    State _profiles[SERIES_COUNT][PROFILE_COUNT] = {};
+    uint8_t _deviating[SERIES_COUNT] = {};      // Consecutive readings out of range
+    uint8_t _normal[SERIES_COUNT]    = {};      // Consecutive readings in range while active
+    uint8_t _active       = 0;
+    uint8_t _relays       = 0;
+    uint32_t _relay_change_ms = 0;
+    uint32_t _last_sensor_ms  = 0;
+    Event _events[MAX_EVENTS] = {};
+    uint32_t _sequence    = 0;
+    EventLog* _event_log  = nullptr;
+    portMUX_TYPE _lock    = portMUX_INITIALIZER_UNLOCKED;
+
+    void evaluate(Series series, float value, uint32_t now, bool settling);
+    void raise(Series series, bool active, float value, float expected, float deviation, uint32_t now);
+    static float minSigma(Series series);
+};
@@ -0,0 +1,109 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "command_scheduler.h"
+
+CommandScheduler::CommandScheduler() {}
+
+bool CommandScheduler::begin(Executor executor, void* context, const char* taskName, uint32_t stackSize,
+                             UBaseType_t taskPriority) {
+    _executor = executor;
+    _context = context;
+    return xTaskCreatePinnedToCore(taskEntry, taskName, stackSize, this, taskPriority, &_task, tskNO_AFFINITY) == pdPASS;
+}
+
+bool CommandScheduler::submit(Priority priority, uint16_t job) {
+    bool queued = false;
+    
+    portENTER_CRITICAL(&_lock);
+    Queue& queue = _queues[priority];
+    PriorityStats& stats = _stats[priority];
+    if (queue.count < QUEUE_CAPACITY) {
+        Entry& entry = queue.entries[(queue.head + queue.count) % QUEUE_CAPACITY];
+        entry.job = job;
+        entry.enqueuedUs = esp_timer_get_time();
+        queue.count++;
+        stats.depth = queue.count;
+        if (stats.depth > stats.maxDepth) {
+            stats.maxDepth = stats.depth;
+        }
+        queued = true;
+    } else {
+        stats.dropped++;
+    }
+    portEXIT_CRITICAL(&_lock);
+    
+    if (queued && _task) {
+        xTaskNotifyGive(_task);
+    }
+    return queued;
+}
+
+CommandScheduler::PriorityStats CommandScheduler::stats(Priority priority) {
+    portENTER_CRITICAL(&_lock);
+    PriorityStats copy = _stats[priority];
+    portEXIT_CRITICAL(&_lock);
+    return copy;
+}
+
+const char* CommandScheduler::priorityName(Priority priority) {
+    switch (priority) {
+        case PRIORITY_ACTUATION:
+            return "actuation";
+        case PRIORITY_NORMAL:
+            return "normal";
+        case PRIORITY_TELEMETRY:
+            return "telemetry";
+        default:
+            return "unknown";
+    }
+}
+
+bool CommandScheduler::take(uint16_t& job) {
+    bool found = false;
+    
+    portENTER_CRITICAL(&_lock);
+    for (int i = 0; i < PRIORITY_COUNT; i++) {
+        Queue& queue = _queues[i];
+        if (queue.count == 0) {
+            continue;
+        }
+        
+        Entry& entry = queue.entries[queue.head];
+        job = entry.job;
+        queue.head = (queue.head + 1) % QUEUE_CAPACITY;
+        queue.count--;
+        
+        PriorityStats& stats = _stats[i];
+        uint32_t waitUs = (uint32_t)(esp_timer_get_time() - entry.enqueuedUs);
+        stats.depth = queue.count;
+        stats.executed++;
+        stats.lastWaitUs = waitUs;
+        stats.totalWaitUs += waitUs;
+        if (waitUs > stats.maxWaitUs) {
+            stats.maxWaitUs = waitUs;
+        }
+        found = true;
+        break;
+    }
+    portEXIT_CRITICAL(&_lock);
+    
+    return found;
+}
+
+void CommandScheduler::taskEntry(void* param) {
+    CommandScheduler* self = static_cast<CommandScheduler*>(param);
+    
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        
+        // Re-check the queues after every job so new actuation work jumps ahead
+        uint16_t job;
+        while (self->take(job)) {
+            self->_executor(self->_context, job);
+        }
+    }
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,73 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+
+/*
+ * Priority queue of pending capability calls, drained by one worker task.
+ *
+ * Jobs are small integers owned by the caller (the MCP server uses request
+ * slot indices). The worker always takes the oldest job of the highest
+ * non-empty priority, so an actuation request waits at most for the job that
+ * is already running, never for queued reads.
+ */
+class CommandScheduler {
+public:
+    enum Priority {
+        PRIORITY_ACTUATION = 0,   // writeRelay, tone, setTime
+        PRIORITY_NORMAL,          // Cheap reads and everything else
+        PRIORITY_TELEMETRY,       // Sensor and system reads
+        PRIORITY_COUNT
+    };
+
+    struct PriorityStats {
+        uint32_t depth;           // Jobs waiting right now
+        uint32_t maxDepth;
+        uint32_t executed;
+        uint32_t dropped;         // Rejected because the queue was full
+        uint32_t lastWaitUs;      // Queue wait of the most recent job
+        uint32_t maxWaitUs;
+        uint64_t totalWaitUs;
+    };
+
+    typedef void (*Executor)(void* context, uint16_t job);
+
+    static constexpr int QUEUE_CAPACITY = 8;
+
+    CommandScheduler();
+
+    // Start the worker task
+    bool begin(Executor executor, void* context, const char* taskName, uint32_t stackSize, UBaseType_t taskPriority);
+
+    // Queue a job; returns false if that priority's queue is full
+    bool submit(Priority priority, uint16_t job);
+
+    PriorityStats stats(Priority priority);
+
+    static const char* priorityName(Priority priority);
+
+private:
+    struct Entry {
+        uint16_t job;
+        int64_t enqueuedUs;
+    };
+
+    struct Queue {
+        Entry entries[QUEUE_CAPACITY];
+        uint8_t head;
+        uint8_t count;
+    };
+
+    Queue _queues[PRIORITY_COUNT]         = {};
+    PriorityStats _stats[PRIORITY_COUNT]  = {};
+    portMUX_TYPE _lock                    = portMUX_INITIALIZER_UNLOCKED;
+    TaskHandle_t _task                    = nullptr;
+    Executor _executor                    = nullptr;
+    void* _context                        = nullptr;
+
+    static void taskEntry(void* param);
+    bool take(uint16_t& job);
+};
@@ -5,7 +5,6 @@
  */
 #include "dashboard_ui.h"
 #include <M5GFX.h>
-#include <queue>
 #include "font_montserrat_semibolditalic_10.h"
 #include "font_montserrat_semibolditalic_12.h"
 #include "img_tag_console.h"
@@ -41,14 +40,49 @@ void DashboardUI::render()
     _canvas->pushSprite(0, 0);
 }
 
-void DashboardUI::console_log(const std::string& msg, bool autoNewLine)
+void DashboardUI::console_log(const char* msg, bool autoNewLine)
 {
+    /* Called from both the loop and the AsyncTCP task */
+    portENTER_CRITICAL(&_console_lock);
     if (autoNewLine) {
-        _console_queue.push('\n');
+        console_push('\n');
     }
-    for (const auto& i : msg) {
-        _console_queue.push(i);
+    for (const char* i = msg; *i; i++) {
+        console_push(*i);
     }
+    portEXIT_CRITICAL(&_console_lock);
+}
+
+void DashboardUI::console_log(const std::string& msg, bool autoNewLine)
+{
+    console_log(msg.c_str(), autoNewLine);
+}
+
+void DashboardUI::console_push(char c)
+{
+    _console_ring[_console_head % _console_ring_size] = c;
+    _console_head++;
+    /* Drop the oldest character once the ring is full */
+    if (_console_head - _console_tail > _console_ring_size) {
+        _console_tail = _console_head - _console_ring_size;
+    }
+}
+
+size_t DashboardUI::console_pending()
+{
+    portENTER_CRITICAL(&_console_lock);
+    size_t pending = _console_head - _console_tail;
+    portEXIT_CRITICAL(&_console_lock);
+    return pending;
+}
+
+char DashboardUI::console_pop()
+{
+    portENTER_CRITICAL(&_console_lock);
+    char c = _console_ring[_console_tail % _console_ring_size];
+    _console_tail++;
+    portEXIT_CRITICAL(&_console_lock);
+    return c;
 }
 
 void DashboardUI::render_status_panel()
@@ -115,23 +149,21 @@ void DashboardUI::render_console_panel()
 
     // Update message pop out
     if (millis() - _console_msg_pop_out_time_count > _console_msg_pop_out_interval) {
-        if (!_console_queue.empty()) {
+        if (console_pending() > 0) {
             /* Cover old cursor */
             _terminal_canvas->fillRect(_terminal_canvas->getCursorX(), _terminal_canvas->getCursorY() + 10, 6, 3,
                                        color_inner_pannel);
 
             char c = 0;
             /* If queue is less than 60, pop out in every 20ms */
-            if (_console_queue.size() < 60) {
-                c = _console_queue.front();
-                _console_queue.pop();
+            if (console_pending() < 60) {
+                c = console_pop();
                 _terminal_canvas->print(c);
             }
             /* If not, pop them all out */
             else {
-                while (_console_queue.size() >= 60) {
-                    c = _console_queue.front();
-                    _console_queue.pop();
+                while (console_pending() >= 60) {
+                    c = console_pop();
                     _terminal_canvas->print(c);
                 }
             }
@@ -6,7 +6,6 @@
 #pragma once
 #include <Arduino.h>
 #include <M5GFX.h>
-#include <queue>
 #include <array>
 
 class DashboardUI {
@@ -22,18 +21,28 @@ public:
 
     void init(LovyanGFX* parent);
     void render();
+    void console_log(const char* msg, bool autoNewLine = true);
     void console_log(const std::string& msg, bool autoNewLine = true);
 
 protected:
     LGFX_Sprite* _canvas          = nullptr;
     LGFX_Sprite* _terminal_canvas = nullptr;
-    std::queue<char> _console_queue;
+    /* Console text waiting to be printed, fixed ring so logging never allocates */
+    static constexpr size_t _console_ring_size = 512;
+    char _console_ring[_console_ring_size];
+    size_t _console_head = 0;
+    size_t _console_tail = 0;
+    portMUX_TYPE _console_lock = portMUX_INITIALIZER_UNLOCKED;
     uint32_t _console_msg_pop_out_interval   = 20;
     uint32_t _console_msg_pop_out_time_count = 0;
     uint32_t _cursor_blink_interval          = 500;
     uint32_t _cursor_time_count              = 0;
     bool _current_cursor_state               = false;
 
+    void console_push(char c);
+    size_t console_pending();
+    char console_pop();
+
     void render_status_panel();
     void render_console_panel();
     void render_io_panel();
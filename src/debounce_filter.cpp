@@ -0,0 +1,74 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "debounce_filter.h"
+
+DebounceFilter::DebounceFilter() {}
+
+void DebounceFilter::setSamples(int channel, uint8_t samples) {
+    if (channel < 0 || channel >= 8) {
+        return;
+    }
+    if (samples > MAX_SAMPLES) {
+        samples = MAX_SAMPLES;
+    }
+
+    uint8_t bit = 1 << channel;
+    for (int b = 0; b < COUNTER_BITS; b++) {
+        if (samples & (1 << b)) {
+            _limit[b] |= bit;
+        } else {
+            _limit[b] &= ~bit;
+        }
+        _count[b] &= ~bit;
+    }
+    if (samples == 0) {
+        _bypass |= bit;
+    } else {
+        _bypass &= ~bit;
+    }
+}
+
+uint8_t DebounceFilter::samples(int channel) const {
+    uint8_t samples = 0;
+    for (int b = 0; b < COUNTER_BITS; b++) {
+        if (_limit[b] & (1 << channel)) {
+            samples |= 1 << b;
+        }
+    }
+    return samples;
+}
+
+uint8_t DebounceFilter::update(uint8_t raw) {
+    uint8_t delta = raw ^ _state;
+
+    // Increment the counters of disagreeing channels, clear the others
+    uint8_t carry = delta;
+    uint8_t differs = 0;
+    for (int b = 0; b < COUNTER_BITS; b++) {
+        uint8_t count = _count[b];
+        _count[b] = (count ^ carry) & delta;
+        carry &= count;
+        differs |= _count[b] ^ _limit[b];
+    }
+
+    // Channels whose counter reached their limit take the new level
+    uint8_t toggle = delta & (~differs | _bypass);
+    _state ^= toggle;
+    for (int b = 0; b < COUNTER_BITS; b++) {
+        _count[b] &= ~toggle;
+    }
+
+    _pending = delta & ~toggle;
+    return _state;
+}
+
+void DebounceFilter::reset(uint8_t state) {
+    _state = state;
+    _pending = 0;
+    for (int b = 0; b < COUNTER_BITS; b++) {
+        _count[b] = 0;
+    }
+}
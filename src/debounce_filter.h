@@ -0,0 +1,51 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+
+/*
+ * Debounce filter for eight inputs at once, built as a vertical counter.
+ *
+ * Each channel has a COUNTER_BITS wide counter, but the counters are stored
+ * bit-sliced: _count[b] holds bit b of all eight counters. A sample costs a
+ * fixed handful of byte-wide operations whatever the inputs are doing, with
+ * no per-channel branches. A channel's output only changes after its raw
+ * level has disagreed with it for its configured number of consecutive
+ * samples; any bounce back resets that channel's counter.
+ */
+class DebounceFilter {
+public:
+    static constexpr int COUNTER_BITS   = 6;
+    static constexpr uint8_t MAX_SAMPLES = (1 << COUNTER_BITS) - 1;
+
+    DebounceFilter();
+
+    // Consecutive samples a new level must hold; 0 passes the channel through
+    void setSamples(int channel, uint8_t samples);
+    uint8_t samples(int channel) const;
+
+    // Feed one raw sample; returns the debounced levels
+    uint8_t update(uint8_t raw);
+
+    // Channels whose raw level currently disagrees with the output
+    uint8_t pending() const {
+        return _pending;
+    }
+
+    uint8_t state() const {
+        return _state;
+    }
+
+    // Force the output, e.g. to the first raw sample after power-up
+    void reset(uint8_t state);
+
+private:
+    uint8_t _state   = 0;
+    uint8_t _pending = 0;
+    uint8_t _bypass  = 0xFF;                // Channels with samples == 0
+    uint8_t _count[COUNTER_BITS] = {};
+    uint8_t _limit[COUNTER_BITS] = {};      // Bit-sliced per-channel sample counts
+};
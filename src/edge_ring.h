@@ -0,0 +1,88 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+
+// One input transition
+struct InputEdge {
+    uint64_t timestampUs;   // esp_timer time of the sample that saw the new level
+    uint32_t sequence;      // Position in the ring, increases by one per edge
+    uint8_t channel;
+    uint8_t level;
+};
+
+/*
+ * Single-producer, multi-reader ring of input edges.
+ *
+ * The sampler task is the only writer and never blocks. Every reader keeps
+ * its own cursor (the next sequence it wants), so the SSE stream, getEdges
+ * callers and the dashboard can all consume the same edges independently.
+ * A reader that falls more than CAPACITY edges behind loses the oldest ones
+ * and is told how many. A cursor ahead of the ring, such as one kept from
+ * before a reboot, restarts at the oldest edge still stored.
+ */
+class EdgeRing {
+public:
+    static constexpr uint32_t CAPACITY = 256;   // Power of two
+
+    // Producer side (sampler task only)
+    void push(uint8_t channel, uint8_t level, uint64_t timestampUs) {
+        uint32_t sequence = _head.load(std::memory_order_relaxed);
+        InputEdge& edge = _edges[sequence & (CAPACITY - 1)];
+        edge.timestampUs = timestampUs;
+        edge.sequence = sequence;
+        edge.channel = channel;
+        edge.level = level;
+        _head.store(sequence + 1, std::memory_order_release);
+    }
+
+    // Sequence the next edge will get
+    uint32_t head() const {
+        return _head.load(std::memory_order_acquire);
+    }
+
+    // Copies up to maxEdges edges starting at cursor and advances it. Edges
+    // that were already overwritten are skipped and counted in lost.
+    int read(uint32_t& cursor, InputEdge* out, int maxEdges, uint32_t* lost = nullptr) const {
+        uint32_t head = this->head();
+        uint32_t skipped = 0;
+        if ((int32_t)(head - cursor) < 0) {
+            // The oldest slot may be rewritten by the next push
+            cursor = head >= CAPACITY ? head - CAPACITY + 1 : 0;
+        } else if (head - cursor > CAPACITY) {
+            skipped = head - cursor - CAPACITY;
+            cursor = head - CAPACITY;
+        }
+
+        int count = 0;
+        while (count < maxEdges && cursor != head) {
+            out[count] = _edges[cursor & (CAPACITY - 1)];
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            // The producer may have lapped us (or be rewriting this slot)
+            // while we were copying
+            uint32_t now = _head.load(std::memory_order_relaxed);
+            if (now - cursor >= CAPACITY) {
+                skipped += now - cursor - CAPACITY + 1;
+                cursor = now - CAPACITY + 1;
+                head = now;
+                continue;
+            }
+            count++;
+            cursor++;
+        }
+
+        if (lost) {
+            *lost = skipped;
+        }
+        return count;
+    }
+
+private:
+    InputEdge _edges[CAPACITY] = {};
+    std::atomic<uint32_t> _head{0};
+};
@@ -0,0 +1,155 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "energy_meter.h"
+#include <Preferences.h>
+#include <string.h>
+
+EnergyMeter::EnergyMeter() {}
+
+void EnergyMeter::begin() {
+    Preferences prefs;
+    if (prefs.begin("energy", true)) {
+        if (prefs.getBytesLength("totals") == sizeof(_totals)) {
+            prefs.getBytes("totals", &_totals, sizeof(_totals));
+        }
+        prefs.end();
+    }
+}
+
+void EnergyMeter::onScan(void* context, const IOSnapshot& previous, const IOSnapshot& current) {
+    static_cast<EnergyMeter*>(context)->record(previous, current);
+}
+
+void EnergyMeter::record(const IOSnapshot& previous, const IOSnapshot& current) {
+    uint32_t now = current.timestamp;
+
+    portENTER_CRITICAL(&_lock);
+    if (current.sensorTimestamp != previous.sensorTimestamp) {
+        // Small negative currents are sensor noise around zero load
+        float power = current.voltage * current.current;
+        if (power < 0) {
+            power = 0;
+        }
+
+        // Trapezoid since the previous reading; energy goes to the relays
+        // that were on over it
+        uint32_t elapsed = current.sensorTimestamp - _sample_ms;
+        if (_sampled && elapsed <= MAX_GAP_MS) {
+            double wh = (_power + power) / 2 * elapsed / 3600000.0;
+            _totals.totalWh += wh;
+            _totals.todayWh += wh;
+            for (int r = 0; r < RELAY_COUNT; r++) {
+                if (_relays & (1 << r)) {
+                    _intervals[r].wh += wh;
+                    _totals.relayWh[r] += wh;
+                }
+            }
+            if (wh > 0) {
+                _dirty = true;
+            }
+        }
+
+        _voltage = current.voltage;
+        _current = current.current;
+        _power = power;
+        _sample_ms = current.sensorTimestamp;
+        _sampled = true;
+    }
+
+    // Relay edges open and close on-intervals
+    for (int r = 0; r < RELAY_COUNT; r++) {
+        uint8_t bit = 1 << r;
+        bool on = current.relays & bit;
+        if (on && !(_relays & bit)) {
+            _intervals[r] = {now, 0, 0};
+        } else if (!on && (_relays & bit)) {
+            _totals.relayIntervals[r]++;
+            _dirty = true;
+        }
+        if (on) {
+            _intervals[r].ms = now - _intervals[r].startMs;
+        }
+    }
+    _relays = current.relays;
+    portEXIT_CRITICAL(&_lock);
+}
+
+void EnergyMeter::flush() {
+    uint32_t now = millis();
+
+    portENTER_CRITICAL(&_lock);
+    bool due = _save_now || (_dirty && now - _last_save_ms >= MCP_ENERGY_SAVE_MS);
+    portEXIT_CRITICAL(&_lock);
+
+    if (due) {
+        save(now);
+    }
+}
+
+void EnergyMeter::setDate(int year, int month, int day) {
+    // An RTC that was never set reads as 2000
+    if (year < 2020) {
+        return;
+    }
+    uint32_t date = year * 10000 + month * 100 + day;
+
+    portENTER_CRITICAL(&_lock);
+    if (_totals.today == 0) {
+        // Energy counted before the date was known belongs to this day
+        _totals.today = date;
+    } else if (date != _totals.today) {
+        memmove(&_totals.days[1], &_totals.days[0], sizeof(Day) * (HISTORY_DAYS - 1));
+        _totals.days[0] = {_totals.today, _totals.todayWh};
+        _totals.today = date;
+        _totals.todayWh = 0;
+        _save_now = true;
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+EnergyMeter::Reading EnergyMeter::read() {
+    Reading reading = {};
+
+    portENTER_CRITICAL(&_lock);
+    reading.voltage = _voltage;
+    reading.current = _current;
+    reading.power = _power;
+    reading.totalWh = _totals.totalWh;
+    reading.today = {_totals.today, _totals.todayWh};
+    for (int d = 0; d < HISTORY_DAYS && _totals.days[d].date != 0; d++) {
+        reading.days[reading.dayCount++] = _totals.days[d];
+    }
+    for (int r = 0; r < RELAY_COUNT; r++) {
+        RelayEnergy& relay = reading.relays[r];
+        relay.on = _relays & (1 << r);
+        relay.intervals = _totals.relayIntervals[r];
+        relay.totalWh = _totals.relayWh[r];
+        relay.intervalWh = _intervals[r].wh;
+        relay.intervalMs = _intervals[r].ms;
+    }
+    reading.saves = _saves;
+    reading.lastSaveMs = _last_save_ms;
+    portEXIT_CRITICAL(&_lock);
+
+    return reading;
+}
+
+void EnergyMeter::save(uint32_t now) {
+    portENTER_CRITICAL(&_lock);
+    Stored copy = _totals;
+    _dirty = false;
+    _save_now = false;
+    _last_save_ms = now;
+    _saves++;
+    portEXIT_CRITICAL(&_lock);
+
+    // Writing to flash takes milliseconds; keep it out of the lock
+    Preferences prefs;
+    if (prefs.begin("energy", false)) {
+        prefs.putBytes("totals", &copy, sizeof(copy));
+        prefs.end();
+    }
+}
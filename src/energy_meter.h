@@ -0,0 +1,115 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include "io_scanner.h"
+
+// Longest time the energy totals may go unsaved while they change
+#ifndef MCP_ENERGY_SAVE_MS
+#define MCP_ENERGY_SAVE_MS (10 * 60 * 1000)
+#endif
+
+/*
+ * Load energy from the supply voltage and IO socket current.
+ *
+ * Every sensor reading of the I/O scan (SENSOR_SCAN_INTERVAL_MS) adds the
+ * trapezoid of power since the previous one, using the actual time between
+ * the readings. Energy accumulates into a lifetime total, the current day
+ * and, for every relay that is on, its current on-interval. The measured
+ * current is the whole socket load, so with several relays on at once each
+ * of them is credited with all of it.
+ *
+ * Days follow the RTC date passed to setDate(); the previous days are kept.
+ * Totals are written to NVS at most every MCP_ENERGY_SAVE_MS and at each
+ * day rollover, so a power loss costs at most that much energy.
+ *
+ * record() runs on the scan task, setDate() and flush() on the loop task,
+ * read() on the worker; a spinlock guards the totals. NVS writes happen in
+ * flush() so a flash write never stalls a scan.
+ */
+class EnergyMeter {
+public:
+    static constexpr int HISTORY_DAYS = 7;
+    static constexpr int RELAY_COUNT  = 4;
+
+    // Readings further apart than this are not integrated across
+    static constexpr uint32_t MAX_GAP_MS = 5000;
+
+    struct Day {
+        uint32_t date;          // YYYYMMDD, 0 = before the RTC date was known
+        double wh;
+    };
+
+    struct RelayEnergy {
+        bool on;
+        uint32_t intervals;     // Completed on-intervals
+        double totalWh;         // Over all on-intervals, including the current one
+        double intervalWh;      // Current on-interval, or the last one while off
+        uint32_t intervalMs;
+    };
+
+    struct Reading {
+        float voltage;
+        float current;
+        float power;            // W
+        double totalWh;
+        Day today;
+        Day days[HISTORY_DAYS]; // Previous days, newest first
+        int dayCount;
+        RelayEnergy relays[RELAY_COUNT];
+        uint32_t saves;
+        uint32_t lastSaveMs;
+    };
+
+    EnergyMeter();
+
+    // Restores the totals from NVS
+    void begin();
+
+    // Scan listener; integrates once per new sensor reading
+    static void onScan(void* context, const IOSnapshot& previous, const IOSnapshot& current);
+    void record(const IOSnapshot& previous, const IOSnapshot& current);
+
+    // Local date from the RTC; a new date closes the current day
+    void setDate(int year, int month, int day);
+
+    // Writes the totals to NVS when a save is due
+    void flush();
+
+    Reading read();
+
+private:
+    struct Stored {
+        uint32_t today;
+        double todayWh;
+        double totalWh;
+        Day days[HISTORY_DAYS];
+        double relayWh[RELAY_COUNT];
+        uint32_t relayIntervals[RELAY_COUNT];
+    };
+
+    struct Interval {
+        uint32_t startMs;
+        double wh;
+        uint32_t ms;
+    };
+
+    Stored _totals       = {};
+    Interval _intervals[RELAY_COUNT] = {};
+    uint8_t _relays      = 0;
+    float _voltage       = 0;
+    float _current       = 0;
+    float _power         = 0;
+    uint32_t _sample_ms  = 0;
+    bool _sampled        = false;
+    bool _dirty          = false;
+    bool _save_now       = false;
+    uint32_t _saves      = 0;
+    uint32_t _last_save_ms = 0;
+    portMUX_TYPE _lock   = portMUX_INITIALIZER_UNLOCKED;
+
+    void save(uint32_t now);
+};
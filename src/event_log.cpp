@@ -0,0 +1,127 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "event_log.h"
+#include <string.h>
+#if MCP_EVENT_LOG_SD
+#include <SD.h>
+#endif
+
+uint32_t EventLog::record(Type type, uint8_t channel, uint8_t state, float value, uint64_t timestampUs,
+                          uint32_t clientIp, const char* requestId) {
+    uint32_t sequence = _reserve.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = _slots[sequence & (CAPACITY - 1)];
+
+    // Mark the slot as being written before touching it
+    slot.commit.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Event& event = slot.event;
+    event.timestampUs = timestampUs;
+    event.sequence = sequence;
+    event.type = type;
+    event.channel = channel;
+    event.state = state;
+    event.clientIp = clientIp;
+    event.value = value;
+    event.requestId[0] = '\0';
+    if (requestId) {
+        strncpy(event.requestId, requestId, REQUEST_ID_TEXT - 1);
+        event.requestId[REQUEST_ID_TEXT - 1] = '\0';
+    }
+
+    slot.commit.store(sequence + 1, std::memory_order_release);
+    return sequence;
+}
+
+int EventLog::read(uint32_t& cursor, Event* out, int maxEvents, uint32_t* lost) const {
+    uint32_t head = this->head();
+    uint32_t skipped = 0;
+    if ((int32_t)(head - cursor) < 0) {
+        // The oldest slot may be claimed by the next record()
+        cursor = head >= CAPACITY ? head - CAPACITY + 1 : 0;
+    } else if (head - cursor > CAPACITY) {
+        skipped = head - cursor - CAPACITY;
+        cursor = head - CAPACITY;
+    }
+
+    int count = 0;
+    while (count < maxEvents && cursor != head) {
+        const Slot& slot = _slots[cursor & (CAPACITY - 1)];
+        if (slot.commit.load(std::memory_order_acquire) != cursor + 1) {
+            // Either lapped by a later event or still being written; in the
+            // second case the next read picks it up
+            uint32_t now = this->head();
+            if (now - cursor > CAPACITY) {
+                skipped += now - cursor - CAPACITY;
+                cursor = now - CAPACITY;
+                head = now;
+                continue;
+            }
+            break;
+        }
+
+        out[count] = slot.event;
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // Rewritten while we were copying
+        if (slot.commit.load(std::memory_order_relaxed) != cursor + 1) {
+            skipped++;
+            cursor++;
+            continue;
+        }
+        count++;
+        cursor++;
+    }
+
+    if (lost) {
+        *lost = skipped;
+    }
+    return count;
+}
+
+void EventLog::mirror() {
+#if MCP_EVENT_LOG_SD
+    if (_mirror_cursor == head()) {
+        return;
+    }
+
+    File file = SD.open("/events.log", FILE_APPEND, true);
+    if (!file) {
+        return;
+    }
+
+    // One line per event: sequence, timestamp, type, channel, state, value, client, id
+    Event events[16];
+    uint32_t lost = 0;
+    int count;
+    while ((count = read(_mirror_cursor, events, 16, &lost)) > 0 || lost > 0) {
+        if (lost > 0) {
+            file.printf("# lost %u\n", (unsigned)lost);
+        }
+        for (int i = 0; i < count; i++) {
+            const Event& event = events[i];
+            file.printf("%u,%llu,%s,%u,%u,%.4g,%u.%u.%u.%u,%s\n", (unsigned)event.sequence,
+                        (unsigned long long)event.timestampUs, typeName(event.type), event.channel, event.state,
+                        event.value, (unsigned)(event.clientIp & 0xFF), (unsigned)((event.clientIp >> 8) & 0xFF),
+                        (unsigned)((event.clientIp >> 16) & 0xFF), (unsigned)(event.clientIp >> 24),
+                        event.requestId);
+        }
+    }
+    file.close();
+#endif
+}
+
+const char* EventLog::typeName(Type type) {
+    switch (type) {
+        case TYPE_INPUT_EDGE:  return "input";
+        case TYPE_RELAY_WRITE: return "relay";
+        case TYPE_ALARM:       return "alarm";
+        case TYPE_LIMIT:       return "limit";
+        case TYPE_ANOMALY:     return "anomaly";
+        case TYPE_INTERLOCK:   return "interlock";
+        default:               return "unknown";
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+
+// Events kept in RAM; must be a power of two
+#ifndef MCP_EVENT_LOG_CAPACITY
+#define MCP_EVENT_LOG_CAPACITY 256
+#endif
+
+// Append every event to /events.log on the SD card as well
+#ifndef MCP_EVENT_LOG_SD
+#define MCP_EVENT_LOG_SD 0
+#endif
+
+/*
+ * Sequence-of-events recorder.
+ *
+ * Input edges (sampler task), relay writes and interlock refusals, alarm
+ * transitions and limit crossings (scan task) all go into one ring,
+ * numbered in the order they were recorded and stamped with esp_timer
+ * microseconds. Writers claim a sequence with one atomic add and publish
+ * the slot by storing its sequence last, so no writer ever blocks another;
+ * readers copy a slot and check that its sequence did not change
+ * underneath them.
+ *
+ * An input edge is stamped with its first sample at the new level, so it is
+ * recorded up to the debounce time after that stamp and can follow events
+ * with later timestamps by as much.
+ *
+ * Readers keep their own cursor like EdgeRing readers; one that falls more
+ * than CAPACITY events behind loses the oldest and is told how many, and
+ * one ahead of the ring restarts at the oldest event still stored.
+ */
+class EventLog {
+public:
+    static constexpr uint32_t CAPACITY = MCP_EVENT_LOG_CAPACITY;
+    static constexpr int REQUEST_ID_TEXT = 16;
+
+    enum Type : uint8_t {
+        TYPE_INPUT_EDGE = 0,    // channel = input, state = level
+        TYPE_RELAY_WRITE,       // channel = relay, state = level, with the requester
+        TYPE_ALARM,             // channel = alarm id, state = AlarmManager::State
+        TYPE_LIMIT,             // channel = alarm id, state = 1 crossed into / 0 back out of the limit
+        TYPE_ANOMALY,           // channel = AnomalyDetector::Series, state = raised
+        TYPE_INTERLOCK,         // channel = relay, state = level refused, value = RelayInterlock::Reason,
+                                // with the requester
+        TYPE_COUNT
+    };
+
+    struct Event {
+        uint64_t timestampUs;
+        uint32_t sequence;
+        Type type;
+        uint8_t channel;
+        uint8_t state;
+        uint32_t clientIp;      // Relay writes and refusals from a request, else 0
+        float value;
+        char requestId[REQUEST_ID_TEXT];    // JSON-RPC id as text, may be truncated
+    };
+
+    // Any task; returns the sequence the event got
+    uint32_t record(Type type, uint8_t channel, uint8_t state, float value, uint64_t timestampUs,
+                    uint32_t clientIp = 0, const char* requestId = nullptr);
+
+    // Sequence the next event will get
+    uint32_t head() const {
+        return _reserve.load(std::memory_order_acquire);
+    }
+
+    // Copies up to maxEvents events starting at cursor and advances it. Stops
+    // early at an event that is still being written.
+    int read(uint32_t& cursor, Event* out, int maxEvents, uint32_t* lost = nullptr) const;
+
+    // Appends events recorded since the last call to the SD card; call from
+    // the loop task. Does nothing unless built with MCP_EVENT_LOG_SD.
+    void mirror();
+
+    static const char* typeName(Type type);
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> commit{0};    // sequence + 1 once written, 0 while writing
+        Event event;
+    };
+
+    Slot _slots[CAPACITY];
+    std::atomic<uint32_t> _reserve{0};
+    uint32_t _mirror_cursor = 0;            // Loop task only
+};
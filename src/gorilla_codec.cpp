@@ -0,0 +1,166 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "gorilla_codec.h"
+#include <string.h>
+
+static uint32_t floatBits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static float bitsFloat(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void GorillaEncoder::begin(uint8_t* data, size_t bytes) {
+    _data = data;
+    _capacity = bytes * 8;
+    _bits = 0;
+    _count = 0;
+    _prev_delta = 0;
+    _prev_leading = 0xFF;
+    memset(data, 0, bytes);
+}
+
+bool GorillaEncoder::append(uint32_t t, float value) {
+    if (_bits + MAX_SAMPLE_BITS > _capacity || _count == UINT16_MAX) {
+        return false;
+    }
+
+    uint32_t valueBits = floatBits(value);
+    if (_count == 0) {
+        write(t, 32);
+        write(valueBits, 32);
+    } else {
+        // Timestamp: delta of delta in the smallest bucket that holds it
+        int32_t delta = (int32_t)(t - _prev_t);
+        int32_t dod = delta - _prev_delta;
+        if (dod == 0) {
+            write(0, 1);
+        } else if (dod >= -63 && dod <= 64) {
+            write(0b10, 2);
+            write(dod + 63, 7);
+        } else if (dod >= -255 && dod <= 256) {
+            write(0b110, 3);
+            write(dod + 255, 9);
+        } else if (dod >= -2047 && dod <= 2048) {
+            write(0b1110, 4);
+            write(dod + 2047, 12);
+        } else {
+            write(0b1111, 4);
+            write((uint32_t)dod, 32);
+        }
+        _prev_delta = delta;
+
+        // Value: XOR with the previous one, reusing its window if it fits
+        uint32_t x = valueBits ^ _prev_value;
+        if (x == 0) {
+            write(0, 1);
+        } else {
+            uint8_t leading = __builtin_clz(x);
+            uint8_t trailing = __builtin_ctz(x);
+            if (leading > 31) {
+                leading = 31;
+            }
+            if (_prev_leading != 0xFF && leading >= _prev_leading && trailing >= _prev_trailing) {
+                write(0b10, 2);
+                write(x >> _prev_trailing, 32 - _prev_leading - _prev_trailing);
+            } else {
+                uint8_t length = 32 - leading - trailing;
+                write(0b11, 2);
+                write(leading, 5);
+                write(length - 1, 5);
+                write(x >> trailing, length);
+                _prev_leading = leading;
+                _prev_trailing = trailing;
+            }
+        }
+    }
+
+    _prev_t = t;
+    _prev_value = valueBits;
+    _count++;
+    return true;
+}
+
+void GorillaEncoder::write(uint32_t value, uint8_t bits) {
+    // MSB first; the block was zeroed, so only ones need setting
+    for (int i = bits - 1; i >= 0; i--) {
+        if (value & (1UL << i)) {
+            _data[_bits >> 3] |= 0x80 >> (_bits & 7);
+        }
+        _bits++;
+    }
+}
+
+void GorillaDecoder::begin(const uint8_t* data, uint32_t bits, uint16_t count) {
+    _data = data;
+    _bits = bits;
+    _position = 0;
+    _remaining = count;
+    _first = true;
+    _prev_delta = 0;
+}
+
+bool GorillaDecoder::next(uint32_t& t, float& value) {
+    if (_remaining == 0) {
+        return false;
+    }
+    _remaining--;
+
+    if (_first) {
+        _first = false;
+        _prev_t = read(32);
+        _prev_value = read(32);
+        t = _prev_t;
+        value = bitsFloat(_prev_value);
+        return true;
+    }
+
+    int32_t dod;
+    if (read(1) == 0) {
+        dod = 0;
+    } else if (read(1) == 0) {
+        dod = (int32_t)read(7) - 63;
+    } else if (read(1) == 0) {
+        dod = (int32_t)read(9) - 255;
+    } else if (read(1) == 0) {
+        dod = (int32_t)read(12) - 2047;
+    } else {
+        dod = (int32_t)read(32);
+    }
+    _prev_delta += dod;
+    _prev_t += _prev_delta;
+
+    if (read(1) == 1) {
+        uint32_t x;
+        if (read(1) == 0) {
+            x = read(32 - _prev_leading - _prev_trailing) << _prev_trailing;
+        } else {
+            _prev_leading = read(5);
+            uint8_t length = read(5) + 1;
+            _prev_trailing = 32 - _prev_leading - length;
+            x = read(length) << _prev_trailing;
+        }
+        _prev_value ^= x;
+    }
+
+    t = _prev_t;
+    value = bitsFloat(_prev_value);
+    return true;
+}
+
+uint32_t GorillaDecoder::read(uint8_t bits) {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < bits && _position < _bits; i++) {
+        value = (value << 1) | ((_data[_position >> 3] >> (7 - (_position & 7))) & 1);
+        _position++;
+    }
+    return value;
+}
@@ -0,0 +1,71 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+
+/*
+ * Gorilla-style compression of (timestamp, float) samples.
+ *
+ * Timestamps are stored as delta-of-delta with variable-length prefixes, so
+ * a series sampled on a fixed period costs one bit per timestamp. Values are
+ * XORed with their predecessor; an unchanged value costs one bit and small
+ * changes reuse the previous window of meaningful bits. The first sample of
+ * a block is stored verbatim, so every block decodes on its own.
+ */
+class GorillaEncoder {
+public:
+    // Worst case: 4 + 32 timestamp bits, 2 + 5 + 5 + 32 value bits
+    static constexpr uint32_t MAX_SAMPLE_BITS = 80;
+
+    // Start a block in data; the first sample costs 64 bits
+    void begin(uint8_t* data, size_t bytes);
+
+    // False (and nothing written) if the block has no room for the sample
+    bool append(uint32_t t, float value);
+
+    uint32_t bits() const {
+        return _bits;
+    }
+
+    uint16_t count() const {
+        return _count;
+    }
+
+private:
+    uint8_t* _data         = nullptr;
+    uint32_t _capacity     = 0;     // In bits
+    uint32_t _bits         = 0;
+    uint16_t _count        = 0;
+    uint32_t _prev_t       = 0;
+    int32_t _prev_delta    = 0;
+    uint32_t _prev_value   = 0;
+    uint8_t _prev_leading  = 0xFF;  // 0xFF = no window yet
+    uint8_t _prev_trailing = 0;
+
+    void write(uint32_t value, uint8_t bits);
+};
+
+class GorillaDecoder {
+public:
+    void begin(const uint8_t* data, uint32_t bits, uint16_t count);
+
+    // Next sample in time order; false at the end of the block
+    bool next(uint32_t& t, float& value);
+
+private:
+    const uint8_t* _data   = nullptr;
+    uint32_t _bits         = 0;
+    uint32_t _position     = 0;
+    uint16_t _remaining    = 0;
+    bool _first            = true;
+    uint32_t _prev_t       = 0;
+    int32_t _prev_delta    = 0;
+    uint32_t _prev_value   = 0;
+    uint8_t _prev_leading  = 0;
+    uint8_t _prev_trailing = 0;
+
+    uint32_t read(uint8_t bits);
+};
@@ -0,0 +1,647 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "history_store.h"
+#include "esp_heap_caps.h"
+#include <math.h>
+#include <string.h>
+
+// Share of each series' budget per resolution, in percent
+static const uint8_t RESOLUTION_SHARE[HistoryStore::RESOLUTION_COUNT] = {30, 30, 25, 15};
+
+// Bins of the value histogram stats() reads percentiles from
+static const int HISTOGRAM_BINS = 128;
+
+// Merges a (count, mean, m2) summary into another (Chan et al.)
+static void mergeMoments(uint32_t& count, double& mean, double& m2, uint32_t otherCount, double otherMean,
+                         double otherM2) {
+    uint32_t total = count + otherCount;
+    if (total == 0) {
+        return;
+    }
+    double delta = otherMean - mean;
+    mean += delta * otherCount / total;
+    m2 += otherM2 + delta * delta * ((double)count * otherCount / total);
+    count = total;
+}
+
+HistoryStore::HistoryStore() {}
+
+HistoryStore::~HistoryStore() {
+    if (_buffer) {
+        heap_caps_free(_buffer);
+    }
+}
+
+bool HistoryStore::begin() {
+    _psram = psramFound();
+    size_t budget = _psram ? MCP_HISTORY_PSRAM_BYTES : MCP_HISTORY_BYTES;
+    size_t perSeries = budget / SERIES_COUNT;
+
+    // Size every ring from the budget, then carve them out of one block
+    size_t total = 0;
+    for (int s = 0; s < SERIES_COUNT; s++) {
+        for (int r = 0; r < RESOLUTION_COUNT; r++) {
+            size_t entrySize = r == RESOLUTION_RAW ? sizeof(Block) : sizeof(Point);
+            _rings[s][r].capacity = perSeries * RESOLUTION_SHARE[r] / 100 / entrySize;
+            if (_rings[s][r].capacity == 0) {
+                _rings[s][r].capacity = 1;
+            }
+            total += _rings[s][r].capacity * entrySize;
+        }
+    }
+
+    uint32_t caps = _psram ? MALLOC_CAP_SPIRAM : (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    _buffer = static_cast<uint8_t*>(heap_caps_malloc(total, caps));
+    if (!_buffer) {
+        return false;
+    }
+    _bytes = total;
+
+    uint8_t* next = _buffer;
+    for (int s = 0; s < SERIES_COUNT; s++) {
+        for (int r = 0; r < RESOLUTION_COUNT; r++) {
+            size_t entrySize = r == RESOLUTION_RAW ? sizeof(Block) : sizeof(Point);
+            _rings[s][r].data = next;
+            next += _rings[s][r].capacity * entrySize;
+        }
+    }
+    return true;
+}
+
+void HistoryStore::onScan(void* context, const IOSnapshot& previous, const IOSnapshot& current) {
+    static_cast<HistoryStore*>(context)->record(current);
+}
+
+void HistoryStore::record(const IOSnapshot& snapshot) {
+    // Snap to the sensor period so steady sampling has a constant delta;
+    // one sample per period
+    uint32_t slot = snapshot.sensorTimestamp - snapshot.sensorTimestamp % IOScanner::SENSOR_SCAN_INTERVAL_MS;
+    if (!_buffer || slot == _last_slot) {
+        return;
+    }
+    _last_slot = slot;
+
+    for (int s = 0; s < SERIES_COUNT; s++) {
+        Series series = static_cast<Series>(s);
+        float value = valueOf(series, snapshot);
+
+        portENTER_CRITICAL(&_lock);
+        append(series, slot, value);
+        fold(series, RESOLUTION_SECOND, sampleOf(series, slot, value));
+        portEXIT_CRITICAL(&_lock);
+    }
+}
+
+void HistoryStore::append(Series series, uint32_t t, float value) {
+    Ring& ring = _rings[series][RESOLUTION_RAW];
+    GorillaEncoder& encoder = _encoders[series];
+
+    // Open a new block (overwriting the oldest) when the current one is full
+    if (ring.count == 0 || !encoder.append(t, value)) {
+        Block& block = reinterpret_cast<Block*>(ring.data)[ring.head];
+        ring.head = (ring.head + 1) % ring.capacity;
+        if (ring.count < ring.capacity) {
+            ring.count++;
+        }
+        block.firstT = t;
+        block.min = value;
+        block.max = value;
+        encoder.begin(block.data, sizeof(block.data));
+        encoder.append(t, value);
+    }
+
+    Block& block = blockAt(ring, ring.count - 1);
+    block.lastT = t;
+    block.bits = encoder.bits();
+    block.count = encoder.count();
+    if (isDigital(series)) {
+        block.min = (float)((uint32_t)block.min & (uint32_t)value);
+        block.max = (float)((uint32_t)block.max | (uint32_t)value);
+    } else {
+        block.min = value < block.min ? value : block.min;
+        block.max = value > block.max ? value : block.max;
+    }
+}
+
+void HistoryStore::fold(Series series, int resolution, const Point& point) {
+    uint32_t period = periodMs(static_cast<Resolution>(resolution));
+    uint32_t start = point.t - point.t % period;
+    Accumulator& acc = _accumulators[series][resolution];
+    bool digital = isDigital(series);
+
+    // A sample from a later bucket closes the current one and rolls it up
+    if (acc.open && start != acc.start) {
+        Point bucket = {};
+        bucket.t = acc.start;
+        bucket.min = acc.min;
+        bucket.max = acc.max;
+        bucket.count = acc.count;
+        if (digital) {
+            for (int c = 0; c < 8; c++) {
+                bucket.duty[c] = (uint8_t)(acc.on[c] * 255 / acc.count + 0.5f);
+            }
+        } else {
+            bucket.avg = (float)acc.mean;
+            bucket.m2 = (float)acc.m2;
+        }
+
+        Ring& ring = _rings[series][resolution];
+        reinterpret_cast<Point*>(ring.data)[ring.head] = bucket;
+        ring.head = (ring.head + 1) % ring.capacity;
+        if (ring.count < ring.capacity) {
+            ring.count++;
+        }
+        if (resolution + 1 < RESOLUTION_COUNT) {
+            fold(series, resolution + 1, bucket);
+        }
+        acc.open = false;
+    }
+
+    if (!acc.open) {
+        acc = {};
+        acc.open = true;
+        acc.start = start;
+        acc.min = point.min;
+        acc.max = point.max;
+    } else if (digital) {
+        acc.min = (float)((uint32_t)acc.min & (uint32_t)point.min);
+        acc.max = (float)((uint32_t)acc.max | (uint32_t)point.max);
+    } else {
+        acc.min = point.min < acc.min ? point.min : acc.min;
+        acc.max = point.max > acc.max ? point.max : acc.max;
+    }
+
+    if (digital) {
+        for (int c = 0; c < 8; c++) {
+            acc.on[c] += point.duty[c] * point.count / 255.0f;
+        }
+        acc.count += point.count;
+    } else {
+        mergeMoments(acc.count, acc.mean, acc.m2, point.count, point.avg, point.m2);
+    }
+}
+
+HistoryStore::Block& HistoryStore::blockAt(const Ring& ring, uint32_t index) const {
+    uint32_t physical = (ring.head + ring.capacity - ring.count + index) % ring.capacity;
+    return reinterpret_cast<Block*>(ring.data)[physical];
+}
+
+HistoryStore::Point HistoryStore::pointAt(const Ring& ring, uint32_t index) const {
+    uint32_t physical = (ring.head + ring.capacity - ring.count + index) % ring.capacity;
+    return reinterpret_cast<const Point*>(ring.data)[physical];
+}
+
+uint32_t HistoryStore::firstAtOrAfter(const Ring& ring, uint32_t t) const {
+    // Buckets are in time order, so binary search the logical index
+    uint32_t low = 0;
+    uint32_t high = ring.count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if ((int32_t)(pointAt(ring, mid).t - t) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+uint32_t HistoryStore::firstBlockEndingAtOrAfter(const Ring& ring, uint32_t t) const {
+    uint32_t low = 0;
+    uint32_t high = ring.count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if ((int32_t)(blockAt(ring, mid).lastT - t) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+uint32_t HistoryStore::oldestTime(const Ring& ring, int resolution) const {
+    if (ring.count == 0) {
+        return 0;
+    }
+    return resolution == RESOLUTION_RAW ? blockAt(ring, 0).firstT : pointAt(ring, 0).t;
+}
+
+int HistoryStore::query(Series series, Resolution resolution, uint32_t from, uint32_t to, Point* out, int maxPoints,
+                        bool* more) {
+    int count = 0;
+    if (more) {
+        *more = false;
+    }
+    if (!_buffer) {
+        return 0;
+    }
+    if (resolution == RESOLUTION_RAW) {
+        return queryRaw(series, from, to, out, maxPoints, more);
+    }
+
+    portENTER_CRITICAL(&_lock);
+    const Ring& ring = _rings[series][resolution];
+    for (uint32_t i = firstAtOrAfter(ring, from); i < ring.count; i++) {
+        Point point = pointAt(ring, i);
+        if ((int32_t)(point.t - to) > 0) {
+            break;
+        }
+        if (count == maxPoints) {
+            if (more) {
+                *more = true;
+            }
+            break;
+        }
+        out[count++] = point;
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    return count;
+}
+
+int HistoryStore::queryRaw(Series series, uint32_t from, uint32_t to, Point* out, int maxPoints, bool* more) {
+    const Ring& ring = _rings[series][RESOLUTION_RAW];
+    uint32_t cursor = from;
+    int count = 0;
+    Block block;
+
+    while (true) {
+        // Copy the block so the decoding runs outside the lock; headers
+        // alone rule out blocks that end before the cursor
+        portENTER_CRITICAL(&_lock);
+        uint32_t index = firstBlockEndingAtOrAfter(ring, cursor);
+        bool found = index < ring.count;
+        if (found) {
+            block = blockAt(ring, index);
+        }
+        portEXIT_CRITICAL(&_lock);
+
+        if (!found || (int32_t)(block.firstT - to) > 0) {
+            return count;
+        }
+
+        GorillaDecoder decoder;
+        decoder.begin(block.data, block.bits, block.count);
+        uint32_t t;
+        float value;
+        while (decoder.next(t, value)) {
+            if ((int32_t)(t - cursor) < 0) {
+                continue;
+            }
+            if ((int32_t)(t - to) > 0) {
+                return count;
+            }
+            if (count == maxPoints) {
+                if (more) {
+                    *more = true;
+                }
+                return count;
+            }
+            out[count++] = sampleOf(series, t, value);
+        }
+        cursor = block.lastT + 1;
+    }
+}
+
+HistoryStore::Resolution HistoryStore::finestCovering(Series series, uint32_t from) {
+    Resolution finest = RESOLUTION_RAW;
+    bool any = false;
+    uint32_t earliest = 0;
+
+    // Without a tier that reaches back to from (a window starting before
+    // boot, or before anything was kept), the finest one holding the
+    // earliest data
+    portENTER_CRITICAL(&_lock);
+    for (int r = 0; r < RESOLUTION_COUNT; r++) {
+        const Ring& ring = _rings[series][r];
+        if (ring.count == 0) {
+            continue;
+        }
+        uint32_t oldest = oldestTime(ring, r);
+        if ((int32_t)(oldest - from) <= 0) {
+            finest = static_cast<Resolution>(r);
+            break;
+        }
+        if (!any || (int32_t)(oldest - earliest) < 0) {
+            finest = static_cast<Resolution>(r);
+            earliest = oldest;
+            any = true;
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    return finest;
+}
+
+bool HistoryStore::stats(Series series, int channel, uint32_t from, uint32_t to, float threshold, const float* ranks,
+                         int rankCount, Stats& out) {
+    out = {};
+    if (!_buffer || (int32_t)(to - from) < 0) {
+        return false;
+    }
+
+    // Read the window from the finest tier that reaches back to from and
+    // keeps the visit within budget; only its partial edges go finer
+    uint32_t span = to - from;
+    int top = finestCovering(series, from);
+    while (top < RESOLUTION_HOUR) {
+        uint32_t period = top == RESOLUTION_RAW ? IOScanner::SENSOR_SCAN_INTERVAL_MS
+                                                : periodMs(static_cast<Resolution>(top));
+        if (span / period <= MCP_STATS_MAX_UNITS) {
+            break;
+        }
+        top++;
+    }
+    out.resolution = static_cast<Resolution>(top);
+
+    // First pass: extremes, moments, integral and time above threshold
+    struct Moments {
+        Stats* out;
+        bool digital;
+        float threshold;
+        uint32_t count;
+        double mean;
+        double m2;
+    } moments = {&out, isDigital(series), threshold, 0, 0, 0};
+
+    visit(series, channel, top, from, to, [](void* context, const Unit& unit) {
+        Moments& moments = *static_cast<Moments*>(context);
+        Stats& stats = *moments.out;
+        if (moments.count == 0) {
+            stats.min = unit.min;
+            stats.max = unit.max;
+        } else {
+            stats.min = unit.min < stats.min ? unit.min : stats.min;
+            stats.max = unit.max > stats.max ? unit.max : stats.max;
+        }
+        mergeMoments(moments.count, moments.mean, moments.m2, unit.count, unit.mean, unit.m2);
+
+        double seconds = unit.count * (IOScanner::SENSOR_SCAN_INTERVAL_MS / 1000.0);
+        stats.integral += unit.mean * seconds;
+        if (unit.min > moments.threshold) {
+            stats.secondsAbove += seconds;
+        } else if (unit.max > moments.threshold) {
+            // A 0/1 channel was above for its duty; of an analog bucket only
+            // the range is known, so assume its values spread evenly over it
+            stats.secondsAbove += moments.digital ? seconds * unit.mean
+                                                  : seconds * (unit.max - moments.threshold) / (unit.max - unit.min);
+        }
+        if (unit.count > 1) {
+            stats.approximate = true;
+        }
+    }, &moments);
+
+    if (moments.count == 0) {
+        return false;
+    }
+    out.samples = moments.count;
+    out.mean = (float)moments.mean;
+    out.stddev = (float)sqrt(moments.m2 / moments.count);
+
+    if (rankCount <= 0) {
+        return true;
+    }
+
+    // Second pass: histogram over [min, max]; a bucket counts at its average
+    struct Histogram {
+        float low;
+        float width;
+        uint32_t total;
+        uint32_t bins[HISTOGRAM_BINS];
+    } histogram = {out.min, (out.max - out.min) / HISTOGRAM_BINS, 0, {}};
+
+    visit(series, channel, top, from, to, [](void* context, const Unit& unit) {
+        Histogram& histogram = *static_cast<Histogram*>(context);
+        int bin = histogram.width > 0 ? (int)((unit.mean - histogram.low) / histogram.width) : 0;
+        bin = bin < 0 ? 0 : (bin >= HISTOGRAM_BINS ? HISTOGRAM_BINS - 1 : bin);
+        histogram.bins[bin] += unit.count;
+        histogram.total += unit.count;
+    }, &histogram);
+
+    for (int i = 0; i < rankCount && i < MAX_PERCENTILES; i++) {
+        double target = ranks[i] / 100.0 * histogram.total;
+        double below = 0;
+        float value = out.max;
+        for (int bin = 0; bin < HISTOGRAM_BINS; bin++) {
+            if (histogram.bins[bin] > 0 && below + histogram.bins[bin] >= target) {
+                double fraction = (target - below) / histogram.bins[bin];
+                value = histogram.low + histogram.width * (float)(bin + fraction);
+                break;
+            }
+            below += histogram.bins[bin];
+        }
+        out.percentiles[i] = value < out.min ? out.min : (value > out.max ? out.max : value);
+    }
+
+    return true;
+}
+
+void HistoryStore::visit(Series series, int channel, int resolution, uint32_t from, uint32_t to,
+                         UnitVisitor visitor, void* context) {
+    if ((int32_t)(to - from) < 0) {
+        return;
+    }
+    if (resolution == RESOLUTION_RAW) {
+        visitRaw(series, channel, from, to, visitor, context);
+        return;
+    }
+
+    // Whole buckets inside the window, looked up by time so that record()
+    // moving the ring in between cannot skip or repeat one
+    const Ring& ring = _rings[series][resolution];
+    uint32_t period = periodMs(static_cast<Resolution>(resolution));
+    uint32_t first = 0;
+    uint32_t end = 0;
+    bool any = false;
+    uint32_t cursor = from;
+    while (true) {
+        Point point = {};
+        portENTER_CRITICAL(&_lock);
+        uint32_t index = firstAtOrAfter(ring, cursor);
+        bool found = index < ring.count;
+        if (found) {
+            point = pointAt(ring, index);
+        }
+        portEXIT_CRITICAL(&_lock);
+
+        if (!found || (int32_t)(point.t + period - 1 - to) > 0) {
+            break;
+        }
+        if (!any) {
+            first = point.t;
+            any = true;
+        }
+        end = point.t + period;
+        visitor(context, unitOf(series, channel, point));
+        cursor = end;
+    }
+
+    // Partial buckets at either edge come from the next finer tier
+    if (!any) {
+        visit(series, channel, resolution - 1, from, to, visitor, context);
+        return;
+    }
+    if ((int32_t)(first - from) > 0) {
+        visit(series, channel, resolution - 1, from, first - 1, visitor, context);
+    }
+    visit(series, channel, resolution - 1, end, to, visitor, context);
+}
+
+void HistoryStore::visitRaw(Series series, int channel, uint32_t from, uint32_t to, UnitVisitor visitor,
+                            void* context) {
+    const Ring& ring = _rings[series][RESOLUTION_RAW];
+    uint32_t cursor = from;
+    Block block;
+
+    while (true) {
+        // Copy the block so the decoding runs outside the lock
+        portENTER_CRITICAL(&_lock);
+        uint32_t index = firstBlockEndingAtOrAfter(ring, cursor);
+        bool found = index < ring.count;
+        if (found) {
+            block = blockAt(ring, index);
+        }
+        portEXIT_CRITICAL(&_lock);
+
+        if (!found || (int32_t)(block.firstT - to) > 0) {
+            return;
+        }
+
+        GorillaDecoder decoder;
+        decoder.begin(block.data, block.bits, block.count);
+        uint32_t t;
+        float value;
+        while (decoder.next(t, value)) {
+            if ((int32_t)(t - cursor) < 0) {
+                continue;
+            }
+            if ((int32_t)(t - to) > 0) {
+                return;
+            }
+            visitor(context, unitOf(series, channel, sampleOf(series, t, value)));
+        }
+        cursor = block.lastT + 1;
+    }
+}
+
+HistoryStore::Point HistoryStore::sampleOf(Series series, uint32_t t, float value) {
+    Point point = {};
+    point.t = t;
+    point.min = value;
+    point.max = value;
+    point.count = 1;
+    if (isDigital(series)) {
+        for (int c = 0; c < 8; c++) {
+            point.duty[c] = ((uint32_t)value >> c) & 1 ? 255 : 0;
+        }
+    } else {
+        point.avg = value;
+    }
+    return point;
+}
+
+HistoryStore::Unit HistoryStore::unitOf(Series series, int channel, const Point& point) {
+    if (!isDigital(series)) {
+        return {point.min, point.max, point.avg, point.m2, point.count};
+    }
+
+    uint32_t bit = 1UL << channel;
+    if ((uint32_t)point.min & bit) {
+        return {1, 1, 1, 0, point.count};
+    }
+    if (!((uint32_t)point.max & bit)) {
+        return {0, 0, 0, 0, point.count};
+    }
+    // On for part of the bucket: a 0/1 value with mean d has m2 = n d (1 - d)
+    float duty = point.duty[channel] / 255.0f;
+    return {0, 1, duty, point.count * duty * (1 - duty), point.count};
+}
+
+HistoryStore::Info HistoryStore::info() {
+    Info info = {};
+    info.psram = _psram;
+    info.bytes = _bytes;
+
+    portENTER_CRITICAL(&_lock);
+    for (int r = 0; r < RESOLUTION_COUNT; r++) {
+        const Ring& ring = _rings[SERIES_TEMPERATURE][r];
+        info.capacity[r] = ring.capacity;
+        info.oldest[r] = oldestTime(ring, r);
+    }
+    for (int s = 0; s < SERIES_COUNT; s++) {
+        const Ring& ring = _rings[s][RESOLUTION_RAW];
+        for (uint32_t b = 0; b < ring.count; b++) {
+            const Block& block = blockAt(ring, b);
+            info.rawSamples[s] += block.count;
+            info.rawBits[s] += block.bits;
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    return info;
+}
+
+float HistoryStore::valueOf(Series series, const IOSnapshot& snapshot) {
+    switch (series) {
+        case SERIES_TEMPERATURE: return snapshot.temperature;
+        case SERIES_VOLTAGE:     return snapshot.voltage;
+        case SERIES_CURRENT:     return snapshot.current;
+        case SERIES_INPUTS:      return snapshot.inputs;
+        case SERIES_RELAYS:      return snapshot.relays;
+        default:                 return 0;
+    }
+}
+
+uint32_t HistoryStore::periodMs(Resolution resolution) {
+    switch (resolution) {
+        case RESOLUTION_SECOND: return 1000;
+        case RESOLUTION_MINUTE: return 60000;
+        case RESOLUTION_HOUR:   return 3600000;
+        default:                return 0;
+    }
+}
+
+const char* HistoryStore::seriesName(Series series) {
+    switch (series) {
+        case SERIES_TEMPERATURE: return "temperature";
+        case SERIES_VOLTAGE:     return "voltage";
+        case SERIES_CURRENT:     return "current";
+        case SERIES_INPUTS:      return "inputs";
+        case SERIES_RELAYS:      return "relays";
+        default:                 return "unknown";
+    }
+}
+
+const char* HistoryStore::resolutionName(Resolution resolution) {
+    switch (resolution) {
+        case RESOLUTION_RAW:    return "raw";
+        case RESOLUTION_SECOND: return "1s";
+        case RESOLUTION_MINUTE: return "1m";
+        case RESOLUTION_HOUR:   return "1h";
+        default:                return "unknown";
+    }
+}
+
+bool HistoryStore::parseSeries(const char* name, Series& series) {
+    for (int s = 0; s < SERIES_COUNT; s++) {
+        if (strcmp(name, seriesName(static_cast<Series>(s))) == 0) {
+            series = static_cast<Series>(s);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HistoryStore::parseResolution(const char* name, Resolution& resolution) {
+    for (int r = 0; r < RESOLUTION_COUNT; r++) {
+        if (strcmp(name, resolutionName(static_cast<Resolution>(r))) == 0) {
+            resolution = static_cast<Resolution>(r);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,214 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include "io_scanner.h"
+#include "gorilla_codec.h"
+
+// Memory budget of the history store, allocated once in begin()
+#ifndef MCP_HISTORY_BYTES
+#define MCP_HISTORY_BYTES (32 * 1024)
+#endif
+#ifndef MCP_HISTORY_PSRAM_BYTES
+#define MCP_HISTORY_PSRAM_BYTES (1024 * 1024)
+#endif
+// Most samples or buckets one stats() pass may visit
+#ifndef MCP_STATS_MAX_UNITS
+#define MCP_STATS_MAX_UNITS 4096
+#endif
+
+/*
+ * Time-series history of the sensors and I/O states in a fixed budget.
+ *
+ * Every sensor scan appends one raw sample per series and folds it into
+ * 1 s buckets, which roll up into 1 min and then 1 h buckets as they close.
+ * Each resolution is a ring sized from the budget, so the coarse tiers
+ * reach back much further than the raw samples. The buffer comes from
+ * PSRAM when the board has it and from internal RAM otherwise.
+ *
+ * Raw samples are Gorilla-compressed into fixed-size blocks. Sample times
+ * are snapped to the sensor period so steady sampling costs one bit per
+ * timestamp, and a value that did not change costs one more. Each block
+ * header carries its time range and min/max, so a range query skips
+ * non-overlapping blocks and decodes the rest sample by sample, stopping
+ * as soon as it has what it needs.
+ *
+ * Analog series keep min/max/average, sample count and sum of squared
+ * deviations per bucket. The digital series store the input or relay
+ * bitmask; their buckets keep the channels that were on for the whole
+ * bucket (AND), at any point in it (OR), and for what share of it.
+ *
+ * stats() aggregates a window from those summaries: whole buckets of the
+ * coarsest useful tier cover the middle and only the partial edges descend
+ * to finer tiers, so a 24 h window reads about 1440 minute buckets and a
+ * few raw samples instead of 864000 samples.
+ *
+ * Timestamps are millis() since boot. record() runs on the scan task and
+ * query() on the worker; a spinlock guards the rings. Raw reads hold it
+ * for one block copy at a time and decode outside it, and stats() does the
+ * same for buckets.
+ */
+class HistoryStore {
+public:
+    enum Series : uint8_t {
+        SERIES_TEMPERATURE = 0,
+        SERIES_VOLTAGE,
+        SERIES_CURRENT,
+        SERIES_INPUTS,
+        SERIES_RELAYS,
+        SERIES_COUNT
+    };
+
+    enum Resolution : uint8_t {
+        RESOLUTION_RAW = 0,
+        RESOLUTION_SECOND,
+        RESOLUTION_MINUTE,
+        RESOLUTION_HOUR,
+        RESOLUTION_COUNT
+    };
+
+    // One raw sample (min = max = avg) or one closed bucket
+    struct Point {
+        uint32_t t;             // Sample time or bucket start
+        float min;              // Digital series: channels on throughout
+        float max;              // Digital series: channels on at any time
+        uint32_t count;         // Raw samples folded in
+        union {
+            struct {
+                float avg;
+                float m2;       // Sum of squared deviations from avg
+            };
+            uint8_t duty[8];    // Digital series: share of the bucket each channel was on, 0-255
+        };
+    };
+
+    static constexpr int MAX_PERCENTILES = 8;
+
+    struct Stats {
+        Resolution resolution;  // Coarsest tier the window was read from
+        uint32_t samples;       // Raw samples represented
+        float min;
+        float max;
+        float mean;
+        float stddev;
+        double integral;        // Value x seconds
+        float secondsAbove;     // Time above the threshold
+        bool approximate;       // Some values estimated from bucket summaries
+        float percentiles[MAX_PERCENTILES];
+    };
+
+    struct Info {
+        bool psram;
+        size_t bytes;
+        uint32_t capacity[RESOLUTION_COUNT];    // Raw: blocks, otherwise buckets
+        uint32_t oldest[RESOLUTION_COUNT];      // Oldest retained time of the temperature series
+        uint32_t rawSamples[SERIES_COUNT];
+        uint32_t rawBits[SERIES_COUNT];         // Compressed size of those samples
+    };
+
+    // Payload of one compressed raw block
+    static constexpr size_t BLOCK_BYTES = 128;
+
+    HistoryStore();
+    ~HistoryStore();
+
+    // Allocates the rings; false if the memory is not available
+    bool begin();
+
+    // Scan listener; records once per new sensor reading
+    static void onScan(void* context, const IOSnapshot& previous, const IOSnapshot& current);
+    void record(const IOSnapshot& snapshot);
+
+    // Points of one series with t in [from, to], oldest first. Returns the
+    // count; more is set if maxPoints cut the range short.
+    int query(Series series, Resolution resolution, uint32_t from, uint32_t to, Point* out, int maxPoints, bool* more);
+
+    // Finest resolution whose retention still reaches back to from, else
+    // the finest one holding the earliest data
+    Resolution finestCovering(Series series, uint32_t from);
+
+    // Aggregates of one series over [from, to]; channel selects the bit of a
+    // digital series, whose values are then 0/1. ranks are percentiles in
+    // 0-100. False if the window holds no data.
+    bool stats(Series series, int channel, uint32_t from, uint32_t to, float threshold, const float* ranks,
+               int rankCount, Stats& out);
+
+    Info info();
+
+    static bool isDigital(Series series) {
+        return series == SERIES_INPUTS || series == SERIES_RELAYS;
+    }
+
+    static uint32_t periodMs(Resolution resolution);
+    static const char* seriesName(Series series);
+    static const char* resolutionName(Resolution resolution);
+    static bool parseSeries(const char* name, Series& series);
+    static bool parseResolution(const char* name, Resolution& resolution);
+
+private:
+    struct Block {
+        uint32_t firstT;
+        uint32_t lastT;
+        uint32_t bits;
+        uint16_t count;
+        float min;              // Digital series: AND / OR of the masks
+        float max;
+        uint8_t data[BLOCK_BYTES];
+    };
+
+    struct Ring {
+        uint8_t* data;          // Block[] or Point[]
+        uint32_t capacity;
+        uint32_t head;          // Next write position
+        uint32_t count;
+    };
+
+    struct Accumulator {
+        bool open;
+        uint32_t start;
+        float min;
+        float max;
+        uint32_t count;
+        double mean;
+        double m2;
+        float on[8];            // Digital series: samples each channel was on
+    };
+
+    // A raw sample or bucket reduced to one channel, as seen by stats()
+    struct Unit {
+        float min;
+        float max;
+        float mean;
+        float m2;
+        uint32_t count;
+    };
+
+    typedef void (*UnitVisitor)(void* context, const Unit& unit);
+
+    uint8_t* _buffer = nullptr;
+    size_t _bytes    = 0;
+    bool _psram      = false;
+    Ring _rings[SERIES_COUNT][RESOLUTION_COUNT] = {};
+    Accumulator _accumulators[SERIES_COUNT][RESOLUTION_COUNT] = {};   // [RAW] unused
+    GorillaEncoder _encoders[SERIES_COUNT];     // Writing the newest raw block
+    uint32_t _last_slot = 0;
+    portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+
+    void append(Series series, uint32_t t, float value);
+    void fold(Series series, int resolution, const Point& point);
+    Block& blockAt(const Ring& ring, uint32_t index) const;
+    Point pointAt(const Ring& ring, uint32_t index) const;
+    uint32_t firstAtOrAfter(const Ring& ring, uint32_t t) const;
+    uint32_t firstBlockEndingAtOrAfter(const Ring& ring, uint32_t t) const;
+    uint32_t oldestTime(const Ring& ring, int resolution) const;
+    int queryRaw(Series series, uint32_t from, uint32_t to, Point* out, int maxPoints, bool* more);
+    void visit(Series series, int channel, int resolution, uint32_t from, uint32_t to, UnitVisitor visitor,
+               void* context);
+    void visitRaw(Series series, int channel, uint32_t from, uint32_t to, UnitVisitor visitor, void* context);
+    static Point sampleOf(Series series, uint32_t t, float value);
+    static Unit unitOf(Series series, int channel, const Point& point);
+    static float valueOf(Series series, const IOSnapshot& snapshot);
+};
@@ -0,0 +1,104 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "idempotency_cache.h"
+
+IdempotencyCache::IdempotencyCache() {}
+
+IdempotencyCache::Result IdempotencyCache::begin(uint32_t ip, uint32_t idHash, uint32_t contentHash, uint32_t now,
+                                                 int* entry, char* buffer, size_t size) {
+    Result result = MISS;
+    
+    portENTER_CRITICAL(&_lock);
+    _clock++;
+    
+    // Find the id, remembering a free or least recently used slot for a miss
+    int victim = -1;
+    int match = -1;
+    for (int i = 0; i < MAX_ENTRIES; i++) {
+        Entry& e = _entries[i];
+        if (e.used && !e.pending && now - e.created > MAX_AGE_MS) {
+            e.used = false;
+        }
+        if (e.used && e.ip == ip && e.idHash == idHash) {
+            match = i;
+        }
+        if (!e.used) {
+            if (victim < 0 || _entries[victim].used) {
+                victim = i;
+            }
+        } else if (!e.pending && (victim < 0 || (_entries[victim].used && e.lastUsed < _entries[victim].lastUsed))) {
+            victim = i;
+        }
+    }
+    
+    if (match >= 0 && _entries[match].contentHash == contentHash) {
+        Entry& e = _entries[match];
+        e.lastUsed = _clock;
+        if (e.pending) {
+            result = IN_PROGRESS;
+            _stats.inProgress++;
+        } else {
+            size_t length = e.length < size - 1 ? e.length : size - 1;
+            memcpy(buffer, e.response, length);
+            buffer[length] = '\0';
+            result = HIT;
+            _stats.hits++;
+        }
+    } else {
+        // Same id with different content means the id was reused: replace it
+        if (match >= 0 && !_entries[match].pending) {
+            victim = match;
+        }
+        
+        if (victim < 0) {
+            // Every entry is executing; run this one uncached
+            *entry = -1;
+        } else {
+            Entry& e = _entries[victim];
+            if (e.used && victim != match) {
+                _stats.evictions++;
+            }
+            e.ip = ip;
+            e.idHash = idHash;
+            e.contentHash = contentHash;
+            e.created = now;
+            e.lastUsed = _clock;
+            e.used = true;
+            e.pending = true;
+            e.length = 0;
+            *entry = victim;
+        }
+        _stats.misses++;
+    }
+    portEXIT_CRITICAL(&_lock);
+    
+    return result;
+}
+
+void IdempotencyCache::complete(int entry, const char* response, size_t length) {
+    if (entry < 0 || entry >= MAX_ENTRIES) {
+        return;
+    }
+    
+    portENTER_CRITICAL(&_lock);
+    Entry& e = _entries[entry];
+    if (response && length < MAX_RESPONSE) {
+        memcpy(e.response, response, length);
+        e.length = length;
+        e.pending = false;
+    } else {
+        e.used = false;
+        e.pending = false;
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+IdempotencyCache::Stats IdempotencyCache::stats() {
+    portENTER_CRITICAL(&_lock);
+    Stats copy = _stats;
+    portEXIT_CRITICAL(&_lock);
+    return copy;
+}
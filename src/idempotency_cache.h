@@ -0,0 +1,89 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+
+/*
+ * Recent responses to write requests, keyed by client IP and JSON-RPC id.
+ *
+ * A retry with the same id gets the stored response instead of running the
+ * handler again. Alongside the id the key carries a hash of method and params,
+ * so a client that restarts and reuses an id for a different call is not
+ * answered from the cache. Entries live in a fixed LRU table and expire after
+ * MAX_AGE_MS.
+ */
+class IdempotencyCache {
+public:
+    static constexpr int MAX_ENTRIES         = 8;
+    static constexpr size_t MAX_RESPONSE     = 384;
+    static constexpr uint32_t MAX_AGE_MS     = 30000;
+
+    enum Result {
+        MISS,           // Entry reserved; execute and call complete()
+        HIT,            // Stored response copied out
+        IN_PROGRESS     // The same request is still executing
+    };
+
+    struct Stats {
+        uint32_t hits;
+        uint32_t misses;
+        uint32_t inProgress;
+        uint32_t evictions;
+    };
+
+    IdempotencyCache();
+
+    // Look up a request. On MISS, *entry is the reserved slot to complete.
+    // On HIT, the response is copied into buffer (NUL terminated).
+    Result begin(uint32_t ip, uint32_t idHash, uint32_t contentHash, uint32_t now, int* entry, char* buffer,
+                 size_t size);
+
+    // Store the response for a reserved entry. Responses that do not fit are
+    // not cached and the entry is released.
+    void complete(int entry, const char* response, size_t length);
+
+    // Give up a reserved entry without a response (request never executed)
+    void release(int entry) { complete(entry, nullptr, 0); }
+
+    Stats stats();
+
+    // FNV-1a, usable as an ArduinoJson writer so documents hash without a buffer
+    class Hasher {
+    public:
+        size_t write(uint8_t c) {
+            _hash = (_hash ^ c) * 16777619u;
+            return 1;
+        }
+        size_t write(const uint8_t* s, size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                write(s[i]);
+            }
+            return n;
+        }
+        uint32_t value() const { return _hash; }
+
+    private:
+        uint32_t _hash = 2166136261u;
+    };
+
+private:
+    struct Entry {
+        uint32_t ip;
+        uint32_t idHash;
+        uint32_t contentHash;
+        uint32_t created;
+        uint32_t lastUsed;
+        bool used;
+        bool pending;
+        uint16_t length;
+        char response[MAX_RESPONSE];
+    };
+
+    Entry _entries[MAX_ENTRIES] = {};
+    Stats _stats                = {};
+    uint32_t _clock             = 0;
+    portMUX_TYPE _lock          = portMUX_INITIALIZER_UNLOCKED;
+};
@@ -0,0 +1,268 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "input_sampler.h"
+#include <M5Unified.h>
+#include <Preferences.h>
+
+// Same pins as the library's readPlcInput(): 4-7 on port 0, 12-15 on port 1
+const uint8_t InputSampler::INPUT_PINS[8] = {4, 5, 6, 7, 12, 13, 14, 15};
+
+InputSampler::InputSampler() {}
+
+InputSampler::~InputSampler() {
+    if (_timer) {
+        esp_timer_stop(_timer);
+    }
+}
+
+bool InputSampler::begin(m5::M5_STAMPLC* stamplc, uint32_t periodUs, const char* taskName, uint32_t stackSize,
+                         UBaseType_t taskPriority) {
+    _stamplc = stamplc;
+    _period_us = periodUs;
+    _stats.periodUs = periodUs;
+
+    // Debounce settings survive a reboot
+    memset(_debounce_ms, MCP_INPUT_DEBOUNCE_MS, sizeof(_debounce_ms));
+    Preferences prefs;
+    if (prefs.begin("inputs", true)) {
+        if (prefs.getBytesLength("debounce") == sizeof(_debounce_ms)) {
+            prefs.getBytes("debounce", _debounce_ms, sizeof(_debounce_ms));
+        }
+        uint8_t modes[8] = {};
+        if (prefs.getBytesLength("counter_mode") == sizeof(modes)) {
+            prefs.getBytes("counter_mode", modes, sizeof(modes));
+        }
+        for (int i = 0; i < 8; i++) {
+            _counters.setMode(i, modes[i] <= PulseCounters::MODE_BOTH ? static_cast<PulseCounters::Mode>(modes[i])
+                                                                         : PulseCounters::MODE_RISING);
+        }
+        prefs.end();
+    }
+    for (int i = 0; i < 8; i++) {
+        applyDebounce(i);
+    }
+    _port_reads = portMatchesLibrary();
+    _stats.portReads = _port_reads;
+
+    if (xTaskCreatePinnedToCore(taskEntry, taskName, stackSize, this, taskPriority, &_task, tskNO_AFFINITY) != pdPASS) {
+        return false;
+    }
+
+    // The timer only wakes the task; the I2C reads must not run in the
+    // esp_timer task where they would delay every other timer
+    esp_timer_create_args_t args = {};
+    args.callback = timerCallback;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "input_sampler";
+
+    if (esp_timer_create(&args, &_timer) != ESP_OK) {
+        return false;
+    }
+    return esp_timer_start_periodic(_timer, periodUs) == ESP_OK;
+}
+
+uint64_t InputSampler::lastSampleUs() {
+    portENTER_CRITICAL(&_lock);
+    uint64_t timestamp = _last_sample_us;
+    portEXIT_CRITICAL(&_lock);
+    return timestamp;
+}
+
+uint8_t InputSampler::scanInputs() {
+    uint8_t state = inputs();
+    uint8_t edged = _edge_mask.exchange(0, std::memory_order_acq_rel);
+
+    // Edged but back at the last reported level: the pulse fit between scans
+    uint8_t hidden = edged & ~(state ^ _last_reported);
+    _last_reported = state ^ hidden;
+    return _last_reported;
+}
+
+bool InputSampler::setDebounceMs(int channel, uint32_t ms) {
+    if (channel < -1 || channel >= 8 || ms > maxDebounceMs()) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&_lock);
+    for (int i = 0; i < 8; i++) {
+        if (channel == -1 || channel == i) {
+            _debounce_ms[i] = ms;
+            applyDebounce(i);
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    Preferences prefs;
+    if (prefs.begin("inputs", false)) {
+        prefs.putBytes("debounce", _debounce_ms, sizeof(_debounce_ms));
+        prefs.end();
+    }
+    return true;
+}
+
+uint32_t InputSampler::debounceMs(int channel) {
+    portENTER_CRITICAL(&_lock);
+    uint32_t ms = _debounce_ms[channel];
+    portEXIT_CRITICAL(&_lock);
+    return ms;
+}
+
+void InputSampler::applyDebounce(int channel) {
+    // Round up so the filter never accepts a level sooner than asked
+    uint32_t samples = ((uint32_t)_debounce_ms[channel] * 1000 + _period_us - 1) / _period_us;
+    _debounce.setSamples(channel, samples > DebounceFilter::MAX_SAMPLES ? DebounceFilter::MAX_SAMPLES : samples);
+}
+
+void InputSampler::setCounterMode(int channel, PulseCounters::Mode mode) {
+    uint8_t modes[8];
+    for (int i = 0; i < 8; i++) {
+        if (channel == -1 || channel == i) {
+            _counters.setMode(i, mode);
+        }
+        modes[i] = _counters.mode(i);
+    }
+
+    Preferences prefs;
+    if (prefs.begin("inputs", false)) {
+        prefs.putBytes("counter_mode", modes, sizeof(modes));
+        prefs.end();
+    }
+}
+
+InputSampler::Stats InputSampler::stats() {
+    portENTER_CRITICAL(&_lock);
+    Stats copy = _stats;
+    portEXIT_CRITICAL(&_lock);
+    return copy;
+}
+
+void InputSampler::timerCallback(void* arg) {
+    InputSampler* self = static_cast<InputSampler*>(arg);
+    xTaskNotifyGive(self->_task);
+}
+
+void InputSampler::taskEntry(void* arg) {
+    InputSampler* self = static_cast<InputSampler*>(arg);
+
+    while (true) {
+        uint32_t pending = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (pending > 1) {
+            portENTER_CRITICAL(&self->_lock);
+            self->_stats.overruns += pending - 1;
+            portEXIT_CRITICAL(&self->_lock);
+        }
+        self->sample();
+    }
+}
+
+void InputSampler::sample() {
+    int64_t start = esp_timer_get_time();
+
+    uint8_t raw = readInputs();
+
+    int64_t now = esp_timer_get_time();
+    uint8_t previous = _state.load(std::memory_order_relaxed);
+
+    portENTER_CRITICAL(&_lock);
+    if (!_primed) {
+        _debounce.reset(raw);
+    }
+    uint8_t levels = _debounce.update(raw);
+    uint8_t pending = _debounce.pending();
+    portEXIT_CRITICAL(&_lock);
+
+    uint8_t changed = _primed ? (levels ^ previous) : 0;
+    uint8_t wasPending = _last_pending;
+    _primed = true;
+
+    // Remember when each channel first showed its candidate level
+    uint8_t started = pending & ~wasPending;
+    _last_pending = pending;
+    for (int i = 0; started; i++, started >>= 1) {
+        if (started & 1) {
+            _pending_since[i] = now;
+        }
+    }
+
+    uint64_t stamps[8];
+    for (int i = 0; i < 8; i++) {
+        if (changed & (1 << i)) {
+            stamps[i] = (wasPending & (1 << i)) ? _pending_since[i] : now;
+            _edges.push(i, (levels >> i) & 1, stamps[i]);
+            if (_event_log) {
+                _event_log->record(EventLog::TYPE_INPUT_EDGE, i, (levels >> i) & 1, (levels >> i) & 1, stamps[i]);
+            }
+        }
+    }
+    _counters.record(changed & levels, changed & ~levels, stamps);
+
+    _state.store(levels, std::memory_order_release);
+    if (changed) {
+        _edge_mask.fetch_or(changed, std::memory_order_acq_rel);
+    }
+
+    uint32_t readUs = (uint32_t)(now - start);
+    portENTER_CRITICAL(&_lock);
+    _last_sample_us = now;
+    _stats.samples++;
+    _stats.lastReadUs = readUs;
+    if (readUs > _stats.maxReadUs) {
+        _stats.maxReadUs = readUs;
+    }
+    _stats.portReads = _port_reads;
+    portEXIT_CRITICAL(&_lock);
+}
+
+uint8_t InputSampler::readInputs() {
+    uint8_t raw;
+    if (_port_reads && readPort(raw)) {
+        if (++_verify_count % VERIFY_SAMPLES == 0) {
+            _port_reads = portMatchesLibrary();
+        }
+        return raw;
+    }
+    _port_reads = false;
+    return readEach();
+}
+
+bool InputSampler::readPort(uint8_t& raw) {
+    // Input port 0 and 1 registers, read back to back
+    uint8_t ports[2];
+    if (!m5::In_I2C.readRegister(MCP_INPUT_EXPANDER_ADDR, 0x00, ports, sizeof(ports), MCP_INPUT_EXPANDER_FREQ)) {
+        return false;
+    }
+    uint16_t levels = ports[0] | ports[1] << 8;
+    raw = 0;
+    for (int i = 0; i < 8; i++) {
+        raw |= ((levels >> INPUT_PINS[i]) & 1) << i;
+    }
+    return true;
+}
+
+uint8_t InputSampler::readEach() {
+    uint8_t raw = 0;
+    for (int i = 0; i < 8; i++) {
+        if (_stamplc->readPlcInput(i)) {
+            raw |= 1 << i;
+        }
+    }
+    return raw;
+}
+
+bool InputSampler::portMatchesLibrary() {
+    // An input that moved between the reads proves nothing either way
+    uint8_t before;
+    uint8_t after;
+    if (!readPort(before)) {
+        return false;
+    }
+    uint8_t library = readEach();
+    if (!readPort(after)) {
+        return false;
+    }
+    return before != after || library == before;
+}
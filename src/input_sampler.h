@@ -0,0 +1,150 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include <M5StamPLC.h>
+#include <atomic>
+#include "esp_timer.h"
+#include "edge_ring.h"
+#include "debounce_filter.h"
+#include "pulse_counters.h"
+#include "event_log.h"
+
+// Input sampling period in microseconds
+#ifndef MCP_INPUT_SAMPLE_US
+#define MCP_INPUT_SAMPLE_US 1000
+#endif
+
+// Debounce applied to channels that have no stored setting
+#ifndef MCP_INPUT_DEBOUNCE_MS
+#define MCP_INPUT_DEBOUNCE_MS 3
+#endif
+
+// AW9523 I/O expander the inputs are wired to
+#ifndef MCP_INPUT_EXPANDER_ADDR
+#define MCP_INPUT_EXPANDER_ADDR 0x58
+#endif
+
+#ifndef MCP_INPUT_EXPANDER_FREQ
+#define MCP_INPUT_EXPANDER_FREQ 400000
+#endif
+
+/*
+ * Timer-driven input sampler.
+ *
+ * A periodic esp_timer wakes a dedicated high-priority task that reads all
+ * eight inputs, timestamps the sample with esp_timer_get_time() and pushes
+ * every transition into an EdgeRing. The I/O scan, SSE and getEdges
+ * all read from here, so pulses far shorter than the scan interval are
+ * still seen with microsecond timestamps.
+ *
+ * Raw samples pass through a DebounceFilter first, so everything downstream
+ * only sees clean edges. An edge is stamped with the time of the first
+ * sample at the new level, not the time the filter accepted it. The same
+ * edges drive the pulse counters.
+ *
+ * A sample reads both input ports of the I/O expander in one I2C
+ * transaction rather than one per input, so the shared bus stays free for
+ * the scan, capture and display. The port read is checked against the
+ * library's per-input reads at start and every VERIFY_SAMPLES samples; if
+ * it fails or disagrees while the inputs hold still, the sampler falls back
+ * to per-input reads for good.
+ */
+class InputSampler {
+public:
+    struct Stats {
+        uint32_t samples;
+        uint32_t overruns;      // Timer periods that passed without a sample
+        uint32_t lastReadUs;    // Time spent reading the inputs
+        uint32_t maxReadUs;
+        uint32_t periodUs;
+        bool portReads;         // false after falling back to per-input reads
+    };
+
+    InputSampler();
+    ~InputSampler();
+
+    bool begin(m5::M5_STAMPLC* stamplc, uint32_t periodUs = MCP_INPUT_SAMPLE_US,
+               const char* taskName = "input_sampler", uint32_t stackSize = 3072, UBaseType_t taskPriority = 5);
+
+    // Current input levels, bit i = input i
+    uint8_t inputs() const {
+        return _state.load(std::memory_order_acquire);
+    }
+
+    // esp_timer time of the latest sample
+    uint64_t lastSampleUs();
+
+    // Levels for the I/O scan. A channel that toggled and came back since the
+    // previous call is reported at its other level for this one call, so a
+    // pulse shorter than the scan interval still shows up as two scan edges.
+    uint8_t scanInputs();
+
+    const EdgeRing& edges() const {
+        return _edges;
+    }
+
+    // Also record every edge in the sequence-of-events log; set before begin()
+    void setEventLog(EventLog* log) {
+        _event_log = log;
+    }
+
+    Stats stats();
+
+    // Per-channel debounce time (channel -1 = all); stored in NVS and
+    // applied on the next sample
+    bool setDebounceMs(int channel, uint32_t ms);
+    uint32_t debounceMs(int channel);
+    uint32_t maxDebounceMs() const {
+        return DebounceFilter::MAX_SAMPLES * _period_us / 1000;
+    }
+
+    PulseCounters& counters() {
+        return _counters;
+    }
+
+    // Counting mode per channel (channel -1 = all), stored in NVS
+    void setCounterMode(int channel, PulseCounters::Mode mode);
+
+private:
+    m5::M5_STAMPLC* _stamplc = nullptr;
+    esp_timer_handle_t _timer = nullptr;
+    TaskHandle_t _task = nullptr;
+    uint32_t _period_us = MCP_INPUT_SAMPLE_US;
+
+    EdgeRing _edges;
+    EventLog* _event_log = nullptr;
+    std::atomic<uint8_t> _state{0};
+    std::atomic<uint8_t> _edge_mask{0};     // Channels with an edge since scanInputs()
+    uint8_t _last_reported = 0;             // Scan task only
+    bool _primed = false;                   // Sampler task only
+
+    DebounceFilter _debounce;               // Guarded by _lock
+    uint8_t _debounce_ms[8] = {};
+    uint8_t _last_pending = 0;              // Sampler task only
+    uint64_t _pending_since[8] = {};        // First sample at the new level, sampler task only
+
+    PulseCounters _counters;
+
+    uint64_t _last_sample_us = 0;
+    Stats _stats = {};
+    portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+
+    static constexpr uint32_t VERIFY_SAMPLES = 1024;
+    static const uint8_t INPUT_PINS[8];     // Expander pin of each input
+
+    bool _port_reads = true;                // Sampler task only
+    uint32_t _verify_count = 0;
+
+    static void timerCallback(void* arg);
+    static void taskEntry(void* arg);
+    void sample();
+    uint8_t readInputs();
+    bool readPort(uint8_t& raw);
+    uint8_t readEach();
+    bool portMatchesLibrary();
+    void applyDebounce(int channel);
+};
@@ -0,0 +1,77 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "io_scanner.h"
+
+IOScanner::IOScanner() {}
+
+void IOScanner::init(m5::M5_STAMPLC* stamplc) {
+    _stamplc = stamplc;
+}
+
+void IOScanner::scan() {
+    uint32_t now = millis();
+    IOSnapshot previous = _snapshot;
+    IOSnapshot next = _snapshot;
+    
+    if (_sampler) {
+        next.inputs = _sampler->scanInputs();
+    } else {
+        next.inputs = 0;
+        for (int i = 0; i < 8; i++) {
+            if (_stamplc->readPlcInput(i)) {
+                next.inputs |= 1 << i;
+            }
+        }
+    }
+    next.relays = 0;
+    for (int i = 0; i < 4; i++) {
+        if (_stamplc->readPlcRelay(i)) {
+            next.relays |= 1 << i;
+        }
+    }
+    
+    if (next.scanCount == 0 || now - next.sensorTimestamp >= SENSOR_SCAN_INTERVAL_MS) {
+        next.temperature = _stamplc->getTemp();
+        if (!_capture || !_capture->latest(next.voltage, next.current)) {
+            next.voltage = _stamplc->getPowerVoltage();
+            next.current = _stamplc->getIoSocketOutputCurrent();
+        }
+        next.sensorTimestamp = now;
+    }
+    
+    next.timestamp = now;
+    next.scanCount++;
+    
+    portENTER_CRITICAL(&_lock);
+    _snapshot = next;
+    int listenerCount = _listener_count;
+    portEXIT_CRITICAL(&_lock);
+    
+    // The first scan has nothing to compare against
+    if (previous.scanCount == 0) {
+        return;
+    }
+    for (int i = 0; i < listenerCount; i++) {
+        _listeners[i].callback(_listeners[i].context, previous, next);
+    }
+}
+
+IOSnapshot IOScanner::snapshot() {
+    portENTER_CRITICAL(&_lock);
+    IOSnapshot copy = _snapshot;
+    portEXIT_CRITICAL(&_lock);
+    return copy;
+}
+
+bool IOScanner::addListener(ScanListener listener, void* context) {
+    portENTER_CRITICAL(&_lock);
+    bool added = _listener_count < MAX_LISTENERS;
+    if (added) {
+        _listeners[_listener_count++] = {listener, context};
+    }
+    portEXIT_CRITICAL(&_lock);
+    return added;
+}
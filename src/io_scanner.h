@@ -0,0 +1,77 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include <M5StamPLC.h>
+#include "input_sampler.h"
+#include "waveform_capture.h"
+
+// Process image produced by one I/O scan
+struct IOSnapshot {
+    uint8_t inputs;             // Bit i = input i
+    uint8_t relays;             // Bit i = relay i
+    float temperature;
+    float voltage;
+    float current;
+    uint32_t timestamp;         // millis() of the scan
+    uint32_t sensorTimestamp;   // millis() of the last sensor read
+    uint32_t scanCount;
+};
+
+/*
+ * Samples inputs, relays and sensors into a shared snapshot.
+ *
+ * Inputs and relays are read on every scan and the I2C sensors every
+ * SENSOR_SCAN_INTERVAL_MS. With an InputSampler attached, inputs come
+ * from its much faster sampling instead of being read here, and with a
+ * WaveformCapture attached so do voltage and current. After each scan the registered listeners
+ * see the previous and the new snapshot, so they can react to edges and
+ * threshold crossings without reading the hardware themselves.
+ */
+class IOScanner {
+public:
+    static constexpr uint32_t SENSOR_SCAN_INTERVAL_MS = 100;
+    static constexpr int MAX_LISTENERS                = 8;
+
+    typedef void (*ScanListener)(void* context, const IOSnapshot& previous, const IOSnapshot& current);
+
+    IOScanner();
+
+    void init(m5::M5_STAMPLC* stamplc);
+
+    // Take input levels from the sampler instead of reading them per scan
+    void setInputSampler(InputSampler* sampler) {
+        _sampler = sampler;
+    }
+
+    // Take voltage and current from the capture task, the power monitor's only reader
+    void setWaveformCapture(WaveformCapture* capture) {
+        _capture = capture;
+    }
+
+    // Call once per scan cycle
+    void scan();
+
+    // Copy of the latest snapshot, safe from any task
+    IOSnapshot snapshot();
+
+    // Register a listener; takes effect from the next scan
+    bool addListener(ScanListener listener, void* context);
+
+private:
+    struct Listener {
+        ScanListener callback;
+        void* context;
+    };
+
+    m5::M5_STAMPLC* _stamplc = nullptr;
+    InputSampler* _sampler   = nullptr;
+    WaveformCapture* _capture = nullptr;
+    IOSnapshot _snapshot     = {};
+    portMUX_TYPE _lock       = portMUX_INITIALIZER_UNLOCKED;
+    Listener _listeners[MAX_LISTENERS] = {};
+    int _listener_count      = 0;
+};
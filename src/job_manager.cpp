@@ -0,0 +1,160 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "job_manager.h"
+
+JobManager::JobManager() {
+}
+
+uint32_t JobManager::start(const char* kind, uint32_t durationMs, Step step, void* context, uint32_t arg,
+                           const char* tokenText, uint32_t now) {
+    uint32_t id = 0;
+
+    portENTER_CRITICAL(&_lock);
+
+    // Prefer a free slot, otherwise recycle the oldest finished job
+    Job* slot = nullptr;
+    for (int i = 0; i < MAX_JOBS; i++) {
+        Job& job = _jobs[i];
+        if (job.state == STATE_FREE) {
+            slot = &job;
+            break;
+        }
+        if (job.state != STATE_RUNNING && (!slot || job.id < slot->id)) {
+            slot = &job;
+        }
+    }
+
+    if (slot) {
+        id = _next_id++;
+        if (_next_id == 0) {
+            _next_id = 1;
+        }
+        slot->id = id;
+        slot->state = STATE_RUNNING;
+        slot->cancelRequested = false;
+        slot->kind = kind;
+        slot->step = step;
+        slot->context = context;
+        slot->arg = arg;
+        slot->started = now;
+        slot->durationMs = durationMs;
+        slot->finishedElapsed = 0;
+        slot->lastReport = now;
+        strncpy(slot->tokenText, tokenText, MAX_TOKEN_TEXT - 1);
+        slot->tokenText[MAX_TOKEN_TEXT - 1] = '\0';
+    }
+
+    portEXIT_CRITICAL(&_lock);
+
+    return id;
+}
+
+bool JobManager::cancel(uint32_t id) {
+    bool found = false;
+
+    portENTER_CRITICAL(&_lock);
+    for (int i = 0; i < MAX_JOBS; i++) {
+        Job& job = _jobs[i];
+        if (job.id == id && job.state == STATE_RUNNING) {
+            job.cancelRequested = true;
+            found = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    return found;
+}
+
+void JobManager::update(uint32_t now, Notify notify, void* context) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        Job& job = _jobs[i];
+
+        // Only this task moves a job out of RUNNING, so the copy stays valid
+        portENTER_CRITICAL(&_lock);
+        bool running = job.state == STATE_RUNNING;
+        bool cancel = job.cancelRequested;
+        portEXIT_CRITICAL(&_lock);
+        if (!running) {
+            continue;
+        }
+
+        uint32_t elapsed = now - job.started;
+        bool done = job.step(job.context, job.arg, elapsed, cancel);
+
+        if (cancel || done) {
+            portENTER_CRITICAL(&_lock);
+            job.state = cancel ? STATE_CANCELLED : STATE_COMPLETED;
+            job.finishedElapsed = elapsed;
+            portEXIT_CRITICAL(&_lock);
+            report(job, elapsed, notify, context);
+        } else if (now - job.lastReport >= PROGRESS_INTERVAL_MS) {
+            job.lastReport = now;
+            report(job, elapsed, notify, context);
+        }
+    }
+}
+
+void JobManager::report(const Job& job, uint32_t elapsed, Notify notify, void* context) {
+    if (!notify) {
+        return;
+    }
+
+    Progress progress;
+    progress.id = job.id;
+    progress.kind = job.kind;
+    progress.state = job.state;
+    progress.total = job.durationMs;
+    progress.progress = job.state == STATE_COMPLETED || elapsed > job.durationMs ? job.durationMs : elapsed;
+    memcpy(progress.tokenText, job.tokenText, MAX_TOKEN_TEXT);
+    notify(context, progress);
+}
+
+int JobManager::list(Info* jobs, int maxJobs, uint32_t now) {
+    int count = 0;
+
+    portENTER_CRITICAL(&_lock);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < MAX_JOBS && count < maxJobs; i++) {
+            const Job& job = _jobs[i];
+            if (job.state == STATE_FREE || (job.state == STATE_RUNNING) != (pass == 0)) {
+                continue;
+            }
+            Info& info = jobs[count++];
+            info.id = job.id;
+            info.kind = job.kind;
+            info.state = job.state;
+            info.elapsedMs = job.state == STATE_RUNNING ? now - job.started : job.finishedElapsed;
+            info.durationMs = job.durationMs;
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    return count;
+}
+
+int JobManager::running() {
+    int count = 0;
+
+    portENTER_CRITICAL(&_lock);
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (_jobs[i].state == STATE_RUNNING) {
+            count++;
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    return count;
+}
+
+const char* JobManager::stateName(State state) {
+    switch (state) {
+        case STATE_RUNNING:   return "running";
+        case STATE_COMPLETED: return "completed";
+        case STATE_CANCELLED: return "cancelled";
+        default:              return "free";
+    }
+}
@@ -0,0 +1,98 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+
+/*
+ * Long-running capability calls.
+ *
+ * A capability that sequences I/O over time starts a job and returns its id
+ * right away. The main loop steps every running job through update(), which
+ * reports progress at most every PROGRESS_INTERVAL_MS and once more when the
+ * job finishes or is cancelled. The MCP server turns those reports
+ * into notifications/progress messages on the SSE stream.
+ *
+ * Jobs are started and cancelled from the worker task and stepped from the
+ * loop task; the table is guarded by a spinlock and step functions are
+ * always called outside it.
+ */
+class JobManager {
+public:
+    static constexpr int MAX_JOBS                  = 8;
+    static constexpr size_t MAX_TOKEN_TEXT         = 40;
+    static constexpr uint32_t PROGRESS_INTERVAL_MS = 1000;
+
+    enum State : uint8_t {
+        STATE_FREE = 0,
+        STATE_RUNNING,
+        STATE_COMPLETED,
+        STATE_CANCELLED
+    };
+
+    // Advances one job; returns true once it is done. Called with cancel set
+    // exactly once if the job is cancelled, so it can undo its outputs.
+    typedef bool (*Step)(void* context, uint32_t arg, uint32_t elapsedMs, bool cancel);
+
+    struct Info {
+        uint32_t id;
+        const char* kind;
+        State state;
+        uint32_t elapsedMs;
+        uint32_t durationMs;
+    };
+
+    struct Progress {
+        uint32_t id;
+        const char* kind;
+        State state;
+        uint32_t progress;                  // Elapsed ms, capped at total
+        uint32_t total;                     // Planned duration in ms
+        char tokenText[MAX_TOKEN_TEXT];     // Serialized progressToken, empty = job id
+    };
+
+    typedef void (*Notify)(void* context, const Progress& progress);
+
+    JobManager();
+
+    // Returns the new job id, or 0 if all slots hold running jobs
+    uint32_t start(const char* kind, uint32_t durationMs, Step step, void* context, uint32_t arg,
+                   const char* tokenText, uint32_t now);
+
+    // Request cancellation; false if the id is unknown or already finished
+    bool cancel(uint32_t id);
+
+    // Call from the main loop
+    void update(uint32_t now, Notify notify, void* context);
+
+    // Copy of up to maxJobs entries, running jobs first; returns the count
+    int list(Info* jobs, int maxJobs, uint32_t now);
+
+    int running();
+
+    static const char* stateName(State state);
+
+private:
+    struct Job {
+        uint32_t id;
+        State state;
+        bool cancelRequested;
+        const char* kind;
+        Step step;
+        void* context;
+        uint32_t arg;
+        uint32_t started;
+        uint32_t durationMs;
+        uint32_t finishedElapsed;
+        uint32_t lastReport;
+        char tokenText[MAX_TOKEN_TEXT];
+    };
+
+    Job _jobs[MAX_JOBS] = {};
+    uint32_t _next_id   = 1;
+    portMUX_TYPE _lock  = portMUX_INITIALIZER_UNLOCKED;
+
+    void report(const Job& job, uint32_t elapsed, Notify notify, void* context);
+};
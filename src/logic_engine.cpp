@@ -0,0 +1,662 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "logic_engine.h"
+#include "scan_cycle.h"
+#include "esp_timer.h"
+#include <Preferences.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+enum Sensor : uint8_t { SENSOR_TEMP = 0, SENSOR_VOLT, SENSOR_CURR };
+enum Comparison : uint8_t { CMP_LT = 0, CMP_GT, CMP_LE, CMP_GE };
+
+}
+
+// Recursive-descent compiler from source text to bytecode
+class LogicEngine::Compiler {
+public:
+    Compiler(const char* source, Program& program, char* error, size_t errorSize)
+        : _p(source), _program(program), _error(error), _error_size(errorSize) {}
+
+    bool compile() {
+        _program.length = 0;
+        while (true) {
+            skipSpace();
+            if (*_p == '\0') {
+                break;
+            }
+            if (*_p == '\n' || *_p == ';') {
+                if (*_p == '\n') {
+                    _line++;
+                }
+                _p++;
+                continue;
+            }
+            if (!statement()) {
+                return false;
+            }
+            skipSpace();
+            if (*_p != '\0' && *_p != '\n' && *_p != ';') {
+                return fail("expected end of statement");
+            }
+        }
+        return emit(OP_END);
+    }
+
+private:
+    const char* _p;
+    int _line = 1;
+    int _depth = 0;
+    int _nesting = 0;       // Open parentheses
+    Program& _program;
+    char* _error;
+    size_t _error_size;
+
+    bool fail(const char* message) {
+        snprintf(_error, _error_size, "line %d: %s", _line, message);
+        return false;
+    }
+
+    void skipSpace() {
+        while (*_p == ' ' || *_p == '\t' || *_p == '\r') {
+            _p++;
+        }
+        if (*_p == '#') {
+            while (*_p != '\0' && *_p != '\n') {
+                _p++;
+            }
+        }
+    }
+
+    bool emit(uint8_t byte) {
+        // Room is always left for the final OP_END
+        if (_program.length >= MAX_CODE - (byte == OP_END ? 0 : 1)) {
+            return fail("program too large");
+        }
+        _program.code[_program.length++] = byte;
+        return true;
+    }
+
+    bool emitBytes(const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++) {
+            if (!emit(bytes[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool push() {
+        if (++_depth > MAX_STACK) {
+            return fail("expression too deeply nested");
+        }
+        return true;
+    }
+
+    bool expect(char c, const char* message) {
+        skipSpace();
+        if (*_p != c) {
+            return fail(message);
+        }
+        _p++;
+        return true;
+    }
+
+    // Identifier made of letters, matched case-insensitively
+    bool word(const char* name) {
+        skipSpace();
+        size_t length = strlen(name);
+        if (strncasecmp(_p, name, length) != 0 || isalnum((unsigned char)_p[length])) {
+            return false;
+        }
+        _p += length;
+        return true;
+    }
+
+    // One of I, R, M, T, C followed by an index
+    bool reference(char& kind, int& index) {
+        skipSpace();
+        char c = toupper((unsigned char)*_p);
+        if (!strchr("IRMTC", c) || c == '\0' || !isdigit((unsigned char)_p[1])) {
+            return false;
+        }
+        char* end;
+        long value = strtol(_p + 1, &end, 10);
+        if (isalpha((unsigned char)*end)) {
+            return false;
+        }
+        int limit = c == 'I' ? 8 : c == 'R' ? RELAY_COUNT : c == 'M' ? MARKERS : c == 'T' ? TIMERS : COUNTERS;
+        _p = end;
+        if (value < 0 || value >= limit) {
+            return fail("operand index out of range");
+        }
+        kind = c;
+        index = value;
+        return true;
+    }
+
+    bool number(float& value) {
+        skipSpace();
+        char* end;
+        value = strtof(_p, &end);
+        if (end == _p) {
+            return fail("expected a number");
+        }
+        _p = end;
+        return true;
+    }
+
+    bool integer(uint32_t& value, uint32_t max) {
+        float number;
+        if (!this->number(number)) {
+            return false;
+        }
+        if (number < 0 || number > max || number != (uint32_t)number) {
+            return fail("preset out of range");
+        }
+        value = number;
+        return true;
+    }
+
+    bool statement() {
+        char kind;
+        int index;
+        const char* start = _p;
+        if (!reference(kind, index)) {
+            _p = start;
+            return *_error ? false : fail("expected R, M, T or C target");
+        }
+        if (!expect('=', "expected '='")) {
+            return false;
+        }
+
+        if (kind == 'R' || kind == 'M') {
+            if (!expression()) {
+                return false;
+            }
+            _depth--;
+            return emit(kind == 'R' ? OP_STORE_RELAY : OP_STORE_MARKER) && emit(index);
+        }
+
+        if (kind == 'T') {
+            bool onDelay = word("ton");
+            if (!onDelay && !word("tof")) {
+                return fail("expected ton() or tof()");
+            }
+            uint32_t preset;
+            if (!expect('(', "expected '('") || !expression() || !expect(',', "expected ','") ||
+                !integer(preset, 0x7FFFFFFF) || !expect(')', "expected ')'")) {
+                return false;
+            }
+            _depth--;
+            return emit(onDelay ? OP_TON : OP_TOF) && emit(index) && emitBytes(&preset, sizeof(preset));
+        }
+
+        if (kind == 'C') {
+            if (!word("ctu")) {
+                return fail("expected ctu()");
+            }
+            uint32_t preset;
+            if (!expect('(', "expected '('") || !expression() || !expect(',', "expected ','") || !expression() ||
+                !expect(',', "expected ','") || !integer(preset, 0xFFFF) || !expect(')', "expected ')'")) {
+                return false;
+            }
+            _depth -= 2;
+            uint16_t preset16 = preset;
+            return emit(OP_CTU) && emit(index) && emitBytes(&preset16, sizeof(preset16));
+        }
+
+        return fail("inputs cannot be assigned");
+    }
+
+    // expression := xorTerm { '|' xorTerm }
+    bool expression() {
+        if (!xorTerm()) {
+            return false;
+        }
+        while (skipSpace(), *_p == '|') {
+            _p++;
+            if (!xorTerm() || !emit(OP_OR)) {
+                return false;
+            }
+            _depth--;
+        }
+        return true;
+    }
+
+    // xorTerm := andTerm { '^' andTerm }
+    bool xorTerm() {
+        if (!andTerm()) {
+            return false;
+        }
+        while (skipSpace(), *_p == '^') {
+            _p++;
+            if (!andTerm() || !emit(OP_XOR)) {
+                return false;
+            }
+            _depth--;
+        }
+        return true;
+    }
+
+    // andTerm := factor { '&' factor }
+    bool andTerm() {
+        if (!factor()) {
+            return false;
+        }
+        while (skipSpace(), *_p == '&') {
+            _p++;
+            if (!factor() || !emit(OP_AND)) {
+                return false;
+            }
+            _depth--;
+        }
+        return true;
+    }
+
+    // factor := { '!' } operand; a run of '!' folds to at most one NOT
+    bool factor() {
+        bool invert = false;
+        while (skipSpace(), *_p == '!') {
+            _p++;
+            invert = !invert;
+        }
+        return operand() && (!invert || emit(OP_NOT));
+    }
+
+    // Parentheses recurse on the worker's stack, so their depth is bounded
+    // like the operand stack's
+    bool operand() {
+        if (*_p == '(') {
+            if (++_nesting > MAX_NESTING) {
+                return fail("expression too deeply nested");
+            }
+            _p++;
+            if (!expression() || !expect(')', "expected ')'")) {
+                return false;
+            }
+            _nesting--;
+            return true;
+        }
+        if ((*_p == '0' || *_p == '1') && !isalnum((unsigned char)_p[1]) && _p[1] != '.') {
+            uint8_t value = *_p++ - '0';
+            return push() && emit(OP_CONST) && emit(value);
+        }
+
+        int sensor = word("temp") ? SENSOR_TEMP : word("volt") ? SENSOR_VOLT : word("curr") ? SENSOR_CURR : -1;
+        if (sensor >= 0) {
+            skipSpace();
+            int comparison;
+            if (_p[0] == '<' && _p[1] == '=') {
+                comparison = CMP_LE;
+                _p += 2;
+            } else if (_p[0] == '>' && _p[1] == '=') {
+                comparison = CMP_GE;
+                _p += 2;
+            } else if (_p[0] == '<') {
+                comparison = CMP_LT;
+                _p++;
+            } else if (_p[0] == '>') {
+                comparison = CMP_GT;
+                _p++;
+            } else {
+                return fail("expected <, >, <= or >= after sensor");
+            }
+            float limit;
+            return number(limit) && push() && emit(OP_COMPARE) && emit(sensor << 2 | comparison) &&
+                   emitBytes(&limit, sizeof(limit));
+        }
+
+        char kind;
+        int index;
+        if (!reference(kind, index)) {
+            return *_error ? false : fail("expected an operand");
+        }
+        static const uint8_t opcodes[] = {OP_INPUT, OP_RELAY, OP_MARKER, OP_TIMER, OP_COUNTER};
+        return push() && emit(opcodes[strchr("IRMTC", kind) - "IRMTC"]) && emit(index);
+    }
+};
+
+LogicEngine::LogicEngine() {}
+
+void LogicEngine::begin(ScanCycle* scan) {
+    _scan = scan;
+
+    Program program = {};
+    Preferences prefs;
+    if (prefs.begin("logic", true)) {
+        size_t length = prefs.getBytesLength("code");
+        if (length > 0 && length <= MAX_CODE) {
+            program.length = prefs.getBytes("code", program.code, length);
+            prefs.getString("source", _source, sizeof(_source));
+        }
+        prefs.end();
+    }
+
+    // A stored program that does not verify is not run
+    if (program.length > 0 && verify(program)) {
+        stage(program);
+    } else {
+        _source[0] = '\0';
+    }
+}
+
+void LogicEngine::onLogic(void* context, const IOSnapshot& snapshot) {
+    static_cast<LogicEngine*>(context)->run(snapshot);
+}
+
+void LogicEngine::run(const IOSnapshot& snapshot) {
+    int64_t start = esp_timer_get_time();
+
+    // A new program starts from cleared markers, timers and counters
+    portENTER_CRITICAL(&_lock);
+    if (_staged_ready) {
+        _active = _staged;
+        _staged_ready = false;
+        _markers = 0;
+        memset(_timers, 0, sizeof(_timers));
+        memset(_counters, 0, sizeof(_counters));
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    if (_active.length <= 1) {
+        return;
+    }
+
+    // Verified at load, so no bounds or stack checks here
+    const uint8_t* code = _active.code;
+    uint8_t stack[MAX_STACK];
+    int sp = 0;
+    uint8_t relays = snapshot.relays;
+    uint32_t now = snapshot.timestamp;
+    size_t pc = 0;
+    bool running = true;
+    while (running) {
+        switch (code[pc++]) {
+            case OP_END:
+                running = false;
+                break;
+            case OP_INPUT:
+                stack[sp++] = (snapshot.inputs >> code[pc++]) & 1;
+                break;
+            case OP_RELAY:
+                stack[sp++] = (relays >> code[pc++]) & 1;
+                break;
+            case OP_MARKER:
+                stack[sp++] = (_markers >> code[pc++]) & 1;
+                break;
+            case OP_TIMER:
+                stack[sp++] = _timers[code[pc++]].done;
+                break;
+            case OP_COUNTER:
+                stack[sp++] = _counters[code[pc++]].done;
+                break;
+            case OP_CONST:
+                stack[sp++] = code[pc++];
+                break;
+            case OP_COMPARE: {
+                uint8_t selector = code[pc++];
+                float limit;
+                memcpy(&limit, code + pc, sizeof(limit));
+                pc += sizeof(limit);
+                uint8_t sensor = selector >> 2;
+                float value = sensor == SENSOR_TEMP ? snapshot.temperature
+                            : sensor == SENSOR_VOLT ? snapshot.voltage
+                                                    : snapshot.current;
+                switch (selector & 3) {
+                    case CMP_LT: stack[sp++] = value < limit; break;
+                    case CMP_GT: stack[sp++] = value > limit; break;
+                    case CMP_LE: stack[sp++] = value <= limit; break;
+                    default:     stack[sp++] = value >= limit; break;
+                }
+                break;
+            }
+            case OP_NOT:
+                stack[sp - 1] ^= 1;
+                break;
+            case OP_AND:
+                sp--;
+                stack[sp - 1] &= stack[sp];
+                break;
+            case OP_OR:
+                sp--;
+                stack[sp - 1] |= stack[sp];
+                break;
+            case OP_XOR:
+                sp--;
+                stack[sp - 1] ^= stack[sp];
+                break;
+            case OP_STORE_RELAY: {
+                uint8_t bit = 1 << code[pc++];
+                relays = stack[--sp] ? (relays | bit) : (relays & ~bit);
+                break;
+            }
+            case OP_STORE_MARKER: {
+                uint16_t bit = 1 << code[pc++];
+                _markers = stack[--sp] ? (_markers | bit) : (_markers & ~bit);
+                break;
+            }
+            case OP_TON:
+            case OP_TOF: {
+                bool onDelay = code[pc - 1] == OP_TON;
+                Timer& timer = _timers[code[pc++]];
+                uint32_t preset;
+                memcpy(&preset, code + pc, sizeof(preset));
+                pc += sizeof(preset);
+                bool in = stack[--sp];
+                if (onDelay) {
+                    // Done once the input has been on for preset ms
+                    if (!in) {
+                        timer.running = false;
+                        timer.done = false;
+                    } else {
+                        if (!timer.running) {
+                            timer.running = true;
+                            timer.startMs = now;
+                        }
+                        timer.done = now - timer.startMs >= preset;
+                    }
+                } else {
+                    // Done while the input is on and for preset ms after
+                    if (in) {
+                        timer.running = false;
+                        timer.done = true;
+                    } else if (timer.done) {
+                        if (!timer.running) {
+                            timer.running = true;
+                            timer.startMs = now;
+                        }
+                        if (now - timer.startMs >= preset) {
+                            timer.running = false;
+                            timer.done = false;
+                        }
+                    }
+                }
+                break;
+            }
+            case OP_CTU: {
+                Counter& counter = _counters[code[pc++]];
+                uint16_t preset;
+                memcpy(&preset, code + pc, sizeof(preset));
+                pc += sizeof(preset);
+                bool reset = stack[--sp];
+                bool in = stack[--sp];
+                if (reset) {
+                    counter.count = 0;
+                } else if (in && !counter.last && counter.count < 0xFFFF) {
+                    counter.count++;
+                }
+                counter.last = in;
+                counter.done = counter.count >= preset;
+                break;
+            }
+        }
+    }
+
+    // Only relays the program owns, and only when they change
+    uint8_t changed = (relays ^ snapshot.relays) & _active.relayMask;
+    for (int relay = 0; changed; relay++, changed >>= 1) {
+        if (changed & 1) {
+            _scan->writeRelay(relay, (relays >> relay) & 1);
+        }
+    }
+
+    uint32_t runUs = (uint32_t)(esp_timer_get_time() - start);
+    portENTER_CRITICAL(&_lock);
+    _status.runs++;
+    _status.lastRunUs = runUs;
+    if (runUs > _status.maxRunUs) {
+        _status.maxRunUs = runUs;
+    }
+    _status.markers = _markers;
+    _status.timers = 0;
+    for (int i = 0; i < TIMERS; i++) {
+        _status.timers |= _timers[i].done << i;
+    }
+    _status.counterDone = 0;
+    for (int i = 0; i < COUNTERS; i++) {
+        _status.counterDone |= _counters[i].done << i;
+        _status.counters[i] = _counters[i].count;
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+bool LogicEngine::load(const char* source, char* error, size_t errorSize, uint8_t reservedRelays) {
+    if (error && errorSize) {
+        error[0] = '\0';
+    }
+    if (strlen(source) >= MAX_SOURCE) {
+        snprintf(error, errorSize, "program too long (max %d characters)", MAX_SOURCE - 1);
+        return false;
+    }
+
+    Program program = {};
+    Compiler compiler(source, program, error, errorSize);
+    if (!compiler.compile()) {
+        return false;
+    }
+    if (!verify(program)) {
+        snprintf(error, errorSize, "compiled program failed verification");
+        return false;
+    }
+    uint8_t reserved = relayMaskOf(program) & reservedRelays;
+    if (reserved) {
+        snprintf(error, errorSize, "R%d is driven by a PID loop", __builtin_ctz(reserved));
+        return false;
+    }
+
+    bool empty = program.length <= 1;
+    strncpy(_source, empty ? "" : source, sizeof(_source) - 1);
+    stage(program);
+
+    Preferences prefs;
+    if (prefs.begin("logic", false)) {
+        if (empty) {
+            prefs.remove("code");
+            prefs.remove("source");
+        } else {
+            prefs.putBytes("code", program.code, program.length);
+            prefs.putString("source", source);
+        }
+        prefs.end();
+    }
+    return true;
+}
+
+void LogicEngine::source(char* out, size_t size) {
+    strncpy(out, _source, size - 1);
+    out[size - 1] = '\0';
+}
+
+LogicEngine::Status LogicEngine::status() {
+    portENTER_CRITICAL(&_lock);
+    Status copy = _status;
+    portEXIT_CRITICAL(&_lock);
+    return copy;
+}
+
+bool LogicEngine::verify(const Program& program) {
+    // Every opcode and operand in range, the stack within bounds and
+    // empty at the end, and exactly one OP_END, at the end
+    const uint8_t* code = program.code;
+    size_t pc = 0;
+    int depth = 0;
+    while (pc < program.length) {
+        uint8_t op = code[pc++];
+        size_t operands = 0;
+        int limit = 0;
+        int pops = 0;
+        int pushes = 0;
+        switch (op) {
+            case OP_END:
+                return pc == program.length && depth == 0;
+            case OP_INPUT:        operands = 1; limit = 8;           pushes = 1; break;
+            case OP_RELAY:        operands = 1; limit = RELAY_COUNT; pushes = 1; break;
+            case OP_MARKER:       operands = 1; limit = MARKERS;     pushes = 1; break;
+            case OP_TIMER:        operands = 1; limit = TIMERS;      pushes = 1; break;
+            case OP_COUNTER:      operands = 1; limit = COUNTERS;    pushes = 1; break;
+            case OP_CONST:        operands = 1; limit = 2;           pushes = 1; break;
+            case OP_COMPARE:      operands = 5; limit = 12;          pushes = 1; break;
+            case OP_NOT:          pops = 1; pushes = 1; break;
+            case OP_AND:
+            case OP_OR:
+            case OP_XOR:          pops = 2; pushes = 1; break;
+            case OP_STORE_RELAY:  operands = 1; limit = RELAY_COUNT; pops = 1; break;
+            case OP_STORE_MARKER: operands = 1; limit = MARKERS;     pops = 1; break;
+            case OP_TON:
+            case OP_TOF:          operands = 5; limit = TIMERS;      pops = 1; break;
+            case OP_CTU:          operands = 3; limit = COUNTERS;    pops = 2; break;
+            default:
+                return false;
+        }
+        if (pc + operands > program.length || (operands && code[pc] >= limit)) {
+            return false;
+        }
+        pc += operands;
+        if (depth < pops) {
+            return false;
+        }
+        depth += pushes - pops;
+        if (depth > MAX_STACK) {
+            return false;
+        }
+    }
+    return false;
+}
+
+uint8_t LogicEngine::relayMaskOf(const Program& program) {
+    uint8_t mask = 0;
+    for (size_t pc = 0; pc + 1 < program.length;) {
+        uint8_t op = program.code[pc];
+        if (op == OP_STORE_RELAY) {
+            mask |= 1 << program.code[pc + 1];
+        }
+        static const uint8_t sizes[OP_COUNT] = {1, 2, 2, 2, 2, 2, 2, 6, 1, 1, 1, 1, 2, 2, 6, 6, 4};
+        pc += sizes[op];
+    }
+    return mask;
+}
+
+void LogicEngine::stage(const Program& program) {
+    // Recomputed so a program from NVS owns exactly what it assigns
+    Program copy = program;
+    copy.relayMask = relayMaskOf(copy);
+
+    portENTER_CRITICAL(&_lock);
+    _staged = copy;
+    _staged_ready = true;
+    _status.loaded = copy.length > 1;
+    _status.codeSize = copy.length;
+    _status.relayMask = copy.relayMask;
+    _status.runs = 0;
+    _status.lastRunUs = 0;
+    _status.maxRunUs = 0;
+    portEXIT_CRITICAL(&_lock);
+}
@@ -0,0 +1,143 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include "io_scanner.h"
+
+class ScanCycle;
+
+/*
+ * On-device boolean logic, compiled to bytecode and run every scan cycle.
+ *
+ * A program is a list of assignments, one per line or separated by ';',
+ * with '#' starting a comment:
+ *
+ *   R0 = I0 & !I1                  relay output
+ *   M0 = (I2 | M0) & !I3           marker (internal bit, kept between scans)
+ *   T0 = ton(I4, 500)              on-delay timer, ms; tof() is off-delay
+ *   C0 = ctu(I5, I6, 10)           up-counter: count edges, reset, preset
+ *   R1 = T0 | C0 | temp > 45.5     timer/counter done bits, sensor compare
+ *
+ * Operands are I0-I7, R0-R3, M0-M15, T0-T7, C0-C7, 0, 1 and comparisons of
+ * temp, volt or curr against a number with <, >, <= or >=. Operators are !,
+ * &, ^ and | in decreasing precedence, plus parentheses.
+ *
+ * load() compiles the source to stack-machine bytecode and verifies it:
+ * operand ranges, stack depth and size are all bounded, so execution needs
+ * no checks of its own and takes microseconds. Relays start each scan at
+ * their read-back state; a relay the program assigns is owned by it and
+ * queued for the output phase only when the result differs.
+ *
+ * The source and bytecode are stored in NVS and the bytecode is verified
+ * again before it runs at boot. load() runs on the worker and hands the
+ * program over under a spinlock; the scan task picks it up at the start of
+ * its next run.
+ */
+class LogicEngine {
+public:
+    static constexpr int MAX_SOURCE   = 1024;
+    static constexpr int MAX_CODE     = 512;
+    static constexpr int MAX_STACK    = 16;
+    static constexpr int MAX_NESTING  = 8;
+    static constexpr int MARKERS      = 16;
+    static constexpr int TIMERS       = 8;
+    static constexpr int COUNTERS     = 8;
+    static constexpr int RELAY_COUNT  = 4;
+
+    struct Status {
+        bool loaded;
+        uint16_t codeSize;
+        uint8_t relayMask;      // Relays the program assigns
+        uint32_t runs;
+        uint32_t lastRunUs;
+        uint32_t maxRunUs;
+        uint16_t markers;
+        uint8_t timers;         // Done bits
+        uint8_t counterDone;
+        uint16_t counters[COUNTERS];
+    };
+
+    LogicEngine();
+
+    // Loads the stored program; relay writes go through scan
+    void begin(ScanCycle* scan);
+
+    // Scan cycle logic step
+    static void onLogic(void* context, const IOSnapshot& snapshot);
+    void run(const IOSnapshot& snapshot);
+
+    // Compiles, verifies, stores and activates source; an empty source
+    // removes the program. A program assigning one of the reserved relays
+    // is refused. On error returns false with a message.
+    bool load(const char* source, char* error, size_t errorSize, uint8_t reservedRelays = 0);
+
+    // Source of the active program
+    void source(char* out, size_t size);
+
+    Status status();
+
+private:
+    enum Opcode : uint8_t {
+        OP_END = 0,
+        OP_INPUT,           // index
+        OP_RELAY,           // index
+        OP_MARKER,          // index
+        OP_TIMER,           // index
+        OP_COUNTER,         // index
+        OP_CONST,           // 0/1
+        OP_COMPARE,         // sensor << 2 | comparison, float limit
+        OP_NOT,
+        OP_AND,
+        OP_OR,
+        OP_XOR,
+        OP_STORE_RELAY,     // index
+        OP_STORE_MARKER,    // index
+        OP_TON,             // index, uint32 preset ms
+        OP_TOF,             // index, uint32 preset ms
+        OP_CTU,             // index, uint16 preset
+        OP_COUNT
+    };
+
+    struct Program {
+        uint8_t code[MAX_CODE];
+        uint16_t length;
+        uint8_t relayMask;  // Set by stage()
+    };
+
+    struct Timer {
+        bool running;
+        bool done;
+        uint32_t startMs;
+    };
+
+    struct Counter {
+        bool last;          // Count input at the previous run
+        bool done;
+        uint16_t count;
+    };
+
+    class Compiler;
+
+    ScanCycle* _scan = nullptr;
+
+    // Worker side, guarded by _lock while handed over
+    Program _staged = {};
+    bool _staged_ready = false;
+    char _source[MAX_SOURCE] = {};
+
+    // Scan task side
+    Program _active = {};
+    uint16_t _markers = 0;
+    Timer _timers[TIMERS] = {};
+    Counter _counters[COUNTERS] = {};
+
+    Status _status = {};    // Guarded by _lock
+    portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+
+    static bool verify(const Program& program);
+    static uint8_t relayMaskOf(const Program& program);
+    void stage(const Program& program);
+};
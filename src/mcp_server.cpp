@@ -5,7 +5,40 @@
  */
 #include "mcp_server.h"
 #include "dashboard_ui.h"
+#include "alloc_tracker.h"
+#include "memory_monitor.h"
+#include "metrics_writer.h"
+#include "io_scanner.h"
+#include "input_sampler.h"
+#include "history_store.h"
+#include "energy_meter.h"
+#include "relay_stats.h"
+#include "anomaly_detector.h"
+#include "alarm_manager.h"
+#include "waveform_capture.h"
+#include "scan_cycle.h"
+#include "logic_engine.h"
+#include "pid_controller.h"
+#include "relay_scheduler.h"
+#include "relay_interlock.h"
 #include <WiFi.h>
+#include <esp_wifi.h>
+#include <lwip/tcpip.h>
+#include <lwip/priv/tcp_priv.h>
+
+static const char ROOT_PAGE_HTML[] =
+    "<html><head><title>M5StamPLC MCP Server</title></head>"
+    "<body style='font-family: Arial, sans-serif; margin: 20px;'>"
+    "<h1>M5StamPLC MCP Server</h1>"
+    "<p>This is an MCP (Model Context Protocol) compliant server for M5StamPLC.</p>"
+    "<h2>Available Endpoints:</h2>"
+    "<ul>"
+    "<li><a href='/mcp'>/mcp</a> - MCP API endpoint (POST)</li>"
+    "<li><a href='/events'>/events</a> - SSE endpoint for real-time updates</li>"
+    "<li><a href='/capabilities'>/capabilities</a> - List available capabilities</li>"
+    "<li><a href='/metrics'>/metrics</a> - Prometheus metrics</li>"
+    "</ul>"
+    "</body></html>";
 
 MCPServer::MCPServer() {}
 
@@ -34,6 +67,29 @@ void MCPServer::init(m5::M5_STAMPLC* stamplc, DashboardUI* ui, int port) {
     // Register all capabilities
     registerCapabilities();
     
+    // Start the worker that executes capability calls in priority order
+    _slot_lock = xSemaphoreCreateRecursiveMutex();
+    _scheduler.begin(executeJob, this, "mcp_exec", 8192, 2);
+    
+    // Long-poll waits are checked after every I/O scan
+    if (_scanner) {
+        _scanner->addListener(onScan, this);
+    }
+    
+    // Stream only edges, anomalies, alarms and captures that happen from now on
+    if (_sampler) {
+        _sse_edge_cursor = _sampler->edges().head();
+    }
+    if (_anomalies) {
+        _sse_anomaly_sequence = _anomalies->lastSequence();
+    }
+    if (_alarms) {
+        _sse_alarm_sequence = _alarms->lastSequence();
+    }
+    if (_capture) {
+        _sse_captures = _capture->status().captures;
+    }
+    
     // Setup HTTP and SSE endpoints
     setupHttpEndpoints();
     setupSSEEndpoints();
@@ -49,10 +105,21 @@ void MCPServer::init(m5::M5_STAMPLC* stamplc, DashboardUI* ui, int port) {
 }
 
 void MCPServer::update() {
-    // Broadcast state to all connected clients periodically
+    // Step long-running jobs; progress goes out as SSE notifications
+    _jobs.update(millis(), onJobProgress, this);
+    
+    // Forward captured input edges, anomalies, alarm transitions and
+    // completed waveform captures as they arrive
+    broadcastEdges();
+    broadcastAnomalies();
+    broadcastAlarms();
+    broadcastCapture();
+    
+    // Broadcast state and PID loops to all connected clients periodically
     static uint32_t lastBroadcastTime = 0;
     if (millis() - lastBroadcastTime > 1000) { // 1 second interval
         broadcastState();
+        broadcastPid();
         lastBroadcastTime = millis();
     }
 }
@@ -74,7 +141,9 @@ void MCPServer::registerCapabilities() {
         "writeRelay",
         "Set the state of a relay",
         {"relayNumber", "state"},
-        std::bind(&MCPServer::handleWriteRelay, this, std::placeholders::_1, std::placeholders::_2)
+        std::bind(&MCPServer::handleWriteRelay, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE,
+        CommandScheduler::PRIORITY_ACTUATION
     });
     
     // Read Relay capability
@@ -90,7 +159,8 @@ void MCPServer::registerCapabilities() {
         "consoleLog",
         "Log a message to the device console",
         {"message"},
-        std::bind(&MCPServer::handleConsoleLog, this, std::placeholders::_1, std::placeholders::_2)
+        std::bind(&MCPServer::handleConsoleLog, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE
     });
     
     // Get System Info capability
@@ -98,7 +168,10 @@ void MCPServer::registerCapabilities() {
         "getSystemInfo",
         "Get information about the system",
         {},
-        std::bind(&MCPServer::handleGetSystemInfo, this, std::placeholders::_1, std::placeholders::_2)
+        std::bind(&MCPServer::handleGetSystemInfo, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_READ,
+        CommandScheduler::PRIORITY_TELEMETRY,
+        MCP_READ_CACHE_MS
     });
     
     // Get IO State capability
@@ -112,9 +185,11 @@ void MCPServer::registerCapabilities() {
     // Tone capability
     _capabilities.push_back({
         "tone",
-        "Play a tone with specified frequency and duration",
-        {"frequency", "duration"},
-        std::bind(&MCPServer::handleTone, this, std::placeholders::_1, std::placeholders::_2)
+        "Play a tone with specified frequency and duration; with async, return a job id at once",
+        {"frequency", "duration", "async"},
+        std::bind(&MCPServer::handleTone, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE,
+        CommandScheduler::PRIORITY_ACTUATION
     });
     
     // Get Time capability
@@ -122,7 +197,10 @@ void MCPServer::registerCapabilities() {
         "getTime",
         "Get the current time from the RTC",
         {},
-        std::bind(&MCPServer::handleGetTime, this, std::placeholders::_1, std::placeholders::_2)
+        std::bind(&MCPServer::handleGetTime, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_READ,
+        CommandScheduler::PRIORITY_NORMAL,
+        MCP_READ_CACHE_MS
     });
     
     // Set Time capability
@@ -130,7 +208,9 @@ void MCPServer::registerCapabilities() {
         "setTime",
         "Set the RTC time",
         {"year", "month", "day", "hour", "minute", "second"},
-        std::bind(&MCPServer::handleSetTime, this, std::placeholders::_1, std::placeholders::_2)
+        std::bind(&MCPServer::handleSetTime, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE,
+        CommandScheduler::PRIORITY_ACTUATION
     });
     
     // Temperature capability
@@ -138,7 +218,10 @@ void MCPServer::registerCapabilities() {
         "getTemperature",
         "Get the current temperature reading",
         {},
-        std::bind(&MCPServer::handleGetTemperature, this, std::placeholders::_1, std::placeholders::_2)
+        std::bind(&MCPServer::handleGetTemperature, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_READ,
+        CommandScheduler::PRIORITY_TELEMETRY,
+        MCP_READ_CACHE_MS
     });
     
     // Power Voltage capability
@@ -146,7 +229,10 @@ void MCPServer::registerCapabilities() {
         "getPowerVoltage",
         "Get the current power voltage reading",
         {},
-        std::bind(&MCPServer::handleGetPowerVoltage, this, std::placeholders::_1, std::placeholders::_2)
+        std::bind(&MCPServer::handleGetPowerVoltage, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_READ,
+        CommandScheduler::PRIORITY_TELEMETRY,
+        MCP_READ_CACHE_MS
     });
     
     // IO Current capability
@@ -154,7 +240,10 @@ void MCPServer::registerCapabilities() {
         "getIoCurrent",
         "Get the current IO socket output current reading",
         {},
-        std::bind(&MCPServer::handleGetIoCurrent, this, std::placeholders::_1, std::placeholders::_2)
+        std::bind(&MCPServer::handleGetIoCurrent, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_READ,
+        CommandScheduler::PRIORITY_TELEMETRY,
+        MCP_READ_CACHE_MS
     });
     
     // All Sensor Data capability
@@ -162,196 +251,1462 @@ void MCPServer::registerCapabilities() {
         "getSensorData",
         "Get all sensor data readings at once (temperature, voltage, current)",
         {},
-        std::bind(&MCPServer::handleGetSensorData, this, std::placeholders::_1, std::placeholders::_2)
+        std::bind(&MCPServer::handleGetSensorData, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_READ,
+        CommandScheduler::PRIORITY_TELEMETRY,
+        MCP_READ_CACHE_MS
+    });
+    
+    // Memory Stats capability
+    _capabilities.push_back({
+        "getMemoryStats",
+        "Get heap fragmentation, PSRAM usage, task stack high-water marks and allocator counters",
+        {},
+        std::bind(&MCPServer::handleGetMemoryStats, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_READ,
+        CommandScheduler::PRIORITY_TELEMETRY
+    });
+    
+    // Wait For Change capability (long-poll)
+    _capabilities.push_back({
+        "waitForChange",
+        "Wait until an input edge occurs or a sensor crosses a threshold, or the timeout expires",
+        {"inputNumber", "edge", "sensor", "above", "below", "timeout"},
+        [](JsonDocument& params, JsonDocument& result) {
+            throw std::runtime_error("waitForChange is answered by the I/O scan");
+        },
+        AdmissionControl::ACCESS_READ,
+        CommandScheduler::PRIORITY_NORMAL,
+        0,
+        true
+    });
+    
+    // Scheduler Stats capability
+    _capabilities.push_back({
+        "getSchedulerStats",
+        "Get per-priority queue depth and wait-time statistics of the command scheduler",
+        {},
+        std::bind(&MCPServer::handleGetSchedulerStats, this, std::placeholders::_1, std::placeholders::_2)
+    });
+    
+    // Get Scan Stats capability
+    _capabilities.push_back({
+        "getScanStats",
+        "Get cycle time, jitter and overrun statistics of the fixed-period PLC scan",
+        {},
+        std::bind(&MCPServer::handleGetScanStats, this, std::placeholders::_1, std::placeholders::_2)
+    });
+    
+    // Configure Scan capability
+    _capabilities.push_back({
+        "configureScan",
+        "Set the PLC scan period in ms and/or reset its statistics",
+        {"periodMs", "resetStats"},
+        std::bind(&MCPServer::handleConfigureScan, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE
+    });
+    
+    // Upload Program capability
+    _capabilities.push_back({
+        "uploadProgram",
+        "Compile, store and run a boolean logic program every scan cycle; an empty source removes it",
+        {"source"},
+        std::bind(&MCPServer::handleUploadProgram, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE
+    });
+    
+    // Get Program capability
+    _capabilities.push_back({
+        "getProgram",
+        "Get the logic program source, its execution statistics and its markers, timers and counters",
+        {},
+        std::bind(&MCPServer::handleGetProgram, this, std::placeholders::_1, std::placeholders::_2)
+    });
+    
+    // Configure PID capability
+    _capabilities.push_back({
+        "configurePid",
+        "Run, retune or remove the PID loop that time-proportions a relay from a sensor value",
+        {"relay", "source", "setpoint", "kp", "ki", "kd", "action", "rampRate", "outMin", "outMax", "cycleMs",
+         "enabled", "remove"},
+        std::bind(&MCPServer::handleConfigurePid, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE
+    });
+    
+    // Get PID capability
+    _capabilities.push_back({
+        "getPid",
+        "Get the configuration, terms and output of every PID loop",
+        {},
+        std::bind(&MCPServer::handleGetPid, this, std::placeholders::_1, std::placeholders::_2)
+    });
+    
+    // Pulse Relay capability
+    _capabilities.push_back({
+        "pulseRelay",
+        "Switch a relay for ms, timed by the scan cycle, optionally after a delay",
+        {"relay", "ms", "state", "afterMs"},
+        std::bind(&MCPServer::handlePulseRelay, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE,
+        CommandScheduler::PRIORITY_ACTUATION
+    });
+    
+    // Schedule Relay capability
+    _capabilities.push_back({
+        "scheduleRelay",
+        "Write a relay after a delay, at a local time, or on a recurring cron schedule",
+        {"relay", "state", "afterMs", "atTime", "cron", "pulseMs", "schedule"},
+        std::bind(&MCPServer::handleScheduleRelay, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE
+    });
+    
+    // Cancel Schedule capability
+    _capabilities.push_back({
+        "cancelSchedule",
+        "Cancel a pending relay write by id, or remove a recurring schedule",
+        {"id", "schedule"},
+        std::bind(&MCPServer::handleCancelSchedule, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE
+    });
+    
+    // Get Schedules capability
+    _capabilities.push_back({
+        "getSchedules",
+        "Get pending relay writes and recurring schedules",
+        {"offset", "limit"},
+        std::bind(&MCPServer::handleGetSchedules, this, std::placeholders::_1, std::placeholders::_2)
+    });
+    
+    // Configure Interlock capability
+    _capabilities.push_back({
+        "configureInterlock",
+        "Set the interlock rule every write to a relay is checked against",
+        {"relay", "notWith", "inputsHigh", "inputsLow", "minOnMs", "minOffMs"},
+        std::bind(&MCPServer::handleConfigureInterlock, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE
+    });
+    
+    // Get Interlocks capability
+    _capabilities.push_back({
+        "getInterlocks",
+        "Get the interlock table and how many writes each rule refused",
+        {},
+        std::bind(&MCPServer::handleGetInterlocks, this, std::placeholders::_1, std::placeholders::_2)
+    });
+    
+    // Get Edges capability
+    _capabilities.push_back({
+        "getEdges",
+        "Get timestamped input edges captured by the high-rate sampler",
+        {"since", "limit"},
+        std::bind(&MCPServer::handleGetEdges, this, std::placeholders::_1, std::placeholders::_2)
+    });
+    
+    // Configure Debounce capability
+    _capabilities.push_back({
+        "configureDebounce",
+        "Set the debounce time of one or all inputs, or read it when ms is omitted",
+        {"inputNumber", "ms"},
+        std::bind(&MCPServer::handleConfigureDebounce, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE
+    });
+    
+    // Get Counters capability
+    _capabilities.push_back({
+        "getCounters",
+        "Get pulse counts, edge totals, period and frequency of one or all inputs",
+        {"inputNumber"},
+        std::bind(&MCPServer::handleGetCounters, this, std::placeholders::_1, std::placeholders::_2)
+    });
+    
+    // Reset Counter capability
+    _capabilities.push_back({
+        "resetCounter",
+        "Preset the pulse count of one or all inputs and optionally change the counted edge",
+        {"inputNumber", "value", "edge"},
+        std::bind(&MCPServer::handleResetCounter, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE
+    });
+    
+    // Get History capability
+    _capabilities.push_back({
+        "getHistory",
+        "Get recorded sensor or I/O history; negative from/to are milliseconds before now",
+        {"series", "from", "to", "resolution", "limit"},
+        std::bind(&MCPServer::handleGetHistory, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_READ,
+        CommandScheduler::PRIORITY_TELEMETRY
+    });
+    
+    // Get Stats capability
+    _capabilities.push_back({
+        "getStats",
+        "Get min, max, mean, stddev, percentiles, integral and time above a threshold of a series over a window",
+        {"series", "channel", "from", "to", "threshold", "percentiles"},
+        std::bind(&MCPServer::handleGetStats, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_READ,
+        CommandScheduler::PRIORITY_TELEMETRY
+    });
+    
+    // Get Energy capability
+    _capabilities.push_back({
+        "getEnergy",
+        "Get load power and energy totals per day and per relay on-interval",
+        {},
+        std::bind(&MCPServer::handleGetEnergy, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_READ,
+        CommandScheduler::PRIORITY_TELEMETRY
+    });
+    
+    // Get Relay Stats capability
+    _capabilities.push_back({
+        "getRelayStats",
+        "Get per-relay switch counts, switches under load and total on-time",
+        {},
+        std::bind(&MCPServer::handleGetRelayStats, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_READ,
+        CommandScheduler::PRIORITY_TELEMETRY
+    });
+    
+    // Reset Relay Stats capability
+    _capabilities.push_back({
+        "resetRelayStats",
+        "Zero the wear counters of a replaced relay",
+        {"relay"},
+        std::bind(&MCPServer::handleResetRelayStats, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE
+    });
+    
+    // Get Anomalies capability
+    _capabilities.push_back({
+        "getAnomalies",
+        "Get sensor anomaly events after a sequence number and the learned profiles for the current relay state",
+        {"since"},
+        std::bind(&MCPServer::handleGetAnomalies, this, std::placeholders::_1, std::placeholders::_2)
+    });
+    
+    // Reset Anomalies capability
+    _capabilities.push_back({
+        "resetAnomalies",
+        "Forget the learned sensor profiles and clear active anomalies",
+        {},
+        std::bind(&MCPServer::handleResetAnomalies, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE
+    });
+    
+    // Configure Alarm capability
+    _capabilities.push_back({
+        "configureAlarm",
+        "Define, change or remove a high/low limit alarm with hysteresis, delays and latching",
+        {"id", "name", "source", "channel", "type", "limit", "hysteresis", "delayOn", "delayOff", "latching",
+         "enabled", "remove"},
+        std::bind(&MCPServer::handleConfigureAlarm, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE
+    });
+    
+    // Get Alarms capability
+    _capabilities.push_back({
+        "getAlarms",
+        "Get the alarm table with current states, and alarm transitions after a sequence number",
+        {"offset", "limit", "since"},
+        std::bind(&MCPServer::handleGetAlarms, this, std::placeholders::_1, std::placeholders::_2)
+    });
+    
+    // Ack Alarm capability
+    _capabilities.push_back({
+        "ackAlarm",
+        "Acknowledge one alarm, or all alarms if id is omitted",
+        {"id"},
+        std::bind(&MCPServer::handleAckAlarm, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE
+    });
+    
+    // Get Events capability
+    _capabilities.push_back({
+        "getEvents",
+        "Get the sequence-of-events log of input edges, relay writes, alarm transitions and limit crossings",
+        {"since", "limit"},
+        std::bind(&MCPServer::handleGetEvents, this, std::placeholders::_1, std::placeholders::_2)
+    });
+    
+    // Arm Capture capability
+    _capabilities.push_back({
+        "armCapture",
+        "Arm a triggered voltage/current capture on an input edge, a relay write, current above or voltage below a threshold",
+        {"trigger", "channel", "edge", "threshold", "pre", "post"},
+        std::bind(&MCPServer::handleArmCapture, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE
+    });
+    
+    // Get Capture capability
+    _capabilities.push_back({
+        "getCapture",
+        "Get the state of the triggered capture and a page of its samples once complete",
+        {"offset", "limit"},
+        std::bind(&MCPServer::handleGetCapture, this, std::placeholders::_1, std::placeholders::_2)
+    });
+    
+    // Get Jobs capability
+    _capabilities.push_back({
+        "getJobs",
+        "List running and recently finished asynchronous jobs",
+        {},
+        std::bind(&MCPServer::handleGetJobs, this, std::placeholders::_1, std::placeholders::_2)
+    });
+    
+    // Cancel Job capability
+    _capabilities.push_back({
+        "cancelJob",
+        "Cancel a running asynchronous job",
+        {"jobId"},
+        std::bind(&MCPServer::handleCancelJob, this, std::placeholders::_1, std::placeholders::_2),
+        AdmissionControl::ACCESS_WRITE,
+        CommandScheduler::PRIORITY_ACTUATION
     });
+    
+    // Give every cacheable capability its own response cache entry
+    int cacheEntries = 0;
+    for (auto& capability : _capabilities) {
+        if (capability.cacheTtlMs > 0 && cacheEntries < ResponseCache::MAX_ENTRIES) {
+            capability.cacheEntry = cacheEntries++;
+        }
+    }
+}
+
+const MCPServer::Capability* MCPServer::findCapability(const char* name) const {
+    for (const auto& capability : _capabilities) {
+        if (capability.name == name) {
+            return &capability;
+        }
+    }
+    return nullptr;
 }
 
 void MCPServer::setupHttpEndpoints() {
     // Root endpoint - serve a simple HTML page
-    _server->on("/", HTTP_GET, [this](AsyncWebServerRequest *request) {
-        String html = "<html><head><title>M5StamPLC MCP Server</title></head>";
-        html += "<body style='font-family: Arial, sans-serif; margin: 20px;'>";
-        html += "<h1>M5StamPLC MCP Server</h1>";
-        html += "<p>This is an MCP (Model Context Protocol) compliant server for M5StamPLC.</p>";
-        html += "<h2>Available Endpoints:</h2>";
-        html += "<ul>";
-        html += "<li><a href='/mcp'>/mcp</a> - MCP API endpoint (POST)</li>";
-        html += "<li><a href='/events'>/events</a> - SSE endpoint for real-time updates</li>";
-        html += "<li><a href='/capabilities'>/capabilities</a> - List available capabilities</li>";
-        html += "</ul>";
-        html += "</body></html>";
-        request->send(200, "text/html", html);
+    _server->on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
+        request->send(200, "text/html", ROOT_PAGE_HTML);
     });
     
     // Capabilities endpoint - list all available capabilities
     _server->on("/capabilities", HTTP_GET, [this](AsyncWebServerRequest *request) {
-        DynamicJsonDocument doc(4096);
-        JsonArray capabilities = doc.createNestedArray("capabilities");
+        _response_doc.clear();
+        JsonArray capabilities = _response_doc.createNestedArray("capabilities");
         
         for (const auto& capability : _capabilities) {
             JsonObject cap = capabilities.createNestedObject();
-            cap["name"] = capability.name;
-            cap["description"] = capability.description;
+            cap["name"] = capability.name.c_str();
+            cap["description"] = capability.description.c_str();
             
             JsonArray params = cap.createNestedArray("parameters");
             for (const auto& param : capability.parameters) {
-                params.add(param);
+                params.add(param.c_str());
             }
         }
         
-        String response;
-        serializeJson(doc, response);
-        request->send(200, "application/json", response);
+        serializeJson(_response_doc, _response_buffer, sizeof(_response_buffer));
+        request->send(200, "application/json", _response_buffer);
+    });
+    
+    // Metrics endpoint - Prometheus text format
+    _server->on("/metrics", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        handleMetrics(request);
     });
     
     // MCP endpoint - handle JSON-RPC style requests
-    _server->on("/mcp", HTTP_POST, [](AsyncWebServerRequest *request) {
-        // Just acknowledge the request, actual processing happens in onBody
-        request->send(200);
+    _server->on("/mcp", HTTP_POST, [this](AsyncWebServerRequest *request) {
+        // Called once the whole body has been received
+        handleMcpRequest(request);
     }, 
     [](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
         // Handle file uploads (not used)
     },
     [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-        // Process the request body
-        DynamicJsonDocument requestDoc(4096);
-        DynamicJsonDocument responseDoc(4096);
-        
-        DeserializationError error = deserializeJson(requestDoc, data, len);
-        
-        if (error) {
-            responseDoc["error"] = error.c_str();
-            responseDoc["success"] = false;
-        } else {
-            // Process as JSON-RPC
-            responseDoc["jsonrpc"] = "2.0";
-            
-            // Copy id if present
-            if (requestDoc.containsKey("id")) {
-                responseDoc["id"] = requestDoc["id"];
-            }
-            
-            // Handle the request
-            try {
-                this->handleJsonRPC(requestDoc, responseDoc);
-            } catch (const std::exception& e) {
-                responseDoc["error"]["code"] = -32000;
-                responseDoc["error"]["message"] = e.what();
-            }
-        }
-        
-        String response;
-        serializeJson(responseDoc, response);
-        request->send(200, "application/json", response);
-        
-        // Log the request (for debugging)
-        _dashboard_ui->console_log("MCP request processed");
+        handleMcpBody(request, data, len, index, total);
     });
 }
 
-void MCPServer::setupSSEEndpoints() {
-    // Create an event source on /events
-    AsyncEventSource* events = new AsyncEventSource("/events");
+// Runs on the lwIP thread: fires AsyncTCP's poll of the connection whose
+// callback argument is client, so ESPAsyncWebServer calls the response
+// filler again right away. client is only compared, never dereferenced; a
+// connection that has closed is simply not found.
+static void pollConnection(void* client) {
+    for (struct tcp_pcb* pcb = tcp_active_pcbs; pcb; pcb = pcb->next) {
+        if (pcb->callback_arg == client && pcb->poll) {
+            pcb->poll(pcb->callback_arg, pcb);
+            return;
+        }
+    }
+}
+
+// Any task: has AsyncTCP pull a response whose answer is now ready instead
+// of at its next 500 ms poll. Never blocks; if lwIP's mailbox is full the
+// regular poll still picks the answer up.
+static void wakeConnection(AsyncClient* client) {
+    if (client) {
+        tcpip_try_callback(pollConnection, client);
+    }
+}
+
+MCPServer::RequestSlot* MCPServer::acquireSlot(AsyncWebServerRequest* request) {
+    RequestSlot* acquired = nullptr;
+    
+    xSemaphoreTakeRecursive(_slot_lock, portMAX_DELAY);
+    for (auto& slot : _slots) {
+        if (slot.state == SLOT_FREE) {
+            slot.owner = request;
+            slot.client = request->client();
+            slot.state = SLOT_RECEIVING;
+            slot.length = 0;
+            slot.overflow = false;
+            acquired = &slot;
+            break;
+        }
+    }
+    xSemaphoreGiveRecursive(_slot_lock);
     
-    // Set up client connect handler
-    events->onConnect([this](AsyncEventSourceClient* client) {
-        if (client->lastId()) {
-            _dashboard_ui->console_log("Client reconnected");
-        } else {
-            _dashboard_ui->console_log("New SSE client connected");
+    if (acquired) {
+        // Give the slot back if the client goes away before the answer
+        request->onDisconnect([this, request]() {
+            handleDisconnect(request);
+        });
+    }
+    return acquired;
+}
+
+MCPServer::RequestSlot* MCPServer::findSlot(AsyncWebServerRequest* request) {
+    RequestSlot* found = nullptr;
+    
+    xSemaphoreTakeRecursive(_slot_lock, portMAX_DELAY);
+    for (auto& slot : _slots) {
+        if (slot.state != SLOT_FREE && slot.owner == request) {
+            found = &slot;
+            break;
         }
-        
-        // Send initial state
-        DynamicJsonDocument stateDoc(1024);
-        JsonObject state = stateDoc.createNestedObject("state");
-        
-        // Add input states
-        JsonArray inputs = state.createNestedArray("inputs");
-        for (int i = 0; i < 8; i++) {
-            inputs.add(_stamplc->readPlcInput(i));
+    }
+    xSemaphoreGiveRecursive(_slot_lock);
+    return found;
+}
+
+void MCPServer::freeSlot(RequestSlot* slot) {
+    xSemaphoreTakeRecursive(_slot_lock, portMAX_DELAY);
+    slot->owner = nullptr;
+    slot->state = SLOT_FREE;
+    xSemaphoreGiveRecursive(_slot_lock);
+}
+
+void MCPServer::handleDisconnect(AsyncWebServerRequest* request) {
+    xSemaphoreTakeRecursive(_slot_lock, portMAX_DELAY);
+    for (auto& slot : _slots) {
+        if (slot.state == SLOT_FREE || slot.owner != request) {
+            continue;
         }
-        
-        // Add relay states
-        JsonArray relays = state.createNestedArray("relays");
-        for (int i = 0; i < 4; i++) {
-            relays.add(_stamplc->readPlcRelay(i));
+        if (slot.state == SLOT_RECEIVING || slot.state == SLOT_ANSWERED) {
+            slot.state = SLOT_FREE;
         }
-        
-        // Add sensor data
-        JsonObject sensors = state.createNestedObject("sensors");
-        sensors["temperature"] = _stamplc->getTemp();
-        sensors["voltage"] = _stamplc->getPowerVoltage();
-        sensors["current"] = _stamplc->getIoSocketOutputCurrent();
-        
-        // Add timestamp
-        state["timestamp"] = millis();
-        
-        // Send to this client
-        String stateStr;
-        serializeJson(stateDoc, stateStr);
-        client->send(stateStr.c_str(), "state", millis(), 1000);
-    });
+        // Queued or running slots are freed by the worker once it is done
+        slot.owner = nullptr;
+    }
+    _wait_list.cancel(request);
+    xSemaphoreGiveRecursive(_slot_lock);
+    takeRefusal(request, nullptr);
+}
+
+bool MCPServer::takeRefusal(AsyncWebServerRequest* request, uint32_t* retryAfterMs) {
+    for (auto& refusal : _refusals) {
+        if (refusal.request == request) {
+            if (retryAfterMs) {
+                *retryAfterMs = refusal.retryAfterMs;
+            }
+            refusal.request = nullptr;
+            return true;
+        }
+    }
+    return false;
+}
+
+void MCPServer::handleMcpBody(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+    RequestSlot* slot;
+    if (index == 0) {
+        // Don't spend a slot on a client that will be rejected anyway, and
+        // keep the verdict: by the time the body is in, a precheck could pass
+        uint32_t retryAfterMs;
+        takeRefusal(request, nullptr);
+        if (!_admission.precheck(request->client()->remoteIP(), millis(), &retryAfterMs)) {
+            _refusals[_next_refusal] = {request, retryAfterMs};
+            _next_refusal = (_next_refusal + 1) % MCP_REQUEST_SLOTS;
+            return;
+        }
+        slot = acquireSlot(request);
+    } else {
+        slot = findSlot(request);
+    }
+    if (!slot) {
+        return;
+    }
     
-    // Add the event source to the server
-    _server->addHandler(events);
+    if (slot->overflow || index + len > MCP_MAX_BODY) {
+        slot->overflow = true;
+        return;
+    }
     
-    // Store the event source for later use
-    _event_sources.push_back(events);
+    memcpy(slot->data + index, data, len);
+    slot->length = index + len;
 }
 
-void MCPServer::broadcastState() {
-    // Skip if no clients connected
-    if (_event_sources.empty() || _event_sources[0]->count() == 0) {
+void MCPServer::handleMcpRequest(AsyncWebServerRequest* request) {
+    AllocTracker::Scope alloc_scope(AllocTracker::SCOPE_REQUEST);
+    
+    RequestSlot* slot = findSlot(request);
+    uint32_t clientIp = request->client()->remoteIP();
+    if (slot) {
+        slot->clientIp = clientIp;
+    }
+    uint32_t retryAfterMs = 0;
+    
+    // Reject excess load before doing any JSON work
+    if (!slot && request->contentLength()) {
+        if (takeRefusal(request, &retryAfterMs)) {
+            _admission.noteRateLimited();
+            sendRejection(request, 429, retryAfterMs, -32029, "Rate limit exceeded");
+        } else {
+            _admission.noteBusy();
+            sendRejection(request, 503, 1000, -32029, "Server busy");
+        }
         return;
     }
     
-    // Create a state document
-    DynamicJsonDocument stateDoc(1024);
-    JsonObject state = stateDoc.createNestedObject("state");
+    DeserializationError error;
+    if (!slot) {
+        error = DeserializationError::EmptyInput;
+    } else if (slot->overflow) {
+        error = DeserializationError::NoMemory;
+    } else {
+        slot->doc.clear();
+        error = deserializeJson(slot->doc, slot->data, slot->length);
+    }
     
-    // Add input states
-    JsonArray inputs = state.createNestedArray("inputs");
-    for (int i = 0; i < 8; i++) {
-        inputs.add(_stamplc->readPlcInput(i));
+    if (error) {
+        StaticJsonDocument<128> errorDoc;
+        errorDoc["error"] = error.c_str();
+        errorDoc["success"] = false;
+        
+        char errorStr[128];
+        serializeJson(errorDoc, errorStr, sizeof(errorStr));
+        if (slot) {
+            freeSlot(slot);
+        }
+        request->send(200, "application/json", errorStr);
+        return;
     }
     
-    // Add relay states
-    JsonArray relays = state.createNestedArray("relays");
-    for (int i = 0; i < 4; i++) {
-        relays.add(_stamplc->readPlcRelay(i));
+    const Capability* capability = findCapability(slot->doc["method"] | "");
+    AdmissionControl::Access access = capability ? capability->access : AdmissionControl::ACCESS_READ;
+    
+    // Retried writes are answered from the idempotency cache without running
+    // the handler again
+    slot->cacheEntry = -1;
+    if (access == AdmissionControl::ACCESS_WRITE && slot->doc.containsKey("id")) {
+        IdempotencyCache::Hasher idHash;
+        IdempotencyCache::Hasher contentHash;
+        serializeJson(slot->doc["id"], idHash);
+        serializeJson(slot->doc["method"], contentHash);
+        serializeJson(slot->doc["params"], contentHash);
+        
+        char cached[IdempotencyCache::MAX_RESPONSE];
+        IdempotencyCache::Result lookup = _idempotency.begin(clientIp, idHash.value(), contentHash.value(), millis(),
+                                                             &slot->cacheEntry, cached, sizeof(cached));
+        if (lookup == IdempotencyCache::HIT) {
+            freeSlot(slot);
+            request->send(200, "application/json", cached);
+            return;
+        }
+        if (lookup == IdempotencyCache::IN_PROGRESS) {
+            freeSlot(slot);
+            sendRejection(request, 409, 1000, -32002, "Request with this id is still executing");
+            return;
+        }
     }
     
-    // Add sensor data
-    JsonObject sensors = state.createNestedObject("sensors");
-    sensors["temperature"] = _stamplc->getTemp();
-    sensors["voltage"] = _stamplc->getPowerVoltage();
-    sensors["current"] = _stamplc->getIoSocketOutputCurrent();
+    // Charge the client's read or write bucket
+    if (!_admission.consume(clientIp, access, millis(), &retryAfterMs)) {
+        _idempotency.release(slot->cacheEntry);
+        freeSlot(slot);
+        sendRejection(request, 429, retryAfterMs, -32029, "Rate limit exceeded");
+        return;
+    }
     
-    // Add timestamp
-    state["timestamp"] = millis();
+    // Long-poll requests wait in the wait list, not in a slot or the queue
+    if (capability && capability->longPoll) {
+        parkWait(request, slot);
+        return;
+    }
     
-    // Serialize and broadcast
-    String stateStr;
-    serializeJson(stateDoc, stateStr);
+    // A fresh enough cached result is answered right here
+    if (capability && capability->cacheEntry >= 0 && serveCached(request, *capability, slot->doc)) {
+        freeSlot(slot);
+        return;
+    }
     
-    // Send to all connected clients
-    for (auto& es : _event_sources) {
-        es->send(stateStr.c_str(), "state", millis(), 1000);
+    // Hand over to the worker; actuation jumps ahead of queued reads
+    CommandScheduler::Priority priority = capability ? capability->priority : CommandScheduler::PRIORITY_NORMAL;
+    xSemaphoreTakeRecursive(_slot_lock, portMAX_DELAY);
+    slot->state = SLOT_QUEUED;
+    xSemaphoreGiveRecursive(_slot_lock);
+    
+    int index = slot - _slots;
+    if (!_scheduler.submit(priority, index)) {
+        _idempotency.release(slot->cacheEntry);
+        freeSlot(slot);
+        _admission.noteBusy();
+        sendRejection(request, 503, 1000, -32029, "Server busy");
+        return;
     }
+    
+    // AsyncTCP pulls the answer once the worker has left it in the slot
+    request->send(request->beginChunkedResponse("application/json",
+        [this, request, index](uint8_t* buffer, size_t maxLen, size_t sent) -> size_t {
+            return fillSlotResponse(request, index, buffer, maxLen, sent);
+        }));
 }
 
-void MCPServer::handleJsonRPC(JsonDocument& request, JsonDocument& response) {
-    // Check if this is a JSON-RPC request
-    if (!request.containsKey("method")) {
-        response["error"]["code"] = -32600;
-        response["error"]["message"] = "Invalid Request - missing method";
-        return;
+size_t MCPServer::fillSlotResponse(AsyncWebServerRequest* request, int index, uint8_t* buffer, size_t maxLen,
+                                   size_t sent) {
+    RequestSlot& slot = _slots[index];
+    size_t length = RESPONSE_TRY_AGAIN;
+    
+    xSemaphoreTakeRecursive(_slot_lock, portMAX_DELAY);
+    if (slot.owner != request) {
+        length = 0;
+    } else if (slot.state == SLOT_ANSWERED) {
+        length = slot.length - sent < maxLen ? slot.length - sent : maxLen;
+        memcpy(buffer, slot.data + sent, length);
+        if (length == 0) {
+            // Last call of the response: everything has been handed over
+            slot.owner = nullptr;
+            slot.state = SLOT_FREE;
+        }
     }
+    xSemaphoreGiveRecursive(_slot_lock);
     
-    // Get the method name
-    String methodName = request["method"].as<String>();
+    return length;
+}
+
+bool MCPServer::serveCached(AsyncWebServerRequest* request, const Capability& capability, JsonDocument& doc) {
+    // maxAge (ms) overrides the default staleness bound up to a server-side
+    // limit; 0 forces a live read
+    JsonVariant maxAgeParam = doc["params"]["maxAge"];
+    uint32_t maxAge = maxAgeParam.isNull() ? capability.cacheTtlMs : maxAgeParam.as<uint32_t>();
+    if (maxAge > MCP_READ_CACHE_MAX_MS) {
+        maxAge = MCP_READ_CACHE_MAX_MS;
+    }
+    
+    // The id is spliced into the text as is, so it has to fit whole
+    char idText[40] = "";
+    if (doc.containsKey("id")) {
+        if (measureJson(doc["id"]) >= sizeof(idText)) {
+            return false;
+        }
+        serializeJson(doc["id"], idText, sizeof(idText));
+    }
+    
+    char result[ResponseCache::MAX_RESULT];
+    uint32_t age = 0;
+    size_t length = _response_cache.lookup(capability.cacheEntry, maxAge, millis(), result, sizeof(result), &age);
+    if (length < 2) {
+        return false;
+    }
     
-    // Notify about incoming command
+    if (_commandReceivedCallback) {
+        _commandReceivedCallback();
+    }
+    
+    // Drop the closing brace so the age can be appended to the result object
+    result[length - 1] = '\0';
+    
+    char id[48] = "";
+    if (doc.containsKey("id")) {
+        snprintf(id, sizeof(id), ",\"id\":%s", idText);
+    }
+    
+    char response[ResponseCache::MAX_RESULT + 128];
+    snprintf(response, sizeof(response), "{\"jsonrpc\":\"2.0\"%s,\"result\":%s%s\"cacheAge\":%u},\"success\":true}", id,
+             result, length > 2 ? "," : "", (unsigned)age);
+    request->send(200, "application/json", response);
+    return true;
+}
+
+void MCPServer::sendError(AsyncWebServerRequest* request, JsonDocument& doc, int code, const char* message) {
+    StaticJsonDocument<256> errorDoc;
+    errorDoc["jsonrpc"] = "2.0";
+    // An id too long for the buffers is answered as null, as for one that
+    // could not be read
+    if (doc.containsKey("id")) {
+        if (measureJson(doc["id"]) < WaitList::MAX_ID_TEXT) {
+            errorDoc["id"] = doc["id"];
+        } else {
+            errorDoc["id"] = nullptr;
+        }
+    }
+    errorDoc["error"]["code"] = code;
+    errorDoc["error"]["message"] = message;
+    
+    char errorStr[256];
+    serializeJson(errorDoc, errorStr, sizeof(errorStr));
+    request->send(200, "application/json", errorStr);
+}
+
+void MCPServer::parkWait(AsyncWebServerRequest* request, RequestSlot* slot) {
+    JsonVariant params = slot->doc["params"];
+    WaitList::Condition condition = {};
+    const char* error = nullptr;
+    
+    if (!_scanner) {
+        error = "I/O scanner not available";
+    } else if (!params["inputNumber"].isNull()) {
+        int inputNumber = params["inputNumber"];
+        const char* edge = params["edge"] | "any";
+        condition.kind = WaitList::WAIT_INPUT_EDGE;
+        condition.channel = inputNumber;
+        if (strcmp(edge, "rising") == 0) {
+            condition.edge = WaitList::EDGE_RISING;
+        } else if (strcmp(edge, "falling") == 0) {
+            condition.edge = WaitList::EDGE_FALLING;
+        } else if (strcmp(edge, "any") == 0) {
+            condition.edge = WaitList::EDGE_ANY;
+        } else {
+            error = "Invalid edge (must be rising, falling or any)";
+        }
+        if (inputNumber < 0 || inputNumber >= 8) {
+            error = "Invalid input number (must be 0-7)";
+        }
+    } else if (!params["sensor"].isNull()) {
+        const char* sensor = params["sensor"] | "";
+        condition.channel = WaitList::SENSOR_COUNT;
+        for (int s = 0; s < WaitList::SENSOR_COUNT; s++) {
+            if (strcmp(sensor, WaitList::sensorName(static_cast<WaitList::Sensor>(s))) == 0) {
+                condition.channel = s;
+            }
+        }
+        if (!params["above"].isNull()) {
+            condition.kind = WaitList::WAIT_SENSOR_ABOVE;
+            condition.threshold = params["above"];
+        } else if (!params["below"].isNull()) {
+            condition.kind = WaitList::WAIT_SENSOR_BELOW;
+            condition.threshold = params["below"];
+        } else {
+            error = "Sensor waits need an above or below threshold";
+        }
+        if (condition.channel == WaitList::SENSOR_COUNT) {
+            error = "Invalid sensor (must be temperature, voltage or current)";
+        }
+    } else {
+        error = "Specify inputNumber or sensor";
+    }
+    
+    uint32_t timeout = params["timeout"] | 30000;
+    if (!error && (timeout < 1 || timeout > 120000)) {
+        error = "Invalid timeout (must be 1-120000 ms)";
+    }
+    
+    // The id goes into the answer as stored text, so it has to fit whole
+    if (!error && slot->doc.containsKey("id") && measureJson(slot->doc["id"]) >= WaitList::MAX_ID_TEXT) {
+        error = "id too long for waitForChange (at most 39 characters as JSON)";
+    }
+    
+    if (error) {
+        sendError(request, slot->doc, -32602, error);
+        freeSlot(slot);
+        return;
+    }
+    
+    char idText[WaitList::MAX_ID_TEXT] = "";
+    if (slot->doc.containsKey("id")) {
+        serializeJson(slot->doc["id"], idText, sizeof(idText));
+    }
+    
+    int index = _wait_list.add(condition, _scanner->snapshot(), millis(), timeout, request, idText);
+    if (index < 0) {
+        _admission.noteBusy();
+        sendRejection(request, 503, 1000, -32029, "Too many pending waits");
+    } else {
+        // The request stays open until the scan completes the wait
+        _wait_clients[index] = request->client();
+        request->send(request->beginChunkedResponse("application/json",
+            [this, request, index](uint8_t* buffer, size_t maxLen, size_t sent) -> size_t {
+                return fillWaitResponse(request, index, buffer, maxLen, sent);
+            }));
+    }
+    
+    // Only the parsed body slot is given back
+    freeSlot(slot);
+}
+
+void MCPServer::onScan(void* context, const IOSnapshot& previous, const IOSnapshot& current) {
+    MCPServer* self = static_cast<MCPServer*>(context);
+    uint32_t completed = self->_wait_list.evaluate(previous, current);
+    for (int i = 0; completed; i++, completed >>= 1) {
+        if (completed & 1) {
+            wakeConnection(self->_wait_clients[i]);
+        }
+    }
+}
+
+size_t MCPServer::fillWaitResponse(AsyncWebServerRequest* request, int index, uint8_t* buffer, size_t maxLen,
+                                   size_t sent) {
+    WaitList::Completion completion;
+    if (!_wait_list.completion(index, request, completion)) {
+        return RESPONSE_TRY_AGAIN;
+    }
+    
+    // Built again on every call; a completion always gives the same text
+    StaticJsonDocument<WAIT_RESPONSE_SIZE> doc;
+    doc["jsonrpc"] = "2.0";
+    if (completion.idText[0]) {
+        doc["id"] = serialized(completion.idText);
+    }
+    
+    JsonObject result = doc.createNestedObject("result");
+    result["triggered"] = completion.triggered;
+    result["timedOut"] = !completion.triggered;
+    result["waited"] = completion.waited;
+    
+    const WaitList::Condition& condition = completion.condition;
+    if (condition.kind == WaitList::WAIT_INPUT_EDGE) {
+        result["inputNumber"] = condition.channel;
+        result["state"] = (bool)(completion.inputs & (1 << condition.channel));
+    } else {
+        result["sensor"] = WaitList::sensorName(static_cast<WaitList::Sensor>(condition.channel));
+        result["value"] = completion.value;
+        result["threshold"] = condition.threshold;
+    }
+    
+    JsonArray inputs = result.createNestedArray("inputs");
+    for (int i = 0; i < 8; i++) {
+        inputs.add((bool)(completion.inputs & (1 << i)));
+    }
+    doc["success"] = true;
+    
+    char response[WAIT_RESPONSE_SIZE];
+    size_t length = serializeJson(doc, response, sizeof(response));
+    if (sent >= length) {
+        _wait_list.release(index);
+        return 0;
+    }
+    length = length - sent < maxLen ? length - sent : maxLen;
+    memcpy(buffer, response + sent, length);
+    return length;
+}
+
+void MCPServer::executeJob(void* context, uint16_t job) {
+    MCPServer* self = static_cast<MCPServer*>(context);
+    self->executeSlot(self->_slots[job]);
+}
+
+void MCPServer::executeSlot(RequestSlot& slot) {
+    AllocTracker::Scope alloc_scope(AllocTracker::SCOPE_EXECUTE);
+    
+    xSemaphoreTakeRecursive(_slot_lock, portMAX_DELAY);
+    slot.state = SLOT_RUNNING;
+    xSemaphoreGiveRecursive(_slot_lock);
+    
+    _rpc_response_doc.clear();
+    
+    // Process as JSON-RPC
+    _rpc_response_doc["jsonrpc"] = "2.0";
+    
+    // Copy id if present
+    if (slot.doc.containsKey("id")) {
+        _rpc_response_doc["id"] = slot.doc["id"];
+    }
+    
+    // Remember who asked, for events the handler records
+    _exec_client_ip = slot.clientIp;
+    _exec_request_id[0] = '\0';
+    JsonVariant requestId = slot.doc["id"];
+    if (requestId.is<const char*>()) {
+        strncpy(_exec_request_id, requestId.as<const char*>(), sizeof(_exec_request_id) - 1);
+        _exec_request_id[sizeof(_exec_request_id) - 1] = '\0';
+    } else if (!requestId.isNull()) {
+        serializeJson(requestId, _exec_request_id, sizeof(_exec_request_id));
+    }
+    
+    // Handle the request. Runs even if the client has gone, so a write the
+    // client asked for still happens.
+    try {
+        this->handleJsonRPC(slot.doc, _rpc_response_doc);
+    } catch (const std::exception& e) {
+        _rpc_response_doc["error"]["code"] = -32000;
+        _rpc_response_doc["error"]["message"] = e.what();
+    }
+    
+    size_t length = serializeJson(_rpc_response_doc, _rpc_buffer, sizeof(_rpc_buffer));
+    _idempotency.complete(slot.cacheEntry, _rpc_buffer, length);
+    
+    // Leave the answer for AsyncTCP to pull and wake it; nobody to answer
+    // frees the slot
+    AsyncClient* client = nullptr;
+    xSemaphoreTakeRecursive(_slot_lock, portMAX_DELAY);
+    if (slot.owner) {
+        memcpy(slot.data, _rpc_buffer, length);
+        slot.length = length;
+        slot.state = SLOT_ANSWERED;
+        client = slot.client;
+    } else {
+        slot.state = SLOT_FREE;
+    }
+    xSemaphoreGiveRecursive(_slot_lock);
+    wakeConnection(client);
+    
+    // Log the request (for debugging)
+    _dashboard_ui->console_log("MCP request processed");
+}
+
+void MCPServer::sendRejection(AsyncWebServerRequest* request, int status, uint32_t retryAfterMs, int code,
+                              const char* message) {
+    char body[160];
+    snprintf(body, sizeof(body),
+             "{\"jsonrpc\":\"2.0\",\"id\":null,\"error\":{\"code\":%d,\"message\":\"%s\"},\"success\":false}",
+             code, message);
+    
+    // Retry-After is in whole seconds, rounded up
+    char retryAfter[12];
+    snprintf(retryAfter, sizeof(retryAfter), "%u", (unsigned)((retryAfterMs + 999) / 1000));
+    
+    AsyncWebServerResponse* response = request->beginResponse(status, "application/json", body);
+    response->addHeader("Retry-After", retryAfter);
+    request->send(response);
+}
+
+void MCPServer::handleMetrics(AsyncWebServerRequest* request) {
+    MetricsWriter metrics(_response_buffer, sizeof(_response_buffer));
+    
+    metrics.family("stamplc_uptime_ms", "counter", "Milliseconds since boot");
+    metrics.sample("stamplc_uptime_ms", millis());
+    
+    const AdmissionControl::Stats& admission = _admission.stats();
+    metrics.family("stamplc_mcp_requests_admitted_total", "counter", "MCP requests admitted");
+    metrics.sample("stamplc_mcp_requests_admitted_total", admission.admitted);
+    metrics.family("stamplc_mcp_requests_rejected_total", "counter", "MCP requests turned away by admission control");
+    metrics.sample("stamplc_mcp_requests_rejected_total", admission.rejectedRate, "reason=\"rate\"");
+    metrics.sample("stamplc_mcp_requests_rejected_total", admission.rejectedBusy, "reason=\"busy\"");
+    
+    metrics.family("stamplc_scheduler_queue_depth", "gauge", "Capability calls waiting per priority");
+    for (int i = 0; i < CommandScheduler::PRIORITY_COUNT; i++) {
+        CommandScheduler::Priority priority = static_cast<CommandScheduler::Priority>(i);
+        char labels[32];
+        snprintf(labels, sizeof(labels), "priority=\"%s\"", CommandScheduler::priorityName(priority));
+        metrics.sample("stamplc_scheduler_queue_depth", _scheduler.stats(priority).depth, labels);
+    }
+    metrics.family("stamplc_scheduler_wait_us_max", "gauge", "Longest queue wait per priority");
+    for (int i = 0; i < CommandScheduler::PRIORITY_COUNT; i++) {
+        CommandScheduler::Priority priority = static_cast<CommandScheduler::Priority>(i);
+        char labels[32];
+        snprintf(labels, sizeof(labels), "priority=\"%s\"", CommandScheduler::priorityName(priority));
+        metrics.sample("stamplc_scheduler_wait_us_max", _scheduler.stats(priority).maxWaitUs, labels);
+    }
+    
+    IdempotencyCache::Stats idempotency = _idempotency.stats();
+    metrics.family("stamplc_idempotency_lookups_total", "counter", "Write requests checked against the retry cache");
+    metrics.sample("stamplc_idempotency_lookups_total", idempotency.hits, "result=\"hit\"");
+    metrics.sample("stamplc_idempotency_lookups_total", idempotency.misses, "result=\"miss\"");
+    metrics.sample("stamplc_idempotency_lookups_total", idempotency.inProgress, "result=\"in_progress\"");
+    
+    ResponseCache::Stats cache = _response_cache.stats();
+    metrics.family("stamplc_read_cache_lookups_total", "counter", "Cacheable reads answered from or missing the cache");
+    metrics.sample("stamplc_read_cache_lookups_total", cache.hits, "result=\"hit\"");
+    metrics.sample("stamplc_read_cache_lookups_total", cache.misses, "result=\"miss\"");
+    
+    metrics.family("stamplc_waits_pending", "gauge", "waitForChange requests currently parked");
+    metrics.sample("stamplc_waits_pending", _wait_list.pending());
+    
+    metrics.family("stamplc_jobs_running", "gauge", "Asynchronous jobs currently running");
+    metrics.sample("stamplc_jobs_running", _jobs.running());
+    
+    if (_history) {
+        HistoryStore::Info history = _history->info();
+        metrics.family("stamplc_history_bytes", "gauge", "Memory reserved for the history store");
+        metrics.sample("stamplc_history_bytes", history.bytes, history.psram ? "heap=\"psram\"" : "heap=\"internal\"");
+        
+        metrics.family("stamplc_history_raw_samples", "gauge", "Raw samples retained per series");
+        for (int s = 0; s < HistoryStore::SERIES_COUNT; s++) {
+            char labels[32];
+            snprintf(labels, sizeof(labels), "series=\"%s\"", HistoryStore::seriesName(static_cast<HistoryStore::Series>(s)));
+            metrics.sample("stamplc_history_raw_samples", history.rawSamples[s], labels);
+        }
+        metrics.family("stamplc_history_raw_bits_per_sample", "gauge", "Compressed size of a raw sample (uncompressed: 64)");
+        for (int s = 0; s < HistoryStore::SERIES_COUNT; s++) {
+            char labels[32];
+            snprintf(labels, sizeof(labels), "series=\"%s\"", HistoryStore::seriesName(static_cast<HistoryStore::Series>(s)));
+            metrics.sample("stamplc_history_raw_bits_per_sample",
+                           history.rawSamples[s] ? (float)history.rawBits[s] / history.rawSamples[s] : 0.0f, labels);
+        }
+    }
+    
+    if (_energy) {
+        EnergyMeter::Reading energy = _energy->read();
+        metrics.family("stamplc_power_watts", "gauge", "Load power from supply voltage and IO socket current");
+        metrics.sample("stamplc_power_watts", energy.power);
+        metrics.family("stamplc_energy_wh_total", "counter", "Load energy since the totals were first stored");
+        metrics.sample("stamplc_energy_wh_total", energy.totalWh);
+        metrics.family("stamplc_relay_energy_wh_total", "counter", "Load energy while each relay was on");
+        for (int r = 0; r < EnergyMeter::RELAY_COUNT; r++) {
+            char labels[16];
+            snprintf(labels, sizeof(labels), "relay=\"%d\"", r);
+            metrics.sample("stamplc_relay_energy_wh_total", energy.relays[r].totalWh, labels);
+        }
+    }
+    
+    if (_relay_stats) {
+        RelayStats::Reading wear = _relay_stats->read();
+        metrics.family("stamplc_relay_switches_total", "counter", "Relay switches since the counters were reset");
+        for (int r = 0; r < RelayStats::RELAY_COUNT; r++) {
+            char labels[16];
+            snprintf(labels, sizeof(labels), "relay=\"%d\"", r);
+            metrics.sample("stamplc_relay_switches_total", wear.relays[r].counters.switches, labels);
+        }
+        metrics.family("stamplc_relay_load_switches_total", "counter", "Relay switches with load current flowing");
+        for (int r = 0; r < RelayStats::RELAY_COUNT; r++) {
+            char labels[16];
+            snprintf(labels, sizeof(labels), "relay=\"%d\"", r);
+            metrics.sample("stamplc_relay_load_switches_total", wear.relays[r].counters.loadSwitches, labels);
+        }
+        metrics.family("stamplc_relay_on_seconds_total", "counter", "Time each relay has been on");
+        for (int r = 0; r < RelayStats::RELAY_COUNT; r++) {
+            char labels[16];
+            snprintf(labels, sizeof(labels), "relay=\"%d\"", r);
+            metrics.sample("stamplc_relay_on_seconds_total", wear.relays[r].counters.onMs / 1000.0, labels);
+        }
+    }
+    
+    if (_anomalies) {
+        uint8_t active = _anomalies->activeMask();
+        metrics.family("stamplc_anomaly_active", "gauge", "1 while a sensor series deviates from its learned profile");
+        for (int s = 0; s < AnomalyDetector::SERIES_COUNT; s++) {
+            char labels[32];
+            snprintf(labels, sizeof(labels), "series=\"%s\"",
+                     AnomalyDetector::seriesName(static_cast<AnomalyDetector::Series>(s)));
+            metrics.sample("stamplc_anomaly_active", (active >> s) & 1, labels);
+        }
+        metrics.family("stamplc_anomaly_events_total", "counter", "Anomalies raised and cleared since boot");
+        metrics.sample("stamplc_anomaly_events_total", _anomalies->lastSequence());
+    }
+    
+    if (_alarms) {
+        int active;
+        int unacknowledged;
+        _alarms->counts(active, unacknowledged);
+        metrics.family("stamplc_alarms_active", "gauge", "Alarms not in the normal state");
+        metrics.sample("stamplc_alarms_active", active);
+        metrics.family("stamplc_alarms_unacknowledged", "gauge", "Active or latched alarms awaiting acknowledgement");
+        metrics.sample("stamplc_alarms_unacknowledged", unacknowledged);
+    }
+    
+    if (_scan) {
+        ScanCycle::Stats scan = _scan->stats();
+        metrics.family("stamplc_scan_period_us", "gauge", "Configured PLC scan period");
+        metrics.sample("stamplc_scan_period_us", scan.periodUs);
+        metrics.family("stamplc_scan_cycles_total", "counter", "PLC scan cycles run");
+        metrics.sample("stamplc_scan_cycles_total", scan.cycles);
+        metrics.family("stamplc_scan_overruns_total", "counter", "PLC scan cycles that took longer than the period");
+        metrics.sample("stamplc_scan_overruns_total", scan.overruns);
+        metrics.family("stamplc_scan_missed_total", "counter", "PLC scan periods that passed without a cycle");
+        metrics.sample("stamplc_scan_missed_total", scan.missed);
+        metrics.family("stamplc_scan_cycle_us_max", "gauge", "Longest PLC scan cycle");
+        metrics.sample("stamplc_scan_cycle_us_max", scan.maxCycleUs);
+        metrics.family("stamplc_scan_jitter_us_max", "gauge", "Largest PLC scan start deviation from the schedule");
+        metrics.sample("stamplc_scan_jitter_us_max", scan.maxJitterUs);
+    }
+    
+    if (_relay_scheduler) {
+        RelayScheduler::Stats schedule = _relay_scheduler->stats();
+        metrics.family("stamplc_schedule_pending", "gauge", "Relay writes waiting in the timing wheel");
+        metrics.sample("stamplc_schedule_pending", schedule.pending);
+        metrics.family("stamplc_schedule_fired_total", "counter", "Delayed and pulsed relay writes made since boot");
+        metrics.sample("stamplc_schedule_fired_total", schedule.fired);
+        metrics.family("stamplc_schedule_recurring_total", "counter", "Recurring schedule matches since boot");
+        metrics.sample("stamplc_schedule_recurring_total", schedule.recurring);
+    }
+    
+    if (_interlock) {
+        metrics.family("stamplc_interlock_rejections_total", "counter", "Relay writes refused by the interlock table");
+        for (int r = 0; r < RelayInterlock::RELAY_COUNT; r++) {
+            char labels[16];
+            snprintf(labels, sizeof(labels), "relay=\"%d\"", r);
+            metrics.sample("stamplc_interlock_rejections_total", _interlock->rejections(r), labels);
+        }
+    }
+    
+    if (_event_log) {
+        metrics.family("stamplc_events_total", "counter", "Events recorded in the sequence-of-events log since boot");
+        metrics.sample("stamplc_events_total", _event_log->head());
+    }
+    
+    if (_sampler) {
+        InputSampler::Stats sampler = _sampler->stats();
+        metrics.family("stamplc_input_samples_total", "counter", "Input samples taken by the high-rate sampler");
+        metrics.sample("stamplc_input_samples_total", sampler.samples);
+        metrics.family("stamplc_input_sample_overruns_total", "counter", "Sample periods missed because the sampler was late");
+        metrics.sample("stamplc_input_sample_overruns_total", sampler.overruns);
+        metrics.family("stamplc_input_sample_read_us_max", "gauge", "Longest time spent reading the inputs");
+        metrics.sample("stamplc_input_sample_read_us_max", sampler.maxReadUs);
+        metrics.family("stamplc_input_port_reads", "gauge", "Inputs read as one expander port (1) or per input (0)");
+        metrics.sample("stamplc_input_port_reads", sampler.portReads ? 1 : 0);
+        metrics.family("stamplc_input_edges_total", "counter", "Input edges captured");
+        metrics.sample("stamplc_input_edges_total", _sampler->edges().head());
+        
+        uint64_t now = esp_timer_get_time();
+        metrics.family("stamplc_input_pulses_total", "counter", "Debounced edges per input since the last resetCounter");
+        for (int i = 0; i < 8; i++) {
+            PulseCounters::Reading reading = _sampler->counters().read(i, now);
+            char labels[40];
+            snprintf(labels, sizeof(labels), "input=\"%d\",edge=\"rising\"", i);
+            metrics.sample("stamplc_input_pulses_total", reading.rising, labels);
+            snprintf(labels, sizeof(labels), "input=\"%d\",edge=\"falling\"", i);
+            metrics.sample("stamplc_input_pulses_total", reading.falling, labels);
+        }
+    }
+    
+    if (_memory_monitor) {
+        MemoryMonitor::Snapshot mem = _memory_monitor->snapshot();
+        
+        metrics.family("stamplc_heap_free_bytes", "gauge", "Free heap");
+        metrics.sample("stamplc_heap_free_bytes", mem.internal.freeBytes, "heap=\"internal\"");
+        if (mem.psramPresent) {
+            metrics.sample("stamplc_heap_free_bytes", mem.psram.freeBytes, "heap=\"psram\"");
+        }
+        metrics.family("stamplc_heap_min_free_bytes", "gauge", "Lowest free heap since boot");
+        metrics.sample("stamplc_heap_min_free_bytes", mem.internal.minFreeBytes, "heap=\"internal\"");
+        if (mem.psramPresent) {
+            metrics.sample("stamplc_heap_min_free_bytes", mem.psram.minFreeBytes, "heap=\"psram\"");
+        }
+        metrics.family("stamplc_heap_largest_free_block_bytes", "gauge", "Largest contiguous free block");
+        metrics.sample("stamplc_heap_largest_free_block_bytes", mem.internal.largestFreeBlock, "heap=\"internal\"");
+        if (mem.psramPresent) {
+            metrics.sample("stamplc_heap_largest_free_block_bytes", mem.psram.largestFreeBlock, "heap=\"psram\"");
+        }
+        metrics.family("stamplc_heap_fragmentation_percent", "gauge", "100 - largest free block / free heap");
+        metrics.sample("stamplc_heap_fragmentation_percent", MemoryMonitor::fragmentation(mem.internal), "heap=\"internal\"");
+        
+        metrics.family("stamplc_task_stack_high_water_bytes", "gauge", "Minimum free stack seen per task");
+        for (int i = 0; i < mem.taskCount; i++) {
+            if (mem.tasks[i].found) {
+                char labels[48];
+                snprintf(labels, sizeof(labels), "task=\"%s\"", mem.tasks[i].name);
+                metrics.sample("stamplc_task_stack_high_water_bytes", mem.tasks[i].highWaterBytes, labels);
+            }
+        }
+        
+        if (AllocTracker::enabled) {
+            metrics.family("stamplc_allocations_total", "counter", "Heap allocations through malloc");
+            metrics.sample("stamplc_allocations_total", mem.allocations.allocs);
+            metrics.family("stamplc_frees_total", "counter", "Heap frees through free");
+            metrics.sample("stamplc_frees_total", mem.allocations.frees);
+        }
+    }
+    
+    request->send(200, "text/plain; version=0.0.4", _response_buffer);
+}
+
+void MCPServer::setupSSEEndpoints() {
+    // Create an event source on /events
+    AsyncEventSource* events = new AsyncEventSource("/events");
+    
+    // Set up client connect handler
+    events->onConnect([this](AsyncEventSourceClient* client) {
+        if (client->lastId()) {
+            _dashboard_ui->console_log("Client reconnected");
+        } else {
+            _dashboard_ui->console_log("New SSE client connected");
+        }
+        
+        // Send initial state to this client
+        char stateStr[512];
+        serializeState(stateStr, sizeof(stateStr));
+        client->send(stateStr, "state", millis(), 1000);
+    });
+    
+    // Add the event source to the server
+    _server->addHandler(events);
+    
+    // Store the event source for later use
+    _event_sources.push_back(events);
+}
+
+void MCPServer::readPower(float& voltage, float& current) {
+    if (_capture && _capture->latest(voltage, current)) {
+        return;
+    }
+    if (_scanner) {
+        IOSnapshot snapshot = _scanner->snapshot();
+        voltage = snapshot.voltage;
+        current = snapshot.current;
+        return;
+    }
+    voltage = _stamplc->getPowerVoltage();
+    current = _stamplc->getIoSocketOutputCurrent();
+}
+
+uint8_t MCPServer::readInputs() {
+    if (_sampler) {
+        return _sampler->inputs();
+    }
+    uint8_t levels = 0;
+    for (int i = 0; i < 8; i++) {
+        if (_stamplc->readPlcInput(i)) {
+            levels |= 1 << i;
+        }
+    }
+    return levels;
+}
+
+size_t MCPServer::serializeState(char* buffer, size_t size) {
+    // Lives on the caller's stack: used from both the loop and AsyncTCP tasks
+    StaticJsonDocument<768> stateDoc;
+    JsonObject state = stateDoc.createNestedObject("state");
+    
+    // Add input states
+    JsonArray inputs = state.createNestedArray("inputs");
+    uint8_t levels = readInputs();
+    for (int i = 0; i < 8; i++) {
+        inputs.add((bool)(levels & (1 << i)));
+    }
+    
+    // Add relay states
+    JsonArray relays = state.createNestedArray("relays");
+    for (int i = 0; i < 4; i++) {
+        relays.add(_stamplc->readPlcRelay(i));
+    }
+    
+    // Add sensor data
+    float voltage;
+    float current;
+    readPower(voltage, current);
+    JsonObject sensors = state.createNestedObject("sensors");
+    sensors["temperature"] = _stamplc->getTemp();
+    sensors["voltage"] = voltage;
+    sensors["current"] = current;
+    
+    if (_energy) {
+        EnergyMeter::Reading reading = _energy->read();
+        JsonObject energy = state.createNestedObject("energy");
+        energy["power"] = reading.power;
+        energy["todayWh"] = reading.today.wh;
+        energy["totalWh"] = reading.totalWh;
+    }
+    
+    // Add timestamp
+    state["timestamp"] = millis();
+    if (_sampler) {
+        state["sampleUs"] = _sampler->lastSampleUs();
+    }
+    
+    return serializeJson(stateDoc, buffer, size);
+}
+
+void MCPServer::broadcastState() {
+    // Skip if no clients connected
+    if (_event_sources.empty() || _event_sources[0]->count() == 0) {
+        return;
+    }
+    
+    char stateStr[512];
+    serializeState(stateStr, sizeof(stateStr));
+    
+    // Send to all connected clients
+    for (auto& es : _event_sources) {
+        es->send(stateStr, "state", millis(), 1000);
+    }
+}
+
+void MCPServer::broadcastEdges() {
+    if (!_sampler) {
+        return;
+    }
+    
+    // Nobody listening: skip ahead rather than replay a backlog on connect
+    if (_event_sources.empty() || _event_sources[0]->count() == 0) {
+        _sse_edge_cursor = _sampler->edges().head();
+        return;
+    }
+    
+    // A few frames per loop pass at most; the rest goes out next pass
+    for (int frame = 0; frame < 4; frame++) {
+        InputEdge edges[16];
+        uint32_t lost = 0;
+        int count = _sampler->edges().read(_sse_edge_cursor, edges, 16, &lost);
+        if (count == 0 && lost == 0) {
+            return;
+        }
+        
+        StaticJsonDocument<1024> edgeDoc;
+        JsonArray list = edgeDoc.createNestedArray("edges");
+        for (int i = 0; i < count; i++) {
+            JsonObject edge = list.createNestedObject();
+            edge["channel"] = edges[i].channel;
+            edge["level"] = (bool)edges[i].level;
+            edge["timestampUs"] = edges[i].timestampUs;
+        }
+        edgeDoc["lost"] = lost;
+        
+        char edgeStr[1024];
+        serializeJson(edgeDoc, edgeStr, sizeof(edgeStr));
+        for (auto& es : _event_sources) {
+            es->send(edgeStr, "edges", millis());
+        }
+    }
+}
+
+// Shared by the SSE anomaly stream and getAnomalies
+static void writeAnomaly(JsonObject entry, const AnomalyDetector::Event& event) {
+    entry["sequence"] = event.sequence;
+    entry["timestamp"] = event.timestamp;
+    entry["series"] = AnomalyDetector::seriesName(event.series);
+    entry["active"] = event.active;
+    entry["relays"] = event.relays;
+    entry["value"] = event.value;
+    entry["expected"] = event.expected;
+    entry["deviation"] = event.deviation;
+}
+
+void MCPServer::broadcastAnomalies() {
+    if (!_anomalies || _anomalies->lastSequence() == _sse_anomaly_sequence) {
+        return;
+    }
+    
+    AnomalyDetector::Event events[AnomalyDetector::MAX_EVENTS];
+    int count = _anomalies->events(_sse_anomaly_sequence, events, AnomalyDetector::MAX_EVENTS);
+    for (int i = 0; i < count; i++) {
+        _sse_anomaly_sequence = events[i].sequence;
+        if (_event_sources.empty() || _event_sources[0]->count() == 0) {
+            continue;
+        }
+        
+        StaticJsonDocument<256> anomalyDoc;
+        writeAnomaly(anomalyDoc.to<JsonObject>(), events[i]);
+        char anomalyStr[256];
+        serializeJson(anomalyDoc, anomalyStr, sizeof(anomalyStr));
+        for (auto& es : _event_sources) {
+            es->send(anomalyStr, "anomaly", millis());
+        }
+    }
+}
+
+// Shared by the SSE alarm stream and getAlarms
+static void writeAlarmEvent(JsonObject entry, const AlarmManager::Event& event, const char* name) {
+    entry["sequence"] = event.sequence;
+    entry["timestamp"] = event.timestamp;
+    entry["id"] = event.id;
+    if (name) {
+        entry["name"] = name;
+    }
+    entry["state"] = AlarmManager::stateName(event.state);
+    entry["value"] = event.value;
+}
+
+void MCPServer::broadcastAlarms() {
+    if (!_alarms || _alarms->lastSequence() == _sse_alarm_sequence) {
+        return;
+    }
+    
+    AlarmManager::Event events[8];
+    int count = _alarms->events(_sse_alarm_sequence, events, 8);
+    for (int i = 0; i < count; i++) {
+        _sse_alarm_sequence = events[i].sequence;
+        if (_event_sources.empty() || _event_sources[0]->count() == 0) {
+            continue;
+        }
+        
+        AlarmManager::Status status;
+        _alarms->status(events[i].id, status);
+        StaticJsonDocument<256> alarmDoc;
+        writeAlarmEvent(alarmDoc.to<JsonObject>(), events[i], status.config.name);
+        char alarmStr[256];
+        serializeJson(alarmDoc, alarmStr, sizeof(alarmStr));
+        for (auto& es : _event_sources) {
+            es->send(alarmStr, "alarm", millis());
+        }
+    }
+}
+
+// Shared by the SSE pid stream and getPid
+static void writePidStatus(JsonObject loop, const PidController::Status& status) {
+    loop["value"] = status.value;
+    loop["setpoint"] = status.setpoint;
+    loop["error"] = status.error;
+    loop["p"] = status.p;
+    loop["i"] = status.i;
+    loop["d"] = status.d;
+    loop["output"] = status.output;
+    loop["on"] = status.relay;
+    loop["kp"] = status.config.kp;
+    loop["ki"] = status.config.ki;
+    loop["kd"] = status.config.kd;
+}
+
+void MCPServer::broadcastPid() {
+    if (!_pid || _event_sources.empty() || _event_sources[0]->count() == 0) {
+        return;
+    }
+    
+    for (int relay = 0; relay < PidController::MAX_LOOPS; relay++) {
+        PidController::Status status;
+        if (!_pid->status(relay, status) || !status.running) {
+            continue;
+        }
+        
+        StaticJsonDocument<384> pidDoc;
+        JsonObject loop = pidDoc.to<JsonObject>();
+        loop["relay"] = relay;
+        writePidStatus(loop, status);
+        char pidStr[384];
+        serializeJson(pidDoc, pidStr, sizeof(pidStr));
+        for (auto& es : _event_sources) {
+            es->send(pidStr, "pid", millis());
+        }
+    }
+}
+
+void MCPServer::broadcastCapture() {
+    if (!_capture) {
+        return;
+    }
+    
+    WaveformCapture::Status status = _capture->status();
+    if (status.captures == _sse_captures) {
+        return;
+    }
+    _sse_captures = status.captures;
+    if (_event_sources.empty() || _event_sources[0]->count() == 0) {
+        return;
+    }
+    
+    // Announce only; the samples are fetched with getCapture
+    StaticJsonDocument<256> captureDoc;
+    captureDoc["captures"] = status.captures;
+    captureDoc["trigger"] = WaveformCapture::triggerName(status.config.trigger);
+    captureDoc["channel"] = status.config.channel;
+    captureDoc["triggerUs"] = status.triggerUs;
+    captureDoc["samples"] = status.count;
+    char captureStr[256];
+    serializeJson(captureDoc, captureStr, sizeof(captureStr));
+    for (auto& es : _event_sources) {
+        es->send(captureStr, "capture", millis());
+    }
+}
+
+void MCPServer::handleJsonRPC(JsonDocument& request, JsonDocument& response) {
+    // Check if this is a JSON-RPC request
+    if (!request.containsKey("method")) {
+        response["error"]["code"] = -32600;
+        response["error"]["message"] = "Invalid Request - missing method";
+        return;
+    }
+    
+    // Get the method name
+    const char* methodName = request["method"] | "";
+    
+    // Notify about incoming command
     if (_commandReceivedCallback) {
         _commandReceivedCallback();
     }
@@ -359,259 +1714,1669 @@ void MCPServer::handleJsonRPC(JsonDocument& request, JsonDocument& response) {
     // Find the capability
     bool found = false;
     for (const auto& capability : _capabilities) {
-        if (capability.name == methodName.c_str()) {
-            // Create temp JsonDocument objects for params and result
-            DynamicJsonDocument paramsDoc(1024);
-            DynamicJsonDocument resultDoc(1024);
+        if (capability.name == methodName) {
+            // Reset the pooled params and result documents
+            _params_doc.clear();
+            _result_doc.clear();
             
             if (request.containsKey("params")) {
-                paramsDoc = request["params"];
+                _params_doc.set(request["params"]);
+            }
+            
+            // Execute the handler
+            capability.handler(_params_doc, _result_doc);
+            
+            // ArduinoJson drops what does not fit without an error; never
+            // answer with a silently truncated result
+            if (_result_doc.overflowed()) {
+                throw std::runtime_error("Result too large for one response");
+            }
+            
+            if (capability.cacheEntry >= 0) {
+                // Keep the serialized result for later reads within the bound
+                char text[ResponseCache::MAX_RESULT];
+                if (measureJson(_result_doc) < sizeof(text)) {
+                    size_t length = serializeJson(_result_doc, text, sizeof(text));
+                    _response_cache.store(capability.cacheEntry, text, length, millis());
+                }
+                _result_doc["cacheAge"] = 0;
+            } else if (capability.access == AdmissionControl::ACCESS_WRITE) {
+                // Relay, time or tone changes can change what reads return
+                _response_cache.invalidate();
+            }
+            
+            // Copy result back to response
+            response["result"] = _result_doc;
+            found = true;
+            break;
+        }
+    }
+    
+    if (!found) {
+        response["error"]["code"] = -32601;
+        char message[96];
+        snprintf(message, sizeof(message), "Method not found: %s", methodName);
+        response["error"]["message"] = message;
+    } else {
+        response["success"] = true;
+    }
+}
+
+// ==== Capability Handlers ====
+
+void MCPServer::handleReadInput(JsonDocument& params, JsonDocument& result) {
+    int inputNumber = params["inputNumber"];
+    
+    // Validate input number
+    if (inputNumber < 0 || inputNumber >= 8) {
+        throw std::runtime_error("Invalid input number (must be 0-7)");
+    }
+    
+    // Read the debounced level, the same one edges and waits see
+    bool state = readInputs() & (1 << inputNumber);
+    
+    // Return the result
+    result["state"] = state;
+}
+
+void MCPServer::handleWriteRelay(JsonDocument& params, JsonDocument& result) {
+    int relayNumber = params["relayNumber"];
+    bool state = params["state"];
+    
+    // Validate relay number
+    if (relayNumber < 0 || relayNumber >= 4) {
+        throw std::runtime_error("Invalid relay number (must be 0-3)");
+    }
+    
+    // Set the relay in the next output phase of the scan, or right here
+    // without one
+    if (_scan) {
+        // Two periods cover a write queued just after an output phase, the
+        // margin a scan held up by higher-priority tasks
+        uint32_t ticket = _scan->writeRelay(relayNumber, state, _exec_client_ip, _exec_request_id);
+        if (!_scan->waitApplied(ticket, 2 * _scan->periodMs() + 50)) {
+            if (_scan->withdraw(relayNumber, ticket)) {
+                throw std::runtime_error("Relay write not applied by the scan cycle (withdrawn)");
+            }
+            // An output phase has it but has not finished; the outcome,
+            // including an interlock refusal, shows in getEvents
+            result["success"] = true;
+            result["pending"] = true;
+            return;
+        }
+        RelayInterlock::Rejection rejection;
+        if (_interlock && _scan->rejected(relayNumber, ticket, rejection)) {
+            // Held back by a minimum time, the write stays queued and is
+            // made once that time has passed
+            if (rejection.reason == RelayInterlock::REASON_MIN_ON ||
+                rejection.reason == RelayInterlock::REASON_MIN_OFF) {
+                result["success"] = true;
+                result["pending"] = true;
+                result["reason"] = RelayInterlock::reasonName(rejection.reason);
+                return;
+            }
+            char message[80];
+            _interlock->describe(relayNumber, state, rejection, message, sizeof(message));
+            throw std::runtime_error(message);
+        }
+    } else {
+        _stamplc->writePlcRelay(relayNumber, state);
+        if (_event_log) {
+            _event_log->record(EventLog::TYPE_RELAY_WRITE, relayNumber, state, state, esp_timer_get_time(),
+                               _exec_client_ip, _exec_request_id);
+        }
+    }
+    
+    // Return success
+    result["success"] = true;
+}
+
+void MCPServer::handleReadRelay(JsonDocument& params, JsonDocument& result) {
+    int relayNumber = params["relayNumber"];
+    
+    // Validate relay number
+    if (relayNumber < 0 || relayNumber >= 4) {
+        throw std::runtime_error("Invalid relay number (must be 0-3)");
+    }
+    
+    // Read the relay
+    bool state = _stamplc->readPlcRelay(relayNumber);
+    
+    // Return the result
+    result["state"] = state;
+}
+
+void MCPServer::handleConsoleLog(JsonDocument& params, JsonDocument& result) {
+    const char* message = params["message"] | "";
+    
+    // Log the message
+    _dashboard_ui->console_log(message);
+    
+    // Return success
+    result["success"] = true;
+}
+
+void MCPServer::handleGetSystemInfo(JsonDocument& params, JsonDocument& result) {
+    // Get system information
+    result["device"] = "M5StamPLC";
+    result["freeHeap"] = ESP.getFreeHeap();
+    result["uptime"] = millis();
+    
+    // Format IP and SSID into local buffers; WiFi.localIP().toString() and
+    // WiFi.SSID() both return heap-backed Strings
+    char ipStr[16];
+    IPAddress ip = WiFi.localIP();
+    snprintf(ipStr, sizeof(ipStr), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+    result["ip"] = ipStr;
+    
+    char ssid[33] = "";
+    wifi_ap_record_t apInfo;
+    if (esp_wifi_sta_get_ap_info(&apInfo) == ESP_OK) {
+        memcpy(ssid, apInfo.ssid, sizeof(ssid) - 1);
+        ssid[sizeof(ssid) - 1] = '\0';
+    }
+    result["wifiSSID"] = ssid;
+    result["wifiRSSI"] = WiFi.RSSI();
+    
+    // Add sensor readings to the system info
+    float voltage;
+    float current;
+    readPower(voltage, current);
+    JsonObject sensors = result.createNestedObject("sensors");
+    sensors["temperature"] = _stamplc->getTemp();
+    sensors["voltage"] = voltage;
+    sensors["current"] = current;
+}
+
+void MCPServer::handleGetIOState(JsonDocument& params, JsonDocument& result) {
+    // Create arrays for inputs and relays
+    JsonArray inputs = result.createNestedArray("inputs");
+    JsonArray relays = result.createNestedArray("relays");
+    
+    // Read all inputs
+    uint8_t levels = readInputs();
+    for (int i = 0; i < 8; i++) {
+        inputs.add((bool)(levels & (1 << i)));
+    }
+    
+    // Read all relays
+    for (int i = 0; i < 4; i++) {
+        relays.add(_stamplc->readPlcRelay(i));
+    }
+}
+
+void MCPServer::handleTone(JsonDocument& params, JsonDocument& result) {
+    int frequency = params["frequency"];
+    int duration = params["duration"];
+    
+    // Validate parameters
+    if (frequency < 0 || frequency > 20000) {
+        throw std::runtime_error("Invalid frequency (must be 0-20000)");
+    }
+    
+    if (duration < 0 || duration > 10000) {
+        throw std::runtime_error("Invalid duration (must be 0-10000)");
+    }
+    
+    // The token goes into every notification as stored text, so it has to
+    // fit whole
+    bool async = params["async"] | false;
+    char tokenText[JobManager::MAX_TOKEN_TEXT] = "";
+    JsonVariant token = params["_meta"]["progressToken"];
+    if (async && !token.isNull()) {
+        if (measureJson(token) >= sizeof(tokenText)) {
+            throw std::runtime_error("progressToken too long (at most 39 characters as JSON)");
+        }
+        serializeJson(token, tokenText, sizeof(tokenText));
+    }
+    
+    // Play the tone
+    _stamplc->tone(frequency, duration);
+    
+    // Asynchronous: completion is reported as notifications/progress over SSE
+    if (async) {
+        uint32_t jobId = _jobs.start("tone", duration, stepToneJob, this, duration, tokenText, millis());
+        if (jobId == 0) {
+            _stamplc->noTone();
+            throw std::runtime_error("Too many running jobs");
+        }
+        result["jobId"] = jobId;
+    }
+    
+    // Return success
+    result["success"] = true;
+}
+
+void MCPServer::handleGetTime(JsonDocument& params, JsonDocument& result) {
+    // Get the current time
+    struct tm time;
+    _stamplc->getRtcTime(&time);
+    
+    // Format the result
+    result["year"] = time.tm_year + 1900;
+    result["month"] = time.tm_mon + 1;
+    result["day"] = time.tm_mday;
+    result["hour"] = time.tm_hour;
+    result["minute"] = time.tm_min;
+    result["second"] = time.tm_sec;
+    
+    // Format string representations
+    char timeStr[9];
+    char dateStr[11];
+    snprintf(timeStr, sizeof(timeStr), "%02d:%02d:%02d", time.tm_hour, time.tm_min, time.tm_sec);
+    snprintf(dateStr, sizeof(dateStr), "%04d.%02d.%02d", time.tm_year + 1900, time.tm_mon + 1, time.tm_mday);
+    
+    result["timeString"] = timeStr;
+    result["dateString"] = dateStr;
+}
+
+void MCPServer::handleSetTime(JsonDocument& params, JsonDocument& result) {
+    // Get parameters
+    int year = params["year"];
+    int month = params["month"];
+    int day = params["day"];
+    int hour = params["hour"];
+    int minute = params["minute"];
+    int second = params["second"];
+    
+    // Validate parameters
+    if (year < 2000 || year > 2099) {
+        throw std::runtime_error("Invalid year (must be 2000-2099)");
+    }
+    
+    if (month < 1 || month > 12) {
+        throw std::runtime_error("Invalid month (must be 1-12)");
+    }
+    
+    if (day < 1 || day > 31) {
+        throw std::runtime_error("Invalid day (must be 1-31)");
+    }
+    
+    if (hour < 0 || hour > 23) {
+        throw std::runtime_error("Invalid hour (must be 0-23)");
+    }
+    
+    if (minute < 0 || minute > 59) {
+        throw std::runtime_error("Invalid minute (must be 0-59)");
+    }
+    
+    if (second < 0 || second > 59) {
+        throw std::runtime_error("Invalid second (must be 0-59)");
+    }
+    
+    // Create a tm structure
+    struct tm time;
+    time.tm_year = year - 1900;
+    time.tm_mon = month - 1;
+    time.tm_mday = day;
+    time.tm_hour = hour;
+    time.tm_min = minute;
+    time.tm_sec = second;
+    
+    // Set the time
+    _stamplc->setRtcTime(&time);
+    
+    // Return success
+    result["success"] = true;
+}
+
+void MCPServer::handleGetTemperature(JsonDocument& params, JsonDocument& result) {
+    // Get the temperature from M5StamPLC
+    float temperature = _stamplc->getTemp();
+    
+    // Return the result
+    result["temperature"] = temperature;
+    result["unit"] = "Celsius";
+}
+
+void MCPServer::handleGetPowerVoltage(JsonDocument& params, JsonDocument& result) {
+    // Get the power voltage from M5StamPLC
+    float voltage;
+    float current;
+    readPower(voltage, current);
+    
+    // Return the result
+    result["voltage"] = voltage;
+    result["unit"] = "Volts";
+}
+
+void MCPServer::handleGetIoCurrent(JsonDocument& params, JsonDocument& result) {
+    // Get the IO socket output current from M5StamPLC
+    float voltage;
+    float current;
+    readPower(voltage, current);
+    
+    // Return the result
+    result["current"] = current;
+    result["unit"] = "Amps";
+}
+
+void MCPServer::handleGetSensorData(JsonDocument& params, JsonDocument& result) {
+    // Get all sensor data at once
+    float temperature = _stamplc->getTemp();
+    float voltage;
+    float current;
+    readPower(voltage, current);
+    
+    // Create a nested sensor object
+    JsonObject sensors = result.createNestedObject("sensors");
+    
+    // Add all sensor readings
+    sensors["temperature"] = temperature;
+    sensors["temperatureUnit"] = "Celsius";
+    
+    sensors["voltage"] = voltage;
+    sensors["voltageUnit"] = "Volts";
+    
+    sensors["current"] = current;
+    sensors["currentUnit"] = "Amps";
+}
+
+static void addHeapStats(JsonObject obj, const MemoryMonitor::HeapStats& stats) {
+    obj["total"] = stats.totalBytes;
+    obj["free"] = stats.freeBytes;
+    obj["minFree"] = stats.minFreeBytes;
+    obj["largestFreeBlock"] = stats.largestFreeBlock;
+    obj["minLargestFreeBlock"] = stats.minLargestFreeBlock;
+    obj["allocatedBlocks"] = stats.allocatedBlocks;
+    obj["freeBlocks"] = stats.freeBlocks;
+    obj["fragmentation"] = MemoryMonitor::fragmentation(stats);
+}
+
+void MCPServer::handleGetMemoryStats(JsonDocument& params, JsonDocument& result) {
+    if (!_memory_monitor) {
+        throw std::runtime_error("Memory monitor not available");
+    }
+    
+    MemoryMonitor::Snapshot mem = _memory_monitor->snapshot();
+    
+    // Age of the background sample the figures come from
+    result["sampleAge"] = millis() - mem.timestamp;
+    
+    addHeapStats(result.createNestedObject("internal"), mem.internal);
+    
+    JsonObject psram = result.createNestedObject("psram");
+    psram["present"] = mem.psramPresent;
+    if (mem.psramPresent) {
+        addHeapStats(psram, mem.psram);
+    }
+    
+    // Minimum free stack (bytes) each watched task has had since it started
+    JsonArray tasks = result.createNestedArray("tasks");
+    for (int i = 0; i < mem.taskCount; i++) {
+        if (mem.tasks[i].found) {
+            JsonObject task = tasks.createNestedObject();
+            task["name"] = mem.tasks[i].name;
+            task["stackHighWater"] = mem.tasks[i].highWaterBytes;
+        }
+    }
+    
+    // Allocation counters, only present in the alloc-tracking build
+    if (AllocTracker::enabled) {
+        JsonObject allocations = result.createNestedObject("allocations");
+        allocations["allocs"] = mem.allocations.allocs;
+        allocations["frees"] = mem.allocations.frees;
+        allocations["failures"] = mem.allocations.failures;
+        allocations["bytes"] = mem.allocations.bytes;
+        
+        for (int i = 0; i < AllocTracker::SCOPE_COUNT; i++) {
+            AllocTracker::ScopeKind kind = static_cast<AllocTracker::ScopeKind>(i);
+            AllocTracker::ScopeStats stats = AllocTracker::scopeStats(kind);
+            JsonObject scope = allocations.createNestedObject(AllocTracker::scopeName(kind));
+            scope["last"] = stats.last;
+            scope["peak"] = stats.peak;
+            scope["samples"] = stats.samples;
+            scope["dirty"] = stats.dirty;
+        }
+    }
+}
+
+bool MCPServer::stepToneJob(void* context, uint32_t arg, uint32_t elapsedMs, bool cancel) {
+    MCPServer* self = static_cast<MCPServer*>(context);
+    if (cancel) {
+        self->_stamplc->noTone();
+        return true;
+    }
+    // The tone stops by itself; the job only tracks its duration in arg
+    return elapsedMs >= arg;
+}
+
+void MCPServer::onJobProgress(void* context, const JobManager::Progress& progress) {
+    MCPServer* self = static_cast<MCPServer*>(context);
+    if (self->_event_sources.empty() || self->_event_sources[0]->count() == 0) {
+        return;
+    }
+    
+    StaticJsonDocument<384> notification;
+    notification["jsonrpc"] = "2.0";
+    notification["method"] = "notifications/progress";
+    JsonObject params = notification.createNestedObject("params");
+    if (progress.tokenText[0]) {
+        params["progressToken"] = serialized(progress.tokenText);
+    } else {
+        params["progressToken"] = progress.id;
+    }
+    params["progress"] = progress.progress;
+    params["total"] = progress.total;
+    params["message"] = JobManager::stateName(progress.state);
+    params["jobId"] = progress.id;
+    params["kind"] = progress.kind;
+    
+    char buffer[384];
+    serializeJson(notification, buffer, sizeof(buffer));
+    for (auto& es : self->_event_sources) {
+        es->send(buffer, "message", millis());
+    }
+}
+
+void MCPServer::handleGetEdges(JsonDocument& params, JsonDocument& result) {
+    if (!_sampler) {
+        throw std::runtime_error("Input sampler not available");
+    }
+    
+    int limit = params["limit"] | 32;
+    if (limit < 1 || limit > 40) {
+        throw std::runtime_error("Invalid limit (must be 1-40)");
+    }
+    
+    // Without since, return the most recent edges
+    const EdgeRing& ring = _sampler->edges();
+    uint32_t head = ring.head();
+    uint32_t cursor = head > (uint32_t)limit ? head - limit : 0;
+    if (!params["since"].isNull()) {
+        cursor = params["since"];
+    }
+    
+    InputEdge edges[40];
+    uint32_t lost = 0;
+    int count = ring.read(cursor, edges, limit, &lost);
+    
+    JsonArray list = result.createNestedArray("edges");
+    for (int i = 0; i < count; i++) {
+        JsonObject edge = list.createNestedObject();
+        edge["sequence"] = edges[i].sequence;
+        edge["channel"] = edges[i].channel;
+        edge["level"] = (bool)edges[i].level;
+        edge["timestampUs"] = edges[i].timestampUs;
+    }
+    result["next"] = cursor;
+    result["lost"] = lost;
+    result["nowUs"] = esp_timer_get_time();
+}
+
+void MCPServer::handleGetEvents(JsonDocument& params, JsonDocument& result) {
+    if (!_event_log) {
+        throw std::runtime_error("Event log not available");
+    }
+    
+    int limit = params["limit"] | 16;
+    if (limit < 1 || limit > 16) {
+        throw std::runtime_error("Invalid limit (must be 1-16)");
+    }
+    
+    // Without since, return the most recent events
+    uint32_t head = _event_log->head();
+    uint32_t cursor = head > (uint32_t)limit ? head - limit : 0;
+    if (!params["since"].isNull()) {
+        cursor = params["since"];
+    }
+    
+    EventLog::Event events[16];
+    uint32_t lost = 0;
+    int count = _event_log->read(cursor, events, limit, &lost);
+    
+    JsonArray list = result.createNestedArray("events");
+    for (int i = 0; i < count; i++) {
+        const EventLog::Event& event = events[i];
+        JsonObject entry = list.createNestedObject();
+        entry["sequence"] = event.sequence;
+        entry["timestampUs"] = event.timestampUs;
+        entry["type"] = EventLog::typeName(event.type);
+        entry["channel"] = event.channel;
+        entry["state"] = event.state;
+        entry["value"] = event.value;
+        if (event.type == EventLog::TYPE_INTERLOCK) {
+            entry["reason"] = RelayInterlock::reasonName(static_cast<RelayInterlock::Reason>(event.value));
+        }
+        if (event.clientIp) {
+            char client[16];
+            snprintf(client, sizeof(client), "%u.%u.%u.%u", (unsigned)(event.clientIp & 0xFF),
+                     (unsigned)((event.clientIp >> 8) & 0xFF), (unsigned)((event.clientIp >> 16) & 0xFF),
+                     (unsigned)(event.clientIp >> 24));
+            entry["client"] = client;
+        }
+        if (event.requestId[0]) {
+            entry["requestId"] = (char*)event.requestId;
+        }
+    }
+    result["next"] = cursor;
+    result["lost"] = lost;
+    result["nowUs"] = esp_timer_get_time();
+}
+
+void MCPServer::handleArmCapture(JsonDocument& params, JsonDocument& result) {
+    if (!_capture) {
+        throw std::runtime_error("Waveform capture not available");
+    }
+    
+    WaveformCapture::Config config = {};
+    if (!WaveformCapture::parseTrigger(params["trigger"] | "", config.trigger)) {
+        throw std::runtime_error("Invalid trigger (must be input, relay, current or voltage)");
+    }
+    
+    int channel = params["channel"] | 0;
+    if (config.trigger == WaveformCapture::TRIGGER_INPUT && (channel < 0 || channel >= 8)) {
+        throw std::runtime_error("Invalid channel (must be 0-7)");
+    }
+    if (config.trigger == WaveformCapture::TRIGGER_RELAY && (channel < 0 || channel >= 4)) {
+        throw std::runtime_error("Invalid channel (must be 0-3)");
+    }
+    config.channel = channel;
+    
+    if (!WaveformCapture::parseEdge(params["edge"] | "any", config.edge)) {
+        throw std::runtime_error("Invalid edge (must be rising, falling or any)");
+    }
+    
+    if (config.trigger == WaveformCapture::TRIGGER_CURRENT || config.trigger == WaveformCapture::TRIGGER_VOLTAGE) {
+        if (!params["threshold"].is<float>()) {
+            throw std::runtime_error("Missing threshold");
+        }
+        config.threshold = params["threshold"];
+    }
+    
+    int pre = params["pre"] | (int)(WaveformCapture::SAMPLES / 4);
+    int post = params["post"] | (int)(WaveformCapture::SAMPLES - WaveformCapture::SAMPLES / 4);
+    if (pre < 0 || post < 1 || pre + post > (int)WaveformCapture::SAMPLES) {
+        throw std::runtime_error("Invalid pre/post (post at least 1, together at most the ring size)");
+    }
+    config.pre = pre;
+    config.post = post;
+    
+    _capture->arm(config);
+    
+    WaveformCapture::Stats stats = _capture->stats();
+    result["success"] = true;
+    result["periodUs"] = stats.periodUs;
+    result["pre"] = pre;
+    result["post"] = post;
+}
+
+void MCPServer::handleGetCapture(JsonDocument& params, JsonDocument& result) {
+    if (!_capture) {
+        throw std::runtime_error("Waveform capture not available");
+    }
+    
+    int offset = params["offset"] | 0;
+    int limit = params["limit"] | 150;
+    if (offset < 0 || offset >= (int)WaveformCapture::SAMPLES) {
+        throw std::runtime_error("Invalid offset");
+    }
+    if (limit < 1 || limit > 150) {
+        throw std::runtime_error("Invalid limit (must be 1-150)");
+    }
+    
+    WaveformCapture::Status status = _capture->status();
+    WaveformCapture::Stats stats = _capture->stats();
+    result["state"] = WaveformCapture::stateName(status.state);
+    result["trigger"] = WaveformCapture::triggerName(status.config.trigger);
+    result["channel"] = status.config.channel;
+    result["pre"] = status.config.pre;
+    result["post"] = status.config.post;
+    result["captures"] = status.captures;
+    result["periodUs"] = stats.periodUs;
+    result["overruns"] = stats.overruns;
+    result["maxReadUs"] = stats.maxReadUs;
+    if (status.state == WaveformCapture::STATE_TRIGGERED || status.state == WaveformCapture::STATE_COMPLETE) {
+        result["triggerUs"] = status.triggerUs;
+    }
+    if (status.state != WaveformCapture::STATE_COMPLETE) {
+        return;
+    }
+    
+    WaveformCapture::Sample samples[150];
+    int count = _capture->read(offset, samples, limit);
+    
+    // Samples go out as [us from trigger, voltage, current] tuples written
+    // straight to text, up to the budget; more covers the rest
+    size_t length = 0;
+    int written = 0;
+    _bulk_text[length++] = '[';
+    for (; written < count; written++) {
+        const WaveformCapture::Sample& sample = samples[written];
+        char row[48];
+        int rowLength = snprintf(row, sizeof(row), "%s[%d,%.4g,%.4g]", written ? "," : "",
+                                 (int)(int32_t)(sample.timeUs - (uint32_t)status.triggerUs), sample.voltage,
+                                 sample.current);
+        if (length + rowLength + 1 > BULK_TEXT_BUDGET) {
+            break;
+        }
+        memcpy(_bulk_text + length, row, rowLength);
+        length += rowLength;
+    }
+    _bulk_text[length++] = ']';
+    _bulk_text[length] = '\0';
+    
+    result["columns"] = serialized("[\"dtUs\",\"voltage\",\"current\"]");
+    result["count"] = status.count;
+    result["offset"] = offset;
+    result["more"] = offset + written < status.count;
+    result["samples"] = serialized(_bulk_text, length);
+}
+
+void MCPServer::handleConfigureDebounce(JsonDocument& params, JsonDocument& result) {
+    if (!_sampler) {
+        throw std::runtime_error("Input sampler not available");
+    }
+    
+    if (!params["ms"].isNull()) {
+        int ms = params["ms"];
+        if (ms < 0 || ms > (int)_sampler->maxDebounceMs()) {
+            throw std::runtime_error("Invalid debounce time (must be 0 to the sampler's maximum)");
+        }
+        
+        // Without inputNumber the setting applies to every input
+        int inputNumber = params["inputNumber"] | -1;
+        if (inputNumber < -1 || inputNumber >= 8) {
+            throw std::runtime_error("Invalid input number (must be 0-7)");
+        }
+        _sampler->setDebounceMs(inputNumber, ms);
+    }
+    
+    JsonArray debounce = result.createNestedArray("debounceMs");
+    for (int i = 0; i < 8; i++) {
+        debounce.add(_sampler->debounceMs(i));
+    }
+    result["maxMs"] = _sampler->maxDebounceMs();
+}
+
+void MCPServer::handleGetCounters(JsonDocument& params, JsonDocument& result) {
+    if (!_sampler) {
+        throw std::runtime_error("Input sampler not available");
+    }
+    
+    int inputNumber = params["inputNumber"] | -1;
+    if (inputNumber < -1 || inputNumber >= 8) {
+        throw std::runtime_error("Invalid input number (must be 0-7)");
+    }
+    
+    uint64_t now = esp_timer_get_time();
+    JsonArray counters = result.createNestedArray("counters");
+    for (int i = 0; i < 8; i++) {
+        if (inputNumber != -1 && inputNumber != i) {
+            continue;
+        }
+        PulseCounters::Reading reading = _sampler->counters().read(i, now);
+        
+        JsonObject counter = counters.createNestedObject();
+        counter["inputNumber"] = i;
+        counter["edge"] = PulseCounters::modeName(reading.mode);
+        counter["count"] = reading.count;
+        counter["rising"] = reading.rising;
+        counter["falling"] = reading.falling;
+        counter["periodUs"] = reading.periodUs;
+        counter["frequencyHz"] = reading.frequencyHz;
+        counter["lastEdgeUs"] = reading.lastEdgeUs;
+    }
+    result["nowUs"] = now;
+}
+
+void MCPServer::handleResetCounter(JsonDocument& params, JsonDocument& result) {
+    if (!_sampler) {
+        throw std::runtime_error("Input sampler not available");
+    }
+    
+    int inputNumber = params["inputNumber"] | -1;
+    if (inputNumber < -1 || inputNumber >= 8) {
+        throw std::runtime_error("Invalid input number (must be 0-7)");
+    }
+    uint32_t value = params["value"] | 0;
+    
+    if (!params["edge"].isNull()) {
+        PulseCounters::Mode mode;
+        if (!PulseCounters::parseMode(params["edge"] | "", mode)) {
+            throw std::runtime_error("Invalid edge (must be rising, falling or both)");
+        }
+        _sampler->setCounterMode(inputNumber, mode);
+    }
+    
+    for (int i = 0; i < 8; i++) {
+        if (inputNumber == -1 || inputNumber == i) {
+            _sampler->counters().reset(i, value);
+        }
+    }
+    
+    result["success"] = true;
+}
+
+// History windows are uptime milliseconds; negative values count back from now
+static void parseWindow(JsonDocument& params, uint32_t now, uint32_t& from, uint32_t& to) {
+    double fromParam = params["from"] | -3600000.0;
+    double toParam = params["to"] | 0.0;
+    from = fromParam < 0 ? now + (int32_t)fromParam : (uint32_t)fromParam;
+    to = toParam <= 0 ? now + (int32_t)toParam : (uint32_t)toParam;
+}
+
+void MCPServer::handleGetHistory(JsonDocument& params, JsonDocument& result) {
+    if (!_history) {
+        throw std::runtime_error("History not available");
+    }
+    
+    HistoryStore::Series series;
+    if (!HistoryStore::parseSeries(params["series"] | "", series)) {
+        throw std::runtime_error("Invalid series (must be temperature, voltage, current, inputs or relays)");
+    }
+    
+    uint32_t now = millis();
+    uint32_t from;
+    uint32_t to;
+    parseWindow(params, now, from, to);
+    
+    HistoryStore::Resolution resolution;
+    const char* resolutionName = params["resolution"] | "auto";
+    if (strcmp(resolutionName, "auto") == 0) {
+        resolution = _history->finestCovering(series, from);
+    } else if (!HistoryStore::parseResolution(resolutionName, resolution)) {
+        throw std::runtime_error("Invalid resolution (must be auto, raw, 1s, 1m or 1h)");
+    }
+    
+    int limit = params["limit"] | 100;
+    if (limit < 1 || limit > 100) {
+        throw std::runtime_error("Invalid limit (must be 1-100)");
+    }
+    
+    HistoryStore::Point points[100];
+    bool more = false;
+    int count = _history->query(series, resolution, from, to, points, limit, &more);
+    
+    // Points go out as compact tuples written straight to text; a row that
+    // would pass the budget ends the page early
+    bool digital = HistoryStore::isDigital(series);
+    size_t length = 0;
+    _bulk_text[length++] = '[';
+    for (int i = 0; i < count; i++) {
+        const HistoryStore::Point& point = points[i];
+        const char* separator = i ? "," : "";
+        char row[64];
+        int rowLength;
+        if (digital) {
+            rowLength = snprintf(row, sizeof(row), "%s[%u,%u,%u]", separator,
+                                 (unsigned)point.t, (unsigned)point.min, (unsigned)point.max);
+        } else if (resolution == HistoryStore::RESOLUTION_RAW) {
+            rowLength = snprintf(row, sizeof(row), "%s[%u,%.5g]", separator, (unsigned)point.t, point.avg);
+        } else {
+            rowLength = snprintf(row, sizeof(row), "%s[%u,%.5g,%.5g,%.5g]", separator,
+                                 (unsigned)point.t, point.min, point.max, point.avg);
+        }
+        if (length + rowLength + 1 > BULK_TEXT_BUDGET) {
+            more = true;
+            break;
+        }
+        memcpy(_bulk_text + length, row, rowLength);
+        length += rowLength;
+    }
+    _bulk_text[length++] = ']';
+    _bulk_text[length] = '\0';
+    
+    result["series"] = HistoryStore::seriesName(series);
+    result["resolution"] = HistoryStore::resolutionName(resolution);
+    if (digital) {
+        result["columns"] = serialized("[\"t\",\"allOn\",\"anyOn\"]");
+    } else if (resolution == HistoryStore::RESOLUTION_RAW) {
+        result["columns"] = serialized("[\"t\",\"value\"]");
+    } else {
+        result["columns"] = serialized("[\"t\",\"min\",\"max\",\"avg\"]");
+    }
+    result["from"] = from;
+    result["to"] = to;
+    result["now"] = now;
+    result["more"] = more;
+    result["points"] = serialized(_bulk_text, length);
+}
+
+void MCPServer::handleGetStats(JsonDocument& params, JsonDocument& result) {
+    if (!_history) {
+        throw std::runtime_error("History not available");
+    }
+    
+    HistoryStore::Series series;
+    if (!HistoryStore::parseSeries(params["series"] | "", series)) {
+        throw std::runtime_error("Invalid series (must be temperature, voltage, current, inputs or relays)");
+    }
+    
+    // Digital series are read one channel at a time, as 0/1 values
+    bool digital = HistoryStore::isDigital(series);
+    int channel = params["channel"] | -1;
+    if (digital) {
+        int channels = series == HistoryStore::SERIES_INPUTS ? 8 : 4;
+        if (channel < 0 || channel >= channels) {
+            throw std::runtime_error(series == HistoryStore::SERIES_INPUTS ? "Invalid channel (must be 0-7)"
+                                                                           : "Invalid channel (must be 0-3)");
+        }
+    }
+    
+    uint32_t now = millis();
+    uint32_t from;
+    uint32_t to;
+    parseWindow(params, now, from, to);
+    if ((int32_t)(to - from) < 0) {
+        throw std::runtime_error("Invalid window (from is after to)");
+    }
+    
+    bool hasThreshold = !params["threshold"].isNull() || digital;
+    float threshold = params["threshold"] | 0.5f;
+    
+    float ranks[HistoryStore::MAX_PERCENTILES] = {50, 90, 95, 99};
+    int rankCount = 4;
+    if (params["percentiles"].is<JsonArray>()) {
+        JsonArray requested = params["percentiles"];
+        if (requested.size() > HistoryStore::MAX_PERCENTILES) {
+            throw std::runtime_error("Too many percentiles (at most 8)");
+        }
+        rankCount = 0;
+        for (JsonVariant rank : requested) {
+            float value = rank | -1.0f;
+            if (value < 0 || value > 100) {
+                throw std::runtime_error("Invalid percentile (must be 0-100)");
             }
-            
-            // Execute the handler
-            capability.handler(paramsDoc, resultDoc);
-            
-            // Copy result back to response
-            response["result"] = resultDoc;
-            found = true;
+            ranks[rankCount++] = value;
+        }
+    }
+    
+    HistoryStore::Stats stats;
+    bool found = _history->stats(series, channel, from, to, hasThreshold ? threshold : NAN, ranks, rankCount, stats);
+    
+    result["series"] = HistoryStore::seriesName(series);
+    if (digital) {
+        result["channel"] = channel;
+    }
+    result["from"] = from;
+    result["to"] = to;
+    result["now"] = now;
+    if (!found) {
+        result["samples"] = 0;
+        return;
+    }
+    
+    // Share of the window the retained history actually covers
+    double seconds = stats.samples * (IOScanner::SENSOR_SCAN_INTERVAL_MS / 1000.0);
+    double window = (to - from + IOScanner::SENSOR_SCAN_INTERVAL_MS) / 1000.0;
+    
+    result["resolution"] = HistoryStore::resolutionName(stats.resolution);
+    result["samples"] = stats.samples;
+    result["coverage"] = seconds < window ? seconds / window : 1.0;
+    result["min"] = stats.min;
+    result["max"] = stats.max;
+    result["mean"] = stats.mean;
+    result["stddev"] = stats.stddev;
+    result["integral"] = stats.integral;
+    if (hasThreshold) {
+        result["threshold"] = threshold;
+        result["secondsAbove"] = stats.secondsAbove;
+    }
+    JsonObject percentiles = result.createNestedObject("percentiles");
+    for (int i = 0; i < rankCount; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "p%g", ranks[i]);
+        percentiles[key] = stats.percentiles[i];
+    }
+    result["approximate"] = stats.approximate;
+}
+
+void MCPServer::handleGetEnergy(JsonDocument& params, JsonDocument& result) {
+    if (!_energy) {
+        throw std::runtime_error("Energy meter not available");
+    }
+    
+    EnergyMeter::Reading reading = _energy->read();
+    result["voltage"] = reading.voltage;
+    result["current"] = reading.current;
+    result["power"] = reading.power;
+    result["totalWh"] = reading.totalWh;
+    
+    JsonObject today = result.createNestedObject("today");
+    today["date"] = reading.today.date;
+    today["wh"] = reading.today.wh;
+    
+    JsonArray days = result.createNestedArray("days");
+    for (int d = 0; d < reading.dayCount; d++) {
+        JsonObject day = days.createNestedObject();
+        day["date"] = reading.days[d].date;
+        day["wh"] = reading.days[d].wh;
+    }
+    
+    JsonArray relays = result.createNestedArray("relays");
+    for (int r = 0; r < EnergyMeter::RELAY_COUNT; r++) {
+        const EnergyMeter::RelayEnergy& energy = reading.relays[r];
+        JsonObject relay = relays.createNestedObject();
+        relay["relay"] = r;
+        relay["on"] = energy.on;
+        relay["intervalWh"] = energy.intervalWh;
+        relay["intervalMs"] = energy.intervalMs;
+        relay["intervals"] = energy.intervals;
+        relay["totalWh"] = energy.totalWh;
+    }
+    
+    result["saves"] = reading.saves;
+    result["lastSave"] = reading.lastSaveMs;
+}
+
+void MCPServer::handleGetRelayStats(JsonDocument& params, JsonDocument& result) {
+    if (!_relay_stats) {
+        throw std::runtime_error("Relay statistics not available");
+    }
+    
+    RelayStats::Reading reading = _relay_stats->read();
+    result["loadCurrent"] = MCP_RELAY_LOAD_CURRENT;
+    
+    JsonArray relays = result.createNestedArray("relays");
+    for (int r = 0; r < RelayStats::RELAY_COUNT; r++) {
+        const RelayStats::Counters& counters = reading.relays[r].counters;
+        JsonObject relay = relays.createNestedObject();
+        relay["relay"] = r;
+        relay["on"] = reading.relays[r].on;
+        relay["switches"] = counters.switches;
+        relay["loadSwitches"] = counters.loadSwitches;
+        relay["onSeconds"] = counters.onMs / 1000.0;
+        relay["peakCurrent"] = counters.peakCurrent;
+    }
+    
+    result["unsavedSwitches"] = reading.unsavedSwitches;
+    result["saves"] = reading.saves;
+    result["lastSave"] = reading.lastSaveMs;
+}
+
+void MCPServer::handleResetRelayStats(JsonDocument& params, JsonDocument& result) {
+    if (!_relay_stats) {
+        throw std::runtime_error("Relay statistics not available");
+    }
+    
+    int relay = params["relay"] | -1;
+    if (!_relay_stats->reset(relay)) {
+        throw std::runtime_error("Invalid relay number (must be 0-3)");
+    }
+    result["relay"] = relay;
+    result["reset"] = true;
+}
+
+void MCPServer::handleGetAnomalies(JsonDocument& params, JsonDocument& result) {
+    if (!_anomalies) {
+        throw std::runtime_error("Anomaly detection not available");
+    }
+    
+    uint32_t since = params["since"] | 0;
+    AnomalyDetector::Event events[AnomalyDetector::MAX_EVENTS];
+    int count = _anomalies->events(since, events, AnomalyDetector::MAX_EVENTS);
+    
+    JsonArray entries = result.createNestedArray("events");
+    for (int i = 0; i < count; i++) {
+        writeAnomaly(entries.createNestedObject(), events[i]);
+    }
+    result["sequence"] = _anomalies->lastSequence();
+    
+    // What the readings are being compared with right now
+    uint8_t relays = _scanner ? _scanner->snapshot().relays : 0;
+    uint8_t active = _anomalies->activeMask();
+    result["relays"] = relays;
+    JsonArray profiles = result.createNestedArray("profiles");
+    for (int s = 0; s < AnomalyDetector::SERIES_COUNT; s++) {
+        AnomalyDetector::Series series = static_cast<AnomalyDetector::Series>(s);
+        AnomalyDetector::Profile profile = _anomalies->profile(series, relays);
+        JsonObject entry = profiles.createNestedObject();
+        entry["series"] = AnomalyDetector::seriesName(series);
+        entry["active"] = (bool)(active & (1 << s));
+        entry["samples"] = profile.count;
+        entry["learning"] = profile.count < AnomalyDetector::WARMUP_SAMPLES;
+        entry["mean"] = profile.mean;
+        entry["stddev"] = profile.stddev;
+        entry["baseline"] = profile.baseline;
+        entry["baselineSigma"] = profile.baselineSigma;
+    }
+}
+
+void MCPServer::handleResetAnomalies(JsonDocument& params, JsonDocument& result) {
+    if (!_anomalies) {
+        throw std::runtime_error("Anomaly detection not available");
+    }
+    
+    _anomalies->reset();
+    result["success"] = true;
+}
+
+void MCPServer::handleConfigureAlarm(JsonDocument& params, JsonDocument& result) {
+    if (!_alarms) {
+        throw std::runtime_error("Alarms not available");
+    }
+    
+    int id = params["id"] | -1;
+    if (id < 0 || id >= AlarmManager::MAX_ALARMS) {
+        throw std::runtime_error("Invalid alarm id (must be 0-31)");
+    }
+    
+    AlarmManager::Config config = {};
+    if (!(params["remove"] | false)) {
+        if (!AlarmManager::parseSource(params["source"] | "", config.source)) {
+            throw std::runtime_error("Invalid source (must be temperature, voltage, current, power, input or relay)");
+        }
+        int channel = params["channel"] | 0;
+        int channels = config.source == AlarmManager::SOURCE_INPUT ? 8 : (config.source == AlarmManager::SOURCE_RELAY ? 4 : 1);
+        if (channel < 0 || channel >= channels) {
+            throw std::runtime_error("Invalid channel for this source");
+        }
+        if (!AlarmManager::parseType(params["type"] | "high", config.type)) {
+            throw std::runtime_error("Invalid type (must be high or low)");
+        }
+        if (params["limit"].isNull()) {
+            throw std::runtime_error("Missing limit");
+        }
+        float hysteresis = params["hysteresis"] | 0.0f;
+        long delayOn = params["delayOn"] | 0L;
+        long delayOff = params["delayOff"] | 0L;
+        if (hysteresis < 0 || delayOn < 0 || delayOff < 0) {
+            throw std::runtime_error("Hysteresis and delays must not be negative");
+        }
+        
+        strncpy(config.name, params["name"] | "", sizeof(config.name) - 1);
+        config.defined = true;
+        config.enabled = params["enabled"] | true;
+        config.latching = params["latching"] | false;
+        config.channel = channel;
+        config.limit = params["limit"];
+        config.hysteresis = hysteresis;
+        config.delayOnMs = delayOn;
+        config.delayOffMs = delayOff;
+    }
+    
+    _alarms->configure(id, config);
+    result["id"] = id;
+    result["defined"] = config.defined;
+}
+
+// getAlarms pages; an alarm takes about 300 bytes of the result document
+// and an event about 120
+static const int ALARMS_PER_PAGE = 8;
+static const int EVENTS_PER_PAGE = 8;
+
+void MCPServer::handleGetAlarms(JsonDocument& params, JsonDocument& result) {
+    if (!_alarms) {
+        throw std::runtime_error("Alarms not available");
+    }
+    
+    int offset = params["offset"] | 0;
+    if (offset < 0 || offset >= AlarmManager::MAX_ALARMS) {
+        throw std::runtime_error("Invalid offset (must be 0-31)");
+    }
+    int limit = params["limit"] | ALARMS_PER_PAGE;
+    if (limit < 1 || limit > ALARMS_PER_PAGE) {
+        throw std::runtime_error("Invalid limit (must be 1-8)");
+    }
+    
+    JsonArray alarms = result.createNestedArray("alarms");
+    int listed = 0;
+    for (int id = offset; id < AlarmManager::MAX_ALARMS; id++) {
+        AlarmManager::Status status;
+        if (!_alarms->status(id, status)) {
+            continue;
+        }
+        if (listed == limit) {
+            result["nextOffset"] = id;
             break;
         }
+        listed++;
+        const AlarmManager::Config& config = status.config;
+        JsonObject alarm = alarms.createNestedObject();
+        alarm["id"] = id;
+        alarm["name"] = status.config.name;     // char[]: copied into the document
+        alarm["source"] = AlarmManager::sourceName(config.source);
+        if (config.source == AlarmManager::SOURCE_INPUT || config.source == AlarmManager::SOURCE_RELAY) {
+            alarm["channel"] = config.channel;
+        }
+        alarm["type"] = AlarmManager::typeName(config.type);
+        alarm["limit"] = config.limit;
+        alarm["hysteresis"] = config.hysteresis;
+        alarm["delayOn"] = config.delayOnMs;
+        alarm["delayOff"] = config.delayOffMs;
+        alarm["latching"] = config.latching;
+        alarm["enabled"] = config.enabled;
+        alarm["state"] = AlarmManager::stateName(status.state);
+        alarm["value"] = status.value;
+        alarm["changed"] = status.changedMs;
     }
     
-    if (!found) {
-        response["error"]["code"] = -32601;
-        response["error"]["message"] = "Method not found: " + methodName;
-    } else {
-        response["success"] = true;
+    // sequence is where the next call continues, so pass it back as since
+    uint32_t since = params["since"] | 0;
+    AlarmManager::Event events[EVENTS_PER_PAGE];
+    int count = _alarms->events(since, events, EVENTS_PER_PAGE);
+    JsonArray entries = result.createNestedArray("events");
+    for (int i = 0; i < count; i++) {
+        writeAlarmEvent(entries.createNestedObject(), events[i], nullptr);
     }
+    uint32_t last = _alarms->lastSequence();
+    uint32_t sequence = count ? events[count - 1].sequence : last;
+    result["sequence"] = sequence;
+    result["moreEvents"] = sequence != last;
 }
 
-// ==== Capability Handlers ====
-
-void MCPServer::handleReadInput(JsonDocument& params, JsonDocument& result) {
-    int inputNumber = params["inputNumber"];
-    
-    // Validate input number
-    if (inputNumber < 0 || inputNumber >= 8) {
-        throw std::runtime_error("Invalid input number (must be 0-7)");
+void MCPServer::handleAckAlarm(JsonDocument& params, JsonDocument& result) {
+    if (!_alarms) {
+        throw std::runtime_error("Alarms not available");
     }
     
-    // Read the input
-    bool state = _stamplc->readPlcInput(inputNumber);
+    int id = params["id"] | -1;
+    if (id < -1 || id >= AlarmManager::MAX_ALARMS) {
+        throw std::runtime_error("Invalid alarm id (must be 0-31)");
+    }
     
-    // Return the result
-    result["state"] = state;
+    result["acknowledged"] = _alarms->acknowledge(id);
 }
 
-void MCPServer::handleWriteRelay(JsonDocument& params, JsonDocument& result) {
-    int relayNumber = params["relayNumber"];
-    bool state = params["state"];
-    
-    // Validate relay number
-    if (relayNumber < 0 || relayNumber >= 4) {
-        throw std::runtime_error("Invalid relay number (must be 0-3)");
+void MCPServer::handleGetJobs(JsonDocument& params, JsonDocument& result) {
+    JobManager::Info jobs[JobManager::MAX_JOBS];
+    int count = _jobs.list(jobs, JobManager::MAX_JOBS, millis());
+    
+    JsonArray entries = result.createNestedArray("jobs");
+    for (int i = 0; i < count; i++) {
+        JsonObject entry = entries.createNestedObject();
+        entry["jobId"] = jobs[i].id;
+        entry["kind"] = jobs[i].kind;
+        entry["state"] = JobManager::stateName(jobs[i].state);
+        entry["elapsed"] = jobs[i].elapsedMs;
+        entry["duration"] = jobs[i].durationMs;
     }
-    
-    // Set the relay
-    _stamplc->writePlcRelay(relayNumber, state);
-    
-    // Return success
-    result["success"] = true;
 }
 
-void MCPServer::handleReadRelay(JsonDocument& params, JsonDocument& result) {
-    int relayNumber = params["relayNumber"];
+void MCPServer::handleCancelJob(JsonDocument& params, JsonDocument& result) {
+    uint32_t jobId = params["jobId"] | 0;
     
-    // Validate relay number
-    if (relayNumber < 0 || relayNumber >= 4) {
-        throw std::runtime_error("Invalid relay number (must be 0-3)");
+    if (!_jobs.cancel(jobId)) {
+        throw std::runtime_error("Unknown or finished job");
     }
     
-    // Read the relay
-    bool state = _stamplc->readPlcRelay(relayNumber);
+    result["jobId"] = jobId;
+    result["cancelled"] = true;
+}
+
+void MCPServer::handleGetScanStats(JsonDocument& params, JsonDocument& result) {
+    if (!_scan) {
+        throw std::runtime_error("Scan cycle not available");
+    }
     
-    // Return the result
-    result["state"] = state;
+    ScanCycle::Stats stats = _scan->stats();
+    result["periodUs"] = stats.periodUs;
+    result["cycles"] = stats.cycles;
+    result["overruns"] = stats.overruns;
+    result["missed"] = stats.missed;
+    result["relayWrites"] = stats.relayWrites;
+    result["interlockRejections"] = stats.interlockRejections;
+    
+    JsonObject cycle = result.createNestedObject("cycleUs");
+    cycle["last"] = stats.lastCycleUs;
+    cycle["mean"] = stats.meanCycleUs;
+    cycle["max"] = stats.maxCycleUs;
+    
+    JsonObject jitter = result.createNestedObject("jitterUs");
+    jitter["last"] = stats.lastJitterUs;
+    jitter["mean"] = stats.meanJitterUs;
+    jitter["max"] = stats.maxJitterUs;
+    
+    JsonObject phases = result.createNestedObject("maxPhaseUs");
+    phases["inputs"] = stats.maxInputUs;
+    phases["logic"] = stats.maxLogicUs;
+    phases["outputs"] = stats.maxOutputUs;
 }
 
-void MCPServer::handleConsoleLog(JsonDocument& params, JsonDocument& result) {
-    String message = params["message"].as<String>();
+void MCPServer::handleConfigureScan(JsonDocument& params, JsonDocument& result) {
+    if (!_scan) {
+        throw std::runtime_error("Scan cycle not available");
+    }
     
-    // Log the message
-    _dashboard_ui->console_log(message.c_str());
+    if (!params["periodMs"].isNull()) {
+        int periodMs = params["periodMs"];
+        if (!_scan->setPeriodMs(periodMs)) {
+            throw std::runtime_error("Invalid period (must be 2-100 ms)");
+        }
+    }
+    if (params["resetStats"] | false) {
+        _scan->resetStats();
+    }
     
-    // Return success
     result["success"] = true;
+    result["periodMs"] = _scan->periodMs();
 }
 
-void MCPServer::handleGetSystemInfo(JsonDocument& params, JsonDocument& result) {
-    // Get system information
-    result["device"] = "M5StamPLC";
-    result["freeHeap"] = ESP.getFreeHeap();
-    result["uptime"] = millis();
-    result["ip"] = WiFi.localIP().toString().c_str();
-    result["wifiSSID"] = WiFi.SSID().c_str();
-    result["wifiRSSI"] = WiFi.RSSI();
+void MCPServer::handleUploadProgram(JsonDocument& params, JsonDocument& result) {
+    if (!_logic) {
+        throw std::runtime_error("Logic engine not available");
+    }
     
-    // Add sensor readings to the system info
-    JsonObject sensors = result.createNestedObject("sensors");
-    sensors["temperature"] = _stamplc->getTemp();
-    sensors["voltage"] = _stamplc->getPowerVoltage();
-    sensors["current"] = _stamplc->getIoSocketOutputCurrent();
-}
-
-void MCPServer::handleGetIOState(JsonDocument& params, JsonDocument& result) {
-    // Create arrays for inputs and relays
-    JsonArray inputs = result.createNestedArray("inputs");
-    JsonArray relays = result.createNestedArray("relays");
+    JsonVariant source = params["source"];
+    if (!source.is<const char*>()) {
+        throw std::runtime_error("Missing source");
+    }
     
-    // Read all inputs
-    for (int i = 0; i < 8; i++) {
-        inputs.add(_stamplc->readPlcInput(i));
+    // Relays of PID loops are not for the program to assign
+    char error[96];
+    if (!_logic->load(source.as<const char*>(), error, sizeof(error), _pid ? _pid->relayMask() : 0)) {
+        throw std::runtime_error(error);
     }
     
-    // Read all relays
-    for (int i = 0; i < 4; i++) {
-        relays.add(_stamplc->readPlcRelay(i));
+    LogicEngine::Status status = _logic->status();
+    result["success"] = true;
+    result["loaded"] = status.loaded;
+    result["codeSize"] = status.codeSize;
+    JsonArray relays = result.createNestedArray("relays");
+    for (int i = 0; i < LogicEngine::RELAY_COUNT; i++) {
+        if (status.relayMask & (1 << i)) {
+            relays.add(i);
+        }
     }
 }
 
-void MCPServer::handleTone(JsonDocument& params, JsonDocument& result) {
-    int frequency = params["frequency"];
-    int duration = params["duration"];
-    
-    // Validate parameters
-    if (frequency < 0 || frequency > 20000) {
-        throw std::runtime_error("Invalid frequency (must be 0-20000)");
-    }
-    
-    if (duration < 0 || duration > 10000) {
-        throw std::runtime_error("Invalid duration (must be 0-10000)");
+void MCPServer::handleGetProgram(JsonDocument& params, JsonDocument& result) {
+    if (!_logic) {
+        throw std::runtime_error("Logic engine not available");
     }
     
-    // Play the tone
-    _stamplc->tone(frequency, duration);
+    LogicEngine::Status status = _logic->status();
+    _logic->source(_bulk_text, LogicEngine::MAX_SOURCE);
+    result["source"] = (const char*)_bulk_text;
+    result["loaded"] = status.loaded;
+    result["codeSize"] = status.codeSize;
+    result["runs"] = status.runs;
+    result["lastRunUs"] = status.lastRunUs;
+    result["maxRunUs"] = status.maxRunUs;
     
-    // Return success
-    result["success"] = true;
+    JsonArray relays = result.createNestedArray("relays");
+    for (int i = 0; i < LogicEngine::RELAY_COUNT; i++) {
+        if (status.relayMask & (1 << i)) {
+            relays.add(i);
+        }
+    }
+    JsonArray markers = result.createNestedArray("markers");
+    for (int i = 0; i < LogicEngine::MARKERS; i++) {
+        markers.add((bool)(status.markers & (1 << i)));
+    }
+    JsonArray timers = result.createNestedArray("timers");
+    for (int i = 0; i < LogicEngine::TIMERS; i++) {
+        timers.add((bool)(status.timers & (1 << i)));
+    }
+    JsonArray counters = result.createNestedArray("counters");
+    for (int i = 0; i < LogicEngine::COUNTERS; i++) {
+        JsonObject counter = counters.createNestedObject();
+        counter["count"] = status.counters[i];
+        counter["done"] = (bool)(status.counterDone & (1 << i));
+    }
 }
 
-void MCPServer::handleGetTime(JsonDocument& params, JsonDocument& result) {
-    // Get the current time
-    struct tm time;
-    _stamplc->getRtcTime(&time);
+void MCPServer::handleConfigurePid(JsonDocument& params, JsonDocument& result) {
+    if (!_pid) {
+        throw std::runtime_error("PID control not available");
+    }
     
-    // Format the result
-    result["year"] = time.tm_year + 1900;
-    result["month"] = time.tm_mon + 1;
-    result["day"] = time.tm_mday;
-    result["hour"] = time.tm_hour;
-    result["minute"] = time.tm_min;
-    result["second"] = time.tm_sec;
+    int relay = params["relay"] | -1;
+    if (relay < 0 || relay >= PidController::MAX_LOOPS) {
+        throw std::runtime_error("Invalid relay number (must be 0-3)");
+    }
     
-    // Format string representations
-    char timeStr[9];
-    char dateStr[11];
-    snprintf(timeStr, sizeof(timeStr), "%02d:%02d:%02d", time.tm_hour, time.tm_min, time.tm_sec);
-    snprintf(dateStr, sizeof(dateStr), "%04d.%02d.%02d", time.tm_year + 1900, time.tm_mon + 1, time.tm_mday);
+    // Omitted parameters keep their value, so a running loop can be
+    // retuned one gain at a time
+    PidController::Status current;
+    bool defined = _pid->status(relay, current);
+    PidController::Config config = {};
+    if (!(params["remove"] | false)) {
+        if (_logic && (_logic->status().relayMask & (1 << relay))) {
+            throw std::runtime_error("Relay is assigned by the logic program");
+        }
+        if (defined) {
+            config = current.config;
+        } else {
+            if (params["setpoint"].isNull() || params["kp"].isNull()) {
+                throw std::runtime_error("Missing setpoint or kp for a new loop");
+            }
+            config.source = PidController::SOURCE_TEMPERATURE;
+            config.action = PidController::ACTION_REVERSE;
+            config.outMax = 100;
+            config.cycleMs = 10000;
+        }
+        if (!params["source"].isNull() && !PidController::parseSource(params["source"] | "", config.source)) {
+            throw std::runtime_error("Invalid source (must be temperature, voltage, current or power)");
+        }
+        if (!params["action"].isNull() && !PidController::parseAction(params["action"] | "", config.action)) {
+            throw std::runtime_error("Invalid action (must be reverse or direct)");
+        }
+        
+        config.defined = true;
+        config.enabled = params["enabled"] | (defined ? config.enabled : true);
+        config.setpoint = params["setpoint"] | config.setpoint;
+        config.kp = params["kp"] | config.kp;
+        config.ki = params["ki"] | config.ki;
+        config.kd = params["kd"] | config.kd;
+        config.rampRate = params["rampRate"] | config.rampRate;
+        config.outMin = params["outMin"] | config.outMin;
+        config.outMax = params["outMax"] | config.outMax;
+        config.cycleMs = params["cycleMs"] | config.cycleMs;
+    }
     
-    result["timeString"] = timeStr;
-    result["dateString"] = dateStr;
+    if (!_pid->configure(relay, config)) {
+        throw std::runtime_error("Invalid PID settings (gains and rampRate >= 0, 0 <= outMin < outMax <= 100, "
+                                 "cycleMs 100-600000)");
+    }
+    result["relay"] = relay;
+    result["defined"] = config.defined;
+    result["enabled"] = config.enabled;
 }
 
-void MCPServer::handleSetTime(JsonDocument& params, JsonDocument& result) {
-    // Get parameters
-    int year = params["year"];
-    int month = params["month"];
-    int day = params["day"];
-    int hour = params["hour"];
-    int minute = params["minute"];
-    int second = params["second"];
-    
-    // Validate parameters
-    if (year < 2000 || year > 2099) {
-        throw std::runtime_error("Invalid year (must be 2000-2099)");
+void MCPServer::handleGetPid(JsonDocument& params, JsonDocument& result) {
+    if (!_pid) {
+        throw std::runtime_error("PID control not available");
     }
     
-    if (month < 1 || month > 12) {
-        throw std::runtime_error("Invalid month (must be 1-12)");
+    JsonArray loops = result.createNestedArray("loops");
+    for (int relay = 0; relay < PidController::MAX_LOOPS; relay++) {
+        PidController::Status status;
+        if (!_pid->status(relay, status)) {
+            continue;
+        }
+        const PidController::Config& config = status.config;
+        JsonObject loop = loops.createNestedObject();
+        loop["relay"] = relay;
+        loop["source"] = PidController::sourceName(config.source);
+        loop["action"] = PidController::actionName(config.action);
+        loop["enabled"] = config.enabled;
+        loop["target"] = config.setpoint;
+        loop["rampRate"] = config.rampRate;
+        loop["outMin"] = config.outMin;
+        loop["outMax"] = config.outMax;
+        loop["cycleMs"] = config.cycleMs;
+        loop["running"] = status.running;
+        loop["updates"] = status.updates;
+        writePidStatus(loop, status);
+    }
+}
+
+void MCPServer::handlePulseRelay(JsonDocument& params, JsonDocument& result) {
+    if (!_relay_scheduler) {
+        throw std::runtime_error("Relay scheduling not available");
     }
     
-    if (day < 1 || day > 31) {
-        throw std::runtime_error("Invalid day (must be 1-31)");
+    int relay = params["relay"] | -1;
+    if (relay < 0 || relay >= RelayScheduler::RELAY_COUNT) {
+        throw std::runtime_error("Invalid relay number (must be 0-3)");
     }
+    long ms = params["ms"] | 0L;
+    long afterMs = params["afterMs"] | 0L;
+    // Shorter pulses would be switched on and off within one scan
+    long minMs = _scan ? _scan->periodMs() : 1;
+    if (ms < minMs || ms > (long)RelayScheduler::MAX_DELAY_MS || afterMs < 0 ||
+        afterMs > (long)RelayScheduler::MAX_DELAY_MS) {
+        throw std::runtime_error("Invalid ms or afterMs (ms from the scan period, both up to 7 days)");
+    }
+    bool state = params["state"] | true;
+    checkPulseWidth(relay, state, ms);
     
-    if (hour < 0 || hour > 23) {
-        throw std::runtime_error("Invalid hour (must be 0-23)");
+    uint32_t id = _relay_scheduler->add(relay, state, afterMs, ms);
+    if (!id) {
+        throw std::runtime_error("Too many pending relay writes");
+    }
+    result["success"] = true;
+    result["id"] = id;
+}
+
+void MCPServer::handleScheduleRelay(JsonDocument& params, JsonDocument& result) {
+    if (!_relay_scheduler) {
+        throw std::runtime_error("Relay scheduling not available");
     }
     
-    if (minute < 0 || minute > 59) {
-        throw std::runtime_error("Invalid minute (must be 0-59)");
+    int relay = params["relay"] | -1;
+    if (relay < 0 || relay >= RelayScheduler::RELAY_COUNT) {
+        throw std::runtime_error("Invalid relay number (must be 0-3)");
+    }
+    if (params["state"].isNull()) {
+        throw std::runtime_error("Missing state");
+    }
+    bool state = params["state"];
+    long pulseMs = params["pulseMs"] | 0L;
+    if (pulseMs < 0 || pulseMs > (long)RelayScheduler::MAX_DELAY_MS) {
+        throw std::runtime_error("Invalid pulseMs (up to 7 days)");
+    }
+    if (pulseMs > 0) {
+        checkPulseWidth(relay, state, pulseMs);
     }
     
-    if (second < 0 || second > 59) {
-        throw std::runtime_error("Invalid second (must be 0-59)");
+    int when = !params["afterMs"].isNull() + !params["atTime"].isNull() + !params["cron"].isNull();
+    if (when != 1) {
+        throw std::runtime_error("Give exactly one of afterMs, atTime or cron");
     }
     
-    // Create a tm structure
-    struct tm time;
-    time.tm_year = year - 1900;
-    time.tm_mon = month - 1;
-    time.tm_mday = day;
-    time.tm_hour = hour;
-    time.tm_min = minute;
-    time.tm_sec = second;
+    // Recurring: into the given or the first free schedule
+    if (!params["cron"].isNull()) {
+        int index = params["schedule"] | -1;
+        RelayScheduler::Schedule existing;
+        for (int i = 0; index < 0 && i < RelayScheduler::MAX_SCHEDULES; i++) {
+            if (!_relay_scheduler->schedule(i, existing)) {
+                index = i;
+            }
+        }
+        if (index < 0) {
+            throw std::runtime_error("No free schedule (max 16)");
+        }
+        char error[64];
+        if (!_relay_scheduler->setSchedule(index, params["cron"] | "", relay, state, pulseMs, error, sizeof(error))) {
+            throw std::runtime_error(error);
+        }
+        result["success"] = true;
+        result["schedule"] = index;
+        return;
+    }
     
-    // Set the time
-    _stamplc->setRtcTime(&time);
+    int64_t delayMs;
+    if (!params["atTime"].isNull()) {
+        struct tm at;
+        bool hasDate;
+        if (!RelayScheduler::parseTime(params["atTime"] | "", at, hasDate)) {
+            throw std::runtime_error("Invalid atTime (must be YYYY-MM-DD HH:MM[:SS] or HH:MM[:SS])");
+        }
+        delayMs = _relay_scheduler->msUntil(at, hasDate);
+        if (delayMs < 0) {
+            throw std::runtime_error("atTime has passed");
+        }
+    } else {
+        delayMs = params["afterMs"] | -1L;
+    }
+    if (delayMs < 0 || delayMs > RelayScheduler::MAX_DELAY_MS) {
+        throw std::runtime_error("Write must be due within 7 days");
+    }
     
-    // Return success
+    uint32_t id = _relay_scheduler->add(relay, state, delayMs, pulseMs);
+    if (!id) {
+        throw std::runtime_error("Too many pending relay writes");
+    }
     result["success"] = true;
+    result["id"] = id;
+    result["dueMs"] = delayMs;
 }
 
-void MCPServer::handleGetTemperature(JsonDocument& params, JsonDocument& result) {
-    // Get the temperature from M5StamPLC
-    float temperature = _stamplc->getTemp();
+void MCPServer::checkPulseWidth(int relay, bool state, uint32_t pulseMs) {
+    if (!_interlock) {
+        return;
+    }
     
-    // Return the result
-    result["temperature"] = temperature;
-    result["unit"] = "Celsius";
+    // The interlock would hold the second write back until the minimum
+    // time is up, so the pulse could not have the width asked for
+    RelayInterlock::Rule rule = _interlock->rule(relay);
+    uint32_t minMs = state ? rule.minOnMs : rule.minOffMs;
+    if (pulseMs < minMs) {
+        char message[96];
+        snprintf(message, sizeof(message), "Pulse shorter than the interlock allows (relay %d must stay %s for %lu ms)",
+                 relay, state ? "on" : "off", (unsigned long)minMs);
+        throw std::runtime_error(message);
+    }
 }
 
-void MCPServer::handleGetPowerVoltage(JsonDocument& params, JsonDocument& result) {
-    // Get the power voltage from M5StamPLC
-    float voltage = _stamplc->getPowerVoltage();
+void MCPServer::handleCancelSchedule(JsonDocument& params, JsonDocument& result) {
+    if (!_relay_scheduler) {
+        throw std::runtime_error("Relay scheduling not available");
+    }
     
-    // Return the result
-    result["voltage"] = voltage;
-    result["unit"] = "Volts";
+    if (!params["schedule"].isNull()) {
+        char error[64];
+        if (!_relay_scheduler->setSchedule(params["schedule"] | -1, nullptr, 0, false, 0, error, sizeof(error))) {
+            throw std::runtime_error(error);
+        }
+    } else if (!_relay_scheduler->cancel(params["id"] | 0UL)) {
+        throw std::runtime_error("No pending relay write with this id");
+    }
+    result["success"] = true;
 }
 
-void MCPServer::handleGetIoCurrent(JsonDocument& params, JsonDocument& result) {
-    // Get the IO socket output current from M5StamPLC
-    float current = _stamplc->getIoSocketOutputCurrent();
+void MCPServer::handleGetSchedules(JsonDocument& params, JsonDocument& result) {
+    if (!_relay_scheduler) {
+        throw std::runtime_error("Relay scheduling not available");
+    }
     
-    // Return the result
-    result["current"] = current;
-    result["unit"] = "Amps";
+    // All 16 schedules take about 2 KB of the result document, so pending
+    // writes (about 100 bytes each) are paged
+    int offset = params["offset"] | 0;
+    int limit = params["limit"] | 12;
+    if (offset < 0 || limit < 1 || limit > 12) {
+        throw std::runtime_error("Invalid offset or limit (limit must be 1-12)");
+    }
+    
+    RelayScheduler::Stats stats = _relay_scheduler->stats();
+    result["pendingCount"] = stats.pending;
+    result["peakPending"] = stats.peakPending;
+    result["fired"] = stats.fired;
+    
+    // One more than the page tells whether there is a next one
+    RelayScheduler::Action actions[13];
+    int count = _relay_scheduler->pending(actions, limit + 1, offset);
+    result["more"] = count > limit;
+    if (count > limit) {
+        count = limit;
+    }
+    JsonArray pending = result.createNestedArray("pending");
+    for (int i = 0; i < count; i++) {
+        JsonObject action = pending.createNestedObject();
+        action["id"] = actions[i].id;
+        action["relay"] = actions[i].relay;
+        action["state"] = actions[i].state;
+        action["dueMs"] = actions[i].dueMs;
+        if (actions[i].pulseMs) {
+            action["pulseMs"] = actions[i].pulseMs;
+        }
+    }
+    
+    JsonArray schedules = result.createNestedArray("schedules");
+    for (int i = 0; i < RelayScheduler::MAX_SCHEDULES; i++) {
+        RelayScheduler::Schedule schedule;
+        if (!_relay_scheduler->schedule(i, schedule)) {
+            continue;
+        }
+        JsonObject entry = schedules.createNestedObject();
+        entry["schedule"] = i;
+        entry["cron"] = schedule.cron;      // char[]: copied into the document
+        entry["relay"] = schedule.relay;
+        entry["state"] = schedule.state;
+        if (schedule.pulseMs) {
+            entry["pulseMs"] = schedule.pulseMs;
+        }
+    }
 }
 
-void MCPServer::handleGetSensorData(JsonDocument& params, JsonDocument& result) {
-    // Get all sensor data at once
-    float temperature = _stamplc->getTemp();
-    float voltage = _stamplc->getPowerVoltage();
-    float current = _stamplc->getIoSocketOutputCurrent();
+// Bit i of the mask for every number i in the array; false if one is out of range
+static bool readMask(JsonVariant list, int count, uint8_t& mask) {
+    mask = 0;
+    if (list.isNull()) {
+        return true;
+    }
+    if (!list.is<JsonArray>()) {
+        return false;
+    }
+    for (JsonVariant item : list.as<JsonArray>()) {
+        int index = item | -1;
+        if (index < 0 || index >= count) {
+            return false;
+        }
+        mask |= 1 << index;
+    }
+    return true;
+}
+
+static void writeMask(JsonArray list, uint8_t mask) {
+    for (int i = 0; mask; i++, mask >>= 1) {
+        if (mask & 1) {
+            list.add(i);
+        }
+    }
+}
+
+void MCPServer::handleConfigureInterlock(JsonDocument& params, JsonDocument& result) {
+    if (!_interlock) {
+        throw std::runtime_error("Interlocks not available");
+    }
     
-    // Create a nested sensor object
-    JsonObject sensors = result.createNestedObject("sensors");
+    int relay = params["relay"] | -1;
+    if (relay < 0 || relay >= RelayInterlock::RELAY_COUNT) {
+        throw std::runtime_error("Invalid relay number (must be 0-3)");
+    }
     
-    // Add all sensor readings
-    sensors["temperature"] = temperature;
-    sensors["temperatureUnit"] = "Celsius";
+    RelayInterlock::Rule rule = {};
+    if (!readMask(params["notWith"], RelayInterlock::RELAY_COUNT, rule.notWith)) {
+        throw std::runtime_error("Invalid notWith (must be an array of relays 0-3)");
+    }
+    if (!readMask(params["inputsHigh"], RelayInterlock::INPUT_COUNT, rule.inputsHigh) ||
+        !readMask(params["inputsLow"], RelayInterlock::INPUT_COUNT, rule.inputsLow)) {
+        throw std::runtime_error("Invalid inputsHigh or inputsLow (must be arrays of inputs 0-7)");
+    }
+    if (rule.inputsHigh & rule.inputsLow) {
+        throw std::runtime_error("An input cannot be required both high and low");
+    }
+    long minOnMs = params["minOnMs"] | 0L;
+    long minOffMs = params["minOffMs"] | 0L;
+    if (minOnMs < 0 || minOffMs < 0) {
+        throw std::runtime_error("Minimum times must not be negative");
+    }
+    rule.minOnMs = minOnMs;
+    rule.minOffMs = minOffMs;
     
-    sensors["voltage"] = voltage;
-    sensors["voltageUnit"] = "Volts";
+    _interlock->configure(relay, rule);
+    result["success"] = true;
+    result["relay"] = relay;
+}
+
+void MCPServer::handleGetInterlocks(JsonDocument& params, JsonDocument& result) {
+    if (!_interlock) {
+        throw std::runtime_error("Interlocks not available");
+    }
     
-    sensors["current"] = current;
-    sensors["currentUnit"] = "Amps";
+    JsonArray relays = result.createNestedArray("relays");
+    for (int r = 0; r < RelayInterlock::RELAY_COUNT; r++) {
+        RelayInterlock::Rule rule = _interlock->rule(r);
+        JsonObject entry = relays.createNestedObject();
+        entry["relay"] = r;
+        writeMask(entry.createNestedArray("notWith"), rule.notWith);
+        writeMask(entry.createNestedArray("inputsHigh"), rule.inputsHigh);
+        writeMask(entry.createNestedArray("inputsLow"), rule.inputsLow);
+        entry["minOnMs"] = rule.minOnMs;
+        entry["minOffMs"] = rule.minOffMs;
+        entry["rejections"] = _interlock->rejections(r);
+    }
+}
+
+void MCPServer::handleGetSchedulerStats(JsonDocument& params, JsonDocument& result) {
+    JsonArray priorities = result.createNestedArray("priorities");
+    
+    for (int i = 0; i < CommandScheduler::PRIORITY_COUNT; i++) {
+        CommandScheduler::Priority priority = static_cast<CommandScheduler::Priority>(i);
+        CommandScheduler::PriorityStats stats = _scheduler.stats(priority);
+        
+        JsonObject entry = priorities.createNestedObject();
+        entry["priority"] = CommandScheduler::priorityName(priority);
+        entry["depth"] = stats.depth;
+        entry["maxDepth"] = stats.maxDepth;
+        entry["executed"] = stats.executed;
+        entry["dropped"] = stats.dropped;
+        entry["lastWaitUs"] = stats.lastWaitUs;
+        entry["maxWaitUs"] = stats.maxWaitUs;
+        entry["avgWaitUs"] = stats.executed ? (uint32_t)(stats.totalWaitUs / stats.executed) : 0;
+    }
 }
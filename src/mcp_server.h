@@ -9,13 +9,33 @@
 #include <ESPAsyncWebServer.h>
 #include <AsyncTCP.h>
 #include <ArduinoJson.h>
-#include <queue>
 #include <functional>
 #include <vector>
 #include <string>
+#include "admission_control.h"
+#include "command_scheduler.h"
+#include "idempotency_cache.h"
+#include "response_cache.h"
+#include "wait_list.h"
+#include "job_manager.h"
+#include "event_log.h"
 
 // Forward declaration
 class DashboardUI;
+class MemoryMonitor;
+class IOScanner;
+class InputSampler;
+class HistoryStore;
+class EnergyMeter;
+class RelayStats;
+class AnomalyDetector;
+class AlarmManager;
+class WaveformCapture;
+class ScanCycle;
+class LogicEngine;
+class PidController;
+class RelayScheduler;
+class RelayInterlock;
 
 class MCPServer {
 public:
@@ -38,6 +58,82 @@ public:
         _commandReceivedCallback = callback;
     }
 
+    // Source of the heap and stack figures for getMemoryStats and /metrics
+    void setMemoryMonitor(MemoryMonitor* monitor) {
+        _memory_monitor = monitor;
+    }
+
+    // Process image that waitForChange is evaluated against; set before init()
+    void setIOScanner(IOScanner* scanner) {
+        _scanner = scanner;
+    }
+
+    // Source of timestamped input edges for getEdges and the SSE edge stream
+    void setInputSampler(InputSampler* sampler) {
+        _sampler = sampler;
+    }
+
+    // Recorded sensor and I/O history for getHistory
+    void setHistoryStore(HistoryStore* history) {
+        _history = history;
+    }
+
+    // Energy totals for getEnergy and the SSE state frame
+    void setEnergyMeter(EnergyMeter* energy) {
+        _energy = energy;
+    }
+
+    // Relay wear counters for getRelayStats/resetRelayStats and /metrics
+    void setRelayStats(RelayStats* stats) {
+        _relay_stats = stats;
+    }
+
+    // Sensor anomalies for getAnomalies and the SSE anomaly stream
+    void setAnomalyDetector(AnomalyDetector* anomalies) {
+        _anomalies = anomalies;
+    }
+
+    // Alarm table for configureAlarm/getAlarms/ackAlarm and the SSE alarm stream
+    void setAlarmManager(AlarmManager* alarms) {
+        _alarms = alarms;
+    }
+
+    // Sequence-of-events log for getEvents; relay writes are recorded into it
+    void setEventLog(EventLog* events) {
+        _event_log = events;
+    }
+
+    // Triggered voltage/current capture for armCapture/getCapture
+    void setWaveformCapture(WaveformCapture* capture) {
+        _capture = capture;
+    }
+
+    // Fixed-period scan; relay writes go through its output phase
+    void setScanCycle(ScanCycle* scan) {
+        _scan = scan;
+    }
+
+    // On-device logic program for uploadProgram/getProgram
+    void setLogicEngine(LogicEngine* logic) {
+        _logic = logic;
+    }
+
+    // PID loops for configurePid/getPid and the SSE pid stream
+    void setPidController(PidController* pid) {
+        _pid = pid;
+    }
+
+    // Timed and recurring relay writes for pulseRelay/scheduleRelay
+    void setRelayScheduler(RelayScheduler* scheduler) {
+        _relay_scheduler = scheduler;
+    }
+
+    // Interlock table for configureInterlock/getInterlocks; writeRelay
+    // reports its refusals
+    void setInterlock(RelayInterlock* interlock) {
+        _interlock = interlock;
+    }
+
 private:
     // MCP Server capabilities
     struct Capability {
@@ -45,23 +141,157 @@ private:
         std::string description;
         std::vector<std::string> parameters;
         std::function<void(JsonDocument&, JsonDocument&)> handler;
+        AdmissionControl::Access access = AdmissionControl::ACCESS_READ;
+        CommandScheduler::Priority priority = CommandScheduler::PRIORITY_NORMAL;
+        uint32_t cacheTtlMs = 0;    // Read-only result may be served this stale; 0 = never cached
+        bool longPoll = false;      // Parked in the wait list instead of executed
+        int cacheEntry = -1;        // Assigned in registerCapabilities
     };
 
     // MCP Server components
     m5::M5_STAMPLC* _stamplc = nullptr;
     DashboardUI* _dashboard_ui = nullptr;
+    MemoryMonitor* _memory_monitor = nullptr;
+    IOScanner* _scanner = nullptr;
+    InputSampler* _sampler = nullptr;
+    HistoryStore* _history = nullptr;
+    EnergyMeter* _energy = nullptr;
+    RelayStats* _relay_stats = nullptr;
+    AnomalyDetector* _anomalies = nullptr;
+    AlarmManager* _alarms = nullptr;
+    EventLog* _event_log = nullptr;
+    WaveformCapture* _capture = nullptr;
+    ScanCycle* _scan = nullptr;
+    LogicEngine* _logic = nullptr;
+    PidController* _pid = nullptr;
+    RelayScheduler* _relay_scheduler = nullptr;
+    RelayInterlock* _interlock = nullptr;
+    uint32_t _sse_edge_cursor = 0;      // Next edge to stream over SSE (loop task only)
+    uint32_t _sse_anomaly_sequence = 0; // Last anomaly event sent over SSE (loop task only)
+    uint32_t _sse_alarm_sequence = 0;   // Last alarm event sent over SSE (loop task only)
+    uint32_t _sse_captures = 0;         // Completed captures announced over SSE (loop task only)
     AsyncWebServer* _server = nullptr;
     std::vector<AsyncEventSource*> _event_sources;
     std::vector<Capability> _capabilities;
+    AdmissionControl _admission;
+    IdempotencyCache _idempotency;
+    ResponseCache _response_cache;
+
+    const Capability* findCapability(const char* name) const;
 
     // MCP specific methods
     void setupHttpEndpoints();
     void setupSSEEndpoints();
     void broadcastState();
-    
-    // SSE event queue management
-    std::queue<std::string> _event_queue;
-    
+    void broadcastEdges();
+    void broadcastAnomalies();
+    void broadcastAlarms();
+    void broadcastCapture();
+    void broadcastPid();
+    size_t serializeState(char* buffer, size_t size);
+
+    // Voltage and current without touching the power monitor while the
+    // capture task is its reader
+    void readPower(float& voltage, float& current);
+    // Debounced input levels (bit i = input i) from the sampler when it runs
+    uint8_t readInputs();
+
+    // Request slot pool. Bodies arrive in chunks on the AsyncTCP task and are
+    // assembled and parsed here, so the /mcp path needs no heap in steady
+    // state. The pool size is also the global cap on concurrent /mcp requests.
+    // The worker leaves the response text in the slot, and AsyncTCP pulls it
+    // through a chunked response: request objects are only safe to touch on
+    // the AsyncTCP task.
+    static constexpr size_t MCP_MAX_BODY         = 2048;
+    static constexpr size_t MCP_MAX_RESPONSE     = 6144;
+    static constexpr size_t MCP_REQUEST_DOC_SIZE = 2048;
+    static constexpr size_t MCP_REQUEST_SLOTS    = 4;
+
+    enum SlotState : uint8_t {
+        SLOT_FREE = 0,
+        SLOT_RECEIVING,     // Body chunks arriving on the AsyncTCP task
+        SLOT_QUEUED,        // Parsed, waiting in the scheduler
+        SLOT_RUNNING,       // Being executed by the worker
+        SLOT_ANSWERED       // Response text in data, being pulled by AsyncTCP
+    };
+
+    struct RequestSlot {
+        AsyncWebServerRequest* owner = nullptr;   // Cleared if the client disconnects
+        AsyncClient* client          = nullptr;   // Connection to wake once answered
+        SlotState state              = SLOT_FREE;
+        size_t length                = 0;         // Of the body, then of the response
+        bool overflow                = false;
+        int cacheEntry               = -1;        // Reserved idempotency cache entry
+        uint32_t clientIp            = 0;
+        char data[MCP_MAX_RESPONSE];              // Request body, then the response text
+        StaticJsonDocument<MCP_REQUEST_DOC_SIZE> doc;
+    };
+    RequestSlot _slots[MCP_REQUEST_SLOTS];
+    SemaphoreHandle_t _slot_lock = nullptr;     // Guards owner/state across tasks
+
+    // Requests refused by the admission precheck when their body started,
+    // so the final handler answers with that verdict (AsyncTCP task only)
+    struct Refusal {
+        AsyncWebServerRequest* request;
+        uint32_t retryAfterMs;
+    };
+    Refusal _refusals[MCP_REQUEST_SLOTS] = {};
+    size_t _next_refusal                 = 0;
+
+    RequestSlot* acquireSlot(AsyncWebServerRequest* request);
+    RequestSlot* findSlot(AsyncWebServerRequest* request);
+    void freeSlot(RequestSlot* slot);
+    bool takeRefusal(AsyncWebServerRequest* request, uint32_t* retryAfterMs);
+    void handleDisconnect(AsyncWebServerRequest* request);
+    size_t fillSlotResponse(AsyncWebServerRequest* request, int index, uint8_t* buffer, size_t maxLen, size_t sent);
+    void handleMcpBody(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total);
+    void handleMcpRequest(AsyncWebServerRequest* request);
+    bool serveCached(AsyncWebServerRequest* request, const Capability& capability, JsonDocument& doc);
+    void sendError(AsyncWebServerRequest* request, JsonDocument& doc, int code, const char* message);
+    void sendRejection(AsyncWebServerRequest* request, int status, uint32_t retryAfterMs, int code,
+                       const char* message);
+    void handleMetrics(AsyncWebServerRequest* request);
+
+    // Long-poll waits, completed from the scan and answered on AsyncTCP
+    static constexpr size_t WAIT_RESPONSE_SIZE = 512;
+    WaitList _wait_list;
+    AsyncClient* _wait_clients[WaitList::MAX_WAITS] = {};  // Connection to wake per entry
+    void parkWait(AsyncWebServerRequest* request, RequestSlot* slot);
+    static void onScan(void* context, const IOSnapshot& previous, const IOSnapshot& current);
+    size_t fillWaitResponse(AsyncWebServerRequest* request, int index, uint8_t* buffer, size_t maxLen, size_t sent);
+
+    // Long-running calls, stepped from update() and reported over SSE
+    JobManager _jobs;
+    static bool stepToneJob(void* context, uint32_t arg, uint32_t elapsedMs, bool cancel);
+    static void onJobProgress(void* context, const JobManager::Progress& progress);
+
+    // Capability execution happens on the scheduler's worker task
+    CommandScheduler _scheduler;
+    static void executeJob(void* context, uint16_t job);
+    void executeSlot(RequestSlot& slot);
+
+    // Worker-side documents, only touched by the scheduler task
+    StaticJsonDocument<6144> _rpc_response_doc;
+    StaticJsonDocument<1024> _params_doc;
+    StaticJsonDocument<4096> _result_doc;
+    char _rpc_buffer[MCP_MAX_RESPONSE];
+
+    // Requester of the slot being executed, for the sequence-of-events log
+    uint32_t _exec_client_ip = 0;
+    char _exec_request_id[EventLog::REQUEST_ID_TEXT] = {};
+
+    // Bulk results are written as JSON text here and attached with
+    // serialized(), which costs no document memory per value. The text is
+    // copied into _result_doc, so rows stop at BULK_TEXT_BUDGET to leave
+    // room for the other members
+    static constexpr size_t BULK_TEXT_BUDGET = 3072;
+    char _bulk_text[4096];
+
+    // AsyncTCP-side buffers for /capabilities and /metrics (per-input and
+    // per-task metric series need more than 4 KB)
+    StaticJsonDocument<4096> _response_doc;
+    char _response_buffer[8192];
+
     // Command received callback
     CommandReceivedCallback _commandReceivedCallback = nullptr;
     
@@ -79,4 +309,38 @@ private:
     void handleGetPowerVoltage(JsonDocument& params, JsonDocument& result);
     void handleGetIoCurrent(JsonDocument& params, JsonDocument& result);
     void handleGetSensorData(JsonDocument& params, JsonDocument& result);
+    void handleGetMemoryStats(JsonDocument& params, JsonDocument& result);
+    void handleGetSchedulerStats(JsonDocument& params, JsonDocument& result);
+    void handleGetJobs(JsonDocument& params, JsonDocument& result);
+    void handleGetEdges(JsonDocument& params, JsonDocument& result);
+    void handleConfigureDebounce(JsonDocument& params, JsonDocument& result);
+    void handleGetHistory(JsonDocument& params, JsonDocument& result);
+    void handleGetStats(JsonDocument& params, JsonDocument& result);
+    void handleGetEnergy(JsonDocument& params, JsonDocument& result);
+    void handleGetRelayStats(JsonDocument& params, JsonDocument& result);
+    void handleResetRelayStats(JsonDocument& params, JsonDocument& result);
+    void handleGetAnomalies(JsonDocument& params, JsonDocument& result);
+    void handleResetAnomalies(JsonDocument& params, JsonDocument& result);
+    void handleConfigureAlarm(JsonDocument& params, JsonDocument& result);
+    void handleGetAlarms(JsonDocument& params, JsonDocument& result);
+    void handleAckAlarm(JsonDocument& params, JsonDocument& result);
+    void handleGetEvents(JsonDocument& params, JsonDocument& result);
+    void handleArmCapture(JsonDocument& params, JsonDocument& result);
+    void handleGetCapture(JsonDocument& params, JsonDocument& result);
+    void handleGetScanStats(JsonDocument& params, JsonDocument& result);
+    void handleConfigureScan(JsonDocument& params, JsonDocument& result);
+    void handleUploadProgram(JsonDocument& params, JsonDocument& result);
+    void handleGetProgram(JsonDocument& params, JsonDocument& result);
+    void handleConfigurePid(JsonDocument& params, JsonDocument& result);
+    void handleGetPid(JsonDocument& params, JsonDocument& result);
+    void handlePulseRelay(JsonDocument& params, JsonDocument& result);
+    void handleScheduleRelay(JsonDocument& params, JsonDocument& result);
+    void checkPulseWidth(int relay, bool state, uint32_t pulseMs);
+    void handleCancelSchedule(JsonDocument& params, JsonDocument& result);
+    void handleGetSchedules(JsonDocument& params, JsonDocument& result);
+    void handleConfigureInterlock(JsonDocument& params, JsonDocument& result);
+    void handleGetInterlocks(JsonDocument& params, JsonDocument& result);
+    void handleGetCounters(JsonDocument& params, JsonDocument& result);
+    void handleResetCounter(JsonDocument& params, JsonDocument& result);
+    void handleCancelJob(JsonDocument& params, JsonDocument& result);
 };
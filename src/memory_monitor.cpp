@@ -0,0 +1,112 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "memory_monitor.h"
+#include <esp_heap_caps.h>
+
+MemoryMonitor::MemoryMonitor() {}
+
+MemoryMonitor::~MemoryMonitor() {
+    if (_timer) {
+        esp_timer_stop(_timer);
+    }
+}
+
+void MemoryMonitor::begin(uint32_t intervalMs) {
+    _snapshot.psramPresent = psramFound();
+    sample();
+    
+    esp_timer_create_args_t args = {};
+    args.callback = [](void* arg) {
+        static_cast<MemoryMonitor*>(arg)->sample();
+    };
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "mem_monitor";
+    
+    if (esp_timer_create(&args, &_timer) == ESP_OK) {
+        esp_timer_start_periodic(_timer, (uint64_t)intervalMs * 1000);
+    }
+}
+
+void MemoryMonitor::watchTask(const char* name) {
+    portENTER_CRITICAL(&_lock);
+    if (_snapshot.taskCount < MAX_TASKS) {
+        _snapshot.tasks[_snapshot.taskCount].name = name;
+        _snapshot.tasks[_snapshot.taskCount].found = false;
+        _snapshot.taskCount++;
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+MemoryMonitor::Snapshot MemoryMonitor::snapshot() {
+    portENTER_CRITICAL(&_lock);
+    Snapshot copy = _snapshot;
+    portEXIT_CRITICAL(&_lock);
+    return copy;
+}
+
+uint32_t MemoryMonitor::fragmentation(const HeapStats& stats) {
+    if (stats.freeBytes == 0) {
+        return 0;
+    }
+    return 100 - (uint32_t)((uint64_t)stats.largestFreeBlock * 100 / stats.freeBytes);
+}
+
+void MemoryMonitor::sampleHeap(uint32_t caps, HeapStats& stats, uint32_t previousMinLargest) {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, caps);
+    
+    stats.totalBytes = heap_caps_get_total_size(caps);
+    stats.freeBytes = info.total_free_bytes;
+    stats.minFreeBytes = info.minimum_free_bytes;
+    stats.largestFreeBlock = info.largest_free_block;
+    stats.allocatedBlocks = info.allocated_blocks;
+    stats.freeBlocks = info.free_blocks;
+    
+    if (previousMinLargest == 0 || info.largest_free_block < previousMinLargest) {
+        stats.minLargestFreeBlock = info.largest_free_block;
+    } else {
+        stats.minLargestFreeBlock = previousMinLargest;
+    }
+}
+
+void MemoryMonitor::sample() {
+    // Gather everything outside the lock; heap_caps_get_info walks the heap
+    HeapStats internal;
+    HeapStats psram = {};
+    sampleHeap(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT, internal, _snapshot.internal.minLargestFreeBlock);
+    if (_snapshot.psramPresent) {
+        sampleHeap(MALLOC_CAP_SPIRAM, psram, _snapshot.psram.minLargestFreeBlock);
+    }
+    
+    uint32_t highWater[MAX_TASKS] = {};
+    bool found[MAX_TASKS] = {};
+    int taskCount = _snapshot.taskCount;
+    for (int i = 0; i < taskCount; i++) {
+        // Tasks may start after the monitor; resolve handles lazily and keep them
+        if (!_handles[i]) {
+            _handles[i] = xTaskGetHandle(_snapshot.tasks[i].name);
+        }
+        if (_handles[i]) {
+            found[i] = true;
+            highWater[i] = uxTaskGetStackHighWaterMark(_handles[i]);
+        }
+    }
+    
+    AllocTracker::Totals allocations = AllocTracker::totals();
+    
+    portENTER_CRITICAL(&_lock);
+    _snapshot.timestamp = millis();
+    _snapshot.samples++;
+    _snapshot.internal = internal;
+    _snapshot.psram = psram;
+    for (int i = 0; i < taskCount; i++) {
+        _snapshot.tasks[i].found = found[i];
+        _snapshot.tasks[i].highWaterBytes = highWater[i];
+    }
+    _snapshot.allocations = allocations;
+    portEXIT_CRITICAL(&_lock);
+}
@@ -0,0 +1,71 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "alloc_tracker.h"
+
+/*
+ * Background heap and stack sampler.
+ *
+ * Heap statistics are gathered from an esp_timer callback, so readers only
+ * copy the last snapshot and never walk the heap themselves.
+ */
+class MemoryMonitor {
+public:
+    static constexpr int MAX_TASKS = 8;
+
+    struct HeapStats {
+        uint32_t totalBytes;
+        uint32_t freeBytes;
+        uint32_t minFreeBytes;        // Lowest free size since boot
+        uint32_t largestFreeBlock;
+        uint32_t minLargestFreeBlock; // Lowest largest block seen by the sampler
+        uint32_t allocatedBlocks;
+        uint32_t freeBlocks;
+    };
+
+    struct TaskStack {
+        const char* name;
+        bool found;
+        uint32_t highWaterBytes;      // Smallest free stack seen by FreeRTOS
+    };
+
+    struct Snapshot {
+        uint32_t timestamp;
+        uint32_t samples;
+        HeapStats internal;
+        bool psramPresent;
+        HeapStats psram;
+        TaskStack tasks[MAX_TASKS];
+        int taskCount;
+        AllocTracker::Totals allocations;
+    };
+
+    MemoryMonitor();
+    ~MemoryMonitor();
+
+    // Start periodic sampling
+    void begin(uint32_t intervalMs = 10000);
+
+    // Add a FreeRTOS task (by name) to the stack high-water report
+    void watchTask(const char* name);
+
+    // Copy of the most recent sample
+    Snapshot snapshot();
+
+    // Fragmentation of a heap in percent (0 = one contiguous free block)
+    static uint32_t fragmentation(const HeapStats& stats);
+
+private:
+    esp_timer_handle_t _timer = nullptr;
+    portMUX_TYPE _lock        = portMUX_INITIALIZER_UNLOCKED;
+    Snapshot _snapshot        = {};
+    TaskHandle_t _handles[MAX_TASKS] = {};
+
+    void sample();
+    static void sampleHeap(uint32_t caps, HeapStats& stats, uint32_t previousMinLargest);
+};
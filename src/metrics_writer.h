@@ -0,0 +1,66 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include <type_traits>
+
+/*
+ * Writes Prometheus text exposition format into a caller-provided buffer.
+ * Output is silently truncated once the buffer is full; check overflowed().
+ */
+class MetricsWriter {
+public:
+    MetricsWriter(char* buffer, size_t size) : _buffer(buffer), _size(size) {
+        if (_size) {
+            _buffer[0] = '\0';
+        }
+    }
+
+    // Emit the HELP/TYPE lines for a metric family
+    void family(const char* name, const char* type, const char* help) {
+        append("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    }
+
+    template <typename T>
+    void sample(const char* name, T value, const char* labels = nullptr) {
+        const char* open = labels ? "{" : "";
+        const char* close = labels ? "}" : "";
+        if (!labels) {
+            labels = "";
+        }
+        if (std::is_floating_point<T>::value) {
+            append("%s%s%s%s %.6g\n", name, open, labels, close, (double)value);
+        } else {
+            append("%s%s%s%s %lld\n", name, open, labels, close, (long long)value);
+        }
+    }
+
+    size_t length() const { return _length; }
+    bool overflowed() const { return _overflowed; }
+
+private:
+    char* _buffer;
+    size_t _size;
+    size_t _length   = 0;
+    bool _overflowed = false;
+
+    void append(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        if (_overflowed) {
+            return;
+        }
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(_buffer + _length, _size - _length, format, args);
+        va_end(args);
+        if (written < 0 || (size_t)written >= _size - _length) {
+            // Drop the partial line so the output stays parseable
+            _buffer[_length] = '\0';
+            _overflowed = true;
+            return;
+        }
+        _length += written;
+    }
+};
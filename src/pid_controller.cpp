@@ -0,0 +1,241 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "pid_controller.h"
+#include "scan_cycle.h"
+#include <Preferences.h>
+#include <string.h>
+
+PidController::PidController() {}
+
+void PidController::begin(ScanCycle* scan) {
+    _scan = scan;
+
+    Preferences prefs;
+    if (prefs.begin("pid", true)) {
+        if (prefs.getBytesLength("loops") == sizeof(_configs)) {
+            prefs.getBytes("loops", _configs, sizeof(_configs));
+        }
+        prefs.end();
+    }
+}
+
+void PidController::onLogic(void* context, const IOSnapshot& snapshot) {
+    static_cast<PidController*>(context)->run(snapshot);
+}
+
+void PidController::run(const IOSnapshot& snapshot) {
+    uint32_t now = snapshot.timestamp;
+    uint8_t driven = 0;
+    uint8_t on = 0;
+
+    portENTER_CRITICAL(&_lock);
+    for (int relay = 0; relay < MAX_LOOPS; relay++) {
+        const Config& config = _configs[relay];
+        if (!config.enabled) {
+            continue;
+        }
+        Runtime& runtime = _runtime[relay];
+        if (!runtime.running || snapshot.sensorTimestamp != runtime.sensorMs) {
+            update(relay, snapshot);
+        }
+
+        // Windows follow each other back to back unless a whole one was missed
+        if (now - runtime.windowStartMs >= config.cycleMs) {
+            runtime.windowStartMs = now - runtime.windowStartMs >= 2 * config.cycleMs
+                                        ? now
+                                        : runtime.windowStartMs + config.cycleMs;
+        }
+        runtime.relay = now - runtime.windowStartMs < runtime.output / 100.0f * config.cycleMs;
+
+        driven |= 1 << relay;
+        if (runtime.relay) {
+            on |= 1 << relay;
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    // Relays of loops that were removed or disabled are switched off once
+    uint8_t released = _driven & ~driven;
+    _driven = driven;
+    uint8_t changed = ((on ^ snapshot.relays) & driven) | (released & snapshot.relays);
+    for (int relay = 0; changed; relay++, changed >>= 1) {
+        if (changed & 1) {
+            _scan->writeRelay(relay, (on >> relay) & 1);
+        }
+    }
+}
+
+void PidController::update(int relay, const IOSnapshot& snapshot) {
+    const Config& config = _configs[relay];
+    Runtime& runtime = _runtime[relay];
+    float value = valueOf(config.source, snapshot);
+
+    // A loop starts from the process value, so no derivative kick and the
+    // ramp leads away from where the process is
+    float dt = 0;
+    if (!runtime.running) {
+        runtime.running = true;
+        runtime.value = value;
+        runtime.setpoint = config.rampRate > 0 ? value : config.setpoint;
+        runtime.windowStartMs = snapshot.timestamp;
+    } else {
+        dt = (snapshot.sensorTimestamp - runtime.sensorMs) / 1000.0f;
+    }
+    runtime.sensorMs = snapshot.sensorTimestamp;
+
+    if (config.rampRate > 0) {
+        float step = config.rampRate * dt;
+        float remaining = config.setpoint - runtime.setpoint;
+        runtime.setpoint += remaining > step ? step : (remaining < -step ? -step : remaining);
+    } else {
+        runtime.setpoint = config.setpoint;
+    }
+
+    // Reverse action: output drives the value up, so error is setpoint - value
+    float sign = config.action == ACTION_REVERSE ? 1.0f : -1.0f;
+    float error = sign * (runtime.setpoint - value);
+    float p = config.kp * error;
+    float d = dt > 0 ? -sign * config.kd * (value - runtime.value) / dt : 0;
+
+    // Conditional integration: not further into a saturated output
+    float integral = runtime.integral + config.ki * error * dt;
+    float unclamped = p + integral + d;
+    if ((unclamped > config.outMax && error > 0) || (unclamped < config.outMin && error < 0)) {
+        integral = runtime.integral;
+    }
+    integral = constrain(integral, config.outMin, config.outMax);
+
+    runtime.value = value;
+    runtime.error = error;
+    runtime.p = p;
+    runtime.integral = integral;
+    runtime.d = d;
+    runtime.output = constrain(p + integral + d, config.outMin, config.outMax);
+    runtime.updates++;
+}
+
+bool PidController::configure(int relay, const Config& config) {
+    if (relay < 0 || relay >= MAX_LOOPS) {
+        return false;
+    }
+    if (config.defined &&
+        (config.source >= SOURCE_COUNT || config.action > ACTION_DIRECT || config.kp < 0 || config.ki < 0 ||
+         config.kd < 0 || config.rampRate < 0 || config.outMin < 0 || config.outMax > 100 ||
+         config.outMin >= config.outMax || config.cycleMs < MIN_CYCLE_MS || config.cycleMs > MAX_CYCLE_MS)) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&_lock);
+    // Same loop with new tuning: carry on from the integral and the
+    // working setpoint
+    const Config& previous = _configs[relay];
+    bool keep = previous.enabled && config.enabled && previous.source == config.source &&
+                previous.action == config.action;
+    _configs[relay] = config;
+    if (!config.defined) {
+        _configs[relay].enabled = false;
+    }
+    if (!keep) {
+        _runtime[relay] = {};
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    save();
+    return true;
+}
+
+bool PidController::status(int relay, Status& out) {
+    if (relay < 0 || relay >= MAX_LOOPS) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&_lock);
+    const Runtime& runtime = _runtime[relay];
+    out.config = _configs[relay];
+    out.running = runtime.running;
+    out.relay = runtime.relay;
+    out.value = runtime.value;
+    out.setpoint = runtime.setpoint;
+    out.error = runtime.error;
+    out.p = runtime.p;
+    out.i = runtime.integral;
+    out.d = runtime.d;
+    out.output = runtime.output;
+    out.updates = runtime.updates;
+    portEXIT_CRITICAL(&_lock);
+
+    return out.config.defined;
+}
+
+uint8_t PidController::relayMask() {
+    uint8_t mask = 0;
+    portENTER_CRITICAL(&_lock);
+    for (int relay = 0; relay < MAX_LOOPS; relay++) {
+        if (_configs[relay].enabled) {
+            mask |= 1 << relay;
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+    return mask;
+}
+
+void PidController::save() {
+    Config copy[MAX_LOOPS];
+    portENTER_CRITICAL(&_lock);
+    memcpy(copy, _configs, sizeof(copy));
+    portEXIT_CRITICAL(&_lock);
+
+    Preferences prefs;
+    if (prefs.begin("pid", false)) {
+        prefs.putBytes("loops", copy, sizeof(copy));
+        prefs.end();
+    }
+}
+
+float PidController::valueOf(Source source, const IOSnapshot& snapshot) {
+    switch (source) {
+        case SOURCE_TEMPERATURE: return snapshot.temperature;
+        case SOURCE_VOLTAGE:     return snapshot.voltage;
+        case SOURCE_CURRENT:     return snapshot.current;
+        case SOURCE_POWER:       return snapshot.voltage * snapshot.current;
+        default:                 return 0;
+    }
+}
+
+const char* PidController::sourceName(Source source) {
+    switch (source) {
+        case SOURCE_TEMPERATURE: return "temperature";
+        case SOURCE_VOLTAGE:     return "voltage";
+        case SOURCE_CURRENT:     return "current";
+        case SOURCE_POWER:       return "power";
+        default:                 return "unknown";
+    }
+}
+
+const char* PidController::actionName(Action action) {
+    return action == ACTION_DIRECT ? "direct" : "reverse";
+}
+
+bool PidController::parseSource(const char* name, Source& source) {
+    for (int s = 0; s < SOURCE_COUNT; s++) {
+        if (strcmp(name, sourceName(static_cast<Source>(s))) == 0) {
+            source = static_cast<Source>(s);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PidController::parseAction(const char* name, Action& action) {
+    if (strcmp(name, "reverse") == 0) {
+        action = ACTION_REVERSE;
+    } else if (strcmp(name, "direct") == 0) {
+        action = ACTION_DIRECT;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,130 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include "io_scanner.h"
+
+class ScanCycle;
+
+/*
+ * Closed-loop PID control with time-proportioned relay outputs.
+ *
+ * There is one loop per relay. Its process value is a sensor of the
+ * snapshot and the PID runs whenever the scan has read the sensors anew
+ * (every SENSOR_SCAN_INTERVAL_MS). The output, a duty of 0-100 %, drives the
+ * relay through time-proportioning: within every cycleMs window the relay
+ * is on for output % of the window. Window edges are checked every scan, so
+ * the on time is accurate to the scan period.
+ *
+ * The derivative acts on the process value only, so setpoint changes do
+ * not kick the output. The integral stops growing while the output is
+ * saturated in the direction of the error and is kept within the output
+ * limits, so the loop does not wind up while the relay is pinned. With a
+ * ramp rate the working setpoint moves towards a new setpoint at that many
+ * units per second, starting from the process value when a loop is enabled.
+ *
+ * Reconfiguring a running loop with the same source and action keeps its
+ * integral and working setpoint, so gains can be tuned live without a bump.
+ * Configurations are stored in NVS; run() is a scan cycle logic step and the
+ * rest runs on the worker, with a spinlock between them.
+ */
+class PidController {
+public:
+    static constexpr int MAX_LOOPS           = 4;     // One per relay
+    static constexpr uint32_t MIN_CYCLE_MS   = 100;
+    static constexpr uint32_t MAX_CYCLE_MS   = 600000;
+
+    enum Source : uint8_t {
+        SOURCE_TEMPERATURE = 0,
+        SOURCE_VOLTAGE,
+        SOURCE_CURRENT,
+        SOURCE_POWER,
+        SOURCE_COUNT
+    };
+
+    enum Action : uint8_t {
+        ACTION_REVERSE = 0,     // Output raises the value (heating)
+        ACTION_DIRECT           // Output lowers the value (cooling)
+    };
+
+    struct Config {
+        bool defined;
+        bool enabled;
+        Source source;
+        Action action;
+        float setpoint;
+        float kp;               // % output per unit of error
+        float ki;               // % per unit of error and second
+        float kd;               // % per unit per second of change
+        float rampRate;         // Setpoint units per second; 0 = step
+        float outMin;           // %
+        float outMax;           // %
+        uint32_t cycleMs;       // Time-proportioning window
+    };
+
+    struct Status {
+        Config config;
+        bool running;           // Has a process value
+        bool relay;             // Relay state asked for
+        float value;            // Process value
+        float setpoint;         // Working (ramped) setpoint
+        float error;
+        float p;                // Terms of the last output, %
+        float i;
+        float d;
+        float output;           // %
+        uint32_t updates;
+    };
+
+    PidController();
+
+    // Restores the loops from NVS; relay writes go through scan
+    void begin(ScanCycle* scan);
+
+    // Scan cycle logic step
+    static void onLogic(void* context, const IOSnapshot& snapshot);
+    void run(const IOSnapshot& snapshot);
+
+    // Replaces (or with defined = false removes) the loop of one relay and
+    // stores the table; false if the configuration is out of range
+    bool configure(int relay, const Config& config);
+
+    bool status(int relay, Status& out);
+
+    // Relays driven by enabled loops
+    uint8_t relayMask();
+
+    static const char* sourceName(Source source);
+    static const char* actionName(Action action);
+    static bool parseSource(const char* name, Source& source);
+    static bool parseAction(const char* name, Action& action);
+
+private:
+    struct Runtime {
+        bool running;
+        bool relay;
+        float value;
+        float setpoint;
+        float error;
+        float p;
+        float integral;
+        float d;
+        float output;
+        uint32_t sensorMs;      // sensorTimestamp of the last update
+        uint32_t windowStartMs;
+        uint32_t updates;
+    };
+
+    ScanCycle* _scan             = nullptr;
+    Config _configs[MAX_LOOPS]   = {};
+    Runtime _runtime[MAX_LOOPS]  = {};
+    uint8_t _driven              = 0;       // Relays driven at the last run (scan task only)
+    portMUX_TYPE _lock           = portMUX_INITIALIZER_UNLOCKED;
+
+    void update(int relay, const IOSnapshot& snapshot);
+    void save();
+    static float valueOf(Source source, const IOSnapshot& snapshot);
+};
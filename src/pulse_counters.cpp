@@ -0,0 +1,124 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "pulse_counters.h"
+#include <string.h>
+
+PulseCounters::PulseCounters() {}
+
+void PulseCounters::record(uint8_t rising, uint8_t falling, const uint64_t* timestamps) {
+    uint8_t edges = rising | falling;
+    if (!edges) {
+        return;
+    }
+
+    portENTER_CRITICAL(&_lock);
+    for (int i = 0; i < 8; i++) {
+        uint8_t bit = 1 << i;
+        if (!(edges & bit)) {
+            continue;
+        }
+
+        Channel& channel = _channels[i];
+        bool isRising = rising & bit;
+        if (isRising) {
+            channel.rising++;
+        } else {
+            channel.falling++;
+        }
+
+        if (channel.mode == MODE_BOTH || (channel.mode == MODE_RISING) == isRising) {
+            channel.count++;
+        }
+
+        // Period is measured between edges of the same direction
+        if ((channel.mode == MODE_FALLING) != isRising) {
+            channel.periodEdges[channel.periodCount % PERIOD_EDGES] = timestamps[i];
+            channel.periodCount++;
+        }
+        channel.lastEdgeUs = timestamps[i];
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+PulseCounters::Reading PulseCounters::read(int channel, uint64_t nowUs) {
+    portENTER_CRITICAL(&_lock);
+    Channel copy = _channels[channel];
+    portEXIT_CRITICAL(&_lock);
+
+    Reading reading = {};
+    reading.mode = copy.mode;
+    reading.count = copy.count;
+    reading.rising = copy.rising;
+    reading.falling = copy.falling;
+    reading.lastEdgeUs = copy.lastEdgeUs;
+
+    // Average over as many periods as the history holds
+    if (copy.periodCount >= 2) {
+        uint32_t periods = copy.periodCount > PERIOD_EDGES ? PERIOD_EDGES - 1 : copy.periodCount - 1;
+        uint64_t newest = copy.periodEdges[(copy.periodCount - 1) % PERIOD_EDGES];
+        uint64_t oldest = copy.periodEdges[(copy.periodCount - 1 - periods) % PERIOD_EDGES];
+        reading.periodUs = (uint32_t)((newest - oldest) / periods);
+
+        // No timing edge for twice the last period (and at least a second):
+        // the input has stopped
+        uint64_t silence = nowUs - newest;
+        uint64_t limit = (uint64_t)reading.periodUs * 2;
+        if (limit < 1000000) {
+            limit = 1000000;
+        }
+        if (reading.periodUs > 0 && silence <= limit) {
+            reading.frequencyHz = 1000000.0f / reading.periodUs;
+        }
+    }
+
+    return reading;
+}
+
+void PulseCounters::reset(int channel, uint32_t value) {
+    portENTER_CRITICAL(&_lock);
+    Channel& target = _channels[channel];
+    target.count = value;
+    target.rising = 0;
+    target.falling = 0;
+    target.periodCount = 0;
+    memset(target.periodEdges, 0, sizeof(target.periodEdges));
+    portEXIT_CRITICAL(&_lock);
+}
+
+void PulseCounters::setMode(int channel, Mode mode) {
+    portENTER_CRITICAL(&_lock);
+    if (_channels[channel].mode != mode) {
+        _channels[channel].mode = mode;
+        _channels[channel].periodCount = 0;
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+PulseCounters::Mode PulseCounters::mode(int channel) {
+    portENTER_CRITICAL(&_lock);
+    Mode mode = _channels[channel].mode;
+    portEXIT_CRITICAL(&_lock);
+    return mode;
+}
+
+const char* PulseCounters::modeName(Mode mode) {
+    switch (mode) {
+        case MODE_RISING:  return "rising";
+        case MODE_FALLING: return "falling";
+        case MODE_BOTH:    return "both";
+        default:           return "unknown";
+    }
+}
+
+bool PulseCounters::parseMode(const char* name, Mode& mode) {
+    for (int m = MODE_RISING; m <= MODE_BOTH; m++) {
+        if (strcmp(name, modeName(static_cast<Mode>(m))) == 0) {
+            mode = static_cast<Mode>(m);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,67 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+
+/*
+ * High-speed counters on the digital inputs.
+ *
+ * The input sampler calls record() with the debounced edges of each sample,
+ * so counting never depends on anybody polling. Every channel keeps rising
+ * and falling totals plus a presettable count of the edges selected by its
+ * mode. Frequency is measured from the timestamps of the last PERIOD_EDGES
+ * rising (or, in falling mode, falling) edges.
+ */
+class PulseCounters {
+public:
+    static constexpr int PERIOD_EDGES = 8;
+
+    enum Mode : uint8_t {
+        MODE_RISING = 0,
+        MODE_FALLING,
+        MODE_BOTH
+    };
+
+    struct Reading {
+        Mode mode;
+        uint32_t count;         // Preset plus edges selected by mode
+        uint32_t rising;
+        uint32_t falling;
+        uint32_t periodUs;      // Average over the last PERIOD_EDGES periods, 0 = unknown
+        float frequencyHz;      // 0 once the input has stopped
+        uint64_t lastEdgeUs;
+    };
+
+    PulseCounters();
+
+    // Sampler task: rising/falling masks and the timestamp of each edge
+    void record(uint8_t rising, uint8_t falling, const uint64_t* timestamps);
+
+    Reading read(int channel, uint64_t nowUs);
+
+    // Preset count and clear the totals and period history
+    void reset(int channel, uint32_t value);
+
+    void setMode(int channel, Mode mode);
+    Mode mode(int channel);
+
+    static const char* modeName(Mode mode);
+    static bool parseMode(const char* name, Mode& mode);
+
+private:
+    struct Channel {
+        Mode mode;
+        uint32_t count;
+        uint32_t rising;
+        uint32_t falling;
+        uint64_t periodEdges[PERIOD_EDGES];   // Ring of timing-edge timestamps
+        uint32_t periodCount;                 // Timing edges seen since reset
+        uint64_t lastEdgeUs;
+    };
+
+    Channel _channels[8] = {};
+    portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+};
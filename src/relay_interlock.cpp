@@ -0,0 +1,179 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "relay_interlock.h"
+#include <Preferences.h>
+#include <string.h>
+
+RelayInterlock::RelayInterlock() {}
+
+void RelayInterlock::begin() {
+    Preferences prefs;
+    if (prefs.begin("interlock", true)) {
+        if (prefs.getBytesLength("table") == sizeof(_rules)) {
+            prefs.getBytes("table", _rules, sizeof(_rules));
+        }
+        prefs.end();
+    }
+}
+
+bool RelayInterlock::configure(int relay, const Rule& rule) {
+    if (relay < 0 || relay >= RELAY_COUNT) {
+        return false;
+    }
+
+    uint8_t bit = 1 << relay;
+    portENTER_CRITICAL(&_lock);
+    _rules[relay] = rule;
+    _rules[relay].notWith &= ~bit & ((1 << RELAY_COUNT) - 1);
+    for (int other = 0; other < RELAY_COUNT; other++) {
+        if (other == relay) {
+            continue;
+        }
+        if (_rules[relay].notWith & (1 << other)) {
+            _rules[other].notWith |= bit;
+        } else {
+            _rules[other].notWith &= ~bit;
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    save();
+    return true;
+}
+
+RelayInterlock::Rule RelayInterlock::rule(int relay) {
+    portENTER_CRITICAL(&_lock);
+    Rule copy = _rules[relay];
+    portEXIT_CRITICAL(&_lock);
+    return copy;
+}
+
+uint8_t RelayInterlock::check(uint8_t relays, uint8_t pending, uint8_t values, uint8_t inputs, uint32_t now,
+                              Rejection* out, uint8_t held) {
+    uint8_t changing = pending & (values ^ relays);
+    if (!changing) {
+        return 0;
+    }
+
+    portENTER_CRITICAL(&_lock);
+    Rule rules[RELAY_COUNT];
+    memcpy(rules, _rules, sizeof(rules));
+    portEXIT_CRITICAL(&_lock);
+
+    // Minimum times first: they decide which switch-offs happen
+    uint8_t rejected = 0;
+    uint8_t repeated = 0;
+    for (int relay = 0; relay < RELAY_COUNT; relay++) {
+        uint8_t bit = 1 << relay;
+        if (!(changing & bit) || !(_known & bit)) {
+            continue;
+        }
+        bool on = relays & bit;
+        if (now - _changed_ms[relay] < (on ? rules[relay].minOnMs : rules[relay].minOffMs)) {
+            rejected |= bit;
+            repeated |= held & bit;
+            out[relay] = {on ? REASON_MIN_ON : REASON_MIN_OFF, 0};
+        }
+    }
+
+    // Switch-ons against the image with the switch-offs that go ahead and
+    // every other switch-on asked for
+    uint8_t switchOn = changing & ~relays & ~rejected;
+    uint8_t image = (relays & ~(changing & ~rejected)) | switchOn;
+    for (int relay = 0; relay < RELAY_COUNT; relay++) {
+        uint8_t bit = 1 << relay;
+        if (!(switchOn & bit)) {
+            continue;
+        }
+        const Rule& rule = rules[relay];
+        uint8_t conflict = image & rule.notWith;
+        uint8_t low = rule.inputsHigh & ~inputs;
+        uint8_t high = rule.inputsLow & inputs;
+        if (conflict) {
+            out[relay] = {REASON_EXCLUSIVE, (uint8_t)__builtin_ctz(conflict)};
+        } else if (low) {
+            out[relay] = {REASON_INPUT_HIGH, (uint8_t)__builtin_ctz(low)};
+        } else if (high) {
+            out[relay] = {REASON_INPUT_LOW, (uint8_t)__builtin_ctz(high)};
+        } else {
+            continue;
+        }
+        rejected |= bit;
+    }
+
+    if (rejected & ~repeated) {
+        portENTER_CRITICAL(&_lock);
+        for (int relay = 0; relay < RELAY_COUNT; relay++) {
+            _rejections[relay] += ((rejected & ~repeated) >> relay) & 1;
+        }
+        portEXIT_CRITICAL(&_lock);
+    }
+    return rejected;
+}
+
+void RelayInterlock::applied(uint8_t changed, uint32_t now) {
+    for (int relay = 0; relay < RELAY_COUNT; relay++) {
+        if (changed & (1 << relay)) {
+            _changed_ms[relay] = now;
+        }
+    }
+    _known |= changed;
+}
+
+uint32_t RelayInterlock::rejections(int relay) {
+    portENTER_CRITICAL(&_lock);
+    uint32_t count = _rejections[relay];
+    portEXIT_CRITICAL(&_lock);
+    return count;
+}
+
+void RelayInterlock::describe(int relay, bool state, const Rejection& rejection, char* out, size_t size) {
+    Rule rule = this->rule(relay);
+    switch (rejection.reason) {
+        case REASON_EXCLUSIVE:
+            snprintf(out, size, "Interlock: relay %d may not be on together with relay %d", relay, rejection.detail);
+            break;
+        case REASON_INPUT_HIGH:
+            snprintf(out, size, "Interlock: relay %d needs input %d high", relay, rejection.detail);
+            break;
+        case REASON_INPUT_LOW:
+            snprintf(out, size, "Interlock: relay %d needs input %d low", relay, rejection.detail);
+            break;
+        case REASON_MIN_ON:
+            snprintf(out, size, "Interlock: relay %d must stay on for %lu ms", relay, (unsigned long)rule.minOnMs);
+            break;
+        case REASON_MIN_OFF:
+            snprintf(out, size, "Interlock: relay %d must stay off for %lu ms", relay, (unsigned long)rule.minOffMs);
+            break;
+        default:
+            snprintf(out, size, "Interlock: relay %d may not be switched %s", relay, state ? "on" : "off");
+            break;
+    }
+}
+
+void RelayInterlock::save() {
+    Rule copy[RELAY_COUNT];
+    portENTER_CRITICAL(&_lock);
+    memcpy(copy, _rules, sizeof(copy));
+    portEXIT_CRITICAL(&_lock);
+
+    Preferences prefs;
+    if (prefs.begin("interlock", false)) {
+        prefs.putBytes("table", copy, sizeof(copy));
+        prefs.end();
+    }
+}
+
+const char* RelayInterlock::reasonName(Reason reason) {
+    switch (reason) {
+        case REASON_EXCLUSIVE:  return "exclusive";
+        case REASON_INPUT_HIGH: return "inputHigh";
+        case REASON_INPUT_LOW:  return "inputLow";
+        case REASON_MIN_ON:     return "minOn";
+        case REASON_MIN_OFF:    return "minOff";
+        default:                return "none";
+    }
+}
@@ -0,0 +1,95 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+
+/*
+ * Interlock table guarding every relay write.
+ *
+ * Each relay has one rule: relays it may not be on together with, inputs
+ * that must be high or low for it to switch on, and minimum on and off
+ * times. The table is kept as bitmasks, so the output phase checks all
+ * queued writes of a scan against the process image with a few mask
+ * operations per relay, whoever queued them (MCP, the logic program, PID
+ * loops or timed writes).
+ *
+ * Only switching is checked: a write of the state a relay already has
+ * always passes, and switching off is held back by the minimum on time
+ * alone. ScanCycle keeps a write refused for a minimum time queued until
+ * that time has passed. Switch-ons are checked against the image after the permitted
+ * switch-offs of the same scan, and two relays that may not be on together
+ * are both refused if asked to switch on in one scan. The rule does not
+ * switch a relay off when an input drops later.
+ *
+ * "Not together" is symmetric and kept so by configure(). The table is
+ * stored in NVS; check() and applied() run on the scan task, the rest on
+ * the worker, with a spinlock between them.
+ */
+class RelayInterlock {
+public:
+    static constexpr int RELAY_COUNT = 4;
+    static constexpr int INPUT_COUNT = 8;
+
+    enum Reason : uint8_t {
+        REASON_NONE = 0,
+        REASON_EXCLUSIVE,       // detail = relay that is on
+        REASON_INPUT_HIGH,      // detail = input that is low
+        REASON_INPUT_LOW,       // detail = input that is high
+        REASON_MIN_ON,
+        REASON_MIN_OFF
+    };
+
+    struct Rule {
+        uint8_t notWith;        // Relays that may not be on at the same time
+        uint8_t inputsHigh;     // Inputs that must be high to switch on
+        uint8_t inputsLow;      // Inputs that must be low to switch on
+        uint32_t minOnMs;
+        uint32_t minOffMs;
+    };
+
+    struct Rejection {
+        Reason reason;
+        uint8_t detail;
+    };
+
+    RelayInterlock();
+
+    // Restores the table from NVS
+    void begin();
+
+    // Replaces the rule of one relay, mirrors its notWith into the other
+    // rules and stores the table
+    bool configure(int relay, const Rule& rule);
+    Rule rule(int relay);
+
+    // Scan task: which of the writes in pending/values may not be made to
+    // the relays, given the inputs; fills out for those. Writes in held were
+    // refused for a minimum time before and are not counted again while
+    // they still are.
+    uint8_t check(uint8_t relays, uint8_t pending, uint8_t values, uint8_t inputs, uint32_t now,
+                  Rejection* out, uint8_t held = 0);
+
+    // Scan task: relays in changed switched at now
+    void applied(uint8_t changed, uint32_t now);
+
+    uint32_t rejections(int relay);
+
+    // Error text for a refused write
+    void describe(int relay, bool state, const Rejection& rejection, char* out, size_t size);
+
+    static const char* reasonName(Reason reason);
+
+private:
+    Rule _rules[RELAY_COUNT]            = {};
+    uint32_t _rejections[RELAY_COUNT]   = {};
+    portMUX_TYPE _lock                  = portMUX_INITIALIZER_UNLOCKED;
+
+    // Scan task only
+    uint32_t _changed_ms[RELAY_COUNT]   = {};
+    uint8_t _known                      = 0;    // Relays switched since boot
+
+    void save();
+};
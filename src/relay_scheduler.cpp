@@ -0,0 +1,489 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "relay_scheduler.h"
+#include "scan_cycle.h"
+#include <Preferences.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+RelayScheduler::RelayScheduler() {
+    for (int list = 0; list < LEVELS * SLOTS; list++) {
+        _heads[list] = NONE;
+    }
+    for (int index = MAX_TIMERS - 1; index >= 0; index--) {
+        _timers[index] = {};
+        _timers[index].list = NONE;
+        _timers[index].next = _free;
+        _free = index;
+    }
+}
+
+void RelayScheduler::begin(ScanCycle* scan) {
+    _scan = scan;
+    _tick = millis();
+
+    Preferences prefs;
+    if (prefs.begin("sched", true)) {
+        if (prefs.getBytesLength("table") == sizeof(_schedules)) {
+            prefs.getBytes("table", _schedules, sizeof(_schedules));
+        }
+        prefs.end();
+    }
+}
+
+void RelayScheduler::setTime(const struct tm& time) {
+    int64_t seconds = toSeconds(time);
+
+    portENTER_CRITICAL(&_lock);
+    _clock = seconds;
+    _clock_ms = millis();
+    _clock_time = time;
+    // 1970-01-01 was a Thursday; not every RTC keeps the weekday
+    _clock_time.tm_wday = (int)(((seconds / 86400) % 7 + 11) % 7);
+    portEXIT_CRITICAL(&_lock);
+}
+
+void RelayScheduler::onLogic(void* context, const IOSnapshot& snapshot) {
+    static_cast<RelayScheduler*>(context)->run(snapshot);
+}
+
+void RelayScheduler::run(const IOSnapshot& snapshot) {
+    uint32_t now = snapshot.timestamp;
+    uint8_t mask = 0;
+    uint8_t values = 0;
+
+    portENTER_CRITICAL(&_lock);
+    while ((int32_t)(now - _tick) >= 0) {
+        // At the start of every 64 ticks the next slot of level 1 comes
+        // down, and so on up while the slot index wraps to 0
+        uint32_t slot = _tick & (SLOTS - 1);
+        if (slot == 0) {
+            for (int level = 1; level < LEVELS; level++) {
+                uint32_t upper = (_tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+                cascade(level, upper);
+                if (upper != 0) {
+                    break;
+                }
+            }
+        }
+        _tick++;
+
+        uint16_t index = _heads[slot];
+        _heads[slot] = NONE;
+        while (index != NONE) {
+            uint16_t next = _timers[index].next;
+            _timers[index].list = NONE;
+            expire(index, now, mask, values);
+            index = next;
+        }
+    }
+
+    // Recurring schedules, once for every new minute of the posted clock;
+    // the minute the clock first shows up in is not run
+    int64_t minute = _clock >= 0 ? _clock / 60 : -1;
+    if (minute != _minute) {
+        bool check = _minute >= 0 && minute >= 0;
+        _minute = minute;
+        for (int i = 0; check && i < MAX_SCHEDULES; i++) {
+            const Schedule& schedule = _schedules[i];
+            if (!schedule.defined || !matches(schedule, _clock_time)) {
+                continue;
+            }
+            _stats.recurring++;
+            uint8_t bit = 1 << schedule.relay;
+            mask |= bit;
+            values = schedule.state ? (values | bit) : (values & ~bit);
+            if (schedule.pulseMs) {
+                allocate(schedule.relay, !schedule.state, now + schedule.pulseMs, 0);
+            }
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    for (int relay = 0; mask; relay++, mask >>= 1) {
+        if (mask & 1) {
+            _scan->writeRelay(relay, (values >> relay) & 1);
+        }
+    }
+}
+
+uint32_t RelayScheduler::add(int relay, bool state, uint32_t delayMs, uint32_t pulseMs) {
+    if (relay < 0 || relay >= RELAY_COUNT || delayMs > MAX_DELAY_MS || pulseMs > MAX_DELAY_MS) {
+        return 0;
+    }
+
+    uint32_t expiry = millis() + delayMs;
+    portENTER_CRITICAL(&_lock);
+    uint32_t id = allocate(relay, state, expiry, pulseMs);
+    portEXIT_CRITICAL(&_lock);
+    return id;
+}
+
+bool RelayScheduler::cancel(uint32_t id) {
+    uint16_t index = id % MAX_TIMERS;
+
+    portENTER_CRITICAL(&_lock);
+    Timer& timer = _timers[index];
+    bool found = id != 0 && timer.list != NONE && timer.id == id;
+    if (found) {
+        unlink(index);
+        timer.next = _free;
+        _free = index;
+        _stats.pending--;
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    return found;
+}
+
+int RelayScheduler::pending(Action* out, int maxActions, int offset) {
+    int count = 0;
+    uint32_t now = millis();
+
+    portENTER_CRITICAL(&_lock);
+    for (int index = 0; index < MAX_TIMERS && count < maxActions; index++) {
+        const Timer& timer = _timers[index];
+        if (timer.list == NONE) {
+            continue;
+        }
+        if (offset > 0) {
+            offset--;
+            continue;
+        }
+        int32_t due = (int32_t)(timer.expiry - now);
+        out[count++] = {timer.id, timer.relay, timer.state, due > 0 ? (uint32_t)due : 0, timer.pulseMs};
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    return count;
+}
+
+bool RelayScheduler::setSchedule(int index, const char* cron, int relay, bool state, uint32_t pulseMs, char* error,
+                                 size_t errorSize) {
+    if (index < 0 || index >= MAX_SCHEDULES) {
+        snprintf(error, errorSize, "Invalid schedule (must be 0-%d)", MAX_SCHEDULES - 1);
+        return false;
+    }
+
+    Schedule schedule = {};
+    if (cron) {
+        if (relay < 0 || relay >= RELAY_COUNT || pulseMs > MAX_DELAY_MS) {
+            snprintf(error, errorSize, "Invalid relay or pulse length");
+            return false;
+        }
+        if (!parseCron(cron, schedule)) {
+            snprintf(error, errorSize, "Invalid cron expression (minute hour day month weekday)");
+            return false;
+        }
+        schedule.defined = true;
+        schedule.relay = relay;
+        schedule.state = state;
+        schedule.pulseMs = pulseMs;
+        strncpy(schedule.cron, cron, CRON_LENGTH - 1);
+    }
+
+    portENTER_CRITICAL(&_lock);
+    _schedules[index] = schedule;
+    portEXIT_CRITICAL(&_lock);
+
+    save();
+    return true;
+}
+
+bool RelayScheduler::schedule(int index, Schedule& out) {
+    if (index < 0 || index >= MAX_SCHEDULES) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&_lock);
+    out = _schedules[index];
+    portEXIT_CRITICAL(&_lock);
+
+    return out.defined;
+}
+
+int64_t RelayScheduler::msUntil(const struct tm& at, bool hasDate) {
+    portENTER_CRITICAL(&_lock);
+    int64_t clock = _clock;
+    uint32_t clockMs = _clock_ms;
+    struct tm today = _clock_time;
+    portEXIT_CRITICAL(&_lock);
+
+    if (clock < 0) {
+        return -1;
+    }
+    int64_t now = clock * 1000 + (millis() - clockMs);
+    struct tm target = at;
+    if (!hasDate) {
+        target.tm_year = today.tm_year;
+        target.tm_mon = today.tm_mon;
+        target.tm_mday = today.tm_mday;
+    }
+    int64_t due = toSeconds(target) * 1000;
+    if (!hasDate && due <= now) {
+        due += 86400000;
+    }
+    return due > now ? due - now : -1;
+}
+
+RelayScheduler::Stats RelayScheduler::stats() {
+    portENTER_CRITICAL(&_lock);
+    Stats copy = _stats;
+    portEXIT_CRITICAL(&_lock);
+    return copy;
+}
+
+uint32_t RelayScheduler::allocate(int relay, bool state, uint32_t expiry, uint32_t pulseMs) {
+    if (_free == NONE) {
+        return 0;
+    }
+    uint16_t index = _free;
+    Timer& timer = _timers[index];
+    _free = timer.next;
+
+    // The index rides in the low bits, so cancel() finds the entry directly
+    if (++_sequence > UINT32_MAX / MAX_TIMERS) {
+        _sequence = 1;
+    }
+    timer.id = _sequence * MAX_TIMERS + index;
+    timer.relay = relay;
+    timer.state = state;
+    timer.expiry = expiry;
+    timer.pulseMs = pulseMs;
+    insert(index);
+
+    if (++_stats.pending > _stats.peakPending) {
+        _stats.peakPending = _stats.pending;
+    }
+    return timer.id;
+}
+
+void RelayScheduler::insert(uint16_t index) {
+    Timer& timer = _timers[index];
+    uint32_t delta = timer.expiry - _tick;
+
+    // Already due: the slot processed next. Otherwise the lowest level that
+    // reaches the expiry, in the slot of its bits at that level.
+    uint16_t list;
+    if ((int32_t)delta < 0) {
+        list = _tick & (SLOTS - 1);
+    } else {
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= 1UL << (SLOT_BITS * (level + 1))) {
+            level++;
+        }
+        list = level * SLOTS + ((timer.expiry >> (SLOT_BITS * level)) & (SLOTS - 1));
+    }
+
+    timer.list = list;
+    timer.prev = NONE;
+    timer.next = _heads[list];
+    if (timer.next != NONE) {
+        _timers[timer.next].prev = index;
+    }
+    _heads[list] = index;
+}
+
+void RelayScheduler::unlink(uint16_t index) {
+    Timer& timer = _timers[index];
+    if (timer.prev != NONE) {
+        _timers[timer.prev].next = timer.next;
+    } else {
+        _heads[timer.list] = timer.next;
+    }
+    if (timer.next != NONE) {
+        _timers[timer.next].prev = timer.prev;
+    }
+    timer.list = NONE;
+}
+
+void RelayScheduler::cascade(int level, uint32_t slot) {
+    uint16_t list = level * SLOTS + slot;
+    uint16_t index = _heads[list];
+    _heads[list] = NONE;
+    while (index != NONE) {
+        uint16_t next = _timers[index].next;
+        insert(index);
+        index = next;
+    }
+}
+
+void RelayScheduler::expire(uint16_t index, uint32_t now, uint8_t& mask, uint8_t& values) {
+    Timer& timer = _timers[index];
+    uint8_t bit = 1 << timer.relay;
+    mask |= bit;
+    values = timer.state ? (values | bit) : (values & ~bit);
+    _stats.fired++;
+
+    // A pulse comes back once with the opposite state, timed from the scan
+    // that switched it
+    if (timer.pulseMs) {
+        timer.state = !timer.state;
+        timer.expiry = now + timer.pulseMs;
+        timer.pulseMs = 0;
+        insert(index);
+        return;
+    }
+    timer.next = _free;
+    _free = index;
+    _stats.pending--;
+}
+
+void RelayScheduler::save() {
+    static Schedule copy[MAX_SCHEDULES];
+    portENTER_CRITICAL(&_lock);
+    memcpy(copy, _schedules, sizeof(copy));
+    portEXIT_CRITICAL(&_lock);
+
+    Preferences prefs;
+    if (prefs.begin("sched", false)) {
+        prefs.putBytes("table", copy, sizeof(copy));
+        prefs.end();
+    }
+}
+
+bool RelayScheduler::matches(const Schedule& schedule, const struct tm& time) {
+    if (!((schedule.minutes >> time.tm_min) & 1) || !((schedule.hours >> time.tm_hour) & 1) ||
+        !((schedule.months >> (time.tm_mon + 1)) & 1)) {
+        return false;
+    }
+    // As in cron: with both day fields restricted, either one matching will do
+    bool day = (schedule.days >> time.tm_mday) & 1;
+    bool weekday = (schedule.weekdays >> time.tm_wday) & 1;
+    if (schedule.anyDay || schedule.anyWeekday) {
+        return day && weekday;
+    }
+    return day || weekday;
+}
+
+// One cron field: '*', values, ranges and steps, separated by commas
+static bool parseField(const char*& p, int low, int high, uint64_t& mask, bool& any) {
+    mask = 0;
+    any = false;
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    const char* start = p;
+    while (true) {
+        int from = low;
+        int to = high;
+        int step = 1;
+        char* end;
+        if (*p == '*') {
+            p++;
+        } else {
+            if (!isdigit((unsigned char)*p)) {
+                return false;
+            }
+            from = strtol(p, &end, 10);
+            p = end;
+            to = from;
+            if (*p == '-') {
+                p++;
+                if (!isdigit((unsigned char)*p)) {
+                    return false;
+                }
+                to = strtol(p, &end, 10);
+                p = end;
+            }
+        }
+        if (*p == '/') {
+            p++;
+            if (!isdigit((unsigned char)*p)) {
+                return false;
+            }
+            step = strtol(p, &end, 10);
+            p = end;
+            if (to == from) {
+                to = high;
+            }
+        }
+        if (from < low || to > high || from > to || step < 1) {
+            return false;
+        }
+        for (int value = from; value <= to; value += step) {
+            mask |= 1ULL << value;
+        }
+        if (*p != ',') {
+            break;
+        }
+        p++;
+    }
+    any = p - start == 1 && *start == '*';
+    return *p == '\0' || *p == ' ' || *p == '\t';
+}
+
+bool RelayScheduler::parseCron(const char* text, Schedule& out) {
+    if (strlen(text) >= CRON_LENGTH) {
+        return false;
+    }
+
+    const char* p = text;
+    uint64_t minutes, hours, days, months, weekdays;
+    bool any;
+    if (!parseField(p, 0, 59, minutes, any) || !parseField(p, 0, 23, hours, any) ||
+        !parseField(p, 1, 31, days, out.anyDay) || !parseField(p, 1, 12, months, any) ||
+        !parseField(p, 0, 7, weekdays, out.anyWeekday)) {
+        return false;
+    }
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    if (*p != '\0') {
+        return false;
+    }
+
+    out.minutes = minutes;
+    out.hours = hours;
+    out.days = days;
+    out.months = months;
+    // 7 is Sunday as well
+    out.weekdays = (weekdays | weekdays >> 7) & 0x7F;
+    return true;
+}
+
+bool RelayScheduler::parseTime(const char* text, struct tm& out, bool& hasDate) {
+    int year = 2000, month = 1, day = 1, hour, minute, second = 0;
+    int length = strlen(text);
+    int used = -1;
+
+    // The seconds are optional; the second %n only counts if they are there
+    memset(&out, 0, sizeof(out));
+    hasDate = strchr(text, '-') != nullptr;
+    int fields = hasDate ? sscanf(text, "%4d-%2d-%2d%*[ T]%2d:%2d%n:%2d%n", &year, &month, &day, &hour, &minute,
+                                  &used, &second, &used)
+                         : sscanf(text, "%2d:%2d%n:%2d%n", &hour, &minute, &used, &second, &used);
+    if (fields < (hasDate ? 5 : 2) || used != length) {
+        return false;
+    }
+    if (year < 2000 || year > 2099 || month < 1 || month > 12 || day < 1 || day > 31 || hour < 0 || hour > 23 ||
+        minute < 0 || minute > 59 || second < 0 || second > 59) {
+        return false;
+    }
+
+    out.tm_year = year - 1900;
+    out.tm_mon = month - 1;
+    out.tm_mday = day;
+    out.tm_hour = hour;
+    out.tm_min = minute;
+    out.tm_sec = second;
+    return true;
+}
+
+int64_t RelayScheduler::toSeconds(const struct tm& time) {
+    // Days since 1970-01-01 of the proleptic Gregorian calendar
+    int year = time.tm_year + 1900;
+    int month = time.tm_mon + 1;
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yearOfEra = year - era * 400;
+    int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + time.tm_mday - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    int64_t days = (int64_t)era * 146097 + dayOfEra - 719468;
+    return days * 86400 + time.tm_hour * 3600 + time.tm_min * 60 + time.tm_sec;
+}
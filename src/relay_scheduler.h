@@ -0,0 +1,153 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include <time.h>
+#include "io_scanner.h"
+
+class ScanCycle;
+
+/*
+ * Delayed, pulsed and recurring relay writes, serviced from the scan.
+ *
+ * Pending writes sit in a hierarchical timing wheel with 1 ms ticks: five
+ * levels of 64 slots, each level 64 times coarser than the one below, reach
+ * 2^30 ms (about 12 days). Adding and cancelling are O(1); every tick
+ * empties one level-0 slot, and every 64 ticks one slot of the next level
+ * is cascaded down, so the cost per tick does not depend on how many
+ * writes are pending. The scan's logic step advances the wheel to the scan
+ * time and queues what expired for the output phase.
+ *
+ * A pulse is one entry: it writes its state when it expires and re-arms
+ * itself to write the opposite state pulseMs after that scan, so the width
+ * is pulseMs rounded up to whole scan periods.
+ *
+ * Recurring schedules use a five-field cron expression (minute, hour, day
+ * of month, month, day of week) in the RTC's local time, which the loop
+ * task posts every second. They are checked once per minute and stored in
+ * NVS; pending one-shot writes are not kept over a reboot.
+ */
+class RelayScheduler {
+public:
+    static constexpr int MAX_TIMERS       = 512;
+    static constexpr int MAX_SCHEDULES    = 16;
+    static constexpr int CRON_LENGTH      = 32;
+    static constexpr int RELAY_COUNT      = 4;
+    static constexpr uint32_t MAX_DELAY_MS = 7 * 24 * 3600 * 1000UL;   // Within the wheel's reach
+
+    struct Action {
+        uint32_t id;
+        uint8_t relay;
+        bool state;
+        uint32_t dueMs;         // From now
+        uint32_t pulseMs;       // Opposite state this long after; 0 = none
+    };
+
+    struct Schedule {
+        bool defined;
+        uint8_t relay;
+        bool state;
+        uint32_t pulseMs;
+        char cron[CRON_LENGTH];
+        uint64_t minutes;       // Bit per matching value
+        uint32_t hours;
+        uint32_t days;
+        uint16_t months;
+        uint8_t weekdays;       // Bit 0 = Sunday
+        bool anyDay;            // Day of month was '*'
+        bool anyWeekday;        // Day of week was '*'
+    };
+
+    struct Stats {
+        uint16_t pending;
+        uint16_t peakPending;
+        uint32_t fired;         // One-shot and pulse writes
+        uint32_t recurring;     // Cron matches
+    };
+
+    RelayScheduler();
+
+    // Restores the recurring schedules; relay writes go through scan
+    void begin(ScanCycle* scan);
+
+    // Local time from the RTC; call every second from the loop task
+    void setTime(const struct tm& time);
+
+    // Scan cycle logic step
+    static void onLogic(void* context, const IOSnapshot& snapshot);
+    void run(const IOSnapshot& snapshot);
+
+    // Writes state to relay after delayMs and, with pulseMs, the opposite
+    // state pulseMs later. Returns the id, or 0 when the wheel is full.
+    uint32_t add(int relay, bool state, uint32_t delayMs, uint32_t pulseMs = 0);
+
+    // Drops a pending write; a pulse that has started keeps its state
+    bool cancel(uint32_t id);
+
+    // Pending writes, in no particular order, after skipping the first
+    // offset; returns the count
+    int pending(Action* out, int maxActions, int offset = 0);
+
+    // Parses cron and stores it as schedule index, or removes it with
+    // cron = nullptr. On error returns false with a message.
+    bool setSchedule(int index, const char* cron, int relay, bool state, uint32_t pulseMs, char* error,
+                     size_t errorSize);
+    bool schedule(int index, Schedule& out);
+
+    // Milliseconds from now until local time at, which with hasDate false
+    // is the next occurrence of its time of day; -1 if it has passed or the
+    // clock has not been posted
+    int64_t msUntil(const struct tm& at, bool hasDate);
+
+    Stats stats();
+
+    // "YYYY-MM-DD HH:MM[:SS]" or "HH:MM[:SS]"
+    static bool parseTime(const char* text, struct tm& out, bool& hasDate);
+
+private:
+    static constexpr int LEVELS      = 5;
+    static constexpr int SLOT_BITS   = 6;
+    static constexpr int SLOTS       = 1 << SLOT_BITS;
+    static constexpr uint16_t NONE   = 0xFFFF;
+
+    struct Timer {
+        uint16_t next;
+        uint16_t prev;
+        uint16_t list;          // level * SLOTS + slot, NONE while free
+        uint8_t relay;
+        bool state;
+        uint32_t expiry;        // Tick
+        uint32_t pulseMs;
+        uint32_t id;
+    };
+
+    ScanCycle* _scan = nullptr;
+
+    // Guarded by _lock
+    Timer _timers[MAX_TIMERS];
+    uint16_t _heads[LEVELS * SLOTS];
+    uint16_t _free = NONE;
+    uint32_t _tick = 0;                 // Next tick to process
+    uint32_t _sequence = 0;
+    Schedule _schedules[MAX_SCHEDULES] = {};
+    Stats _stats = {};
+    int64_t _clock = -1;                // Posted local time, seconds since 1970
+    uint32_t _clock_ms = 0;             // millis() when it was posted
+    struct tm _clock_time = {};
+    portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+
+    int64_t _minute = -1;               // Last minute checked (scan task only)
+
+    uint32_t allocate(int relay, bool state, uint32_t expiry, uint32_t pulseMs);
+    void insert(uint16_t index);
+    void unlink(uint16_t index);
+    void cascade(int level, uint32_t slot);
+    void expire(uint16_t index, uint32_t now, uint8_t& mask, uint8_t& values);
+    void save();
+    static bool matches(const Schedule& schedule, const struct tm& time);
+    static bool parseCron(const char* text, Schedule& out);
+    static int64_t toSeconds(const struct tm& time);
+};
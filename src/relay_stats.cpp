@@ -0,0 +1,122 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "relay_stats.h"
+#include <Preferences.h>
+#include <string.h>
+
+RelayStats::RelayStats() {}
+
+void RelayStats::begin() {
+    Preferences prefs;
+    if (prefs.begin("relaystats", true)) {
+        if (prefs.getBytesLength("counters") == sizeof(_counters)) {
+            prefs.getBytes("counters", _counters, sizeof(_counters));
+        }
+        prefs.end();
+    }
+}
+
+void RelayStats::onScan(void* context, const IOSnapshot& previous, const IOSnapshot& current) {
+    static_cast<RelayStats*>(context)->record(previous, current);
+}
+
+void RelayStats::record(const IOSnapshot& previous, const IOSnapshot& current) {
+    portENTER_CRITICAL(&_lock);
+    // The image at boot is where counting starts, not a switch
+    if (!_scanned) {
+        _relays = current.relays;
+        _scanned = true;
+        portEXIT_CRITICAL(&_lock);
+        return;
+    }
+
+    uint32_t elapsed = current.timestamp - previous.timestamp;
+    uint8_t changed = _relays ^ current.relays;
+    for (int r = 0; r < RELAY_COUNT; r++) {
+        uint8_t bit = 1 << r;
+        Counters& counters = _counters[r];
+        if (_relays & bit) {
+            counters.onMs += elapsed;
+            _dirty = true;
+        }
+        if (changed & bit) {
+            // previous was read before the write that made this edge
+            counters.switches++;
+            if (previous.current >= MCP_RELAY_LOAD_CURRENT) {
+                counters.loadSwitches++;
+            }
+            if (previous.current > counters.peakCurrent) {
+                counters.peakCurrent = previous.current;
+            }
+            _unsaved++;
+            _dirty = true;
+        }
+    }
+    _relays = current.relays;
+    portEXIT_CRITICAL(&_lock);
+}
+
+void RelayStats::flush() {
+    uint32_t now = millis();
+
+    portENTER_CRITICAL(&_lock);
+    uint32_t elapsed = now - _last_save_ms;
+    bool due = _save_now ||
+               (_dirty && elapsed >= MCP_RELAY_STATS_MIN_SAVE_MS &&
+                (elapsed >= MCP_RELAY_STATS_SAVE_MS || _unsaved >= MCP_RELAY_STATS_SAVE_SWITCHES));
+    portEXIT_CRITICAL(&_lock);
+
+    if (due) {
+        save(now);
+    }
+}
+
+bool RelayStats::reset(int relay) {
+    if (relay < 0 || relay >= RELAY_COUNT) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&_lock);
+    _counters[relay] = {};
+    _save_now = true;
+    portEXIT_CRITICAL(&_lock);
+    return true;
+}
+
+RelayStats::Reading RelayStats::read() {
+    Reading reading = {};
+
+    portENTER_CRITICAL(&_lock);
+    for (int r = 0; r < RELAY_COUNT; r++) {
+        reading.relays[r].on = _relays & (1 << r);
+        reading.relays[r].counters = _counters[r];
+    }
+    reading.unsavedSwitches = _unsaved;
+    reading.saves = _saves;
+    reading.lastSaveMs = _last_save_ms;
+    portEXIT_CRITICAL(&_lock);
+
+    return reading;
+}
+
+void RelayStats::save(uint32_t now) {
+    Counters copy[RELAY_COUNT];
+    portENTER_CRITICAL(&_lock);
+    memcpy(copy, _counters, sizeof(copy));
+    _dirty = false;
+    _save_now = false;
+    _unsaved = 0;
+    _last_save_ms = now;
+    _saves++;
+    portEXIT_CRITICAL(&_lock);
+
+    // Writing to flash takes milliseconds; keep it out of the lock
+    Preferences prefs;
+    if (prefs.begin("relaystats", false)) {
+        prefs.putBytes("counters", copy, sizeof(copy));
+        prefs.end();
+    }
+}
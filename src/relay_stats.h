@@ -0,0 +1,102 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include "io_scanner.h"
+
+// Longest time the counters may go unsaved while they change
+#ifndef MCP_RELAY_STATS_SAVE_MS
+#define MCP_RELAY_STATS_SAVE_MS (10 * 60 * 1000)
+#endif
+
+// Unsaved switches that bring the next save forward
+#ifndef MCP_RELAY_STATS_SAVE_SWITCHES
+#define MCP_RELAY_STATS_SAVE_SWITCHES 256
+#endif
+
+// Shortest time between two saves, however fast the relays switch
+#ifndef MCP_RELAY_STATS_MIN_SAVE_MS
+#define MCP_RELAY_STATS_MIN_SAVE_MS (60 * 1000)
+#endif
+
+// IO socket current (A) from which a switch counts as switching under load
+#ifndef MCP_RELAY_LOAD_CURRENT
+#define MCP_RELAY_LOAD_CURRENT 0.1f
+#endif
+
+/*
+ * Relay operation counters for maintenance planning.
+ *
+ * Relay edges in the read-back process image count as switches, whoever
+ * made the write, and each scan a relay is on adds to its on-time. A switch
+ * counts as under load when the last current reading before it, taken in
+ * the scan before the edge showed, was at least MCP_RELAY_LOAD_CURRENT.
+ * That current is the whole IO socket load, so a switch is also counted
+ * under load when another relay carried the current.
+ *
+ * The counters live in RAM and are written to NVS in batches: when they
+ * changed, at most every MCP_RELAY_STATS_SAVE_MS, or earlier once
+ * MCP_RELAY_STATS_SAVE_SWITCHES switches are unsaved, but never more often
+ * than every MCP_RELAY_STATS_MIN_SAVE_MS. A power loss costs at most one
+ * batch.
+ *
+ * record() runs on the scan task, flush() on the loop task, read() and
+ * reset() on the worker; a spinlock guards the counters and flash writes
+ * stay out of the scan.
+ */
+class RelayStats {
+public:
+    static constexpr int RELAY_COUNT = 4;
+
+    struct Counters {
+        uint32_t switches;      // Both directions
+        uint32_t loadSwitches;  // Switches at or above the load current
+        uint64_t onMs;
+        float peakCurrent;      // Highest current switched, A
+    };
+
+    struct Relay {
+        bool on;
+        Counters counters;
+    };
+
+    struct Reading {
+        Relay relays[RELAY_COUNT];
+        uint32_t unsavedSwitches;
+        uint32_t saves;
+        uint32_t lastSaveMs;
+    };
+
+    RelayStats();
+
+    // Restores the counters from NVS
+    void begin();
+
+    // Scan listener; counts edges and on-time
+    static void onScan(void* context, const IOSnapshot& previous, const IOSnapshot& current);
+    void record(const IOSnapshot& previous, const IOSnapshot& current);
+
+    // Writes the counters to NVS when a batch is due; call from the loop task
+    void flush();
+
+    // Zeroes the counters of a replaced relay and saves at the next flush()
+    bool reset(int relay);
+
+    Reading read();
+
+private:
+    Counters _counters[RELAY_COUNT] = {};
+    uint8_t _relays         = 0;
+    bool _scanned           = false;
+    bool _dirty             = false;
+    bool _save_now          = false;
+    uint32_t _unsaved       = 0;    // Switches since the last save
+    uint32_t _saves         = 0;
+    uint32_t _last_save_ms  = 0;
+    portMUX_TYPE _lock      = portMUX_INITIALIZER_UNLOCKED;
+
+    void save(uint32_t now);
+};
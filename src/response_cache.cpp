@@ -0,0 +1,61 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "response_cache.h"
+
+ResponseCache::ResponseCache() {}
+
+size_t ResponseCache::lookup(int entry, uint32_t maxAgeMs, uint32_t now, char* buffer, size_t size, uint32_t* ageMs) {
+    if (entry < 0 || entry >= MAX_ENTRIES) {
+        return 0;
+    }
+    
+    size_t length = 0;
+    
+    portENTER_CRITICAL(&_lock);
+    Entry& e = _entries[entry];
+    uint32_t age = now - e.storedAt;
+    if (e.valid && maxAgeMs > 0 && age <= maxAgeMs && e.length < size) {
+        memcpy(buffer, e.result, e.length);
+        buffer[e.length] = '\0';
+        length = e.length;
+        *ageMs = age;
+        _stats.hits++;
+    } else {
+        _stats.misses++;
+    }
+    portEXIT_CRITICAL(&_lock);
+    
+    return length;
+}
+
+void ResponseCache::store(int entry, const char* result, size_t length, uint32_t now) {
+    if (entry < 0 || entry >= MAX_ENTRIES || length >= MAX_RESULT) {
+        return;
+    }
+    
+    portENTER_CRITICAL(&_lock);
+    Entry& e = _entries[entry];
+    memcpy(e.result, result, length);
+    e.length = length;
+    e.storedAt = now;
+    e.valid = true;
+    portEXIT_CRITICAL(&_lock);
+}
+
+void ResponseCache::invalidate() {
+    portENTER_CRITICAL(&_lock);
+    for (auto& e : _entries) {
+        e.valid = false;
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+ResponseCache::Stats ResponseCache::stats() {
+    portENTER_CRITICAL(&_lock);
+    Stats copy = _stats;
+    portEXIT_CRITICAL(&_lock);
+    return copy;
+}
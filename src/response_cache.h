@@ -0,0 +1,60 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+
+// Default staleness bound for cached read capabilities, override with -D
+#ifndef MCP_READ_CACHE_MS
+#define MCP_READ_CACHE_MS 1000
+#endif
+
+// Largest staleness a client may ask for with maxAge
+#ifndef MCP_READ_CACHE_MAX_MS
+#define MCP_READ_CACHE_MAX_MS 10000
+#endif
+
+/*
+ * Serialized results of read-only capabilities.
+ *
+ * The worker stores each fresh result here; later calls inside the
+ * staleness bound are answered on the AsyncTCP task straight from the text,
+ * without touching I2C or the scheduler.
+ */
+class ResponseCache {
+public:
+    static constexpr int MAX_ENTRIES     = 8;
+    static constexpr size_t MAX_RESULT   = 512;
+
+    struct Stats {
+        uint32_t hits;
+        uint32_t misses;
+    };
+
+    ResponseCache();
+
+    // Copy the result stored in an entry if it is at most maxAgeMs old.
+    // Returns the result length (0 on miss) and the entry age.
+    size_t lookup(int entry, uint32_t maxAgeMs, uint32_t now, char* buffer, size_t size, uint32_t* ageMs);
+
+    void store(int entry, const char* result, size_t length, uint32_t now);
+
+    // Drop every entry, e.g. after a write that may change what reads return
+    void invalidate();
+
+    Stats stats();
+
+private:
+    struct Entry {
+        bool valid;
+        uint32_t storedAt;
+        uint16_t length;
+        char result[MAX_RESULT];
+    };
+
+    Entry _entries[MAX_ENTRIES] = {};
+    Stats _stats                = {};
+    portMUX_TYPE _lock          = portMUX_INITIALIZER_UNLOCKED;
+};
@@ -0,0 +1,306 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "scan_cycle.h"
+#include <Preferences.h>
+#include <string.h>
+
+ScanCycle::ScanCycle() {}
+
+ScanCycle::~ScanCycle() {
+    if (_timer) {
+        esp_timer_stop(_timer);
+    }
+}
+
+bool ScanCycle::begin(m5::M5_STAMPLC* stamplc, IOScanner* scanner, const char* taskName, uint32_t stackSize,
+                      UBaseType_t taskPriority) {
+    _stamplc = stamplc;
+    _scanner = scanner;
+
+    Preferences prefs;
+    if (prefs.begin("scan", true)) {
+        uint32_t periodMs = prefs.getUInt("period_ms", MCP_SCAN_PERIOD_MS);
+        if (periodMs >= MIN_PERIOD_MS && periodMs <= MAX_PERIOD_MS) {
+            _period_us = periodMs * 1000;
+        }
+        prefs.end();
+    }
+    _stats.periodUs = _period_us;
+
+    if (xTaskCreatePinnedToCore(taskEntry, taskName, stackSize, this, taskPriority, &_task, MCP_SCAN_CORE) != pdPASS) {
+        return false;
+    }
+
+    esp_timer_create_args_t args = {};
+    args.callback = timerCallback;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "plc_scan";
+
+    if (esp_timer_create(&args, &_timer) != ESP_OK) {
+        return false;
+    }
+    return esp_timer_start_periodic(_timer, _period_us) == ESP_OK;
+}
+
+bool ScanCycle::addLogic(LogicStep step, void* context) {
+    if (_logic_count >= MAX_LOGIC) {
+        return false;
+    }
+    _logic[_logic_count++] = {step, context};
+    return true;
+}
+
+uint32_t ScanCycle::writeRelay(int relay, bool state, uint32_t clientIp, const char* requestId) {
+    portENTER_CRITICAL(&_lock);
+    _pending |= 1 << relay;
+    _held &= ~(1 << relay);
+    if (state) {
+        _values |= 1 << relay;
+    } else {
+        _values &= ~(1 << relay);
+    }
+    uint32_t ticket = ++_ticket;
+    Request& request = _requests[relay];
+    request.ticket = ticket;
+    request.clientIp = clientIp;
+    request.requestId[0] = '\0';
+    if (requestId) {
+        strncpy(request.requestId, requestId, sizeof(request.requestId) - 1);
+        request.requestId[sizeof(request.requestId) - 1] = '\0';
+    }
+    portEXIT_CRITICAL(&_lock);
+    return ticket;
+}
+
+bool ScanCycle::waitApplied(uint32_t ticket, uint32_t timeoutMs) {
+    uint32_t start = millis();
+    while (true) {
+        portENTER_CRITICAL(&_lock);
+        bool applied = (int32_t)(_applied - ticket) >= 0;
+        portEXIT_CRITICAL(&_lock);
+        if (applied) {
+            return true;
+        }
+        if (millis() - start >= timeoutMs) {
+            return false;
+        }
+        vTaskDelay(1);
+    }
+}
+
+bool ScanCycle::withdraw(int relay, uint32_t ticket) {
+    portENTER_CRITICAL(&_lock);
+    bool queued = (_pending & (1 << relay)) && _requests[relay].ticket == ticket;
+    if (queued) {
+        _pending &= ~(1 << relay);
+        _held &= ~(1 << relay);
+    }
+    portEXIT_CRITICAL(&_lock);
+    return queued;
+}
+
+bool ScanCycle::rejected(int relay, uint32_t ticket, RelayInterlock::Rejection& out) {
+    portENTER_CRITICAL(&_lock);
+    bool refused = _refusals[relay].ticket == ticket;
+    if (refused) {
+        out = _refusals[relay].rejection;
+    }
+    portEXIT_CRITICAL(&_lock);
+    return refused;
+}
+
+bool ScanCycle::setPeriodMs(uint32_t periodMs) {
+    if (periodMs < MIN_PERIOD_MS || periodMs > MAX_PERIOD_MS) {
+        return false;
+    }
+
+    _period_us = periodMs * 1000;
+    if (_timer) {
+        esp_timer_stop(_timer);
+        esp_timer_start_periodic(_timer, _period_us);
+    }
+    resetStats();
+
+    Preferences prefs;
+    if (prefs.begin("scan", false)) {
+        prefs.putUInt("period_ms", periodMs);
+        prefs.end();
+    }
+    return true;
+}
+
+ScanCycle::Stats ScanCycle::stats() {
+    portENTER_CRITICAL(&_lock);
+    Stats copy = _stats;
+    if (_stats.cycles) {
+        copy.meanCycleUs = _cycle_total_us / _stats.cycles;
+        copy.meanJitterUs = _jitter_total_us / _stats.cycles;
+    }
+    portEXIT_CRITICAL(&_lock);
+    return copy;
+}
+
+void ScanCycle::resetStats() {
+    portENTER_CRITICAL(&_lock);
+    uint32_t relayWrites = _stats.relayWrites;
+    uint32_t interlockRejections = _stats.interlockRejections;
+    _stats = {};
+    _stats.periodUs = _period_us;
+    _stats.relayWrites = relayWrites;
+    _stats.interlockRejections = interlockRejections;
+    _cycle_total_us = 0;
+    _jitter_total_us = 0;
+    _resync = true;
+    portEXIT_CRITICAL(&_lock);
+}
+
+void ScanCycle::timerCallback(void* arg) {
+    ScanCycle* self = static_cast<ScanCycle*>(arg);
+    xTaskNotifyGive(self->_task);
+}
+
+void ScanCycle::taskEntry(void* arg) {
+    ScanCycle* self = static_cast<ScanCycle*>(arg);
+
+    while (true) {
+        uint32_t pending = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        self->cycle(pending - 1);
+    }
+}
+
+void ScanCycle::cycle(uint32_t missed) {
+    int64_t start = esp_timer_get_time();
+    uint32_t period = _period_us;
+
+    // Jitter against the ideal schedule; after missed periods, a reset or a
+    // period change a new schedule starts here
+    portENTER_CRITICAL(&_lock);
+    bool resync = _resync || missed > 0;
+    _resync = false;
+    portEXIT_CRITICAL(&_lock);
+    uint32_t jitter = 0;
+    if (resync) {
+        _expected_us = start;
+    } else {
+        jitter = (uint32_t)(start > _expected_us ? start - _expected_us : _expected_us - start);
+    }
+    _expected_us += period;
+
+    _scanner->scan();
+    int64_t inputsDone = esp_timer_get_time();
+
+    IOSnapshot snapshot = _scanner->snapshot();
+    for (int i = 0; i < _logic_count; i++) {
+        _logic[i].step(_logic[i].context, snapshot);
+    }
+    int64_t logicDone = esp_timer_get_time();
+
+    applyOutputs(snapshot);
+    int64_t end = esp_timer_get_time();
+
+    uint32_t cycleUs = (uint32_t)(end - start);
+    uint32_t inputUs = (uint32_t)(inputsDone - start);
+    uint32_t logicUs = (uint32_t)(logicDone - inputsDone);
+    uint32_t outputUs = (uint32_t)(end - logicDone);
+
+    portENTER_CRITICAL(&_lock);
+    _stats.cycles++;
+    _stats.missed += missed;
+    if (cycleUs > period) {
+        _stats.overruns++;
+    }
+    _stats.lastCycleUs = cycleUs;
+    _stats.lastJitterUs = jitter;
+    _cycle_total_us += cycleUs;
+    _jitter_total_us += jitter;
+    if (cycleUs > _stats.maxCycleUs) {
+        _stats.maxCycleUs = cycleUs;
+    }
+    if (jitter > _stats.maxJitterUs) {
+        _stats.maxJitterUs = jitter;
+    }
+    if (inputUs > _stats.maxInputUs) {
+        _stats.maxInputUs = inputUs;
+    }
+    if (logicUs > _stats.maxLogicUs) {
+        _stats.maxLogicUs = logicUs;
+    }
+    if (outputUs > _stats.maxOutputUs) {
+        _stats.maxOutputUs = outputUs;
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+void ScanCycle::applyOutputs(const IOSnapshot& snapshot) {
+    portENTER_CRITICAL(&_lock);
+    uint8_t pending = _pending;
+    uint8_t values = _values;
+    uint8_t held = _held;
+    uint32_t ticket = _ticket;
+    Request requests[RELAY_COUNT];
+    memcpy(requests, _requests, sizeof(requests));
+    _pending = 0;
+    portEXIT_CRITICAL(&_lock);
+
+    uint32_t now = millis();
+    RelayInterlock::Rejection rejections[RELAY_COUNT];
+    uint8_t rejected = 0;
+    if (_interlock && pending) {
+        rejected = _interlock->check(snapshot.relays, pending, values, snapshot.inputs, now, rejections, held);
+    }
+
+    // A write refused for a minimum time only has to wait; it is checked
+    // again every scan until it goes through
+    uint8_t waiting = 0;
+
+    for (int relay = 0; relay < RELAY_COUNT; relay++) {
+        if (!(pending & (1 << relay))) {
+            continue;
+        }
+        bool state = values & (1 << relay);
+        const Request& request = requests[relay];
+        if (rejected & (1 << relay)) {
+            RelayInterlock::Reason reason = rejections[relay].reason;
+            if (reason == RelayInterlock::REASON_MIN_ON || reason == RelayInterlock::REASON_MIN_OFF) {
+                waiting |= 1 << relay;
+            }
+            // Logic steps and held writes ask again every scan; record those
+            // once until the reason changes, requests from a client every time
+            uint8_t recorded = reason << 1 | state;
+            bool repeat = held & (1 << relay);
+            if (_event_log && ((request.clientIp && !repeat) || recorded != _recorded[relay])) {
+                _event_log->record(EventLog::TYPE_INTERLOCK, relay, state, rejections[relay].reason,
+                                   esp_timer_get_time(), request.clientIp, request.requestId);
+            }
+            _recorded[relay] = recorded;
+            continue;
+        }
+        _recorded[relay] = 0;
+        _stamplc->writePlcRelay(relay, state);
+        if (_event_log) {
+            _event_log->record(EventLog::TYPE_RELAY_WRITE, relay, state, state, esp_timer_get_time(),
+                               request.clientIp, request.requestId);
+        }
+    }
+    if (_interlock) {
+        _interlock->applied(pending & ~rejected & (values ^ snapshot.relays), now);
+    }
+
+    portENTER_CRITICAL(&_lock);
+    for (int relay = 0; relay < RELAY_COUNT; relay++) {
+        if (rejected & (1 << relay)) {
+            _refusals[relay] = {requests[relay].ticket, rejections[relay]};
+        }
+    }
+    // Held writes go back in the queue unless a newer write replaced them
+    _held = waiting & ~_pending;
+    _pending |= _held;
+    _applied = ticket;
+    _stats.relayWrites += __builtin_popcount(pending & ~rejected);
+    _stats.interlockRejections += __builtin_popcount(rejected & ~(held & waiting));
+    portEXIT_CRITICAL(&_lock);
+}
@@ -0,0 +1,169 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include <M5StamPLC.h>
+#include "esp_timer.h"
+#include "io_scanner.h"
+#include "event_log.h"
+#include "relay_interlock.h"
+
+// Scan period used until configureScan stores another one
+#ifndef MCP_SCAN_PERIOD_MS
+#define MCP_SCAN_PERIOD_MS 10
+#endif
+
+// Core the scan task is pinned to; the loop task (display, MCP updates) runs
+// there too, at a lower priority
+#ifndef MCP_SCAN_CORE
+#define MCP_SCAN_CORE 1
+#endif
+
+/*
+ * Fixed-period PLC scan.
+ *
+ * A periodic esp_timer wakes a dedicated task, pinned to MCP_SCAN_CORE above
+ * the loop task's priority, that runs one cycle in a fixed order:
+ *
+ *   1. inputs   - IOScanner::scan() builds the process image; its listeners
+ *                 (history, energy, anomalies, alarms, waits) see it here
+ *   2. logic    - the registered logic steps, which may queue relay writes
+ *   3. outputs  - queued relay writes are applied and recorded
+ *
+ * Every relay write goes through writeRelay(), so outputs change at one
+ * point of the cycle no matter who asked for them. Several writes to one
+ * relay within a cycle are coalesced; the last one wins. With an interlock
+ * table attached, the writes are checked against it right before they are
+ * made; refused ones are recorded and dropped, except that a write held
+ * back by a minimum on or off time stays queued until that time has passed
+ * or a newer write to the relay replaces it.
+ *
+ * Cycle time per phase, start jitter against the ideal schedule and
+ * overruns are tracked for getScanStats. The display render and everything
+ * else on the loop task can no longer delay a scan.
+ */
+class ScanCycle {
+public:
+    static constexpr int MAX_LOGIC        = 4;
+    static constexpr int RELAY_COUNT      = 4;
+    static constexpr uint32_t MIN_PERIOD_MS = 2;
+    static constexpr uint32_t MAX_PERIOD_MS = 100;
+
+    typedef void (*LogicStep)(void* context, const IOSnapshot& snapshot);
+
+    struct Stats {
+        uint32_t periodUs;
+        uint32_t cycles;
+        uint32_t overruns;          // Cycles that took longer than the period
+        uint32_t missed;            // Timer periods that passed without a cycle
+        uint32_t lastCycleUs;
+        uint32_t maxCycleUs;
+        uint32_t meanCycleUs;
+        uint32_t lastJitterUs;      // Start time against the ideal schedule
+        uint32_t maxJitterUs;
+        uint32_t meanJitterUs;
+        uint32_t maxInputUs;
+        uint32_t maxLogicUs;
+        uint32_t maxOutputUs;
+        uint32_t relayWrites;
+        uint32_t interlockRejections;
+    };
+
+    ScanCycle();
+    ~ScanCycle();
+
+    // Reads the stored period and starts the scan task
+    bool begin(m5::M5_STAMPLC* stamplc, IOScanner* scanner, const char* taskName = "plc_scan",
+               uint32_t stackSize = 4096, UBaseType_t taskPriority = 6);
+
+    // Relay writes are recorded in the sequence-of-events log when applied
+    void setEventLog(EventLog* log) {
+        _event_log = log;
+    }
+
+    // Relay writes are checked against the interlock table when applied
+    void setInterlock(RelayInterlock* interlock) {
+        _interlock = interlock;
+    }
+
+    // Register a logic step; call before begin()
+    bool addLogic(LogicStep step, void* context);
+
+    // Queues a relay write for the next output phase and returns a ticket
+    // for waitApplied(); any task
+    uint32_t writeRelay(int relay, bool state, uint32_t clientIp = 0, const char* requestId = nullptr);
+
+    // Blocks until the output phase has handled ticket
+    bool waitApplied(uint32_t ticket, uint32_t timeoutMs);
+
+    // Drops the write of ticket if no output phase has taken it yet; false
+    // once it is being applied or a later write replaced it
+    bool withdraw(int relay, uint32_t ticket);
+
+    // After waitApplied: whether the interlock refused the write of ticket
+    bool rejected(int relay, uint32_t ticket, RelayInterlock::Rejection& out);
+
+    // Changes the period now and stores it in NVS
+    bool setPeriodMs(uint32_t periodMs);
+    uint32_t periodMs() const {
+        return _period_us / 1000;
+    }
+
+    Stats stats();
+    void resetStats();
+
+private:
+    struct Request {
+        uint32_t ticket;
+        uint32_t clientIp;
+        char requestId[EventLog::REQUEST_ID_TEXT];
+    };
+
+    struct Refusal {
+        uint32_t ticket;
+        RelayInterlock::Rejection rejection;
+    };
+
+    struct Logic {
+        LogicStep step;
+        void* context;
+    };
+
+    m5::M5_STAMPLC* _stamplc = nullptr;
+    IOScanner* _scanner      = nullptr;
+    EventLog* _event_log     = nullptr;
+    RelayInterlock* _interlock = nullptr;
+    esp_timer_handle_t _timer = nullptr;
+    TaskHandle_t _task       = nullptr;
+    volatile uint32_t _period_us = MCP_SCAN_PERIOD_MS * 1000;
+
+    Logic _logic[MAX_LOGIC]  = {};
+    int _logic_count         = 0;
+
+    // Output image, guarded by _lock
+    uint8_t _pending         = 0;       // Relays with a queued write
+    uint8_t _values          = 0;
+    uint8_t _held            = 0;       // Pending writes held back by a minimum time
+    Request _requests[RELAY_COUNT] = {};
+    uint32_t _ticket         = 0;       // Last ticket handed out
+    uint32_t _applied        = 0;       // Last ticket applied
+    Refusal _refusals[RELAY_COUNT] = {};    // Last refused write per relay
+    uint8_t _recorded[RELAY_COUNT] = {};    // Refusal last recorded per relay (scan task only)
+
+    // Guarded by _lock
+    Stats _stats             = {};
+    uint64_t _cycle_total_us  = 0;
+    uint64_t _jitter_total_us = 0;
+    bool _resync             = true;    // Start a new schedule on the next cycle
+
+    int64_t _expected_us     = 0;       // Scan task only
+    portMUX_TYPE _lock       = portMUX_INITIALIZER_UNLOCKED;
+
+    static void timerCallback(void* arg);
+    static void taskEntry(void* arg);
+    void cycle(uint32_t missed);
+    void applyOutputs(const IOSnapshot& snapshot);
+};
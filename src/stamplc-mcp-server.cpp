@@ -8,11 +8,42 @@
 #include <WiFi.h>
 #include "dashboard_ui.h"
 #include "mcp_server.h"
+#include "alloc_tracker.h"
+#include "memory_monitor.h"
+#include "io_scanner.h"
+#include "input_sampler.h"
+#include "history_store.h"
+#include "energy_meter.h"
+#include "relay_stats.h"
+#include "anomaly_detector.h"
+#include "alarm_manager.h"
+#include "event_log.h"
+#include "waveform_capture.h"
+#include "scan_cycle.h"
+#include "logic_engine.h"
+#include "pid_controller.h"
+#include "relay_scheduler.h"
+#include "relay_interlock.h"
 #include "wifi_config.h"
 #include <time.h>         // For NTP time synchronization
 
 DashboardUI dashboard_ui;
 MCPServer mcp_server;
+MemoryMonitor memory_monitor;
+IOScanner io_scanner;
+InputSampler input_sampler;
+HistoryStore history_store;
+EnergyMeter energy_meter;
+RelayStats relay_stats;
+AnomalyDetector anomaly_detector;
+AlarmManager alarm_manager;
+EventLog event_log;
+WaveformCapture waveform_capture;
+ScanCycle scan_cycle;
+LogicEngine logic_engine;
+PidController pid_controller;
+RelayScheduler relay_scheduler;
+RelayInterlock relay_interlock;
 
 // Status light states
 enum StatusLightState {
@@ -63,6 +94,10 @@ void update_time_and_date()
         snprintf(string_buffer, sizeof(string_buffer), "%04d.%02d.%02d", time.tm_year + 1900, time.tm_mon + 1,
                  time.tm_mday);
         dashboard_ui.statusDate = string_buffer;
+        energy_meter.setDate(time.tm_year + 1900, time.tm_mon + 1, time.tm_mday);
+        energy_meter.flush();
+        relay_stats.flush();
+        relay_scheduler.setTime(time);
 
         time_count = millis();
     }
@@ -91,16 +126,13 @@ void update_button_events()
 
 void update_plc_io_state()
 {
-    static uint32_t time_count = 0;
-
-    if (millis() - time_count > 50) {
-        for (int i = 0; i < 8; i++) {
-            dashboard_ui.inputStateList[i] = M5StamPLC.readPlcInput(i);
-        }
-        for (int i = 0; i < 4; i++) {
-            dashboard_ui.relayStateList[i] = M5StamPLC.readPlcRelay(i);
-        }
-        time_count = millis();
+    /* The scan task owns the I/O; the dashboard mirrors the process image */
+    IOSnapshot snapshot = io_scanner.snapshot();
+    for (int i = 0; i < 8; i++) {
+        dashboard_ui.inputStateList[i] = snapshot.inputs & (1 << i);
+    }
+    for (int i = 0; i < 4; i++) {
+        dashboard_ui.relayStateList[i] = snapshot.relays & (1 << i);
     }
 }
 
@@ -123,11 +155,72 @@ void task_write_relay_regularly(void* param)
 void setup()
 {
     /* Init M5StamPLC */
+#if MCP_EVENT_LOG_SD
+    auto config = M5StamPLC.config();
+    config.enableSdCard = true;
+    M5StamPLC.config(config);
+#endif
     M5StamPLC.begin();
 
+    /* Start high-rate input sampling and feed the I/O scan from it */
+    input_sampler.setEventLog(&event_log);
+    input_sampler.begin(&M5StamPLC);
+
+    /* Sample voltage and current into the capture ring; triggers come from the event log */
+    waveform_capture.setEventLog(&event_log);
+    waveform_capture.begin(&M5StamPLC);
+
+    /* Init I/O scanner */
+    io_scanner.init(&M5StamPLC);
+    io_scanner.setInputSampler(&input_sampler);
+    io_scanner.setWaveformCapture(&waveform_capture);
+
+    /* Record sensor and I/O history from every scan */
+    if (history_store.begin()) {
+        io_scanner.addListener(HistoryStore::onScan, &history_store);
+    }
+
+    /* Integrate load energy from the same sensor readings */
+    energy_meter.begin();
+    io_scanner.addListener(EnergyMeter::onScan, &energy_meter);
+
+    /* Count relay switches and on-time for maintenance */
+    relay_stats.begin();
+    io_scanner.addListener(RelayStats::onScan, &relay_stats);
+
+    /* Learn per-relay-state sensor profiles and flag deviations */
+    anomaly_detector.setEventLog(&event_log);
+    io_scanner.addListener(AnomalyDetector::onScan, &anomaly_detector);
+
+    /* Evaluate the stored alarm table on every scan */
+    alarm_manager.setEventLog(&event_log);
+    alarm_manager.begin();
+    io_scanner.addListener(AlarmManager::onScan, &alarm_manager);
+
+    /* Run inputs, logic and outputs on a fixed period, independent of the loop */
+    scan_cycle.setEventLog(&event_log);
+    relay_interlock.begin();
+    scan_cycle.setInterlock(&relay_interlock);
+    logic_engine.begin(&scan_cycle);
+    scan_cycle.addLogic(LogicEngine::onLogic, &logic_engine);
+    pid_controller.begin(&scan_cycle);
+    scan_cycle.addLogic(PidController::onLogic, &pid_controller);
+    relay_scheduler.begin(&scan_cycle);
+    scan_cycle.addLogic(RelayScheduler::onLogic, &relay_scheduler);
+    scan_cycle.begin(&M5StamPLC, &io_scanner);
+
     /* Init dashboard UI */
     dashboard_ui.init(&M5StamPLC.Display);
 
+    /* Start background heap and stack sampling */
+    memory_monitor.watchTask("loopTask");
+    memory_monitor.watchTask("async_tcp");
+    memory_monitor.watchTask("mcp_exec");
+    memory_monitor.watchTask("input_sampler");
+    memory_monitor.watchTask("capture");
+    memory_monitor.watchTask("plc_scan");
+    memory_monitor.begin();
+
     /* Set initial status light to red (not connected to WiFi) */
     currentStatusLight = STATUS_WIFI_DISCONNECTED;
     updateStatusLight();
@@ -182,6 +275,21 @@ void setup()
         }
         
         /* Initialize MCP server */
+        mcp_server.setMemoryMonitor(&memory_monitor);
+        mcp_server.setIOScanner(&io_scanner);
+        mcp_server.setInputSampler(&input_sampler);
+        mcp_server.setHistoryStore(&history_store);
+        mcp_server.setEnergyMeter(&energy_meter);
+        mcp_server.setRelayStats(&relay_stats);
+        mcp_server.setAnomalyDetector(&anomaly_detector);
+        mcp_server.setAlarmManager(&alarm_manager);
+        mcp_server.setEventLog(&event_log);
+        mcp_server.setWaveformCapture(&waveform_capture);
+        mcp_server.setScanCycle(&scan_cycle);
+        mcp_server.setLogicEngine(&logic_engine);
+        mcp_server.setPidController(&pid_controller);
+        mcp_server.setRelayScheduler(&relay_scheduler);
+        mcp_server.setInterlock(&relay_interlock);
         mcp_server.init(&M5StamPLC, &dashboard_ui, MCP_SERVER_PORT);
         
         /* Set the command received callback */
@@ -200,6 +308,9 @@ void setup()
 
 void loop()
 {
+    /* Count heap allocations made by this iteration (alloc-tracking build only) */
+    AllocTracker::Scope alloc_scope(AllocTracker::SCOPE_LOOP);
+
     M5StamPLC.update();
 
     update_time_and_date();
@@ -229,6 +340,13 @@ void loop()
         }
     }
 
+    /* Append new events to the SD card log about once a second */
+    static uint32_t lastMirrorTime = 0;
+    if (millis() - lastMirrorTime >= 1000) {
+        lastMirrorTime = millis();
+        event_log.mirror();
+    }
+
     /* Render dashboard UI */
     dashboard_ui.render();
 }
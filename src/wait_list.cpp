@@ -0,0 +1,249 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "wait_list.h"
+#include <float.h>
+
+WaitList::WaitList() {
+    rebuildAggregates(0);
+}
+
+int WaitList::add(const Condition& condition, const IOSnapshot& current, uint32_t now, uint32_t timeoutMs, void* owner,
+                  const char* idText) {
+    int index = -1;
+    
+    portENTER_CRITICAL(&_lock);
+    for (int i = 0; i < MAX_WAITS; i++) {
+        Entry& entry = _entries[i];
+        if (entry.state != STATE_FREE) {
+            continue;
+        }
+        entry.state = STATE_WAITING;
+        entry.condition = condition;
+        entry.owner = owner;
+        entry.started = now;
+        entry.deadline = now + timeoutMs;
+        entry.past = isPast(condition, current);
+        entry.triggered = false;
+        strncpy(entry.idText, idText, MAX_ID_TEXT - 1);
+        entry.idText[MAX_ID_TEXT - 1] = '\0';
+        index = i;
+        break;
+    }
+    if (index >= 0) {
+        rebuildAggregates(now);
+    }
+    portEXIT_CRITICAL(&_lock);
+    
+    return index;
+}
+
+uint32_t WaitList::evaluate(const IOSnapshot& previous, const IOSnapshot& current) {
+    uint8_t rising = ~previous.inputs & current.inputs;
+    uint8_t falling = previous.inputs & ~current.inputs;
+    uint32_t now = current.timestamp;
+    uint32_t completed = 0;
+    
+    portENTER_CRITICAL(&_lock);
+    if (!_any_waiting && !_cancelled) {
+        portEXIT_CRITICAL(&_lock);
+        return 0;
+    }
+    
+    // Fast path: nothing any wait cares about happened this scan
+    bool candidate = _cancelled || (rising & _rising_mask) || (falling & _falling_mask) ||
+                     (int32_t)(now - _next_deadline) >= 0;
+    for (int s = 0; s < SENSOR_COUNT && !candidate; s++) {
+        float value = sensorValue(current, s);
+        candidate = value > _lowest_above[s] || value < _highest_below[s] || value <= _rearm_above[s] ||
+                    value >= _rearm_below[s];
+    }
+    
+    if (candidate) {
+        for (int i = 0; i < MAX_WAITS; i++) {
+            Entry& entry = _entries[i];
+            if (entry.state != STATE_WAITING) {
+                continue;
+            }
+            if (!entry.owner) {
+                // Client went away; nobody to answer
+                entry.state = STATE_FREE;
+                continue;
+            }
+            
+            bool triggered = matches(entry, rising, falling, current);
+            if (triggered || (int32_t)(now - entry.deadline) >= 0) {
+                entry.state = STATE_DONE;
+                entry.triggered = triggered;
+                entry.finished = now;
+                entry.inputs = current.inputs;
+                entry.value = entry.condition.kind == WAIT_INPUT_EDGE ? 0 : sensorValue(current, entry.condition.channel);
+                completed |= 1UL << i;
+            }
+        }
+        _cancelled = false;
+        rebuildAggregates(now);
+    }
+    portEXIT_CRITICAL(&_lock);
+    
+    return completed;
+}
+
+bool WaitList::completion(int index, void* owner, Completion& out) {
+    bool done = false;
+    
+    portENTER_CRITICAL(&_lock);
+    const Entry& entry = _entries[index];
+    if (entry.state == STATE_DONE && entry.owner == owner) {
+        out.condition = entry.condition;
+        out.triggered = entry.triggered;
+        out.waited = entry.finished - entry.started;
+        out.inputs = entry.inputs;
+        out.value = entry.value;
+        memcpy(out.idText, entry.idText, MAX_ID_TEXT);
+        done = true;
+    }
+    portEXIT_CRITICAL(&_lock);
+    
+    return done;
+}
+
+void WaitList::release(int index) {
+    portENTER_CRITICAL(&_lock);
+    _entries[index].state = STATE_FREE;
+    _entries[index].owner = nullptr;
+    portEXIT_CRITICAL(&_lock);
+}
+
+void WaitList::cancel(void* owner) {
+    portENTER_CRITICAL(&_lock);
+    for (auto& entry : _entries) {
+        if (entry.state == STATE_FREE || entry.owner != owner) {
+            continue;
+        }
+        // Waiting entries are dropped by the next evaluate(), finished
+        // ones have nobody left to collect them
+        entry.owner = nullptr;
+        if (entry.state == STATE_DONE) {
+            entry.state = STATE_FREE;
+        } else {
+            _cancelled = true;
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+int WaitList::pending() {
+    int count = 0;
+    portENTER_CRITICAL(&_lock);
+    for (const auto& entry : _entries) {
+        if (entry.state == STATE_WAITING) {
+            count++;
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+    return count;
+}
+
+const char* WaitList::sensorName(Sensor sensor) {
+    switch (sensor) {
+        case SENSOR_TEMPERATURE:
+            return "temperature";
+        case SENSOR_VOLTAGE:
+            return "voltage";
+        case SENSOR_CURRENT:
+            return "current";
+        default:
+            return "unknown";
+    }
+}
+
+float WaitList::sensorValue(const IOSnapshot& snapshot, uint8_t sensor) {
+    switch (sensor) {
+        case SENSOR_TEMPERATURE:
+            return snapshot.temperature;
+        case SENSOR_VOLTAGE:
+            return snapshot.voltage;
+        case SENSOR_CURRENT:
+            return snapshot.current;
+        default:
+            return 0;
+    }
+}
+
+void WaitList::rebuildAggregates(uint32_t now) {
+    _rising_mask = 0;
+    _falling_mask = 0;
+    for (int s = 0; s < SENSOR_COUNT; s++) {
+        _lowest_above[s] = FLT_MAX;
+        _highest_below[s] = -FLT_MAX;
+        _rearm_above[s] = -FLT_MAX;
+        _rearm_below[s] = FLT_MAX;
+    }
+    _any_waiting = false;
+    _next_deadline = now + 0x7FFFFFFF;
+    
+    for (const auto& entry : _entries) {
+        if (entry.state != STATE_WAITING) {
+            continue;
+        }
+        _any_waiting = true;
+        if ((int32_t)(entry.deadline - _next_deadline) < 0) {
+            _next_deadline = entry.deadline;
+        }
+        
+        const Condition& condition = entry.condition;
+        switch (condition.kind) {
+            case WAIT_INPUT_EDGE:
+                if (condition.edge & EDGE_RISING) {
+                    _rising_mask |= 1 << condition.channel;
+                }
+                if (condition.edge & EDGE_FALLING) {
+                    _falling_mask |= 1 << condition.channel;
+                }
+                break;
+            case WAIT_SENSOR_ABOVE:
+                if (entry.past && condition.threshold > _rearm_above[condition.channel]) {
+                    _rearm_above[condition.channel] = condition.threshold;
+                } else if (!entry.past && condition.threshold < _lowest_above[condition.channel]) {
+                    _lowest_above[condition.channel] = condition.threshold;
+                }
+                break;
+            case WAIT_SENSOR_BELOW:
+                if (entry.past && condition.threshold < _rearm_below[condition.channel]) {
+                    _rearm_below[condition.channel] = condition.threshold;
+                } else if (!entry.past && condition.threshold > _highest_below[condition.channel]) {
+                    _highest_below[condition.channel] = condition.threshold;
+                }
+                break;
+        }
+    }
+}
+
+bool WaitList::matches(Entry& entry, uint8_t rising, uint8_t falling, const IOSnapshot& current) {
+    const Condition& condition = entry.condition;
+    if (condition.kind == WAIT_INPUT_EDGE) {
+        uint8_t bit = 1 << condition.channel;
+        return ((condition.edge & EDGE_RISING) && (rising & bit)) ||
+               ((condition.edge & EDGE_FALLING) && (falling & bit));
+    }
+    
+    // Only the move onto the far side counts
+    bool past = isPast(condition, current);
+    bool crossed = past && !entry.past;
+    entry.past = past;
+    return crossed;
+}
+
+bool WaitList::isPast(const Condition& condition, const IOSnapshot& current) {
+    switch (condition.kind) {
+        case WAIT_SENSOR_ABOVE:
+            return sensorValue(current, condition.channel) > condition.threshold;
+        case WAIT_SENSOR_BELOW:
+            return sensorValue(current, condition.channel) < condition.threshold;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,130 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include "io_scanner.h"
+
+/*
+ * Parked waitForChange requests.
+ *
+ * The scan calls evaluate() every cycle. Edge masks, the tightest sensor
+ * thresholds and the earliest deadline of all waits are kept up to date on
+ * add/remove, so a scan where nothing relevant happened costs a handful of
+ * compares no matter how many requests are waiting.
+ *
+ * Sensor waits complete on a crossing. Each remembers whether the value is
+ * past its threshold, starting from the reading at add(); a wait that
+ * starts past it is armed once the value comes back, and completes when it
+ * crosses again.
+ *
+ * A finished entry stays until whoever answers the request releases it, so
+ * the answer can be collected on the task that owns the request.
+ */
+class WaitList {
+public:
+    static constexpr int MAX_WAITS      = 16;
+    static constexpr size_t MAX_ID_TEXT = 40;
+
+    enum Kind : uint8_t {
+        WAIT_INPUT_EDGE = 0,
+        WAIT_SENSOR_ABOVE,
+        WAIT_SENSOR_BELOW
+    };
+
+    enum Sensor : uint8_t {
+        SENSOR_TEMPERATURE = 0,
+        SENSOR_VOLTAGE,
+        SENSOR_CURRENT,
+        SENSOR_COUNT
+    };
+
+    enum Edge : uint8_t {
+        EDGE_RISING  = 1,
+        EDGE_FALLING = 2,
+        EDGE_ANY     = 3
+    };
+
+    struct Condition {
+        Kind kind;
+        uint8_t channel;        // Input number or Sensor
+        uint8_t edge;           // Edge mask for input waits
+        float threshold;        // For sensor waits
+    };
+
+    // A finished wait, handed to whoever answers the request
+    struct Completion {
+        Condition condition;
+        bool triggered;         // false = timed out
+        uint32_t waited;
+        uint8_t inputs;
+        float value;
+        char idText[MAX_ID_TEXT];
+    };
+
+    WaitList();
+
+    // Park a request; current gives the side sensor waits start on. idText
+    // is the serialized JSON-RPC id ("" if none). Returns the entry index,
+    // or -1 if the list is full.
+    int add(const Condition& condition, const IOSnapshot& current, uint32_t now, uint32_t timeoutMs, void* owner,
+            const char* idText);
+
+    // Check all waits against a scan. Returns a bitmask of entries that just
+    // completed; read them with completion().
+    uint32_t evaluate(const IOSnapshot& previous, const IOSnapshot& current);
+
+    // Outcome of entry index once it has completed for owner; the entry is
+    // kept until release()
+    bool completion(int index, void* owner, Completion& out);
+    void release(int index);
+
+    // Drop the waits of a disconnected client
+    void cancel(void* owner);
+
+    int pending();
+
+    static const char* sensorName(Sensor sensor);
+    static float sensorValue(const IOSnapshot& snapshot, uint8_t sensor);
+
+private:
+    enum State : uint8_t {
+        STATE_FREE = 0,
+        STATE_WAITING,
+        STATE_DONE
+    };
+
+    struct Entry {
+        State state;
+        Condition condition;
+        void* owner;
+        uint32_t started;
+        uint32_t deadline;
+        bool past;              // Sensor value beyond the threshold at the last check
+        bool triggered;
+        uint32_t finished;
+        uint8_t inputs;
+        float value;
+        char idText[MAX_ID_TEXT];
+    };
+
+    Entry _entries[MAX_WAITS] = {};
+    portMUX_TYPE _lock        = portMUX_INITIALIZER_UNLOCKED;
+
+    // Aggregates over all waiting entries
+    uint8_t _rising_mask  = 0;
+    uint8_t _falling_mask = 0;
+    float _lowest_above[SENSOR_COUNT];     // Armed waits
+    float _highest_below[SENSOR_COUNT];
+    float _rearm_above[SENSOR_COUNT];      // Waits that started past their threshold
+    float _rearm_below[SENSOR_COUNT];
+    uint32_t _next_deadline = 0;
+    bool _any_waiting       = false;
+    bool _cancelled         = false;
+
+    void rebuildAggregates(uint32_t now);
+    bool matches(Entry& entry, uint8_t rising, uint8_t falling, const IOSnapshot& current);
+    static bool isPast(const Condition& condition, const IOSnapshot& current);
+};
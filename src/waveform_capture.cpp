@@ -0,0 +1,273 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "waveform_capture.h"
+#include <string.h>
+
+WaveformCapture::WaveformCapture() {}
+
+WaveformCapture::~WaveformCapture() {
+    if (_timer) {
+        esp_timer_stop(_timer);
+    }
+}
+
+bool WaveformCapture::begin(m5::M5_STAMPLC* stamplc, uint32_t periodUs, const char* taskName, uint32_t stackSize,
+                            UBaseType_t taskPriority) {
+    _stamplc = stamplc;
+    _stats.periodUs = periodUs;
+
+    // Have a reading for the I/O scan before the first one is due
+    sample();
+
+    esp_timer_create_args_t args = {};
+    args.callback = timerCallback;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "capture";
+
+    // Without the task the reading would go stale; the I/O scan then reads
+    // the sensors itself
+    if (xTaskCreatePinnedToCore(taskEntry, taskName, stackSize, this, taskPriority, &_task, tskNO_AFFINITY) != pdPASS ||
+        esp_timer_create(&args, &_timer) != ESP_OK || esp_timer_start_periodic(_timer, periodUs) != ESP_OK) {
+        _valid = false;
+        return false;
+    }
+    return true;
+}
+
+bool WaveformCapture::arm(const Config& config) {
+    if (config.trigger >= TRIGGER_COUNT || config.post < 1 || (uint32_t)config.pre + config.post > SAMPLES) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&_lock);
+    _status.config = config;
+    _status.state = STATE_ARMED;
+    _status.triggerUs = 0;
+    _status.count = 0;
+    _generation++;
+    portEXIT_CRITICAL(&_lock);
+    return true;
+}
+
+WaveformCapture::Status WaveformCapture::status() {
+    portENTER_CRITICAL(&_lock);
+    Status copy = _status;
+    portEXIT_CRITICAL(&_lock);
+    return copy;
+}
+
+WaveformCapture::Stats WaveformCapture::stats() {
+    portENTER_CRITICAL(&_lock);
+    Stats copy = _stats;
+    portEXIT_CRITICAL(&_lock);
+    return copy;
+}
+
+int WaveformCapture::read(int offset, Sample* out, int maxSamples) {
+    int count = 0;
+
+    portENTER_CRITICAL(&_lock);
+    if (_status.state == STATE_COMPLETE) {
+        for (int i = offset; i < _status.count && count < maxSamples; i++) {
+            out[count++] = _ring[(_first + i) % SAMPLES];
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    return count;
+}
+
+bool WaveformCapture::latest(float& voltage, float& current) {
+    portENTER_CRITICAL(&_lock);
+    bool valid = _valid;
+    voltage = _latest.voltage;
+    current = _latest.current;
+    portEXIT_CRITICAL(&_lock);
+    return valid;
+}
+
+void WaveformCapture::timerCallback(void* arg) {
+    WaveformCapture* self = static_cast<WaveformCapture*>(arg);
+    xTaskNotifyGive(self->_task);
+}
+
+void WaveformCapture::taskEntry(void* arg) {
+    WaveformCapture* self = static_cast<WaveformCapture*>(arg);
+
+    while (true) {
+        uint32_t pending = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (pending > 1) {
+            portENTER_CRITICAL(&self->_lock);
+            self->_stats.overruns += pending - 1;
+            portEXIT_CRITICAL(&self->_lock);
+        }
+        self->sample();
+    }
+}
+
+void WaveformCapture::sample() {
+    int64_t start = esp_timer_get_time();
+    float voltage = _stamplc->getPowerVoltage();
+    float current = _stamplc->getIoSocketOutputCurrent();
+    uint32_t readUs = (uint32_t)(esp_timer_get_time() - start);
+    Sample reading = {(uint32_t)start, voltage, current};
+
+    portENTER_CRITICAL(&_lock);
+    _latest = reading;
+    _valid = true;
+    _stats.samples++;
+    if (readUs > _stats.maxReadUs) {
+        _stats.maxReadUs = readUs;
+    }
+    State state = _status.state;
+    Config config = _status.config;
+    uint32_t generation = _generation;
+    portEXIT_CRITICAL(&_lock);
+
+    if (generation != _seen_generation) {
+        _seen_generation = generation;
+        _arm_head = _head;
+        _event_cursor = _event_log ? _event_log->head() : 0;
+        _beyond = config.trigger == TRIGGER_CURRENT ? current > config.threshold : voltage < config.threshold;
+    }
+
+    // A complete capture stays in the ring until the next arm
+    if (state == STATE_COMPLETE) {
+        return;
+    }
+    _ring[_head % SAMPLES] = reading;
+    _head++;
+
+    if (state == STATE_ARMED) {
+        bool fired = false;
+        uint64_t triggerUs = start;
+        uint32_t index = _head - 1;
+        switch (config.trigger) {
+            case TRIGGER_CURRENT:
+            case TRIGGER_VOLTAGE: {
+                bool beyond = config.trigger == TRIGGER_CURRENT ? current > config.threshold
+                                                                : voltage < config.threshold;
+                fired = beyond && !_beyond;
+                _beyond = beyond;
+                break;
+            }
+            default:
+                fired = checkEvents(config, triggerUs);
+                break;
+        }
+
+        // Only once the pre-trigger part has been filled since arming
+        if (fired && _head - _arm_head > config.pre) {
+            if (config.trigger == TRIGGER_INPUT || config.trigger == TRIGGER_RELAY) {
+                // Not so far back that the pre-trigger samples are gone
+                uint32_t earliest = _arm_head + config.pre;
+                if (_head - earliest > SAMPLES - config.pre) {
+                    earliest = _head - SAMPLES + config.pre;
+                }
+                index = indexAtOrAfter(triggerUs, earliest);
+            }
+            _trigger_index = index;
+            state = STATE_TRIGGERED;
+
+            portENTER_CRITICAL(&_lock);
+            if (_generation == generation) {
+                _status.state = STATE_TRIGGERED;
+                _status.triggerUs = triggerUs;
+            }
+            portEXIT_CRITICAL(&_lock);
+        }
+    }
+
+    if (state == STATE_TRIGGERED && _head - _trigger_index >= config.post) {
+        portENTER_CRITICAL(&_lock);
+        if (_generation == generation) {
+            _first = (_trigger_index - config.pre) % SAMPLES;
+            _status.count = config.pre + config.post;
+            _status.state = STATE_COMPLETE;
+            _status.captures++;
+        }
+        portEXIT_CRITICAL(&_lock);
+    }
+}
+
+bool WaveformCapture::checkEvents(const Config& config, uint64_t& triggerUs) {
+    if (!_event_log) {
+        return false;
+    }
+
+    EventLog::Type type = config.trigger == TRIGGER_INPUT ? EventLog::TYPE_INPUT_EDGE : EventLog::TYPE_RELAY_WRITE;
+    EventLog::Event events[8];
+    int count;
+    while ((count = _event_log->read(_event_cursor, events, 8)) > 0) {
+        for (int i = 0; i < count; i++) {
+            const EventLog::Event& event = events[i];
+            if (event.type != type || event.channel != config.channel) {
+                continue;
+            }
+            if (config.edge == EDGE_ANY || (config.edge == EDGE_RISING) == (event.state != 0)) {
+                triggerUs = event.timestampUs;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+uint32_t WaveformCapture::indexAtOrAfter(uint64_t timeUs, uint32_t earliest) {
+    // Walk back from the newest sample; the event is at most a few ms old
+    uint32_t index = _head;
+    while (index > earliest) {
+        if ((int32_t)(_ring[(index - 1) % SAMPLES].timeUs - (uint32_t)timeUs) < 0) {
+            break;
+        }
+        index--;
+    }
+    return index;
+}
+
+const char* WaveformCapture::triggerName(Trigger trigger) {
+    switch (trigger) {
+        case TRIGGER_INPUT:   return "input";
+        case TRIGGER_RELAY:   return "relay";
+        case TRIGGER_CURRENT: return "current";
+        case TRIGGER_VOLTAGE: return "voltage";
+        default:              return "unknown";
+    }
+}
+
+const char* WaveformCapture::stateName(State state) {
+    switch (state) {
+        case STATE_IDLE:      return "idle";
+        case STATE_ARMED:     return "armed";
+        case STATE_TRIGGERED: return "triggered";
+        case STATE_COMPLETE:  return "complete";
+        default:              return "unknown";
+    }
+}
+
+bool WaveformCapture::parseTrigger(const char* name, Trigger& trigger) {
+    for (int t = 0; t < TRIGGER_COUNT; t++) {
+        if (strcmp(name, triggerName(static_cast<Trigger>(t))) == 0) {
+            trigger = static_cast<Trigger>(t);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WaveformCapture::parseEdge(const char* name, Edge& edge) {
+    if (strcmp(name, "rising") == 0) {
+        edge = EDGE_RISING;
+    } else if (strcmp(name, "falling") == 0) {
+        edge = EDGE_FALLING;
+    } else if (strcmp(name, "any") == 0) {
+        edge = EDGE_ANY;
+    } else {
+        return false;
+    }
+    return true;
+}
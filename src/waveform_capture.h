@@ -0,0 +1,156 @@
+/*
+ * SPDX-FileCopyrightText: 2025 M5Stack Technology CO LTD
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+#include <Arduino.h>
+#include <M5StamPLC.h>
+#include "esp_timer.h"
+#include "event_log.h"
+
+// Voltage/current sampling period in microseconds
+#ifndef MCP_CAPTURE_SAMPLE_US
+#define MCP_CAPTURE_SAMPLE_US 1000
+#endif
+
+// Samples kept in the ring; pre + post of a capture must fit
+#ifndef MCP_CAPTURE_SAMPLES
+#define MCP_CAPTURE_SAMPLES 512
+#endif
+
+/*
+ * Oscilloscope-style capture of the supply voltage and load current.
+ *
+ * A periodic esp_timer wakes a dedicated task that reads both values from
+ * the power monitor into a continuous ring, far faster than the 100 ms
+ * sensor scan. arm() sets a trigger and how many samples to keep before and
+ * after it. Once the trigger fires and the post-trigger samples are in, the
+ * ring freezes until the next arm() so the capture can be read at leisure.
+ *
+ * Level triggers (current above, voltage below) fire on the first sample
+ * that crosses the threshold. Input edges and relay writes are taken from
+ * the EventLog, and the trigger point is the first sample at or after the
+ * event's timestamp, so the debounce delay of an input edge does not shift
+ * the waveform. The pre-trigger part is filled after arming before any
+ * trigger is accepted.
+ *
+ * The task is the only reader of the power monitor while it runs; the I/O
+ * scan takes voltage and current from latest() instead.
+ */
+class WaveformCapture {
+public:
+    static constexpr uint32_t SAMPLES = MCP_CAPTURE_SAMPLES;
+
+    enum Trigger : uint8_t {
+        TRIGGER_INPUT = 0,      // Edge on input channel
+        TRIGGER_RELAY,          // Write to relay channel
+        TRIGGER_CURRENT,        // Current rises above threshold
+        TRIGGER_VOLTAGE,        // Voltage falls below threshold
+        TRIGGER_COUNT
+    };
+
+    enum Edge : uint8_t {
+        EDGE_RISING = 0,
+        EDGE_FALLING,
+        EDGE_ANY
+    };
+
+    enum State : uint8_t {
+        STATE_IDLE = 0,         // Never armed
+        STATE_ARMED,            // Waiting for the trigger
+        STATE_TRIGGERED,        // Collecting post-trigger samples
+        STATE_COMPLETE          // Frozen until the next arm()
+    };
+
+    struct Config {
+        Trigger trigger;
+        Edge edge;
+        uint8_t channel;
+        float threshold;
+        uint16_t pre;
+        uint16_t post;
+    };
+
+    struct Sample {
+        uint32_t timeUs;        // Low 32 bits of esp_timer time
+        float voltage;
+        float current;
+    };
+
+    struct Status {
+        State state;
+        Config config;
+        uint32_t captures;      // Completed since boot
+        uint64_t triggerUs;     // Event or sample time that fired
+        uint16_t count;         // Samples available once complete
+    };
+
+    struct Stats {
+        uint32_t samples;
+        uint32_t overruns;      // Timer periods that passed without a sample
+        uint32_t maxReadUs;
+        uint32_t periodUs;
+    };
+
+    WaveformCapture();
+    ~WaveformCapture();
+
+    bool begin(m5::M5_STAMPLC* stamplc, uint32_t periodUs = MCP_CAPTURE_SAMPLE_US,
+               const char* taskName = "capture", uint32_t stackSize = 3072, UBaseType_t taskPriority = 4);
+
+    // Source of input edge and relay write triggers; set before begin()
+    void setEventLog(EventLog* log) {
+        _event_log = log;
+    }
+
+    // Discards the previous capture and waits for the trigger
+    bool arm(const Config& config);
+
+    Status status();
+    Stats stats();
+
+    // Copies up to maxSamples of a complete capture starting at offset; the
+    // first sample is the oldest pre-trigger one
+    int read(int offset, Sample* out, int maxSamples);
+
+    // Latest reading, for the I/O scan
+    bool latest(float& voltage, float& current);
+
+    static const char* triggerName(Trigger trigger);
+    static const char* stateName(State state);
+    static bool parseTrigger(const char* name, Trigger& trigger);
+    static bool parseEdge(const char* name, Edge& edge);
+
+private:
+    m5::M5_STAMPLC* _stamplc = nullptr;
+    esp_timer_handle_t _timer = nullptr;
+    TaskHandle_t _task = nullptr;
+    EventLog* _event_log = nullptr;
+
+    Sample _ring[SAMPLES] = {};
+    uint32_t _head = 0;                 // Samples written since boot
+
+    // Guarded by _lock
+    Status _status = {};
+    Stats _stats = {};
+    uint32_t _generation = 0;           // Bumped by arm()
+    uint32_t _first = 0;                // Ring index of the first captured sample
+    Sample _latest = {};
+    bool _valid = false;
+
+    // Sampler task only
+    uint32_t _seen_generation = 0;
+    uint32_t _arm_head = 0;             // _head when the arm was seen
+    uint32_t _trigger_index = 0;
+    uint32_t _event_cursor = 0;
+    bool _beyond = false;
+
+    portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+
+    static void timerCallback(void* arg);
+    static void taskEntry(void* arg);
+    void sample();
+    bool checkEvents(const Config& config, uint64_t& triggerUs);
+    uint32_t indexAtOrAfter(uint64_t timeUs, uint32_t earliest);
+};